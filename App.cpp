@@ -29,6 +29,7 @@
 #include "gui/actions.hxx"
 #include "gui/ConfirmDialog.hpp"
 #include "gui/IconView.hpp"
+#include "gui/LargeFileView.hpp"
 #include "gui/Location.hpp"
 #include "gui/SearchPane.hpp"
 #include "gui/sidepane.hh"
@@ -46,8 +47,10 @@
 #include "Media.hpp"
 #include "prefs.hh"
 #include "Prefs.hpp"
+#include "startup.hh"
 #include "str.hxx"
 #include "thumbnail.hh"
+#include "ThumbnailPrefetcher.hpp"
 
 #include <QApplication>
 #include <QBoxLayout>
@@ -89,47 +92,51 @@ void* ThumbnailLoader (void *args)
 {
 	pthread_detach(pthread_self());
 	cornus::ThumbLoaderData *th_data = (cornus::ThumbLoaderData*) args;
-	if (!th_data->Lock()) {
+	/// Workers pull straight from the shared (prioritized) queue,
+	/// all fields are guarded by the global mutex.
+	GlobalThumbLoaderData *global_data = th_data->global_data;
+	if (!global_data->Lock()) {
 		return NULL;
 	}
 	
 	ZSTD_DCtx *decompress_context = ZSTD_createDCtx();
 	ByteArray temp_ba;
-	io::ReadParams read_params = {};
-	read_params.print_errors = PrintErrors::No;
-	read_params.can_rely = CanRelyOnStatxSize::Yes;
 	
 	while (th_data->wait_for_work)
 	{
-		if (th_data->new_work == nullptr)
+		auto &work_queue = global_data->work_queue;
+		if (work_queue.isEmpty())
 		{
-			cint status = th_data->CondWaitForNewWork();
+			cint status = global_data->CondWaitForWorkQueueChange();
 			if (status != 0)
 			{
 				mtl_status(status);
 				break;
 			}
-		}
-		
-		ThumbLoaderArgs *new_work = th_data->new_work;
-		if (new_work == nullptr) {
-			// mtl_trace("new_work == nullptr");
 			continue;
 		}
 		
-		th_data->Unlock();
-		QString thumb_in_temp_path = io::BuildTempPathFromID(new_work->file_id, new_work->time_modified);
-		Thumbnail *thumbnail = nullptr;
+		ThumbLoaderArgs *new_work = work_queue.takeLast();
+		global_data->Unlock();
+		Thumbnail *thumbnail = global_data->cache->Get(new_work->file_id,
+			new_work->time_modified, true);
+		if (thumbnail != nullptr)
+		{
+			thumbnail->tab_id = new_work->tab_id;
+			thumbnail->dir_id = new_work->dir_id;
+			thumbnail->origin = Origin::MemoryCache;
+		}
 		cbool has_ext_attr = !new_work->ba.is_empty();
 		temp_ba.to(0);
 		thumbnail::AbiType abi_version = -1;
-		if (has_ext_attr || io::ReadFile(thumb_in_temp_path, temp_ba, read_params))
+		bool marked_failed = false;
+		if (thumbnail == nullptr && (has_ext_attr ||
+			global_data->store->Get(new_work->file_id, new_work->time_modified, temp_ba)))
 		{
-			// mtl_info("%s: %s, has_ext_attr: %d", qPrintable(new_work->full_path),
-			// 	qPrintable(thumb_in_temp_path), has_ext_attr);
 			ByteArray &img_ba = has_ext_attr ? new_work->ba : temp_ba;
+			marked_failed = thumbnail::IsMarkedFailed(img_ba);
 			i32 orig_img_w, orig_img_h;
-			QImage img = thumbnail::ImageFromByteArray(img_ba,
+			QImage img = marked_failed ? QImage() : thumbnail::ImageFromByteArray(img_ba,
 				orig_img_w, orig_img_h, abi_version, decompress_context);
 			if (!img.isNull())
 			{
@@ -148,56 +155,66 @@ void* ThumbnailLoader (void *args)
 			}
 		}
 		
-		if (thumbnail == nullptr)
+		if (thumbnail == nullptr && !marked_failed)
 		{
 			thumbnail = thumbnail::Load(new_work->full_path,
 				new_work->file_id.inode_number,
 				new_work->ext, new_work->icon_w,
 				new_work->icon_h, new_work->tab_id,
 				new_work->dir_id);
-			if (thumbnail)
+			if (thumbnail) {
 				thumbnail->origin = Origin::DiskFile;
+			} else if (thumbnail::IsMatroskaExtension(new_work->ext)) {
+				/// Most have no cover art, don't parse them on every visit.
+				/// Keyed by mtime like the thumbnails, adding one is noticed:
+				ByteArray marker;
+				thumbnail::MakeFailedMarker(marker);
+				global_data->store->Put(new_work->file_id, new_work->time_modified,
+					marker.data(), marker.size());
+			}
 		}
 		
-		th_data->Lock();
-		
 		if (thumbnail == nullptr)
 		{
-			th_data->new_work = nullptr;
 			mtl_info("thumbnail failed %s", qPrintable(new_work->full_path));
-			continue;
+			/// Report it anyway (with a null image) so that the file
+			/// doesn't get requested over and over again.
+			thumbnail = new Thumbnail();
+			thumbnail->file_id = new_work->file_id.inode_number;
+			thumbnail->tab_id = new_work->tab_id;
+			thumbnail->dir_id = new_work->dir_id;
 		}
 		
-		if (!th_data->wait_for_work)
+		if (new_work->display_w > 0)
 		{
-			delete thumbnail;
-			break;
+			thumbnail::ScaleForDisplay(thumbnail, new_work->display_w,
+				new_work->display_h, new_work->dpr);
 		}
 		
-		QString fp = new_work->full_path;
 		App *app = new_work->app;
-		delete new_work;
-		th_data->new_work = nullptr;
-		if (th_data->wait_for_work)
-		{
-			// if (fp.indexOf("company") >= 0) {
-			// 	mtl_info("thumbnail arrived: %s", qPrintable(fp));
-			// }
-			QMetaObject::invokeMethod(app, "ThumbnailArrived",
-				Q_ARG(cornus::Thumbnail*, thumbnail));
-		} else {
-			delete thumbnail;
-			break;
-		}
+		/// Prefetched ones only go to the cache, which needs the args:
+		cbool prefetched = (new_work->tab_id == thumbnail::PrefetchTabId);
+		if (!prefetched)
+			delete new_work;
+		global_data->Lock();
+		global_data->done_count++;
 		
-		{ // signal that the thread is waiting for new work
-			th_data->Unlock();
-			if (th_data->global_data->TryLock())
+		if (th_data->wait_for_work && app != nullptr)
+		{
+			if (prefetched)
 			{
-				th_data->global_data->SignalWorkQueueChanged();
-				th_data->global_data->Unlock();
+				QMetaObject::invokeMethod(app, "ThumbnailPrefetched",
+					Q_ARG(cornus::Thumbnail*, thumbnail),
+					Q_ARG(cornus::ThumbLoaderArgs*, new_work));
+			} else {
+				QMetaObject::invokeMethod(app, "ThumbnailArrived",
+					Q_ARG(cornus::Thumbnail*, thumbnail));
 			}
-			th_data->Lock();
+		} else {
+			/// either shutting down or a benchmark run without an app
+			delete thumbnail;
+			if (prefetched)
+				delete new_work;
 		}
 	}
 	
@@ -205,15 +222,9 @@ void* ThumbnailLoader (void *args)
 	
 	cu64 t = static_cast<u64>(pthread_self());
 	th_data->thread_exited = true;
-	// after Unlock() th_data might be already deleted, so save a pointer:
-	auto *global_data = th_data->global_data;
-	th_data->Unlock();
-	
 	// signal that the thread exited
-	cbool unlock = global_data->Lock();
 	global_data->Broadcast();
-	if (unlock)
-		global_data->Unlock();
+	global_data->Unlock();
 	if (DebugThumbnailExit)
 		mtl_trace("%ld EXIT", t);
 	
@@ -312,7 +323,6 @@ App::App()
 	printf("%#08x\n", i);   // gives 0x000007
 	*/
 	Init();
-	blacklist_.Load();
 	// QString s = QString::fromUtf8("Schöne Grüße");
 	// auto ba = s.toLocal8Bit();
 	// printf("%s len: %d\n", ba.data(), s.length());
@@ -337,14 +347,8 @@ App::~App()
 	
 	ShutdownThumbnailThreads();
 	prefs_->Save();
+	dir_size_cache_.Save();
 	
-	QHashIterator<QString, QIcon*> i(icon_set_);
-	while (i.hasNext())
-	{
-		i.next();
-		QIcon *icon = i.value();
-		delete icon;
-	}
 	{
 		tree_data_.Lock();
 		tree_data_.sidepane_model_destroyed = true;
@@ -368,12 +372,6 @@ App::~App()
 	delete hid_;
 	hid_ = nullptr;
 	
-	if (compress_ctx_)
-	{
-		ZSTD_freeCCtx(compress_ctx_);
-		compress_ctx_ = nullptr;
-	}
-
 	for (auto *shortcut: shortcuts_)
 		delete shortcut;
 	shortcuts_.clear();
@@ -393,6 +391,7 @@ void App::ApplyDefaultPrefs()
 	cols[(int)gui::Column::Size] = 1;
 	cols[(int)gui::Column::TimeModified] = 1;
 	cols[(int)gui::Column::TimeCreated] = 0;
+	cols[(int)gui::Column::DirSize] = 0;
 }
 
 void App::ArchiveAskDestArchivePath(const QString &ext)
@@ -569,7 +568,8 @@ void App::CloseTabAt(cint i)
 	{
 		QApplication::quit();
 	} else {
-		auto *tab = tab_widget_->widget(i);
+		auto *tab = (gui::Tab*) tab_widget_->widget(i);
+		thumbnail::CancelWork(global_thumb_loader_data_, tab->id(), -1);
 		tab_widget_->removeTab(i);
 		delete tab;
 	}
@@ -1020,13 +1020,13 @@ QIcon* App::GetDefaultIcon()
 { // this function must not return nullptr
 	if (icon_cache_.unknown == nullptr)
 	{
-		QString full_path = GetIconThatStartsWith(QLatin1String("text"));
+		QString full_path = icons_.FindPathStartingWith(QLatin1String("text"));
 		if (full_path.isEmpty())
 		{
 			const QIcon ic = QIcon::fromTheme(QLatin1String("text-x-generic"));
 			icon_cache_.unknown = new QIcon(ic);
 		} else {
-			icon_cache_.unknown = GetIconOrLoadExisting(full_path);
+			icon_cache_.unknown = icons_.Get(full_path);
 		}
 	}
 	return icon_cache_.unknown;
@@ -1053,37 +1053,8 @@ QIcon* App::GetFolderIcon()
 }
 
 QIcon* App::GetIcon(const QString &str) {
-	QString full_path = GetIconThatStartsWith(str);
-	return GetIconOrLoadExisting(full_path);
-}
-
-QIcon* App::GetIconOrLoadExisting(const QString &icon_path)
-{
-	if (icon_path.isEmpty())
-		return nullptr;
-	
-	QIcon *found = icon_set_.value(icon_path, nullptr);
-	
-	if (found != nullptr)
-		return found;
-	
-	auto *icon = new QIcon(icon_path);
-	// mtl_info("icon path: %s", qPrintable(icon_path));
-	icon_set_.insert(icon_path, icon);
-	
-	return icon;
-}
-
-QString App::GetIconThatStartsWith(const QString &s)
-{
-	QHashIterator<QString, QString> it(icon_names_);
-	while (it.hasNext()) {
-		it.next();
-		if (it.key().startsWith(s))
-			return it.value();
-	}
-	
-	return QString();
+	QString full_path = icons_.FindPathStartingWith(str);
+	return icons_.Get(full_path);
 }
 
 QString App::GetPartitionFreeSpace()
@@ -1174,6 +1145,7 @@ void SetThreadPolicyAndPriority(const pthread_t &th, cint policy,
 void App::Init()
 {
 	qRegisterMetaType<cornus::io::File*>();
+	qRegisterMetaType<cornus::io::Files*>();
 	qRegisterMetaType<cornus::io::FilesData*>();
 	qRegisterMetaType<cornus::io::FileEvent>();
 	qRegisterMetaType<cornus::PartitionEvent*>();
@@ -1181,6 +1153,7 @@ void App::Init()
 	qRegisterMetaType<QVector<cornus::gui::TreeItem*>>();
 	qDBusRegisterMetaType<QMap<QString, QVariant>>();
 	qRegisterMetaType<cornus::Thumbnail*>();
+	qRegisterMetaType<cornus::ThumbLoaderArgs*>();
 	
 	app_quitting_fd_ = ::eventfd(0, 0);
 	if (app_quitting_fd_ == -1)
@@ -1193,15 +1166,21 @@ void App::Init()
 	
 	media_ = new Media();
 	hid_ = new Hid(this);
+	thumbnail_prefetcher_ = new ThumbnailPrefetcher(this);
 	
-	io::NewThread(gui::sidepane::LoadItems, this);
-	io::socket::AutoLoadRegularIODaemon();
 	setWindowIcon(QIcon(cornus::AppIconPath));
 	if (windowHandle())
 		windowHandle()->setIcon(QIcon(cornus::AppIconPath));
 	prefs_ = new Prefs(this);
 	if (!prefs_->Load())
 		ApplyDefaultPrefs();
+	thumbnail_cache_.SetBudgetMiB(prefs_->thumbnail_cache_mib());
+	startup::Mark("Prefs loaded");
+	
+	env_ = QProcessEnvironment::systemEnvironment();
+	io::InitEnvInfo(desktop_, search_icons_dirs_, xdg_data_dirs_,
+		possible_categories_, env_);
+	startup::Mark("Env info");
 	
 	{
 		tab_widget_ = new gui::TabsWidget();
@@ -1211,11 +1190,8 @@ void App::Init()
 		connect(tab_widget_, &QTabWidget::currentChanged, this, &App::TabSelected);
 		OpenNewTab(FirstTime::Yes);
 	}
+	startup::Mark("Initial tab");
 	
-	env_ = QProcessEnvironment::systemEnvironment();
-	io::InitEnvInfo(desktop_, search_icons_dirs_, xdg_data_dirs_,
-		possible_categories_, env_);
-	SetupIconNames();
 	CreateGui();
 	if (prefs_->remember_window_size())
 	{
@@ -1226,26 +1202,51 @@ void App::Init()
 		}
 	}
 	
-	auto *clipboard = QGuiApplication::clipboard();
-	connect(clipboard, &QClipboard::changed, this, &App::ClipboardChanged);
-	
-	ClipboardChanged(QClipboard::Clipboard);
 	DetectThemeType();
-	RegisterVolumesListener();
 	RegisterShortcuts();
-	ReadMTP();
+	startup::Mark("GUI created");
 /// enables receiving ordinary mouse events (when mouse is not down)
 //	setMouseTracking(true);
 	
 //	TestPolkit(this);
 }
 
+void App::InitDeferred()
+{
+	/// Everything that isn't needed to paint the initial directory,
+	/// runs once the window has been shown.
+	startup::Mark("Event loop running");
+	io::NewThread(gui::sidepane::LoadItems, this);
+	io::socket::AutoLoadRegularIODaemon();
+	RegisterVolumesListener();
+	startup::Mark("Side pane & volume listeners started");
+	
+	auto *clipboard = QGuiApplication::clipboard();
+	connect(clipboard, &QClipboard::changed, this, &App::ClipboardChanged);
+	ClipboardChanged(QClipboard::Clipboard);
+	startup::Mark("Clipboard");
+	
+	blacklist_.LoadIfNeeded();
+	startup::Mark("Blacklist loaded");
+	
+	mime_cache_.Load();
+	startup::Mark("Mime cache loaded");
+	
+	if (!media_->loaded())
+		media_->Reload();
+	startup::Mark("Media DB loaded");
+	
+	ReadMTP();
+}
+
 void App::InitThumbnailPoolIfNeeded()
 {
 	if (!global_thumb_loader_data_.threads.isEmpty())
 		return;
 	
 	cint max_thread_count = std::max(1, AvailableCpuCores()/* - 1*/);
+	global_thumb_loader_data_.store = &thumb_store_;
+	global_thumb_loader_data_.cache = &thumbnail_cache_;
 	for (int i = 0; i < max_thread_count; i++)
 	{
 		ThumbLoaderData *thread_data = new ThumbLoaderData();
@@ -1258,8 +1259,6 @@ void App::InitThumbnailPoolIfNeeded()
 		
 		global_thumb_loader_data_.threads.append(thread_data);
 	}
-	
-	io::NewThread(thumbnail::LoadMonitor, &global_thumb_loader_data_);
 }
 
 void App::LaunchOrOpenDesktopFile(const QString &full_path,
@@ -1290,11 +1289,11 @@ QIcon* App::LoadIcon(io::File &file)
 	{
 		if (icon_cache_.folder == nullptr)
 		{
-			QString full_path = GetIconThatStartsWith(QLatin1String("special_folder"));
+			QString full_path = icons_.FindPathStartingWith(QLatin1String("special_folder"));
 			if (full_path.isEmpty()) {
 				return nullptr;
 			}
-			icon_cache_.folder = GetIconOrLoadExisting(full_path);
+			icon_cache_.folder = icons_.Get(full_path);
 		}
 		
 		return icon_cache_.folder;
@@ -1309,11 +1308,11 @@ QIcon* App::LoadIcon(io::File &file)
 		if (fn.indexOf(QLatin1String(".so.")) != -1)
 		{
 			if (icon_cache_.lib == nullptr) {
-				QString full_path = GetIconThatStartsWith(QLatin1String("special_sharedlib"));
+				QString full_path = icons_.FindPathStartingWith(QLatin1String("special_sharedlib"));
 				if (full_path.isEmpty()) {
 					return nullptr;
 				}
-				icon_cache_.lib = GetIconOrLoadExisting(full_path);
+				icon_cache_.lib = icons_.Get(full_path);
 			}
 			return icon_cache_.lib;
 		}
@@ -1336,42 +1335,23 @@ QIcon* App::LoadIcon(io::File &file)
 		}
 	}
 	
-	QString full_path = icon_names_.value(ext);
+	QString full_path = icons_.FindPath(ext);
 	
 	if (!full_path.isEmpty()) {
 		// mtl_info("filename: %s", qPrintable(full_path));
-		return GetIconOrLoadExisting(full_path);
+		return icons_.Get(full_path);
 	}
 	
 	if (ext.startsWith(QLatin1String("blend"))) {
-		QString full_path = GetIconThatStartsWith(QLatin1String("special_blender"));
+		QString full_path = icons_.FindPathStartingWith(QLatin1String("special_blender"));
 		if (!full_path.isEmpty()) {
-			return GetIconOrLoadExisting(full_path);
+			return icons_.Get(full_path);
 		}
 	}
 	
 	return nullptr;//GetDefaultIcon();
 }
 
-void App::LoadIconsFrom(QString dir_path)
-{
-	QVector<QString> available_names;
-	if (!io::ListFileNames(dir_path, available_names))
-		return;
-	
-	if (!dir_path.endsWith('/'))
-		dir_path.append('/');
-	
-	for (const auto &name: available_names)
-	{
-		int index = name.lastIndexOf('.');
-		auto ext = (index == -1) ? name : name.mid(0, index);
-		if (!icon_names_.contains(ext)) {
-			icon_names_.insert(ext, dir_path + name);
-		}
-	}
-}
-
 void App::MediaFileChanged()
 {
 	Q_EMIT media_->Changed();
@@ -1450,35 +1430,12 @@ ExecInfo App::QueryExecInfo(io::File &file) {
 	return QueryExecInfo(file.build_full_path(), file.cache().ext);
 }
 
-ExecInfo App::QueryExecInfo(const QString &full_path, const QString &ext)
-{
-/// ls -ls ./2to3-2.7 
-/// 4 -rwxr-xr-x 1 root root 96 Aug 24 22:12 ./2to3-2.7
-
-///#! /bin/sh
-	const isize size = 64;
-	char buf[size];
-	ExecInfo ret = {};
-	
-	auto real_size = io::TryReadFile(full_path, buf, size, &ret);
-	
-	if (!ext.isEmpty()) {
-		if (ext == QLatin1String("sh") || ext == QLatin1String("py")) {
-			ret.type |= ExecType::ShellScript;
-		} else if (ext == QLatin1String("bat")) {
-			ret.type |= ExecType::BatScript;
-		}
-	}
-	
-	if(real_size > 0)
-		TestExecBuf(buf, real_size, ret);
-	
-	return ret;
+ExecInfo App::QueryExecInfo(const QString &full_path, const QString &ext) {
+	return mime_cache_.QueryExecInfo(full_path, ext);
 }
 
 QString App::QueryMimeType(const QString &full_path) {
-	QMimeType mt = mime_db_.mimeTypeForFile(full_path);
-	return mt.name();
+	return mime_cache_.QueryMimeType(full_path);
 }
 
 /*static void dump_folder_list(LIBMTP_folder_t *folderlist, int level)
@@ -1651,6 +1608,28 @@ void App::RegisterShortcuts()
 			}
 		});
 	}
+	{
+		sp = Register(QKeySequence(Qt::CTRL | Qt::SHIFT | Qt::Key_F));
+		connect(sp, &QShortcut::activated, [=] {
+			if (level_browser())
+			{
+				search_pane_->SetSearchByContents();
+				search_pane_->setVisible(true);
+				search_pane_->RequestFocus();
+			}
+		});
+	}
+	{
+		sp = Register(QKeySequence(Qt::CTRL | Qt::ALT | Qt::Key_F));
+		connect(sp, &QShortcut::activated, [=] {
+			if (level_browser())
+			{
+				search_pane_->SetSearchByFileNameRecursive();
+				search_pane_->setVisible(true);
+				search_pane_->RequestFocus();
+			}
+		});
+	}
 	{
 		sp = Register(QKeySequence(Qt::CTRL | Qt::Key_M));
 		connect(sp, &QShortcut::activated, [=] {
@@ -1749,6 +1728,12 @@ void App::RegisterVolumesListener()
 	//g_signal_connect(monitor, "mount-changed", (GCallback)MountChanged, this);
 }
 
+void App::PrioritizeThumbnails(const ThumbViewport &vp)
+{
+	auto g = global_thumb_loader_data_.guard();
+	thumbnail::Prioritize(global_thumb_loader_data_.work_queue, vp);
+}
+
 void App::Reload()
 {
 	gui::Tab *tab = this->tab();
@@ -1815,9 +1800,7 @@ void App::RenameSelectedFile()
 		if (file->is_symlink()) {
 			mime = QLatin1String("inode/symlink");
 		} else {
-			QString full_path = file->build_full_path();
-			QMimeType mt = mime_db_.mimeTypeForFile(full_path);
-			mime = mt.name();
+			mime = QueryMimeType(file->build_full_path());
 		}
 		QLabel *text_label = new QLabel();
 		text_label->setAlignment(Qt::AlignLeft | Qt::AlignVCenter);
@@ -1954,16 +1937,6 @@ void App::SaveBookmarks()
 	save_file.Commit();
 }
 
-void App::SaveThumbnail()
-{
-	if (compress_ctx_ == nullptr)
-		compress_ctx_ = ZSTD_createCCtx();
-	
-	if (!thumbnails_to_save_.isEmpty())
-		io::SaveThumbnailToDisk(thumbnails_to_save_.takeLast(), compress_ctx_,
-			prefs_->store_thumbnails_in_ext_attrs());
-}
-
 void App::SelectCurrentTab()
 {
 	TabSelected(tab_widget_->currentIndex());
@@ -2001,53 +1974,60 @@ void App::SetTopLevel(const TopLevel tl, io::File *cloned_file)
 		toolbar_->setVisible(true);
 		top_level_stack_.stack->setCurrentIndex(top_level_stack_.window_index);
 	} else if (tl == TopLevel::Editor) {
-		if (top_level_stack_.editor == nullptr)
+		top_level_stack_.saved_window_title = windowTitle();
+		QString title;
+		QWidget *widget = nullptr;
+		int index = -1;
+		if (cloned_file->size() > gui::TextEditMaxFileSize)
 		{
-			top_level_stack_.editor = new gui::TextEdit(tab());
-			top_level_stack_.editor_index = top_level_stack_.stack->addWidget(top_level_stack_.editor);
+			if (top_level_stack_.viewer == nullptr)
+			{
+				top_level_stack_.viewer = new gui::LargeFileView(this);
+				top_level_stack_.viewer_index = top_level_stack_.stack->addWidget(top_level_stack_.viewer);
+			}
+			
+			if (top_level_stack_.viewer->Display(cloned_file))
+			{
+				title = tr("Esc => Exit, Ctrl+G => Go To, F => Follow");
+				widget = top_level_stack_.viewer;
+				index = top_level_stack_.viewer_index;
+			}
+		} else {
+			if (top_level_stack_.editor == nullptr)
+			{
+				top_level_stack_.editor = new gui::TextEdit(tab());
+				top_level_stack_.editor_index = top_level_stack_.stack->addWidget(top_level_stack_.editor);
+			}
+			
+			if (top_level_stack_.editor->Display(cloned_file))
+			{
+				title = tr("Esc => Exit, Ctrl+S => Save & Exit");
+				widget = top_level_stack_.editor;
+				index = top_level_stack_.editor_index;
+			}
 		}
 		
-		top_level_stack_.saved_window_title = windowTitle();
-		if (top_level_stack_.editor->Display(cloned_file))
+		if (index != -1)
 		{
-			setWindowTitle(tr("Esc => Exit, Ctrl+S => Save & Exit"));
+			setWindowTitle(title);
 			toolbar_->setVisible(false);
-			top_level_stack_.stack->setCurrentIndex(top_level_stack_.editor_index);
+			top_level_stack_.stack->setCurrentIndex(index);
+			widget->setFocus();
 			tab()->table()->ClearMouseOver();
 			top_level_stack_.level = tl;
 		}
 	}
 }
 
-void App::SetupIconNames()
-{
-	const QString folder_name = QLatin1String("file_icons");
-	
-	QString icons_from_config = prefs::QueryAppConfigPath();
-	if (!icons_from_config.endsWith('/'))
-		icons_from_config.append('/');
-	icons_from_config.append(folder_name);
-	
-	if (io::DirExists(icons_from_config)) {
-		LoadIconsFrom(icons_from_config);
-	} else {
-		QDir app_dir(QCoreApplication::applicationDirPath());
-		if (app_dir.exists(folder_name)) {
-			LoadIconsFrom(app_dir.filePath(folder_name));
-		} else if (app_dir.cdUp()) {
-			if (app_dir.exists(folder_name))
-				LoadIconsFrom(app_dir.filePath(folder_name));
-		}
-	}
-	
-	const QString shared_dir = QLatin1String("/usr/share/cornus/") + folder_name;
-	if (io::DirExists(shared_dir))
-		LoadIconsFrom(shared_dir);
-}
-
 void App::showEvent(QShowEvent *evt)
 {
 	//mtl_info("spontaneous: %d", evt->spontaneous());
+	if (!deferred_init_done_)
+	{
+		deferred_init_done_ = true;
+		startup::Mark("Window shown");
+		QTimer::singleShot(0, this, &App::InitDeferred);
+	}
 }
 
 bool App::ShowInputDialog(const gui::InputDialogParams &params,
@@ -2123,9 +2103,32 @@ bool App::ShouldLoadThumbnailFor(io::File *file, const gui::ViewMode current_mod
 		return false;
 	}
 	
+	/// Seen before (maybe in another folder visit), no need to load it:
+	Thumbnail *cached = thumbnail_cache_.Get(file->id(), file->time_modified_s(), false);
+	if (cached != nullptr)
+	{
+		file->thumbnail(cached);
+		return false;
+	}
+	
 	return true;
 }
 
+bool App::ThumbnailPending(const io::File *file, const gui::ViewMode current_mode,
+	const gui::ViewMode calling_mode) const
+{
+	if (current_mode != calling_mode || current_mode != gui::ViewMode::Icons)
+		return false;
+	
+	if (!file->is_regular() || !file->load_thumbnail() || file->thumbnail() != nullptr)
+		return false;
+	
+	if (!file->extensionCanHaveThumbnail())
+		return false;
+	
+	return !blacklist_.Contains(file, Efa::Thumbnail);
+}
+
 void App::ShutdownThumbnailThreads()
 {
 	global_thumb_loader_data_.Lock();
@@ -2135,11 +2138,9 @@ void App::ShutdownThumbnailThreads()
 		if (DebugThumbnailExit)
 			mtl_info("Terminating thread %d", global_index++);
 		// Terminate thumb loading threads if any
-		th_data->Lock();
 		th_data->wait_for_work = false;
-		th_data->SignalNewWorkAvailable();
-		th_data->Unlock();
 	}
+	global_thumb_loader_data_.Broadcast();
 	
 	struct timespec till;
 	ci64 ms = 50 * 1000 * 1000;
@@ -2149,10 +2150,7 @@ void App::ShutdownThumbnailThreads()
 		for (int i = threads_vec.size() - 1; i >= 0; i--)
 		{
 			ThumbLoaderData *item = threads_vec[i];
-			item->Lock();
-			cbool exited = item->thread_exited;
-			item->Unlock();
-			if (exited)
+			if (item->thread_exited)
 			{
 				if (DebugThumbnailExit)
 					mtl_info("Thread %d exited", i);
@@ -2202,8 +2200,8 @@ void App::SubmitThumbLoaderBatchFromTab(
 		for (int i = new_work_vec->size() - 1; i >= 0; i--)
 		{
 // Iteration happens from last to first on purpose because the user needs
-// the thumbnails to be loaded from top to bottom and since the thumbnails
-// monitor picks from the bottom of the vector queue with vector->takeLast()
+// the thumbnails to be loaded from top to bottom and since the thumbnail
+// workers pick from the bottom of the vector queue with vector->takeLast()
 // (because it's more efficient than vector->takeFirst()) one must submit
 // the items from last to first.
 			auto *item = (*new_work_vec)[i];
@@ -2224,13 +2222,44 @@ void App::SubmitThumbLoaderFromTab(ThumbLoaderArgs *arg)
 		InitThumbnailPoolIfNeeded();
 		
 // Iteration happens from last to first on purpose because the user needs
-// the thumbnails to be loaded from top to bottom and since the thumbnails
-// monitor picks from the bottom of the vector queue with vector->takeLast()
+// the thumbnails to be loaded from top to bottom and since the thumbnail
+// workers pick from the bottom of the vector queue with vector->takeLast()
 // (because it's more efficient than vector->takeFirst()) one must submit
 // the items from last to first.
 		global_thumb_loader_data_.work_queue.append(arg);
+		/// One item, so wake up a single worker:
+		global_thumb_loader_data_.SignalWorkQueueChanged();
+	}
+}
+
+void App::SubmitThumbPrefetchBatch(QVector<ThumbLoaderArgs*> *new_work_vec)
+{
+	if (new_work_vec->isEmpty())
+	{
+		delete new_work_vec;
+		return;
+	}
+	
+	{
+		auto g = global_thumb_loader_data_.guard();
+		InitThumbnailPoolIfNeeded();
+		auto &work_queue = global_thumb_loader_data_.work_queue;
+		thumbnail::CancelWork_NoLock(work_queue, thumbnail::PrefetchTabId, -1);
+		
+		/// Speculative work goes to the front (workers take from the back),
+		/// so that it only runs when nothing the user sees is waiting.
+		/// The first file ends up closest to the back.
+		QVector<ThumbLoaderArgs*> queue;
+		queue.reserve(new_work_vec->size() + work_queue.size());
+		for (int i = new_work_vec->size() - 1; i >= 0; i--)
+			queue.append((*new_work_vec)[i]);
+		queue.append(work_queue);
+		work_queue.swap(queue);
+		
 		global_thumb_loader_data_.Broadcast();
 	}
+	
+	delete new_work_vec;
 }
 
 gui::Tab* App::tab() const
@@ -2267,6 +2296,7 @@ void App::TabSelected(cint index)
 		// index can be -1 when Ctrl+W the only existing tab.
 		return;
 	}
+	thumbnail_prefetcher_->Cancel();
 	gui::Tab *tab = (gui::Tab*)tab_widget_->widget(index);
 	const QString &path = tab->current_dir();
 	location_->SetLocation(path);
@@ -2332,37 +2362,6 @@ void App::TellUserDesktopFileABIDoesntMatch()
 	TellUser(tr("Please restart IO daemon: desktop file ABI doesn't match."));
 }
 
-void App::TestExecBuf(const char *buf, const isize size, ExecInfo &ret)
-{
-	if (size < 4)
-		return;
-	
-	if (buf[0] == 0x7F && buf[1] == 'E' && buf[2] == 'L' && buf[3] == 'F') {
-		ret.type |= ExecType::Elf;
-		return;
-	}
-	
-	QString s = QString::fromLocal8Bit(buf, size);
-	if (s.startsWith("#!")) {
-		ret.type |= ExecType::ShellScript;
-		
-		cint new_line = s.indexOf('\n');
-		if (new_line == -1) {
-			return;
-		}
-		
-		cint start = 2;
-		cint count = new_line - start;
-		if (count > 0) {
-			auto starter = s.mid(start, new_line - start);
-			
-			if (!starter.isEmpty())
-				ret.starter = starter.trimmed();
-		}
-		return;
-	}
-}
-
 void App::ThumbnailArrived(cornus::Thumbnail *thumbnail)
 {
 	// mtl_info("Thumbnail arrived, ID: %lu, path: %s",
@@ -2396,26 +2395,36 @@ void App::ThumbnailArrived(cornus::Thumbnail *thumbnail)
 			
 			// mtl_info("Found file: %s", qPrintable(file->name()));
 			found_file = true;
+			if (thumbnail->img.isNull())
+			{ // loading failed, don't ask for it again
+				file->load_thumbnail(false);
+				files.Unlock();
+				delete thumbnail;
+				tab->icon_view()->RepaintLater();
+				return;
+			}
 			file->thumbnail(thumbnail);
 			const io::DiskFileId file_id = file->id();
+			ci64 time_modified = file->time_modified_s();
 			QString full_path = file->build_full_path();
 			files.Unlock();
 			
+			if (thumbnail->origin != Origin::MemoryCache)
+				thumbnail_cache_.Put(file_id, time_modified, *thumbnail);
+			
 			tab->icon_view()->RepaintLater();
 			if (thumbnail->origin == Origin::DiskFile)
 			{
 				io::SaveThumbnail st;
 				st.full_path = full_path;
-				st.time_modified = file->time_modified_s();
+				st.time_modified = time_modified;
 				// mtl_info("Save thumbnail to disk: %s", qPrintable(full_path));
 				st.id = file_id;
 				st.orig_img_w = thumbnail->original_image_w;
 				st.orig_img_h = thumbnail->original_image_h;
 				st.thmb = thumbnail->img;
 				st.dir = can_write_to_dir ? TempDir::No : TempDir::Yes;
-				thumbnails_to_save_.append(st);
-				
-				QTimer::singleShot(0, this, &App::SaveThumbnail);
+				thumbnail_saver_.Submit(st, prefs_->store_thumbnails_in_ext_attrs());
 			}
 			return; // thumbnail is assigned to file, files is unlocked, so just return
 		}
@@ -2425,6 +2434,31 @@ void App::ThumbnailArrived(cornus::Thumbnail *thumbnail)
 	delete thumbnail; // file for thumbnail not found, so delete it.
 }
 
+void App::ThumbnailPrefetched(cornus::Thumbnail *thumbnail, cornus::ThumbLoaderArgs *arg)
+{
+	AutoDelete ad_thumbnail(thumbnail);
+	AutoDelete ad_arg(arg);
+	if (thumbnail->img.isNull() || thumbnail->origin == Origin::MemoryCache)
+		return;
+	
+	thumbnail_cache_.Put(arg->file_id, arg->time_modified, *thumbnail);
+	if (thumbnail->origin != Origin::DiskFile)
+		return;
+	
+	/// Save it like ThumbnailArrived() does, otherwise it would only come
+	/// back from the cache and never get stored:
+	QStringView dir_path = QStringView(arg->full_path).left(arg->full_path.lastIndexOf('/') + 1);
+	io::SaveThumbnail st;
+	st.full_path = arg->full_path;
+	st.time_modified = arg->time_modified;
+	st.id = arg->file_id;
+	st.orig_img_w = thumbnail->original_image_w;
+	st.orig_img_h = thumbnail->original_image_h;
+	st.thmb = thumbnail->img;
+	st.dir = io::CanWriteToDir(dir_path) ? TempDir::No : TempDir::Yes;
+	thumbnail_saver_.Submit(st, prefs_->store_thumbnails_in_ext_attrs());
+}
+
 void App::ToggleExecBitOfSelectedFiles()
 {
 	auto &view_files = *files(tab()->files_id());
@@ -4,13 +4,19 @@
 #include "cornus.hh"
 #include "decl.hxx"
 #include "err.hpp"
+#include "Icons.hpp"
 #include "io/decl.hxx"
+#include "io/DirSizeCache.hpp"
 #include "io/io.hh"
+#include "io/MimeCache.hpp"
 #include "io/Notify.hpp"
+#include "io/ThumbStore.hpp"
 #include "gui/decl.hxx"
 #include "misc/Blacklist.hpp"
 #include "TreeData.hpp"
 #include "thumbnail.hh"
+#include "ThumbnailCache.hpp"
+#include "ThumbnailSaver.hpp"
 
 #include <QClipboard>
 #include <QHash>
@@ -20,7 +26,6 @@
 #include <QMap>
 #include <QMenu>
 #include <QMetaType> /// Q_DECLARE_METATYPE()
-#include <QMimeDatabase>
 #include <QProcessEnvironment>
 #include <QShortcut>
 #include <QSplitter>
@@ -47,6 +52,7 @@ public:
 	misc::Blacklist& blacklist() { return blacklist_; }
 	QMenu* CreateNewMenu();
 	DirId current_dir_id() const;
+	io::DirSizeCache& dir_size_cache() { return dir_size_cache_; }
 	void DeleteFilesById(const FilesId id);
 	Category desktop() const { return desktop_; }
 	void DisplayFileContents(const int row, io::File *cloned_file = nullptr);
@@ -59,12 +65,16 @@ public:
 	static ClipboardData GetClipboardData();
 	QIcon* GetIcon(const QString &str);
 	QIcon* GetFileIcon(io::File *file);
+	Icons& icons() { return icons_; }
 	QString GetPartitionFreeSpace();
 	FilesId GenNextFilesId();
 	
 	void GoUp();
 	void GoTo(QStringView path);
 	GuiBits& gui_bits() { return gui_bits_; }
+	GlobalThumbLoaderData& global_thumb_loader_data() { return global_thumb_loader_data_; }
+	ThumbnailCache& thumbnail_cache() { return thumbnail_cache_; }
+	ThumbnailPrefetcher* thumbnail_prefetcher() const { return thumbnail_prefetcher_; }
 	
 	QColor green_color() const { return (theme_type_ == ThemeType::Light) ?
 		QColor(0, 100, 0) : QColor(200, 255, 200);
@@ -87,6 +97,7 @@ public:
 	void OpenTerminal();
 	const QHash<QString, Category>& possible_categories() const { return possible_categories_; }
 	Prefs& prefs() { return *prefs_; }
+	void PrioritizeThumbnails(const ThumbViewport &vp);
 	inline ExecInfo QueryExecInfo(io::File &file);
 	ExecInfo QueryExecInfo(const QString &full_path, const QString &ext);
 	QString QueryMimeType(const QString &full_path);
@@ -100,10 +111,15 @@ public:
 	void SetTopLevel(const TopLevel tl, io::File *cloned_file = nullptr);
 	bool ShouldLoadThumbnailFor(io::File *file, const gui::ViewMode current_mode,
 								const gui::ViewMode calling_mode);
+	/// Side effect free version for painting: whether @file still waits
+	/// for its thumbnail.
+	bool ThumbnailPending(const io::File *file, const gui::ViewMode current_mode,
+		const gui::ViewMode calling_mode) const;
 	bool ShowInputDialog(const gui::InputDialogParams &params, QString &ret_val);
 	
 	void SubmitThumbLoaderBatchFromTab(QVector<ThumbLoaderArgs*> *new_work_vec, const TabId tab_id, const DirId dir_id);
 	void SubmitThumbLoaderFromTab(ThumbLoaderArgs *arg);
+	void SubmitThumbPrefetchBatch(QVector<ThumbLoaderArgs*> *new_work_vec);
 	gui::Tab* tab() const; // returns current tab
 	gui::Tab* tab(const TabId id, int *ret_index = nullptr);
 	gui::Tab* tab_at(const int tab_index) const;
@@ -116,7 +132,6 @@ public:
 	void ToggleExecBitOfSelectedFiles();
 	void TellUser(const QString &msg, const QString title = QString());
 	void TellUserDesktopFileABIDoesntMatch();
-	void TestExecBuf(const char *buf, const isize size, ExecInfo &ret);
 	ThemeType theme_type() const { return theme_type_; }
 	gui::ToolBar *toolbar() const { return toolbar_; }
 	HashInfo WaitForRootDaemon(const CanOverwrite co);
@@ -124,6 +139,7 @@ public:
 public Q_SLOTS:
 	void MediaFileChanged();
 	void ThumbnailArrived(cornus::Thumbnail *thumbnail);
+	void ThumbnailPrefetched(cornus::Thumbnail *thumbnail, cornus::ThumbLoaderArgs *arg);
 	
 protected:
 	bool event(QEvent *event) override;
@@ -146,19 +162,15 @@ private:
 	// QIcon* GenIconFromExt(QString ext);
 	QIcon* GetDefaultIcon();
 	QIcon* GetFolderIcon();
-	QIcon* GetIconOrLoadExisting(const QString &icon_path);
-	QString GetIconThatStartsWith(const QString &trunc);
 	void Init();
+	void InitDeferred();
 	void InitThumbnailPoolIfNeeded();
 	QIcon *LoadIcon(io::File &file);
-	void LoadIconsFrom(QString dir_path);
 	void OpenWithDefaultApp(const QString &full_path);
 	int ReadMTP();
 	inline QShortcut* Register(const QKeySequence ks);
 	void RegisterShortcuts();
 	void RegisterVolumesListener();
-	void SaveThumbnail();
-	void SetupIconNames();
 	void ShutdownThumbnailThreads();
 	void TabSelected(const int i);
 	
@@ -166,14 +178,14 @@ private:
 	QVector<QString> search_icons_dirs_;
 	QVector<QString> xdg_data_dirs_;
 	QString theme_name_;
-	QMimeDatabase mime_db_;
+	io::MimeCache mime_cache_;
+	io::DirSizeCache dir_size_cache_;
 	struct IconCache {
 		QIcon *folder = nullptr;
 		QIcon *lib = nullptr;
 		QIcon *unknown = nullptr;
 	} icon_cache_ = {};
-	QHash<QString, QIcon*> icon_set_;
-	QHash<QString, QString> icon_names_;
+	Icons icons_;
 	
 	gui::ToolBar *toolbar_ = nullptr;
 	gui::Location *location_ = nullptr;
@@ -188,8 +200,10 @@ private:
 	struct TopLevelStack {
 		QStackedWidget *stack = nullptr;
 		gui::TextEdit *editor = nullptr;
+		gui::LargeFileView *viewer = nullptr;
 		int window_index = -1;
 		int editor_index = -1;
+		int viewer_index = -1;
 		int imgview_index = -1;
 		TopLevel level = TopLevel::Browser;
 		QString saved_window_title;
@@ -225,11 +239,14 @@ void DropArea::paste()
 	gui::TabsWidget *tab_widget_ = nullptr;
 	cornus::GuiBits gui_bits_ = {};
 	HashInfo root_hash_ = {};
-	QVector<io::SaveThumbnail> thumbnails_to_save_;
-	ZSTD_CCtx *compress_ctx_ = nullptr;
+	io::ThumbStore thumb_store_;
+	ThumbnailSaver thumbnail_saver_{&thumb_store_};
+	ThumbnailCache thumbnail_cache_;
+	ThumbnailPrefetcher *thumbnail_prefetcher_ = nullptr;
 	QProcessEnvironment env_;
 	QLocale locale_;
 	int app_quitting_fd_ = -1;
+	bool deferred_init_done_ = false;
 	misc::Blacklist blacklist_;
 	
 	GlobalThumbLoaderData global_thumb_loader_data_ = {};
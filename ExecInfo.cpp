@@ -41,6 +41,35 @@ bool ExecInfo::Run(const QString &app_path, const QString &working_dir) const
 	return true;
 }
 
+void ExecInfo::TestBuf(const char *buf, const isize size)
+{
+	if (size < 4)
+		return;
+	
+	if (buf[0] == 0x7F && buf[1] == 'E' && buf[2] == 'L' && buf[3] == 'F') {
+		type |= ExecType::Elf;
+		return;
+	}
+	
+	QString s = QString::fromLocal8Bit(buf, size);
+	if (s.startsWith("#!")) {
+		type |= ExecType::ShellScript;
+		
+		cint new_line = s.indexOf('\n');
+		if (new_line == -1) {
+			return;
+		}
+		
+		cint start = 2;
+		cint count = new_line - start;
+		if (count > 0) {
+			auto s2 = s.mid(start, count);
+			
+			if (!s2.isEmpty())
+				starter = s2.trimmed();
+		}
+		return;
+	}
 }
 
-
+}
@@ -22,6 +22,7 @@ public:
 	virtual ~ExecInfo();
 	
 	bool Run(const QString &app_path, const QString &dir_path) const;
+	void TestBuf(const char *buf, const isize size);
 
 	bool is_elf() const { return type & ExecType::Elf; }
 	bool is_shell_script() const { return type & ExecType::ShellScript; }
@@ -7,6 +7,7 @@
 #include "gui/TableModel.hpp"
 #include "io/File.hpp"
 #include "io/Files.hpp"
+#include "ThumbnailPrefetcher.hpp"
 
 namespace cornus {
 
@@ -47,6 +48,7 @@ void Hid::HandleKeySelect(gui::Tab *tab, const VDirection vdir,
 	cbool up_or_down = key == Qt::Key_Up || key == Qt::Key_Down;
 	int new_file_index = -1;
 	QSet<int> indices;
+	QString selected_dir_path;
 	{
 		MutexGuard guard = files.guard();
 		files.SelectAllFiles(Lock::No, Selected::No, indices);
@@ -76,8 +78,16 @@ void Hid::HandleKeySelect(gui::Tab *tab, const VDirection vdir,
 				indices.insert(old_file_index);
 			}
 		}
+		
+		if (new_file_index >= 0 && new_file_index < file_count)
+		{
+			io::File *file = files.data.vec[new_file_index];
+			if (file->is_dir_or_so())
+				selected_dir_path = file->build_full_path();
+		}
 	}
 	
+	app_->thumbnail_prefetcher()->Hovered(selected_dir_path);
 	if (new_file_index != -1) {
 		tab->ScrollToFile(new_file_index);
 	}
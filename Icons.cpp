@@ -0,0 +1,158 @@
+#include "Icons.hpp"
+
+#include "io/io.hh"
+#include "prefs.hh"
+#include "startup.hh"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QPainter>
+
+#include <algorithm>
+
+namespace cornus {
+
+Icons::Icons()
+{
+	pixmaps_.setMaxCost(IconPixmapCacheKiB);
+}
+
+Icons::~Icons()
+{
+	pixmaps_.clear();
+	for (QIcon *icon: icon_set_)
+		delete icon;
+	icon_set_.clear();
+}
+
+QString Icons::FindPath(const QString &name)
+{
+	IndexNamesIfNeeded();
+	return icon_names_.value(name);
+}
+
+QString Icons::FindPathStartingWith(const QString &s)
+{
+	IndexNamesIfNeeded();
+	auto found = starts_with_.constFind(s);
+	if (found != starts_with_.constEnd())
+		return found.value();
+	
+	QString ret;
+	QHashIterator<QString, QString> it(icon_names_);
+	while (it.hasNext()) {
+		it.next();
+		if (it.key().startsWith(s)) {
+			ret = it.value();
+			break;
+		}
+	}
+	
+	starts_with_.insert(s, ret);
+	return ret;
+}
+
+QIcon* Icons::Get(const QString &icon_path)
+{
+	if (icon_path.isEmpty())
+		return nullptr;
+	
+	QIcon *found = icon_set_.value(icon_path, nullptr);
+	if (found != nullptr)
+		return found;
+	
+	/// Doesn't decode anything yet, that happens in GetPixmap().
+	auto *icon = new QIcon(icon_path);
+	icon_set_.insert(icon_path, icon);
+	
+	return icon;
+}
+
+QPixmap Icons::GetPixmap(const QIcon &icon, const QSize &sz, const qreal dpr)
+{
+	IconPixmapKey key;
+	key.icon_key = icon.cacheKey();
+	key.w = sz.width();
+	key.h = sz.height();
+	key.dpr_x100 = qRound(dpr * 100);
+	
+	QPixmap *found = pixmaps_.object(key);
+	if (found != nullptr)
+		return *found;
+	
+	QPixmap pixmap = icon.pixmap(sz, dpr);
+	cint cost_kib = std::max<i64>(1, (i64(pixmap.width()) * pixmap.height() * 4) / 1024);
+	pixmaps_.insert(key, new QPixmap(pixmap), cost_kib);
+	
+	return pixmap;
+}
+
+void Icons::IndexNamesFrom(QString dir_path)
+{
+	QVector<QString> available_names;
+	if (!io::ListFileNames(dir_path, available_names))
+		return;
+	
+	if (!dir_path.endsWith('/'))
+		dir_path.append('/');
+	
+	for (const auto &name: available_names)
+	{
+		int index = name.lastIndexOf('.');
+		auto ext = (index == -1) ? name : name.mid(0, index);
+		if (!icon_names_.contains(ext)) {
+			icon_names_.insert(ext, dir_path + name);
+		}
+	}
+}
+
+void Icons::IndexNamesIfNeeded()
+{
+	/// Only the names get indexed, on first use of an icon
+	/// instead of at startup.
+	if (names_indexed_)
+		return;
+	names_indexed_ = true;
+	const QString folder_name = QLatin1String("file_icons");
+	
+	QString icons_from_config = prefs::QueryAppConfigPath();
+	if (!icons_from_config.endsWith('/'))
+		icons_from_config.append('/');
+	icons_from_config.append(folder_name);
+	
+	if (io::DirExists(icons_from_config)) {
+		IndexNamesFrom(icons_from_config);
+	} else {
+		QDir app_dir(QCoreApplication::applicationDirPath());
+		if (app_dir.exists(folder_name)) {
+			IndexNamesFrom(app_dir.filePath(folder_name));
+		} else if (app_dir.cdUp()) {
+			if (app_dir.exists(folder_name))
+				IndexNamesFrom(app_dir.filePath(folder_name));
+		}
+	}
+	
+	const QString shared_dir = QLatin1String("/usr/share/cornus/") + folder_name;
+	if (io::DirExists(shared_dir))
+		IndexNamesFrom(shared_dir);
+	startup::Mark("Icon names indexed");
+}
+
+void Icons::Paint(QPainter *painter, const QIcon &icon, const QRect &rect)
+{
+	cint side = std::min(rect.width(), rect.height());
+	if (side <= 0)
+		return;
+	
+	const qreal dpr = painter->device()->devicePixelRatioF();
+	const QPixmap pixmap = GetPixmap(icon, QSize(side, side), dpr);
+	if (pixmap.isNull())
+		return;
+	
+	const QSizeF logical = pixmap.deviceIndependentSize();
+	const QPointF at(rect.x() + (rect.width() - logical.width()) / 2.0,
+		rect.y() + (rect.height() - logical.height()) / 2.0);
+	painter->drawPixmap(at, pixmap);
+}
+
+}
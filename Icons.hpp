@@ -0,0 +1,70 @@
+#pragma once
+
+#include "decl.hxx"
+#include "err.hpp"
+
+#include <QCache>
+#include <QHash>
+#include <QIcon>
+#include <QPixmap>
+#include <QString>
+
+QT_BEGIN_NAMESPACE
+class QPainter;
+QT_END_NAMESPACE
+
+namespace cornus {
+
+/// Upper limit for decoded icon pixmaps, in KiB.
+const int IconPixmapCacheKiB = 32 * 1024;
+
+struct IconPixmapKey {
+	i64 icon_key = 0; // QIcon::cacheKey()
+	i32 w = 0;
+	i32 h = 0;
+	i32 dpr_x100 = 100;
+	
+	bool operator==(const IconPixmapKey &rhs) const {
+		return icon_key == rhs.icon_key && w == rhs.w && h == rhs.h &&
+			dpr_x100 == rhs.dpr_x100;
+	}
+};
+
+inline size_t qHash(const IconPixmapKey &key, size_t seed)
+{
+	return qHashMulti(seed, key.icon_key, key.w, key.h, key.dpr_x100);
+}
+
+/** Indexes the names of the file_icons dirs without loading anything,
+creates a QIcon only when it's first asked for, and caches the pixmaps
+each icon got rasterized to (keyed by icon + size + device pixel ratio)
+in a bounded LRU so that painting never rasterizes an SVG twice.
+GUI thread only. */
+class Icons {
+public:
+	Icons();
+	~Icons();
+	
+	QIcon* Get(const QString &icon_path);
+	QString FindPath(const QString &name);
+	QString FindPathStartingWith(const QString &s);
+	
+	/// Returned pixmap has its devicePixelRatio set to @dpr.
+	QPixmap GetPixmap(const QIcon &icon, const QSize &sz, const qreal dpr);
+	/// Like QIcon::paint(painter, rect) with Qt::AlignCenter, but cached.
+	void Paint(QPainter *painter, const QIcon &icon, const QRect &rect);
+	
+private:
+	NO_ASSIGN_COPY_MOVE(Icons);
+	
+	void IndexNamesFrom(QString dir_path);
+	void IndexNamesIfNeeded();
+	
+	QHash<QString, QIcon*> icon_set_;
+	QHash<QString, QString> icon_names_;
+	QHash<QString, QString> starts_with_;
+	QCache<IconPixmapKey, QPixmap> pixmaps_;
+	bool names_indexed_ = false;
+};
+
+}
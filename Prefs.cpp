@@ -94,6 +94,9 @@ bool Prefs::Load()
 	splitter_sizes_.append(buf.next_i32());
 	win_w_ = buf.next_i32();
 	win_h_ = buf.next_i32();
+	/// Added later on, files saved before don't have it:
+	if (buf.has_more(sizeof(i32)))
+		thumbnail_cache_mib_ = buf.next_i32();
 	
 	// ABI: this line must be the last one to save unknown data to @left_bytes
 	// to avoid casual abi version bumps which would entail losing prefs.
@@ -137,6 +140,7 @@ void Prefs::Save() const
 	const auto sz = app_->size();
 	buf.add_i32(sz.width());
 	buf.add_i32(sz.height());
+	buf.add_i32(thumbnail_cache_mib_);
 	
 	// ABI: this line must be the last one to add data to @buf
 	buf.add(left_bytes_, From::Start);
@@ -68,6 +68,9 @@ public:
 	bool sync_views_scroll_location() const { return bool_ & SyncViewsScrollLocation; }
 	void sync_views_scroll_location(bool b) { toggle_bool(b, SyncViewsScrollLocation); }
 	
+	i32 thumbnail_cache_mib() const { return thumbnail_cache_mib_; }
+	void thumbnail_cache_mib(ci32 n) { thumbnail_cache_mib_ = n; }
+	
 	const QList<int>& splitter_sizes() const { return splitter_sizes_; }
 	QMap<i8, bool>& cols_visibility() { return cols_visibility_; }
 	i16 custom_table_font_size() const {
@@ -90,6 +93,7 @@ private:
 	QMap<i8, bool> cols_visibility_;
 	QList<int> splitter_sizes_;
 	i32 win_w_ = -1, win_h_ = -1;
+	i32 thumbnail_cache_mib_ = prefs::DefaultThumbnailCacheMiB;
 	ByteArray *left_bytes_ = nullptr;
 	
 	App *app_ = nullptr;
@@ -0,0 +1,67 @@
+#include "ThumbnailCache.hpp"
+
+#include "MutexGuard.hpp"
+#include "prefs.hh"
+
+#include <algorithm>
+
+namespace cornus {
+
+ThumbnailCache::ThumbnailCache()
+{
+	cache_.setMaxCost(prefs::DefaultThumbnailCacheMiB * 1024);
+}
+
+ThumbnailCache::~ThumbnailCache() {}
+
+Thumbnail* ThumbnailCache::Get(const io::DiskFileId &id, ci64 time_modified,
+	cbool count_miss)
+{
+	MutexGuard guard(&mutex_);
+	Thumbnail *found = cache_.object({id, time_modified});
+	if (found == nullptr)
+	{
+		if (count_miss)
+			misses_++;
+		return nullptr;
+	}
+	
+	hits_++;
+	return found->Clone();
+}
+
+void ThumbnailCache::Put(const io::DiskFileId &id, ci64 time_modified,
+	const Thumbnail &thumbnail)
+{
+	if (thumbnail.img.isNull())
+		return;
+	
+	Thumbnail *copy = new Thumbnail(thumbnail);
+	copy->debug_path.clear();
+	/// Each view has its own size for it, only img is shared:
+	copy->display_img = QImage();
+	cint cost_kib = std::max<i64>(1, thumbnail.img.sizeInBytes() / 1024);
+	MutexGuard guard(&mutex_);
+	cache_.insert({id, time_modified}, copy, cost_kib);
+}
+
+void ThumbnailCache::SetBudgetMiB(cint mib)
+{
+	MutexGuard guard(&mutex_);
+	cache_.setMaxCost(std::max(1, mib) * 1024);
+}
+
+ThumbnailCacheStats ThumbnailCache::stats() const
+{
+	MutexGuard guard(&mutex_);
+	ThumbnailCacheStats ret;
+	ret.hits = hits_;
+	ret.misses = misses_;
+	ret.used_kib = cache_.totalCost();
+	ret.max_kib = cache_.maxCost();
+	ret.count = cache_.count();
+	
+	return ret;
+}
+
+}
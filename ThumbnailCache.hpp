@@ -0,0 +1,47 @@
+#pragma once
+
+#include "decl.hxx"
+#include "err.hpp"
+#include "io/ThumbStore.hpp"
+#include "thumbnail.hh"
+
+#include <QCache>
+
+#include <pthread.h>
+
+namespace cornus {
+
+struct ThumbnailCacheStats {
+	i64 hits = 0;
+	i64 misses = 0;
+	i64 used_kib = 0;
+	i64 max_kib = 0;
+	int count = 0;
+};
+
+/** Process wide LRU of decoded thumbnails keyed by DiskFileId + mtime,
+bounded by a memory budget (prefs). Unlike io::File::cache().thumbnail
+it survives leaving a folder, so going back to it doesn't re-read and
+re-decompress anything. Thread safe. */
+class ThumbnailCache {
+public:
+	ThumbnailCache();
+	~ThumbnailCache();
+	
+	/// Returns a copy owned by the caller or nullptr. @count_miss is
+	/// false for lookups that don't go to disk on a miss.
+	Thumbnail* Get(const io::DiskFileId &id, ci64 time_modified, cbool count_miss);
+	void Put(const io::DiskFileId &id, ci64 time_modified, const Thumbnail &thumbnail);
+	void SetBudgetMiB(cint mib);
+	ThumbnailCacheStats stats() const;
+	
+private:
+	NO_ASSIGN_COPY_MOVE(ThumbnailCache);
+	
+	mutable pthread_mutex_t mutex_ = PTHREAD_MUTEX_INITIALIZER;
+	QCache<io::ThumbStoreKey, Thumbnail> cache_;
+	i64 hits_ = 0;
+	i64 misses_ = 0;
+};
+
+}
@@ -0,0 +1,244 @@
+#include "ThumbnailPrefetcher.hpp"
+
+#include "App.hpp"
+#include "AutoDelete.hh"
+#include "gui/IconView.hpp"
+#include "gui/Tab.hpp"
+#include "io/File.hpp"
+#include "MutexGuard.hpp"
+#include "Prefs.hpp"
+#include "thumbnail.hh"
+
+#include <QTimer>
+
+#include <algorithm>
+
+namespace cornus {
+
+struct PrefetchListArgs {
+	ThumbnailPrefetcher *prefetcher = nullptr;
+	QProcessEnvironment env;
+	QString dir_path;
+	SortingOrder sorting_order;
+	DirId generation = 0;
+	int max_files = ThumbPrefetchDefaultFiles;
+	bool show_hidden_files = false;
+};
+
+void ThumbnailPrefetcher::ListAndSend(PrefetchListArgs *args)
+{
+	QVector<QString> names;
+	if (!io::ListFileNames(args->dir_path, names))
+		return;
+	
+	if (names.size() > ThumbPrefetchMaxEntries)
+	{
+		mtl_info("Not prefetching %lld files", i64(names.size()));
+		return;
+	}
+	
+	/// io::SortFiles() gets the sorting order through file->files():
+	io::Files *files = new io::Files();
+	files->data.processed_dir_path = args->dir_path;
+	files->data.sorting_order = args->sorting_order;
+	files->data.dir_id = args->generation;
+	auto &vec = files->data.vec;
+	
+	struct statx stx;
+	for (int i = 0; i < names.size(); i++)
+	{
+		/// Whoever hovers over folders quickly moves on before this ends:
+		if ((i % 64) == 0 && args->prefetcher->generation() != args->generation)
+		{
+			delete files;
+			return;
+		}
+		
+		const QString &name = names[i];
+		if (!args->show_hidden_files && name.startsWith('.'))
+			continue;
+		
+		io::File *file = new io::File(files);
+		file->name(name);
+		if (!file->extensionCanHaveThumbnail())
+		{
+			delete file;
+			continue;
+		}
+		
+		auto path_ba = (args->dir_path + name).toLocal8Bit();
+		if (statx(0, path_ba.data(), AT_SYMLINK_NOFOLLOW, STATX_ALL, &stx) != 0)
+		{
+			delete file;
+			continue;
+		}
+		
+		io::FillInStx(*file, stx, nullptr);
+		if (!file->is_regular())
+		{
+			delete file;
+			continue;
+		}
+		
+		vec.append(file);
+	}
+	
+	std::sort(vec.begin(), vec.end(), cornus::io::SortFiles);
+	while (vec.size() > args->max_files)
+		delete vec.takeLast();
+	
+	/// The thumbnail (if any) is in the ext attrs:
+	for (io::File *file: vec)
+		io::ReloadMeta(*file, stx, args->env, PrintErrors::No, &args->dir_path);
+	
+	if (args->prefetcher->generation() != args->generation)
+	{
+		delete files;
+		return;
+	}
+	
+	QMetaObject::invokeMethod(args->prefetcher, "Listed",
+		Q_ARG(cornus::io::Files*, files));
+}
+
+ThumbnailPrefetcher::ThumbnailPrefetcher(App *app): QObject(app), app_(app)
+{
+	timer_ = new QTimer(this);
+	timer_->setSingleShot(true);
+	timer_->setInterval(ThumbPrefetchDelayMs);
+	connect(timer_, &QTimer::timeout, this, &ThumbnailPrefetcher::Start);
+}
+
+ThumbnailPrefetcher::~ThumbnailPrefetcher()
+{
+	generation_++;
+	MutexGuard guard(&mutex_);
+	while (threads_ > 0)
+		pthread_cond_wait(&cond_, &mutex_);
+}
+
+void ThumbnailPrefetcher::Cancel()
+{
+	timer_->stop();
+	hovered_.clear();
+	if (started_.isEmpty())
+		return;
+	
+	started_.clear();
+	generation_++;
+	thumbnail::CancelWork(app_->global_thumb_loader_data(), thumbnail::PrefetchTabId, -1);
+}
+
+void ThumbnailPrefetcher::GoingTo(const QString &dir_path)
+{
+	timer_->stop();
+	hovered_.clear();
+	/// Its thumbnails are the ones that folder needs first:
+	if (!started_.isEmpty() && io::SameFiles(started_, dir_path))
+		return;
+	
+	Cancel();
+}
+
+void ThumbnailPrefetcher::Hovered(const QString &dir_path)
+{
+	if (dir_path == hovered_)
+		return;
+	
+	hovered_ = dir_path;
+	timer_->stop();
+	if (!hovered_.isEmpty())
+		timer_->start();
+}
+
+void ThumbnailPrefetcher::Listed(cornus::io::Files *files)
+{
+	AutoDelete ad_files(files);
+	if (files->data.dir_id != generation_)
+		return;
+	
+	QVector<ThumbLoaderArgs*> *work_vec = new QVector<ThumbLoaderArgs*>();
+	auto &vec = files->data.vec;
+	for (int i = 0; i < vec.size(); i++)
+	{
+		io::File *file = vec[i];
+		/// Also skips the blacklisted ones and the ones already cached:
+		if (!app_->ShouldLoadThumbnailFor(file, gui::ViewMode::Icons, gui::ViewMode::Icons))
+			continue;
+		
+		ThumbLoaderArgs *arg = new ThumbLoaderArgs();
+		arg->app = app_;
+		arg->ba = file->thumbnail_attrs();
+		arg->full_path = file->build_full_path();
+		arg->file_id = file->id();
+		arg->time_modified = file->time_modified_s();
+		arg->ext = file->cache().ext.toLocal8Bit();
+		arg->tab_id = thumbnail::PrefetchTabId;
+		arg->icon_w = thumbnail::MaxImgW;
+		arg->icon_h = thumbnail::MaxImgH;
+		arg->file_index = i;
+		work_vec->append(arg);
+	}
+	
+	app_->SubmitThumbPrefetchBatch(work_vec);
+}
+
+void* ThumbnailPrefetcher::ListFolder(void *p)
+{
+	pthread_detach(pthread_self());
+	PrefetchListArgs *args = (PrefetchListArgs*) p;
+	ThumbnailPrefetcher *prefetcher = args->prefetcher;
+	ListAndSend(args);
+	delete args;
+	
+	MutexGuard guard(&prefetcher->mutex_);
+	prefetcher->threads_--;
+	pthread_cond_broadcast(&prefetcher->cond_);
+	
+	return nullptr;
+}
+
+void ThumbnailPrefetcher::Start()
+{
+	gui::Tab *tab = app_->tab();
+	/// Thumbnails are only shown (and loaded) in the icon view:
+	if (hovered_ == started_ || tab == nullptr ||
+		tab->view_mode() != gui::ViewMode::Icons)
+		return;
+	
+	QString dir_path = hovered_;
+	if (!dir_path.endsWith('/'))
+		dir_path.append('/');
+	
+	if (io::SameFiles(dir_path, tab->current_dir()))
+		return;
+	
+	const QString hovered = hovered_;
+	Cancel();
+	hovered_ = started_ = hovered;
+	
+	PrefetchListArgs *args = new PrefetchListArgs();
+	args->prefetcher = this;
+	args->env = app_->env();
+	args->dir_path = dir_path;
+	args->generation = generation_;
+	args->show_hidden_files = app_->prefs().show_hidden_files();
+	{
+		auto &files = tab->view_files();
+		auto g = files.guard();
+		args->sorting_order = files.data.sorting_order;
+	}
+	
+	gui::IconView *icon_view = tab->icon_view();
+	cint per_screen = (icon_view != nullptr) ? icon_view->CellsPerScreen() : -1;
+	args->max_files = (per_screen > 0) ?
+		std::min(per_screen, ThumbPrefetchMaxFiles) : ThumbPrefetchDefaultFiles;
+	
+	MutexGuard guard(&mutex_);
+	if (io::NewThread(ListFolder, args))
+		threads_++;
+	else
+		delete args;
+}
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "decl.hxx"
+#include "err.hpp"
+#include "io/decl.hxx"
+#include "io/Files.hpp"
+
+#include <QObject>
+#include <QString>
+
+#include <atomic>
+#include <pthread.h>
+
+QT_BEGIN_NAMESPACE
+class QTimer;
+QT_END_NAMESPACE
+
+namespace cornus {
+
+/// How long the mouse (or the selection) has to stay on a folder:
+const int ThumbPrefetchDelayMs = 300;
+/// Used when the current tab has no icon view to measure a screen with:
+const int ThumbPrefetchDefaultFiles = 48;
+const int ThumbPrefetchMaxFiles = 256;
+/// Folders with more entries aren't listed speculatively:
+const int ThumbPrefetchMaxEntries = 20000;
+
+struct PrefetchListArgs;
+
+/** Warms the ThumbnailCache for the first screenful of a folder that is
+hovered or selected (in the icon view or in the side pane) so that going
+into it doesn't start with placeholders. The folder is listed on its own
+thread, its files get queued for the thumbnail workers behind any other
+work, and a newer hover, navigation or tab switch cancels what's left. */
+class ThumbnailPrefetcher: public QObject {
+	Q_OBJECT
+public:
+	ThumbnailPrefetcher(App *app);
+	virtual ~ThumbnailPrefetcher();
+	
+	void Cancel();
+	DirId generation() const { return generation_; }
+	/// Called when a tab goes to @dir_path, keeps the prefetch work if
+	/// it's for that folder, cancels it otherwise.
+	void GoingTo(const QString &dir_path);
+	/// An empty @dir_path means the mouse is on something else.
+	void Hovered(const QString &dir_path);
+
+public Q_SLOTS:
+	/// Called by the listing thread, files->data.dir_id is the generation.
+	void Listed(cornus::io::Files *files);
+
+private:
+	NO_ASSIGN_COPY_MOVE(ThumbnailPrefetcher);
+	
+	static void ListAndSend(PrefetchListArgs *args);
+	/// The listing thread, runs ListAndSend() and counts in threads_:
+	static void* ListFolder(void *p);
+	void Start();
+	
+	App *app_ = nullptr;
+	QTimer *timer_ = nullptr;
+	QString hovered_;
+	QString started_;
+	std::atomic<DirId> generation_ = 0;
+	/// The destructor waits for the listing threads, which use this:
+	pthread_mutex_t mutex_ = PTHREAD_MUTEX_INITIALIZER;
+	pthread_cond_t cond_ = PTHREAD_COND_INITIALIZER;
+	int threads_ = 0;
+};
+
+}
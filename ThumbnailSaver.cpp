@@ -0,0 +1,90 @@
+#include "ThumbnailSaver.hpp"
+
+#include <zstd.h>
+
+#include <algorithm>
+
+namespace cornus {
+
+ThumbnailSaver::ThumbnailSaver(io::ThumbStore *store): store_(store) {}
+
+ThumbnailSaver::~ThumbnailSaver()
+{
+	cm_.Lock();
+	exit_ = true;
+	cm_.Broadcast();
+	/// The threads use this object, wait for them to finish the batch
+	/// they're writing:
+	while (running_count_ > 0)
+		cm_.CondWait();
+	cm_.Unlock();
+}
+
+void ThumbnailSaver::Submit(const io::SaveThumbnail &item, cbool store_in_ext_attrs)
+{
+	auto g = cm_.guard();
+	store_in_ext_attrs_ = store_in_ext_attrs;
+	auto it = pending_.find(item.id);
+	if (it != pending_.end())
+	{
+		it.value() = item;
+		return;
+	}
+	
+	pending_.insert(item.id, item);
+	order_.append(item.id);
+	
+	if (running_count_ < ThumbnailSaverThreads)
+	{
+		if (io::NewThread(Work, this))
+			running_count_++;
+	}
+	
+	cm_.Signal();
+}
+
+void* ThumbnailSaver::Work(void *args)
+{
+	pthread_detach(pthread_self());
+	ThumbnailSaver *saver = (ThumbnailSaver*) args;
+	ZSTD_CCtx *compress_ctx = ZSTD_createCCtx();
+	QVector<io::SaveThumbnail> batch;
+	batch.reserve(ThumbnailSaveBatch);
+	
+	saver->cm_.Lock();
+	while (!saver->exit_)
+	{
+		auto &order = saver->order_;
+		if (order.isEmpty())
+		{
+			cint status = saver->cm_.CondWait();
+			if (status != 0)
+			{
+				mtl_status(status);
+				break;
+			}
+			continue;
+		}
+		
+		cint count = std::min(ThumbnailSaveBatch, int(order.size()));
+		for (int i = 0; i < count; i++)
+			batch.append(saver->pending_.take(order.takeLast()));
+		cbool store_in_ext_attrs = saver->store_in_ext_attrs_;
+		saver->cm_.Unlock();
+		
+		for (const io::SaveThumbnail &item: batch)
+			io::SaveThumbnailToDisk(item, compress_ctx, store_in_ext_attrs, saver->store_);
+		batch.clear();
+		
+		saver->cm_.Lock();
+	}
+	
+	ZSTD_freeCCtx(compress_ctx);
+	saver->running_count_--;
+	saver->cm_.Broadcast();
+	saver->cm_.Unlock();
+	
+	return nullptr;
+}
+
+}
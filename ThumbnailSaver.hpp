@@ -0,0 +1,44 @@
+#pragma once
+
+#include "CondMutex.hpp"
+#include "decl.hxx"
+#include "err.hpp"
+#include "io/decl.hxx"
+#include "io/io.hh"
+
+#include <QHash>
+#include <QVector>
+
+namespace cornus {
+
+/// How many items a writer thread takes per lock:
+const int ThumbnailSaveBatch = 16;
+const int ThumbnailSaverThreads = 2;
+
+/** Compresses the thumbnails that were generated from image files and
+stores them (in ext attrs or the thumbnail store) on its own threads, each with
+its own ZSTD_CCtx, so that the GUI thread only updates the model.
+Submits for a file that is still queued replace the queued item.
+Whatever is still queued at exit is dropped, it gets regenerated. */
+class ThumbnailSaver {
+public:
+	ThumbnailSaver(io::ThumbStore *store);
+	~ThumbnailSaver();
+	
+	void Submit(const io::SaveThumbnail &item, cbool store_in_ext_attrs);
+	
+private:
+	NO_ASSIGN_COPY_MOVE(ThumbnailSaver);
+	
+	static void* Work(void *args);
+	
+	CondMutex cm_ = {};
+	io::ThumbStore *store_ = nullptr;
+	QHash<io::DiskFileId, io::SaveThumbnail> pending_;
+	QVector<io::DiskFileId> order_;
+	int running_count_ = 0;
+	bool exit_ = false;
+	bool store_in_ext_attrs_ = true;
+};
+
+}
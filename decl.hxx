@@ -19,6 +19,7 @@ class Media;
 class MutexGuard;
 class MyDaemon;
 class Prefs;
+class ThumbnailPrefetcher;
 class TreeItems;
 
 const QString AppIconPath = QLatin1String(":/cornus.mas.png");
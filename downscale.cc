@@ -0,0 +1,238 @@
+#include "downscale.hh"
+
+#include <QVector>
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CORNUS_DOWNSCALE_X86
+#include <immintrin.h>
+#endif
+
+namespace cornus::downscale {
+
+using AddRowFunc = void (*)(const uchar *row, u16 *acc, cint n);
+using SumBoxesFunc = void (*)(const u16 *acc, const i32 *x_edges,
+	cint dst_w, cint rows, uchar *dst);
+
+/// All implementations divide with the same float ops (no FMA) so that
+/// they give identical results.
+static inline uchar Mean(cu32 sum, cf32 inv_area)
+{
+	return uchar(std::min(255.0f, f32(sum) * inv_area + 0.5f));
+}
+
+static void AddRow(const uchar *row, u16 *acc, cint n)
+{
+	for (int i = 0; i < n; i++)
+		acc[i] += row[i];
+}
+
+static void AddRow32(const uchar *row, u32 *acc, cint n)
+{
+	for (int i = 0; i < n; i++)
+		acc[i] += row[i];
+}
+
+template <typename T>
+static void SumBoxes(const T *acc, const i32 *x_edges, cint dst_w,
+	cint rows, uchar *dst)
+{
+	for (int dx = 0; dx < dst_w; dx++)
+	{
+		cint x0 = x_edges[dx];
+		cint x1 = x_edges[dx + 1];
+		u32 sum[4] = {};
+		for (int x = x0; x < x1; x++)
+		{
+			const T *p = acc + x * 4;
+			sum[0] += p[0];
+			sum[1] += p[1];
+			sum[2] += p[2];
+			sum[3] += p[3];
+		}
+		
+		cf32 inv_area = 1.0f / f32(i64(x1 - x0) * rows);
+		uchar *out = dst + dx * 4;
+		for (int c = 0; c < 4; c++)
+			out[c] = Mean(sum[c], inv_area);
+	}
+}
+
+static void SumBoxes16(const u16 *acc, const i32 *x_edges, cint dst_w,
+	cint rows, uchar *dst)
+{
+	SumBoxes<u16>(acc, x_edges, dst_w, rows, dst);
+}
+
+#ifdef CORNUS_DOWNSCALE_X86
+__attribute__((target("sse4.1")))
+static void AddRowSse41(const uchar *row, u16 *acc, cint n)
+{
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		const __m128i bytes = _mm_loadu_si128((const __m128i*)(row + i));
+		const __m128i lo = _mm_cvtepu8_epi16(bytes);
+		const __m128i hi = _mm_cvtepu8_epi16(_mm_srli_si128(bytes, 8));
+		__m128i *a = (__m128i*)(acc + i);
+		_mm_storeu_si128(a, _mm_add_epi16(_mm_loadu_si128(a), lo));
+		_mm_storeu_si128(a + 1, _mm_add_epi16(_mm_loadu_si128(a + 1), hi));
+	}
+	
+	for (; i < n; i++)
+		acc[i] += row[i];
+}
+
+/// One pixel's 4 channels per 128 bit lane, used by the AVX2 path too.
+__attribute__((target("sse4.1")))
+static void SumBoxesSse41(const u16 *acc, const i32 *x_edges, cint dst_w,
+	cint rows, uchar *dst)
+{
+	const __m128 half = _mm_set1_ps(0.5f);
+	for (int dx = 0; dx < dst_w; dx++)
+	{
+		cint x0 = x_edges[dx];
+		cint x1 = x_edges[dx + 1];
+		__m128i sum = _mm_setzero_si128();
+		for (int x = x0; x < x1; x++)
+		{
+			const __m128i px = _mm_loadl_epi64((const __m128i*)(acc + x * 4));
+			sum = _mm_add_epi32(sum, _mm_cvtepu16_epi32(px));
+		}
+		
+		const __m128 inv_area = _mm_set1_ps(1.0f / f32(i64(x1 - x0) * rows));
+		const __m128 mean = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(sum), inv_area), half);
+		__m128i v = _mm_cvttps_epi32(mean);
+		v = _mm_packus_epi32(v, v);
+		v = _mm_packus_epi16(v, v);
+		cu32 packed = u32(_mm_cvtsi128_si32(v));
+		memcpy(dst + dx * 4, &packed, sizeof packed);
+	}
+}
+
+__attribute__((target("avx2")))
+static void AddRowAvx2(const uchar *row, u16 *acc, cint n)
+{
+	int i = 0;
+	for (; i + 32 <= n; i += 32)
+	{
+		const __m256i lo = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row + i)));
+		const __m256i hi = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row + i + 16)));
+		__m256i *a = (__m256i*)(acc + i);
+		_mm256_storeu_si256(a, _mm256_add_epi16(_mm256_loadu_si256(a), lo));
+		_mm256_storeu_si256(a + 1, _mm256_add_epi16(_mm256_loadu_si256(a + 1), hi));
+	}
+	
+	for (; i < n; i++)
+		acc[i] += row[i];
+}
+#endif
+
+static Simd Detect()
+{
+#ifdef CORNUS_DOWNSCALE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return Simd::Avx2;
+	if (__builtin_cpu_supports("sse4.1"))
+		return Simd::Sse41;
+#endif
+	return Simd::None;
+}
+
+Simd BestSimd()
+{
+	static const Simd best = Detect();
+	return best;
+}
+
+const char* SimdName(const Simd simd)
+{
+	switch (simd) {
+	case Simd::Sse41: return "SSE4.1";
+	case Simd::Avx2: return "AVX2";
+	default: return "scalar";
+	}
+}
+
+void Box32(const uchar *src, cint src_w, cint src_h, cisize src_bpl,
+	uchar *dst, cint dst_w, cint dst_h, cisize dst_bpl, const Simd simd)
+{
+	if (dst_w <= 0 || dst_h <= 0 || dst_w > src_w || dst_h > src_h)
+	{
+		mtl_warn("Can't scale %dx%d to %dx%d", src_w, src_h, dst_w, dst_h);
+		return;
+	}
+	
+	AddRowFunc add_row = AddRow;
+	SumBoxesFunc sum_boxes = SumBoxes16;
+#ifdef CORNUS_DOWNSCALE_X86
+	if (simd == Simd::Avx2 && BestSimd() == Simd::Avx2) {
+		add_row = AddRowAvx2;
+		sum_boxes = SumBoxesSse41;
+	} else if (simd != Simd::None && BestSimd() != Simd::None) {
+		add_row = AddRowSse41;
+		sum_boxes = SumBoxesSse41;
+	}
+#else
+	Q_UNUSED(simd);
+#endif
+	
+	/// Box dx spans source columns [x_edges[dx], x_edges[dx + 1]):
+	QVector<i32> x_edges(dst_w + 1);
+	for (int dx = 0; dx <= dst_w; dx++)
+		x_edges[dx] = i32(i64(dx) * src_w / dst_w);
+	
+	cint n = src_w * 4;
+	QVector<u16> acc(n);
+	QVector<u32> acc32;
+	
+	for (int dy = 0; dy < dst_h; dy++)
+	{
+		cint y0 = int(i64(dy) * src_h / dst_h);
+		cint y1 = int(i64(dy + 1) * src_h / dst_h);
+		cint rows = y1 - y0;
+		uchar *out = dst + dy * dst_bpl;
+		
+		if (rows <= MaxU16Rows)
+		{
+			memset(acc.data(), 0, n * sizeof(u16));
+			for (int y = y0; y < y1; y++)
+				add_row(src + y * src_bpl, acc.data(), n);
+			sum_boxes(acc.constData(), x_edges.constData(), dst_w, rows, out);
+		} else {
+			acc32.fill(0, n);
+			for (int y = y0; y < y1; y++)
+				AddRow32(src + y * src_bpl, acc32.data(), n);
+			SumBoxes<u32>(acc32.constData(), x_edges.constData(), dst_w, rows, out);
+		}
+	}
+}
+
+QImage Scale(const QImage &img, const QSize &size, const Simd simd)
+{
+	if (img.isNull() || size.isEmpty())
+		return QImage();
+	
+	cf64 ratio = std::min(f64(img.width()) / size.width(),
+		f64(img.height()) / size.height());
+	if (ratio < MinBoxRatio)
+		return img.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+	
+	const QImage::Format format = img.hasAlphaChannel() ?
+		QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+	const QImage src = (img.format() == format) ? img : img.convertToFormat(format);
+	QImage dst(size, format);
+	if (src.isNull() || dst.isNull())
+		return QImage();
+	
+	Box32(src.constBits(), src.width(), src.height(), src.bytesPerLine(),
+		dst.bits(), dst.width(), dst.height(), dst.bytesPerLine(), simd);
+	dst.setColorSpace(src.colorSpace());
+	
+	return dst;
+}
+
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "err.hpp"
+
+#include <QImage>
+#include <QSize>
+
+namespace cornus::downscale {
+
+enum class Simd: i8 {
+	None,
+	Sse41,
+	Avx2
+};
+
+/// Below this ratio a box filter aliases visibly, Qt's smooth scaling is used.
+const f64 MinBoxRatio = 2.0;
+/// The u16 column sums overflow past this many rows per box (255 * 257 < 65536):
+cint MaxU16Rows = 257;
+
+/// Detected once, the best instruction set this CPU supports.
+Simd BestSimd();
+const char* SimdName(const Simd simd);
+
+/** Area averaging (box filter) of 4 byte pixels, every destination pixel
+is the rounded mean of the source pixels it covers. Color channels must
+be premultiplied for the result to be correct. Doesn't scale up. */
+void Box32(const uchar *src, cint src_w, cint src_h, cisize src_bpl,
+	uchar *dst, cint dst_w, cint dst_h, cisize dst_bpl, const Simd simd);
+
+/// Scales @img down to @size (aspect ratio is not kept), in the format
+/// RGB32 or ARGB32_Premultiplied.
+QImage Scale(const QImage &img, const QSize &size, const Simd simd = BestSimd());
+
+}
@@ -2,9 +2,9 @@
 
 #include "../App.hpp"
 #include "../AutoDelete.hh"
+#include "../io/DirSizeCache.hpp"
+#include "../io/DiskUsage.hpp"
 #include "../io/io.hh"
-#include "../MutexGuard.hpp"
-#include "../trash.hh"
 
 #include <QBoxLayout>
 #include <QFormLayout>
@@ -12,38 +12,6 @@
 
 namespace cornus::gui {
 
-void *CountFolderTh(void *arg)
-{
-	pthread_detach(pthread_self());
-	io::CountFolderData *data = (io::CountFolderData*)arg;
-	bool is_trash_dir;
-	const QString name = io::GetFileNameOfFullPath(data->full_path).toString();
-	int err = io::DoStat(data->full_path, name, is_trash_dir, true, *data);
-	
-	if (err != 0){
-		auto guard = data->guard();
-		data->err_str = QObject::tr("Failed: ") + strerror(err);
-		data->thread_has_quit = true;
-		return nullptr;
-	}
-	
-	err = io::CountSizeRecursiveTh(data->full_path, *data, is_trash_dir);
-	
-	auto guard = data->guard();
-	if (data->app_has_quit)
-	{
-		delete data;
-		return nullptr;
-	}
-	
-	if (err != 0)
-		data->err_str = QObject::tr("Failed: ") + strerror(err);
-	
-	data->thread_has_quit = true;
-	
-	return nullptr;
-}
-
 CountFolder::CountFolder(App *app, const QString &dir_path):
 app_(app)
 {
@@ -57,10 +25,8 @@ app_(app)
 	setModal(true);
 	setVisible(true);
 	
-	data_ = new io::CountFolderData();
-	data_->full_path = full_path_;
-	
-	if (!io::NewThread(CountFolderTh, data_))
+	du_ = new io::DiskUsage(&app_->dir_size_cache());
+	if (!du_->Start(full_path_))
 		return;
 	
 	timer_ = new QTimer(this);
@@ -73,25 +39,37 @@ app_(app)
 
 CountFolder::~CountFolder()
 {
-	if (thread_has_quit_) {
-		delete data_;
-		data_ = nullptr;
-	} else {
-		MutexGuard mutex(&data_->mutex);
-		data_->app_has_quit = true;
-	}
+	/// Waits for the threads to finish the folders they're on:
+	delete du_;
+	du_ = nullptr;
 }
 
 void CountFolder::CheckState()
 {
+	/// Checked first so that the totals read next are the final ones:
+	done_ = !du_->running();
 	io::CountRecursiveInfo info;
+	QVector<io::DiskUsageTop> tops;
+	du_->GetProgress(info, &tops, CountFolderTopN);
+	
+	tops_list_->clear();
+	for (const io::DiskUsageTop &top: tops)
+	{
+		tops_list_->addItem(io::SizeToString(top.size)
+			+ QLatin1String("  ") + top.name);
+	}
+	
 	QString error;
+	cint failed = du_->dirs_failed();
+	if (failed > 0)
 	{
-		MutexGuard guard(&data_->mutex);
-		info = data_->info;
-		thread_has_quit_ = data_->thread_has_quit;
-		error = data_->err_str;
+		error = tr("%1 folders couldn't be read (%2)")
+			.arg(failed).arg(strerror(du_->first_error()));
 	}
+	
+	if (done_)
+		app_->dir_size_cache().Save();
+	
 	UpdateInfo(&info, error);
 }
 
@@ -135,6 +113,11 @@ void CountFolder::CreateGui()
 	progress_label_ = CreateLineEdit();
 	form->addRow(tr("Progress:"), progress_label_);
 	
+	tops_list_ = new QListWidget();
+	tops_list_->setFixedWidth(FixedLineWidth);
+	tops_list_->setFixedHeight(tops_list_->fontMetrics().height() * (CountFolderTopN + 1));
+	form->addRow(tr("Largest sub-folders:"), tops_list_);
+	
 	{
 		QFrame *line = new QFrame(this);
 		line->setFrameShape(QFrame::HLine); // Horizontal line
@@ -192,14 +175,17 @@ void CountFolder::UpdateInfo(cornus::io::CountRecursiveInfo *info,
 		size_label_->setText(s);
 	}
 	
-	if (thread_has_quit_) {
-		timer_->stop();
-		progress_label_->setText(tr("Done ") + QChar(0x2705));
-	} else if (!err_msg.isEmpty()) {
+	if (done_) {
 		timer_->stop();
-		progress_label_->setText(QChar(0x274C) + tr("Error: ") + err_msg);
+		s = tr("Done ") + QChar(0x2705);
+		if (!err_msg.isEmpty())
+			s.append(QLatin1String(", ") + err_msg);
+		progress_label_->setText(s);
 	} else {
-		progress_label_->setText(tr("In progress.."));
+		s = tr("In progress.. %1 folders, %2 from cache")
+			.arg(locale_.toString(info->dir_count))
+			.arg(locale_.toString(du_->dirs_cached()));
+		progress_label_->setText(s);
 	}
 }
 
@@ -2,6 +2,7 @@
 
 #include <QDialog>
 #include <QLineEdit>
+#include <QListWidget>
 #include <QLocale>
 #include <QTimer>
 
@@ -11,6 +12,9 @@
 
 namespace cornus::gui {
 
+/// How many of the largest sub-folders are listed:
+const int CountFolderTopN = 10;
+
 class CountFolder : public QDialog {
 	Q_OBJECT
 public:
@@ -37,9 +41,10 @@ private:
 	QLineEdit *file_count_label_ = nullptr;
 	QLineEdit *folder_count_label_ = nullptr;
 	QLineEdit *progress_label_ = nullptr;
+	QListWidget *tops_list_ = nullptr;
 	
-	io::CountFolderData *data_ = nullptr;
+	io::DiskUsage *du_ = nullptr;
 	QLocale locale_;
-	bool thread_has_quit_ = false;
+	bool done_ = false;
 };
 }
@@ -0,0 +1,246 @@
+#include "DirSizeQueue.hpp"
+
+#include "../App.hpp"
+#include "../io/DirSizeCache.hpp"
+#include "../io/DiskUsage.hpp"
+#include "../io/File.hpp"
+#include "../io/Files.hpp"
+#include "../io/io.hh"
+#include "../MutexGuard.hpp"
+#include "Tab.hpp"
+#include "Table.hpp"
+#include "TableModel.hpp"
+
+#include <QScrollBar>
+#include <QTimer>
+
+#include <algorithm>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace cornus::gui {
+
+/// From linux/ioprio.h, glibc doesn't wrap ioprio_set():
+const int IoprioClassShift = 13;
+const int IoprioClassIdle = 3;
+const int IoprioWhoProcess = 1;
+
+static void LowerPriority()
+{
+	/// On Linux both apply to the calling thread only:
+	const pid_t tid = ::syscall(SYS_gettid);
+	if (::setpriority(PRIO_PROCESS, tid, DirSizeNice) != 0)
+		mtl_status(errno);
+	
+	if (::syscall(SYS_ioprio_set, IoprioWhoProcess, tid,
+		IoprioClassIdle << IoprioClassShift) != 0)
+		mtl_status(errno);
+}
+
+DirSizeQueue::DirSizeQueue(App *app, Table *table): app_(app), table_(table)
+{
+	timer_ = new QTimer(this);
+	timer_->setSingleShot(true);
+	timer_->setInterval(DirSizeDelayMs);
+	connect(timer_, &QTimer::timeout, this, &DirSizeQueue::QueueVisible);
+}
+
+DirSizeQueue::~DirSizeQueue()
+{
+	quit_ = true;
+	Cancel();
+	MutexGuard guard(&mutex_);
+	while (threads_ > 0)
+		pthread_cond_wait(&cond_, &mutex_);
+}
+
+void DirSizeQueue::Cancel()
+{
+	timer_->stop();
+	MutexGuard guard(&mutex_);
+	jobs_.clear();
+	results_.clear();
+	dir_id_ = -1;
+	for (Active &next: active_)
+	{
+		next.cancelled = true;
+		next.du->Cancel();
+	}
+}
+
+void DirSizeQueue::Deliver()
+{
+	QVector<Result> results;
+	{
+		MutexGuard guard(&mutex_);
+		results = std::move(results_);
+		results_.clear();
+		delivery_pending_ = false;
+	}
+	
+	QVector<int> rows;
+	{
+		io::Files &files = table_->tab()->view_files();
+		auto g = files.guard();
+		auto &vec = files.data.vec;
+		for (const Result &result: results)
+		{
+			if (result.dir_id != files.data.dir_id)
+				continue;
+			
+			int row = result.row;
+			if (row < 0 || row >= vec.size() || !(vec[row]->id() == result.id))
+			{
+				/// Sorted again or changed meanwhile:
+				auto same = [&result](io::File *file) { return file->id() == result.id; };
+				auto it = std::find_if(vec.cbegin(), vec.cend(), same);
+				if (it == vec.cend())
+					continue;
+				row = int(it - vec.cbegin());
+			}
+			
+			vec[row]->dir_size(result.size);
+			rows.append(row);
+		}
+	}
+	
+	TableModel *model = table_->model();
+	for (cint row: rows)
+		model->UpdateRange(row, Column::DirSize, row, Column::DirSize);
+}
+
+void DirSizeQueue::QueueVisible()
+{
+	if (table_->isColumnHidden(int(Column::DirSize)))
+	{
+		Cancel();
+		return;
+	}
+	
+	cint row_start = table_->verticalScrollBar()->value() / table_->GetRowHeight();
+	cint row_end = row_start + table_->GetVisibleRowsCount();
+	QVector<Job> jobs;
+	DirId dir_id;
+	{
+		io::Files &files = table_->tab()->view_files();
+		auto g = files.guard();
+		dir_id = files.data.dir_id;
+		auto &vec = files.data.vec;
+		cint count = vec.size();
+		for (int i = row_start; i <= row_end && i < count; i++)
+		{
+			io::File *file = vec[i];
+			if (!file->is_dir() || file->dir_size() != -1)
+				continue;
+			
+			Job job;
+			job.full_path = file->build_full_path();
+			job.id = file->id();
+			job.dir_id = dir_id;
+			job.row = i;
+			jobs.append(job);
+		}
+	}
+	
+	MutexGuard guard(&mutex_);
+	if (dir_id != dir_id_)
+	{
+		/// Still counting folders of the previous listing:
+		for (Active &next: active_)
+		{
+			next.cancelled = true;
+			next.du->Cancel();
+		}
+		dir_id_ = dir_id;
+	}
+	
+	/// The ones which went out of view aren't needed anymore:
+	jobs_.clear();
+	for (const Job &job: jobs)
+	{
+		auto same = [&job](const Active &a) { return !a.cancelled && a.id == job.id; };
+		if (std::none_of(active_.cbegin(), active_.cend(), same))
+			jobs_.append(job);
+	}
+	
+	cint wanted = std::min(DirSizeMaxThreads, int(active_.size() + jobs_.size()));
+	while (threads_ < wanted)
+	{
+		if (!io::NewThread(Work, this))
+			break;
+		threads_++;
+	}
+}
+
+void DirSizeQueue::Schedule()
+{
+	timer_->start();
+}
+
+void* DirSizeQueue::Work(void *p)
+{
+	pthread_detach(pthread_self());
+	DirSizeQueue *queue = (DirSizeQueue*) p;
+	LowerPriority();
+	io::DirSizeCache *cache = &queue->app_->dir_size_cache();
+	
+	while (true)
+	{
+		Job job;
+		io::DiskUsage du(cache);
+		{
+			MutexGuard guard(&queue->mutex_);
+			if (queue->jobs_.isEmpty() || queue->quit_)
+			{
+				queue->threads_--;
+				pthread_cond_broadcast(&queue->cond_);
+				return nullptr;
+			}
+			
+			job = queue->jobs_.takeFirst();
+			Active active;
+			active.du = &du;
+			active.id = job.id;
+			queue->active_.append(active);
+		}
+		
+		cbool done = du.Run(job.full_path);
+		io::CountRecursiveInfo info;
+		du.GetProgress(info);
+		
+		bool deliver = false;
+		{
+			MutexGuard guard(&queue->mutex_);
+			bool cancelled = false;
+			auto &active = queue->active_;
+			for (int i = 0; i < active.size(); i++)
+			{
+				if (active[i].du == &du)
+				{
+					cancelled = active[i].cancelled;
+					active.remove(i);
+					break;
+				}
+			}
+			
+			if (done && !cancelled && job.dir_id == queue->dir_id_)
+			{
+				Result result;
+				result.id = job.id;
+				result.dir_id = job.dir_id;
+				result.row = job.row;
+				/// The folder itself couldn't be opened:
+				result.size = (info.dir_count > 0) ? info.size : -2;
+				queue->results_.append(result);
+				deliver = !queue->delivery_pending_;
+				queue->delivery_pending_ = true;
+			}
+		}
+		
+		if (deliver)
+			QMetaObject::invokeMethod(queue, "Deliver", Qt::QueuedConnection);
+	}
+}
+
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "decl.hxx"
+#include "../decl.hxx"
+#include "../err.hpp"
+#include "../io/decl.hxx"
+
+#include <QObject>
+#include <QString>
+#include <QVector>
+
+#include <atomic>
+#include <pthread.h>
+
+QT_BEGIN_NAMESPACE
+class QTimer;
+QT_END_NAMESPACE
+
+namespace cornus::gui {
+
+/// Waits for scrolling to settle before queueing the folders in view:
+const int DirSizeDelayMs = 200;
+const int DirSizeMaxThreads = 2;
+/// Lowest CPU priority, the idle I/O class is set too:
+const int DirSizeNice = 19;
+
+/** Fills in the details view's "Folder size" column: the folders in view
+are counted one per thread by a small pool of lowest priority threads
+(io::DiskUsage on the io::DirSizeCache shared with "Folder stats"), each
+result is set on its file and its cell repainted as soon as it's ready.
+Scrolling drops the queued folders which went out of view, a new listing
+also stops the ones being counted. Does nothing while the column is
+hidden. */
+class DirSizeQueue: public QObject {
+	Q_OBJECT
+public:
+	DirSizeQueue(App *app, Table *table);
+	virtual ~DirSizeQueue();
+	
+	/// Stops counting, called when another folder gets listed:
+	void Cancel();
+	/// Queues the folders in view after a short delay:
+	void Schedule();
+
+public Q_SLOTS:
+	/// Called by the worker threads when they've got results:
+	void Deliver();
+
+private:
+	NO_ASSIGN_COPY_MOVE(DirSizeQueue);
+	
+	struct Job {
+		QString full_path;
+		io::DiskFileId id = {};
+		DirId dir_id = -1;
+		int row = -1; // where it was, a hint for finding it again
+	};
+	
+	struct Result {
+		io::DiskFileId id = {};
+		DirId dir_id = -1;
+		int row = -1;
+		i64 size = -1;
+	};
+	
+	struct Active {
+		io::DiskUsage *du = nullptr;
+		io::DiskFileId id = {};
+		bool cancelled = false;
+	};
+	
+	void QueueVisible();
+	static void* Work(void *p);
+	
+	App *app_ = nullptr;
+	Table *table_ = nullptr;
+	QTimer *timer_ = nullptr;
+	
+	pthread_mutex_t mutex_ = PTHREAD_MUTEX_INITIALIZER;
+	pthread_cond_t cond_ = PTHREAD_COND_INITIALIZER;
+	QVector<Job> jobs_;
+	QVector<Active> active_;
+	QVector<Result> results_;
+	DirId dir_id_ = -1; // of the listing the jobs are for
+	int threads_ = 0;
+	bool delivery_pending_ = false;
+	std::atomic<bool> quit_ = false;
+};
+
+}
@@ -1,5 +1,8 @@
 #include "Hiliter.hpp"
 
+#include <QTextDocument>
+#include <QTimer>
+
 namespace cornus::gui {
 
 Hiliter::Hiliter(QTextDocument *parent): QSyntaxHighlighter(parent)
@@ -25,6 +28,118 @@ Hiliter::Hiliter(QTextDocument *parent): QSyntaxHighlighter(parent)
 	multiline_comment_format_.setForeground(Qt::blue);
 	comment_start_expression_ = QRegularExpression(QLatin1String("/\\*"));
 	comment_end_expression_ = QRegularExpression(QLatin1String("\\*/"));
+	
+	timer_ = new QTimer(this);
+	timer_->setInterval(0);
+	connect(timer_, &QTimer::timeout, this, &Hiliter::Continue);
+}
+
+void Hiliter::BeginLoad()
+{
+	timer_->stop();
+	loading_ = true;
+}
+
+void Hiliter::BuildScanner()
+{
+	scanner_groups_.clear();
+	scanner_ = QRegularExpression();
+	if (hiliting_rules_.isEmpty())
+		return;
+	
+	/// With alternation the leftmost match wins and at the same spot
+	/// the first alternative. The reverse order keeps the later rule
+	/// winning only when both match at the same spot: unlike applying
+	/// the rules one by one, a match isn't painted over by a later rule
+	/// matching inside it (a quote in a // comment stays a comment).
+	QString pattern;
+	int capture = 1;
+	for (int i = hiliting_rules_.size() - 1; i >= 0;)
+	{
+		const QTextCharFormat &format = hiliting_rules_[i].format;
+		QString alternatives;
+		int inner_captures = 0;
+		for (; i >= 0 && hiliting_rules_[i].format == format; i--)
+		{
+			const QRegularExpression &rule_pattern = hiliting_rules_[i].pattern;
+			if (!alternatives.isEmpty())
+				alternatives.append('|');
+			alternatives.append(QLatin1String("(?:")).append(rule_pattern.pattern()).append(')');
+			inner_captures += rule_pattern.captureCount();
+		}
+		
+		if (!pattern.isEmpty())
+			pattern.append('|');
+		pattern.append('(').append(alternatives).append(')');
+		scanner_groups_.append({capture, format});
+		capture += 1 + inner_captures;
+	}
+	
+	scanner_ = QRegularExpression(pattern);
+	if (!scanner_.isValid())
+	{
+		mtl_warn("%s", qPrintable(scanner_.errorString()));
+		scanner_groups_.clear();
+		return;
+	}
+	
+	scanner_.optimize();
+}
+
+void Hiliter::Continue()
+{
+	QTextDocument *doc = document();
+	if (doc == nullptr)
+	{
+		timer_->stop();
+		return;
+	}
+	
+	ElapsedTimer slice;
+	slice.Continue();
+	work_timer_.Continue();
+	QTextBlock block = doc->findBlockByNumber(next_block_);
+	while (block.isValid() && slice.elapsed_ms() < HiliteSliceMs)
+	{
+		rehighlightBlock(block);
+		block = block.next();
+		next_block_++;
+	}
+	work_timer_.Pause();
+	
+	if (!block.isValid())
+	{
+		timer_->stop();
+		mtl_info("Highlighted \"%s\" (%d blocks) in %ldms", qPrintable(doc_name_),
+			doc->blockCount(), work_timer_.elapsed_ms());
+	}
+}
+
+void Hiliter::EndLoad(const QString &doc_name)
+{
+	loading_ = false;
+	doc_name_ = doc_name;
+	next_block_ = 0;
+	work_timer_.Continue(Reset::Yes);
+	work_timer_.Pause();
+	if (has_rules())
+		timer_->start();
+}
+
+void Hiliter::HighlightVisible(const QTextBlock &first, const QTextBlock &last)
+{
+	if (!timer_->isActive())
+		return;
+	
+	work_timer_.Continue();
+	for (QTextBlock block = first; block.isValid(); block = block.next())
+	{
+		if (block.blockNumber() >= next_block_)
+			rehighlightBlock(block);
+		if (block == last)
+			break;
+	}
+	work_timer_.Pause();
 }
 
 void Hiliter::SetupAssemblyNasm()
@@ -136,17 +251,29 @@ void Hiliter::SetupAssemblyNasm()
 
 void Hiliter::highlightBlock(const QString &text)
 {
-	for (const HighlightingRule &rule : std::as_const(hiliting_rules_))
+	/// Most blocks end up in state 0, so when they're really highlighted
+	/// later on the change of state doesn't drag in all the next blocks:
+	setCurrentBlockState(0);
+	if (loading_)
+		return;
+	
+	if (!scanner_groups_.isEmpty())
 	{
-		QRegularExpressionMatchIterator matchIterator = rule.pattern.globalMatch(text);
-		while (matchIterator.hasNext()) {
-			QRegularExpressionMatch match = matchIterator.next();
-			setFormat(match.capturedStart(), match.capturedLength(), rule.format);
+		QRegularExpressionMatchIterator it = scanner_.globalMatch(text);
+		while (it.hasNext())
+		{
+			const QRegularExpressionMatch match = it.next();
+			for (const ScannerGroup &group: std::as_const(scanner_groups_))
+			{
+				if (match.capturedStart(group.capture) != -1)
+				{
+					setFormat(match.capturedStart(), match.capturedLength(), group.format);
+					break;
+				}
+			}
 		}
 	}
 	
-	setCurrentBlockState(0);
-	
 	if (mode_ == HiliteMode::C_CPP) {
 		
 		int startIndex = 0;
@@ -340,6 +467,7 @@ void Hiliter::SwitchTo(const HiliteMode mode)
 {
 	mode_ = mode;
 	hiliting_rules_.clear();
+	timer_->stop();
 	
 	switch (mode) {
 	case HiliteMode::PlainText: SetupPlainText(); break;
@@ -349,6 +477,8 @@ void Hiliter::SwitchTo(const HiliteMode mode)
 	case HiliteMode::Assembly_NASM: SetupAssemblyNasm(); break;
 	default: SetupPlainText();
 	}
+	
+	BuildScanner();
 }
 
 }
@@ -1,17 +1,30 @@
 #pragma once
 
 #include <QSyntaxHighlighter>
+#include <QTextBlock>
 #include <QTextCharFormat>
 #include <QRegularExpression>
 
 #include "decl.hxx"
+#include "../ElapsedTimer.hpp"
 
 QT_BEGIN_NAMESPACE
 class QTextDocument;
+class QTimer;
 QT_END_NAMESPACE
 
 namespace cornus::gui {
 
+/// How long a background highlighting step may block the GUI thread:
+const int HiliteSliceMs = 8;
+
+/** The rules of a mode get combined into one precompiled regex (a
+capture group per run of rules with the same format) so that a block
+gets scanned once instead of once per rule. Matches don't overlap, the
+one that starts first gets its format. A newly loaded document
+isn't highlighted in one go: between BeginLoad() and EndLoad() blocks
+are only given a state, then the visible blocks get highlighted first
+and the rest in HiliteSliceMs steps from an idle timer. */
 class Hiliter : public QSyntaxHighlighter
 {
 	Q_OBJECT
@@ -19,6 +32,10 @@ class Hiliter : public QSyntaxHighlighter
 public:
 	Hiliter(QTextDocument *parent = 0);
 	
+	void BeginLoad();
+	void EndLoad(const QString &doc_name);
+	/// Highlights the blocks the background pass hasn't gotten to yet.
+	void HighlightVisible(const QTextBlock &first, const QTextBlock &last);
 	void SwitchTo(const HiliteMode mode);
 	
 protected:
@@ -26,6 +43,9 @@ protected:
 	
 private:
 	
+	void BuildScanner();
+	void Continue();
+	bool has_rules() const { return !scanner_groups_.isEmpty() || mode_ == HiliteMode::C_CPP; }
 	void SetupAssemblyNasm();
 	void SetupC_CPP();
 	void SetupDesktopFile();
@@ -40,6 +60,14 @@ private:
 	
 	QVector<HighlightingRule> hiliting_rules_;
 	
+	struct ScannerGroup {
+		int capture = -1;
+		QTextCharFormat format;
+	};
+	
+	QRegularExpression scanner_;
+	QVector<ScannerGroup> scanner_groups_;
+	
 	QRegularExpression comment_start_expression_;
 	QRegularExpression comment_end_expression_;
 	
@@ -54,6 +82,12 @@ private:
 
 	QTextCharFormat multiline_comment_format_;
 	HiliteMode mode_ = HiliteMode::None;
+	
+	QTimer *timer_ = nullptr;
+	ElapsedTimer work_timer_;
+	QString doc_name_;
+	int next_block_ = 0; // of the background pass
+	bool loading_ = false;
 };
 
 } // cornus::gui
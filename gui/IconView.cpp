@@ -7,6 +7,8 @@
 #include "../io/Files.hpp"
 #include "../Prefs.hpp"
 #include "RestorePainter.hpp"
+#include "../startup.hh"
+#include "../ThumbnailPrefetcher.hpp"
 #include "Tab.hpp"
 #include "Table.hpp"
 
@@ -24,12 +26,12 @@
 
 namespace cornus::gui {
 
-cint MaxImgW = 512;
-cint MaxImgH = 512;
+/// Ready to blit thumbnails, a screenful of big cells is a few MiB:
+cint DisplayCacheKiB = 64 * 1024;
 
 inline ThumbLoaderArgs* ThumbLoaderArgsFromFile(Tab *tab,
 	io::File *file, const DirId dir_id,
-	cint max_img_w, cint max_img_h)
+	cint max_img_w, cint max_img_h, const IconDim &cell, cf64 dpr)
 {
 	ThumbLoaderArgs *p = new ThumbLoaderArgs();
 	p->app = tab->app();
@@ -42,6 +44,9 @@ inline ThumbLoaderArgs* ThumbLoaderArgsFromFile(Tab *tab,
 	p->dir_id = dir_id;
 	p->icon_w = max_img_w;
 	p->icon_h = max_img_h;
+	p->display_w = cell.w_and_gaps;
+	p->display_h = cell.h_and_gaps - cell.text_h;
+	p->dpr = dpr;
 	
 	return p;
 }
@@ -57,6 +62,17 @@ IconView::IconView(App *app, Tab *tab, QScrollBar *vs):
 IconView::~IconView()
 {}
 
+int IconView::CellsPerScreen() const
+{
+	const IconDim &cell = icon_dim_;
+	if (cell.rh <= 0)
+		return -1;
+	
+	/// A partially visible row at the top and at the bottom:
+	cint rows = int(std::ceil(height() / cell.rh)) + 1;
+	return rows * cell.per_row;
+}
+
 int IconView::CellIndexInNextRow(cint file_index, const VDirection vdir)
 {
 	cint file_count = tab_->view_files().cached_files_count;
@@ -189,37 +205,86 @@ DrawBorder IconView::DrawThumbnail(io::File *file, QPainter &painter,
 	cauto &cell = icon_dim_;
 	cauto max_img_h = cell.h_and_gaps - cell.text_h;
 	cauto max_img_w = cell.w_and_gaps;
+	cf64 dpr = devicePixelRatioF();
 	
 	has_icon = true;
-	QPixmap pixmap;
-	if (file->thumbnail())
+	const Thumbnail *thumbnail = file->thumbnail();
+	QIcon *icon = nullptr;
+	f64 pic_w = sz.width(), pic_h = sz.height();
+	if (thumbnail != nullptr && !thumbnail->img.isNull())
 	{
-		pixmap = QPixmap::fromImage(file->thumbnail()->img);
+		pic_w = thumbnail->img.width();
+		pic_h = thumbnail->img.height();
 	} else {
-		QIcon *icon = app_->GetFileIcon(file);
-		
+		thumbnail = nullptr;
+		icon = app_->GetFileIcon(file);
 		if (icon) {
-			pixmap = icon->pixmap(sz);
+			/// Only the aspect ratio is needed here, the icon's natural one:
+			const QSize actual = icon->actualSize(sz);
+			if (!actual.isEmpty()) {
+				pic_w = actual.width();
+				pic_h = actual.height();
+			}
 		} else {
 			has_icon = false;
 		}
 	}
 	
-	cf64 pic_w = (has_icon) ? pixmap.width() : sz.width();
-	cf64 pic_h = (has_icon) ? pixmap.height() : sz.height();
 	double scaled_w, scaled_h;
 	cf64 scale_ratio = std::max(pic_w / max_img_w, pic_h / max_img_h);
 	scaled_w = pic_w / scale_ratio;
 	scaled_h = pic_h / scale_ratio;
 	
 	cauto img_x = x + (max_img_w - scaled_w) / 2;
-	cint off = 10;
-	bounding_rect = QRect(img_x + off, y + off, scaled_w - off*2, scaled_h - off*2);
+	cint off = thumbnail::DisplayMargin;
+	bounding_rect = QRect(QPoint(img_x + off, y + off),
+		thumbnail::DisplaySize(pic_w, pic_h, max_img_w, max_img_h));
+	if (!has_icon || bounding_rect.isEmpty())
+		return DrawBorder::Yes;
+	
+	/// Both caches hand out pixmaps of exactly bounding_rect's size (in
+	/// device pixels), so drawPixmap() below is a plain blit.
+	const QPixmap pixmap = (thumbnail != nullptr)
+		? GetDisplayPixmap(*thumbnail, bounding_rect.size(), dpr)
+		: app_->icons().GetPixmap(*icon, bounding_rect.size(), dpr);
 	painter.drawPixmap(bounding_rect, pixmap);
 	
 	return DrawBorder::Yes;
 }
 
+QPixmap IconView::GetDisplayPixmap(const Thumbnail &thumbnail, const QSize &sz, cf64 dpr)
+{
+	const QSize device_sz = sz * dpr;
+	/// display_img was made for another zoom or screen (or not at all),
+	/// draw a fast scaled one until the workers make it again:
+	cbool ready = (thumbnail.display_img.size() == device_sz);
+	if (!ready)
+		display_rescale_needed_ = true;
+	
+	const QImage &img = ready ? thumbnail.display_img : thumbnail.img;
+	IconPixmapKey key;
+	key.icon_key = img.cacheKey();
+	key.w = sz.width();
+	key.h = sz.height();
+	key.dpr_x100 = qRound(dpr * 100);
+	
+	QPixmap *found = display_cache_.object(key);
+	if (found != nullptr)
+	{
+		paint_stats_.hits++;
+		return *found;
+	}
+	
+	paint_stats_.misses++;
+	QPixmap pixmap = ready ? QPixmap::fromImage(img) : QPixmap::fromImage(
+		img.scaled(device_sz, Qt::IgnoreAspectRatio, Qt::FastTransformation));
+	pixmap.setDevicePixelRatio(dpr);
+	cint cost_kib = std::max<i64>(1, (i64(pixmap.width()) * pixmap.height() * 4) / 1024);
+	display_cache_.insert(key, new QPixmap(pixmap), cost_kib);
+	
+	return pixmap;
+}
+
 void IconView::DisplayingNewDirectory(const DirId dir_id, const Reload r)
 {
 	if (last_cancelled_except_ != dir_id)
@@ -227,6 +292,7 @@ void IconView::DisplayingNewDirectory(const DirId dir_id, const Reload r)
 		last_cancelled_except_ = dir_id;
 		app_->RemoveAllThumbTasksExcept(dir_id);
 	}
+	display_rescale_sent_.clear();
 	
 	if (is_current_view())
 	{
@@ -264,11 +330,15 @@ void IconView::HiliteFileUnderMouse()
 	if (mouse_over_file_ != -1)
 		indices.insert(mouse_over_file_);
 	
+	QString dir_path;
 	{
 		io::Files &files = tab_->view_files();
 		MutexGuard guard = files.guard();
-		GetFileAt_NoLock(mouse_pos_, Clone::No, &mouse_over_file_);
+		io::File *file = GetFileAt_NoLock(mouse_pos_, Clone::No, &mouse_over_file_);
+		if (file != nullptr && file->is_dir_or_so())
+			dir_path = file->build_full_path();
 	}
+	app_->thumbnail_prefetcher()->Hovered(dir_path);
 	
 	if (mouse_over_file_ != -1 && !indices.contains(mouse_over_file_))
 		indices.insert(mouse_over_file_);
@@ -278,6 +348,7 @@ void IconView::HiliteFileUnderMouse()
 
 void IconView::Init()
 {
+	display_cache_.setMaxCost(DisplayCacheKiB);
 	setFocusPolicy(Qt::WheelFocus);
 	
 	// enables receiving ordinary mouse events (when mouse is not down)
@@ -359,6 +430,7 @@ void IconView::keyReleaseEvent(QKeyEvent *evt)
 
 void IconView::leaveEvent(QEvent *evt)
 {
+	app_->thumbnail_prefetcher()->Hovered(QString());
 	ClearMouseOver();
 	UpdateIndex(mouse_over_file_);
 }
@@ -447,6 +519,8 @@ void IconView::mouseReleaseEvent(QMouseEvent *evt)
 void IconView::paintEvent(QPaintEvent *ev)
 {
 	last_repaint_.Continue(Reset::Yes);
+	ElapsedTimer paint_timer;
+	paint_timer.Continue();
 	
 	static bool first_time = true;
 	if (first_time)
@@ -462,6 +536,16 @@ void IconView::paintEvent(QPaintEvent *ev)
 	auto clear_r = QRect(0, 0, width(), height());
 	painter.fillRect(clear_r, option.palette.brush(QPalette::Base));
 	ComputeProportions(icon_dim_);
+	{ /// Zoom or screen change, the cached pixmaps have the wrong size:
+		cf64 dpr = devicePixelRatioF();
+		if (display_cache_cell_w_ != icon_dim_.w_and_gaps || display_cache_dpr_ != dpr)
+		{
+			display_cache_.clear();
+			display_rescale_sent_.clear();
+			display_cache_cell_w_ = icon_dim_.w_and_gaps;
+			display_cache_dpr_ = dpr;
+		}
+	}
 	cf64 scroll_y = vs_->value();
 	cauto &cell = icon_dim_; // to make sure I don't change any value
 	cint at_row = scroll_y / cell.rh;
@@ -484,6 +568,9 @@ void IconView::paintEvent(QPaintEvent *ev)
 	io::Files &files = tab_->view_files();
 	files.Lock();
 	const QSize img_sz(256, 256);
+	const DirId dir_id = files.data.dir_id;
+	cint first_visible = file_index;
+	int pending_thumbnails = 0;
 	
 	for (double y = y_off; y < y_end; y += cell.rh)
 	{
@@ -516,6 +603,10 @@ void IconView::paintEvent(QPaintEvent *ev)
 					painter.fillRect(cell_r, c);
 				}
 				
+				/// Painting has no side effects, the thumbnails already in
+				/// ThumbnailCache are picked when the batch is sent.
+				if (app_->ThumbnailPending(file, tab_->view_mode(), ViewMode::Icons))
+					pending_thumbnails++;
 				QRect bounding_rect;
 				draw_border = DrawThumbnail(file, painter, x, y, img_sz, has_icon, bounding_rect);
 				const Thumbnail *thmb = file->thumbnail();
@@ -576,6 +667,37 @@ void IconView::paintEvent(QPaintEvent *ev)
 	
 	if (tab_->magnified())
 		tab_->PaintMagnified(this, option);
+	
+	UpdateThumbnailViewport(dir_id, first_visible, file_index - 1, pending_thumbnails);
+	startup::MarkFirstPaint();
+	
+	if (display_rescale_needed_)
+	{
+		display_rescale_needed_ = false;
+		QTimer::singleShot(0, this, &IconView::SendDisplayRescale);
+	}
+	
+	paint_stats_.last_frame_mc = paint_timer.elapsed_mc();
+	if (app_->prefs().show_ms_files_loaded())
+		DrawPaintStats(painter);
+}
+
+void IconView::DrawPaintStats(QPainter &painter)
+{
+	/// The time of this frame up to here, drawing the stats isn't included.
+	const QString s = QString("paint %1 ms, cache %2/%3 hit/miss, %4 KiB")
+		.arg(double(paint_stats_.last_frame_mc) / 1000.0, 0, 'f', 2)
+		.arg(paint_stats_.hits).arg(paint_stats_.misses)
+		.arg(display_cache_.totalCost());
+	const QFontMetrics fm = fontMetrics();
+	QRect r = fm.boundingRect(s);
+	r.adjust(-4, -2, 4, 2);
+	r.moveTopRight(QPoint(width() - 4, 4));
+	painter.fillRect(r, QColor(0, 0, 0, 160));
+	QPen saved_pen = painter.pen();
+	painter.setPen(Qt::white);
+	painter.drawText(r, Qt::AlignCenter, s);
+	painter.setPen(saved_pen);
 }
 
 void IconView::RepaintLater(cint custom_ms)
@@ -660,20 +782,30 @@ void IconView::SendLoadingNewThumbnailsBatch()
 		const DirId dir_id = files.data.dir_id;
 	files.Unlock();
 	
+	IconDim cell = {};
+	ComputeProportions(cell);
+	cf64 dpr = devicePixelRatioF();
 	QVector<ThumbLoaderArgs*> *work_stack = new QVector<ThumbLoaderArgs*>();
 	{
 		auto g = files.guard();
-		for (io::File *file: files.data.vec)
+		auto &vec = files.data.vec;
+		cint count = vec.size();
+		for (int i = 0; i < count; i++)
 		{
+			io::File *file = vec[i];
 			if (!app_->ShouldLoadThumbnailFor(file, tab_->view_mode(), ViewMode::Icons)) {
 				continue;
 			}
-			auto *arg = ThumbLoaderArgsFromFile(tab_, file, dir_id, MaxImgW, MaxImgH);
+			auto *arg = ThumbLoaderArgsFromFile(tab_, file, dir_id,
+				thumbnail::MaxImgW, thumbnail::MaxImgH, cell, dpr);
+			arg->file_index = i;
 			work_stack->append(arg);
 		}
 	}
 	
 	app_->SubmitThumbLoaderBatchFromTab(work_stack, tab_->id(), dir_id);
+	/// the new batch must be ordered by what's on screen again:
+	thumb_viewport_ = {};
 }
 
 void IconView::SendLoadingNewThumbnail(io::File *cloned_file)
@@ -689,10 +821,54 @@ void IconView::SendLoadingNewThumbnail(io::File *cloned_file)
 	MTL_CHECK_VOID(files.Lock());
 	const DirId dir_id = files.data.dir_id;
 	files.Unlock();
-	auto *arg = ThumbLoaderArgsFromFile(tab_, cloned_file, dir_id, MaxImgW, MaxImgH);
+	IconDim cell = {};
+	ComputeProportions(cell);
+	auto *arg = ThumbLoaderArgsFromFile(tab_, cloned_file, dir_id,
+		thumbnail::MaxImgW, thumbnail::MaxImgH, cell, devicePixelRatioF());
 	app_->SubmitThumbLoaderFromTab(arg);
 }
 
+void IconView::SendDisplayRescale()
+{
+	const ThumbViewport &vp = thumb_viewport_;
+	if (!is_current_view() || vp.visible_last < vp.visible_first)
+		return;
+	
+	IconDim cell = {};
+	ComputeProportions(cell);
+	cf64 dpr = devicePixelRatioF();
+	cf64 max_img_w = cell.w_and_gaps;
+	cf64 max_img_h = cell.h_and_gaps - cell.text_h;
+	auto &files = tab_->view_files();
+	auto g = files.guard();
+	if (files.data.dir_id != vp.dir_id)
+		return;
+	
+	/// The workers take it from ThumbnailCache (or load it again)
+	/// and the new one replaces the file's thumbnail when it arrives:
+	auto &vec = files.data.vec;
+	cint last = std::min(vp.visible_last, int(vec.size()) - 1);
+	for (int i = vp.visible_first; i <= last; i++)
+	{
+		io::File *file = vec[i];
+		const Thumbnail *thumbnail = file->thumbnail();
+		if (thumbnail == nullptr || thumbnail->img.isNull())
+			continue;
+		
+		const QSize sz = thumbnail::DisplaySize(thumbnail->img.width(),
+			thumbnail->img.height(), max_img_w, max_img_h);
+		if (sz.isEmpty() || thumbnail->display_img.size() == sz * dpr ||
+			display_rescale_sent_.contains(file->id_num()))
+			continue;
+		
+		display_rescale_sent_.insert(file->id_num());
+		auto *arg = ThumbLoaderArgsFromFile(tab_, file, vp.dir_id,
+			thumbnail::MaxImgW, thumbnail::MaxImgH, cell, dpr);
+		arg->file_index = i;
+		app_->SubmitThumbLoaderFromTab(arg);
+	}
+}
+
 void IconView::SetViewState(const NewState ns)
 {
 	if (ns == NewState::AboutToSet)
@@ -729,6 +905,38 @@ void IconView::UpdateFileIndexRange(cint start, cint end)
 	update();
 }
 
+void IconView::UpdateThumbnailViewport(const DirId dir_id, cint first,
+	cint last, cint pending_thumbnails)
+{
+	if (last < first)
+		return;
+	
+	ThumbViewport &vp = thumb_viewport_;
+	if (vp.dir_id != dir_id || vp.visible_first != first || vp.visible_last != last)
+	{
+		cint count = last - first + 1;
+		vp.tab_id = tab_->id();
+		vp.dir_id = dir_id;
+		vp.visible_first = first;
+		vp.visible_last = last;
+		vp.prefetch_first = std::max(0, first - count);
+		vp.prefetch_last = last + count * ThumbPrefetchScreens;
+		app_->PrioritizeThumbnails(vp);
+		
+		ttv_pending_ = pending_thumbnails > 0;
+		if (ttv_pending_)
+			ttv_timer_.Continue(Reset::Yes);
+		return;
+	}
+	
+	if (ttv_pending_ && pending_thumbnails == 0)
+	{
+		ttv_pending_ = false;
+		if (app_->prefs().show_ms_files_loaded())
+			mtl_info("Visible thumbnails ready in %ld ms", ttv_timer_.elapsed_ms());
+	}
+}
+
 void IconView::UpdateScrollRange()
 {
 	ComputeProportions(icon_dim_);
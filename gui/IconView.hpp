@@ -5,6 +5,8 @@
 #include "../err.hpp"
 #include "../io/io.hh"
 #include "../ElapsedTimer.hpp"
+#include "../Icons.hpp"
+#include "../thumbnail.hh"
 
 #include <cmath>
 
@@ -12,6 +14,9 @@ QT_BEGIN_NAMESPACE
 class QScrollBar;
 QT_END_NAMESPACE
 
+#include <QCache>
+#include <QPixmap>
+#include <QSet>
 #include <QWidget>
 
 #include <chrono>
@@ -42,6 +47,12 @@ struct IconDim {
 	int row_count = -1;
 };
 
+struct PaintStats {
+	i64 last_frame_mc = 0;
+	i64 hits = 0;
+	i64 misses = 0;
+};
+
 struct Last {
 	int file_count = -1;
 	int row_count = -1;
@@ -66,6 +77,8 @@ public:
 	QSize minimumSize() const { return size(); }
 	QSize maximumSize() const { return size(); }
 	int CellIndexInNextRow(const int file_index, const VDirection vdir);
+	/// How many cells fit on the screen, -1 before the first paint.
+	int CellsPerScreen() const;
 	void SendLoadingNewThumbnailsBatch();
 	void SendLoadingNewThumbnail(io::File *cloned_file);
 	void SetViewState(const NewState ns);
@@ -110,10 +123,15 @@ private:
 	void ClearMouseOver();
 	void ComputeProportions(IconDim &dim) const;
 	void DelayedRepaint();
+	void DrawPaintStats(QPainter &painter);
 	DrawBorder DrawThumbnail(io::File *file, QPainter &painter, double x,
 							 double y, QSize sz, bool &has_icon, QRect &bounding_rect);
+	QPixmap GetDisplayPixmap(const Thumbnail &thumbnail, const QSize &sz, const f64 dpr);
 	void Init();
+	void SendDisplayRescale();
 	void UpdateScrollRange();
+	void UpdateThumbnailViewport(const DirId dir_id, cint first,
+		cint last, cint pending_thumbnails);
 	
 	App *app_ = nullptr;
 	Tab *tab_ = nullptr;
@@ -129,6 +147,21 @@ private:
 	int scroll_page_step_ = -1;
 	DirId last_cancelled_except_ = -1;
 	ShiftSelect shift_select_ = {};
+	ThumbViewport thumb_viewport_ = {};
+	/// time-to-visible-thumbnails, from the moment the visible cells
+	/// changed until all of them got their thumbnails:
+	ElapsedTimer ttv_timer_;
+	bool ttv_pending_ = false;
+	/// Thumbnails converted and scaled to their on-screen size once,
+	/// keyed by QImage::cacheKey() + size + dpr, emptied on zoom change:
+	QCache<IconPixmapKey, QPixmap> display_cache_;
+	f64 display_cache_cell_w_ = -1;
+	f64 display_cache_dpr_ = -1;
+	/// Painted ones whose display_img doesn't match the current zoom
+	/// get it made again by the workers, once per zoom and listing:
+	QSet<u64> display_rescale_sent_;
+	bool display_rescale_needed_ = false;
+	PaintStats paint_stats_ = {};
 	
 	bool mouse_down_ = false;
 	QPoint drop_coord_ = {-1, -1};
@@ -0,0 +1,601 @@
+#include "LargeFileView.hpp"
+
+#include "../App.hpp"
+#include "../AutoDelete.hh"
+#include "../io/File.hpp"
+#include "../io/io.hh"
+#include "../MutexGuard.hpp"
+
+#include <QFontMetrics>
+#include <QKeyEvent>
+#include <QPainter>
+#include <QScrollBar>
+#include <QSocketNotifier>
+#include <QTimer>
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace cornus::gui {
+
+/// How much the indexing thread scans between publishing its progress:
+static const i64 IndexChunkSize = 8 * 1024 * 1024;
+static const int IndexProgressMs = 100;
+/// What painting reads at once, enough for the visible lines usually:
+static const i64 PaintReadSize = 64 * 1024;
+/// A rotated log gets recreated a moment after the old one is renamed:
+static const int ReopenTries = 10;
+static const int ReopenRetryMs = 500;
+
+bool FileWindow::Cover(cint fd, ci64 pos, ci64 end)
+{
+	ci64 needed_to = std::min(end, pos + LargeFileMaxLineBytes);
+	if (pos >= from && needed_to <= to())
+		return true;
+	
+	ci64 size = std::min(end - pos, std::max(read_size, LargeFileMaxLineBytes));
+	buf.resize(size);
+	from = pos;
+	i64 done = 0;
+	while (done < size)
+	{
+		cisize count = ::pread(fd, buf.data() + done, size - done, pos + done);
+		if (count == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			mtl_status(errno);
+			break;
+		}
+		if (count == 0)
+			break;
+		done += count;
+	}
+	buf.resize(done);
+	
+	return to() >= needed_to;
+}
+
+/// Where the line at @pos ends (past its '\n'), or -1 if it's the
+/// unterminated tail of the file. Cover() must have been called.
+i64 FileWindow::NextLineStart(ci64 pos, ci64 end) const
+{
+	ci64 limit = std::min(end, pos + LargeFileMaxLineBytes);
+	const char *nl = (const char*) memchr(at(pos), '\n', limit - pos);
+	if (nl != nullptr)
+		return from + (nl - buf.constData()) + 1;
+	
+	return (limit - pos == LargeFileMaxLineBytes) ? limit : -1;
+}
+
+static void* IndexLines(void *p)
+{
+	pthread_detach(pthread_self());
+	LineIndex *index = (LineIndex*) p;
+	int fd;
+	i64 pos, end, line;
+	{
+		MutexGuard guard(&index->mutex);
+		fd = index->fd;
+		pos = index->indexed_to;
+		end = index->size;
+		line = index->line_count;
+	}
+	
+	FileWindow window;
+	window.read_size = IndexChunkSize + LargeFileMaxLineBytes;
+	QVector<i64> checkpoints;
+	bool done = false;
+	while (!done && pos < end)
+	{
+		ci64 chunk_end = std::min(end, pos + IndexChunkSize);
+		while (pos < chunk_end)
+		{
+			/// Truncated meanwhile, FileChanged() starts over:
+			if (!window.Cover(fd, pos, end))
+			{
+				done = true;
+				break;
+			}
+			
+			ci64 next = window.NextLineStart(pos, end);
+			if (next == -1)
+			{
+				done = true;
+				break;
+			}
+			
+			line++;
+			if ((line % LargeFileLinesPerCheckpoint) == 0)
+				checkpoints.append(next);
+			pos = next;
+		}
+		
+		{
+			MutexGuard guard(&index->mutex);
+			index->checkpoints.append(checkpoints);
+			index->line_count = line;
+			index->indexed_to = pos;
+			if (index->cancel)
+				done = true;
+		}
+		checkpoints.clear();
+	}
+	
+	MutexGuard guard(&index->mutex);
+	index->running = false;
+	guard.Signal(&index->cond);
+	
+	return nullptr;
+}
+
+LargeFileView::LargeFileView(App *app): app_(app)
+{
+	setFocusPolicy(Qt::StrongFocus);
+	
+	QFont font;
+	font.setFamily(QLatin1String("Hack"));
+	font.setFixedPitch(true);
+	font.setPointSize(13);
+	setFont(font);
+	
+	QFontMetrics fm(font);
+	line_h_ = std::max(1, fm.lineSpacing());
+	char_w_ = std::max(1, fm.horizontalAdvance(QChar(' ')));
+	ascent_ = fm.ascent();
+	window_.read_size = PaintReadSize;
+	
+	progress_timer_ = new QTimer(this);
+	progress_timer_->setInterval(IndexProgressMs);
+	connect(progress_timer_, &QTimer::timeout, this, &LargeFileView::IndexProgress);
+}
+
+LargeFileView::~LargeFileView()
+{
+	Close();
+}
+
+void LargeFileView::AskGoTo()
+{
+	gui::InputDialogParams params;
+	params.title = tr("Go To");
+	params.msg = tr("Line number, or @ and a byte offset:");
+	params.placeholder_text = QLatin1String("1000 or @0x1f400");
+	
+	QString ret_val;
+	if (!app_->ShowInputDialog(params, ret_val))
+		return;
+	
+	ret_val = ret_val.trimmed();
+	bool ok = false;
+	if (ret_val.startsWith('@'))
+	{
+		ci64 offset = ret_val.mid(1).toLongLong(&ok, 0);
+		if (ok)
+			GoToOffset(offset);
+	} else {
+		ci64 line = ret_val.toLongLong(&ok);
+		if (ok)
+			GoToLine(line - 1);
+	}
+}
+
+void LargeFileView::Close()
+{
+	StopIndexing();
+	progress_timer_->stop();
+	
+	if (notifier_ != nullptr)
+	{
+		/// Might be called from its own signal:
+		notifier_->setEnabled(false);
+		notifier_->deleteLater();
+		notifier_ = nullptr;
+	}
+	
+	if (inotify_fd_ != -1)
+	{
+		::close(inotify_fd_);
+		inotify_fd_ = -1;
+	}
+	
+	window_.Clear();
+	file_size_ = 0;
+	
+	if (fd_ != -1)
+	{
+		::close(fd_);
+		fd_ = -1;
+	}
+	
+	index_.fd = -1;
+	index_.size = 0;
+	index_.checkpoints.clear();
+	index_.line_count = 0;
+	index_.indexed_to = 0;
+	shown_lines_ = 0;
+	grown_ = false;
+}
+
+bool LargeFileView::Display(io::File *cloned_file)
+{
+	AutoDelete ad(cloned_file);
+	MTL_CHECK(!cloned_file->is_dir_or_so());
+	
+	Close();
+	full_path_ = cloned_file->build_full_path();
+	follow_ = false;
+	MTL_CHECK(Open());
+	
+	verticalScrollBar()->setValue(0);
+	horizontalScrollBar()->setValue(0);
+	UpdateScrollBars();
+	viewport()->update();
+	
+	return true;
+}
+
+void LargeFileView::FileChanged()
+{
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	u32 mask = 0;
+	isize count;
+	while ((count = ::read(inotify_fd_, buf, sizeof buf)) > 0)
+	{
+		isize at = 0;
+		while (at < count)
+		{
+			auto *ev = (const struct inotify_event*) (buf + at);
+			mask |= ev->mask;
+			at += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+	
+	struct stat st;
+	if (::fstat(fd_, &st) != 0)
+	{
+		mtl_status(errno);
+		return;
+	}
+	
+	/// Both the watch and fd_ stay with the old inode when the file is
+	/// renamed or unlinked (log rotation), the path is followed instead:
+	if ((mask & (IN_MOVE_SELF | IN_DELETE_SELF)) || st.st_nlink == 0)
+	{
+		Reopen(ReopenTries);
+		return;
+	}
+	
+	if (st.st_size < file_size_)
+	{
+		/// Truncated in place (copytruncate log rotation), start over:
+		Reopen(0);
+		return;
+	}
+	
+	if (st.st_size == file_size_)
+		return;
+	
+	{
+		MutexGuard guard(&index_.mutex);
+		if (index_.running)
+		{
+			/// The thread indexes up to the old size, picked up once it's done:
+			grown_ = true;
+			return;
+		}
+	}
+	
+	file_size_ = st.st_size;
+	{
+		MutexGuard guard(&index_.mutex);
+		index_.size = file_size_;
+	}
+	StartIndexing();
+}
+
+void LargeFileView::GoToLine(ci64 line)
+{
+	follow_ = false;
+	auto *vs = verticalScrollBar();
+	vs->setValue(int(std::clamp(line, i64(0), i64(vs->maximum()))));
+}
+
+void LargeFileView::GoToOffset(ci64 offset)
+{
+	i64 line, pos, end, line_count;
+	{
+		MutexGuard guard(&index_.mutex);
+		const auto &cps = index_.checkpoints;
+		if (cps.isEmpty())
+			return;
+		auto it = std::upper_bound(cps.begin(), cps.end(), offset);
+		ci64 k = std::max(i64(0), i64(it - cps.begin()) - 1);
+		line = k * LargeFileLinesPerCheckpoint;
+		pos = cps[k];
+		end = index_.size;
+		line_count = index_.line_count;
+	}
+	
+	while (line < line_count)
+	{
+		if (!window_.Cover(fd_, pos, end))
+			break;
+		ci64 next = window_.NextLineStart(pos, end);
+		if (next > offset)
+			break;
+		pos = next;
+		line++;
+	}
+	
+	GoToLine(line);
+}
+
+void LargeFileView::IndexProgress()
+{
+	bool running;
+	{
+		MutexGuard guard(&index_.mutex);
+		running = index_.running;
+	}
+	
+	UpdateScrollBars();
+	viewport()->update();
+	
+	if (!running)
+	{
+		progress_timer_->stop();
+		if (grown_)
+		{
+			grown_ = false;
+			FileChanged();
+		}
+	}
+}
+
+void LargeFileView::keyPressEvent(QKeyEvent *evt)
+{
+	const auto key = evt->key();
+	const auto modifiers = evt->modifiers();
+	cbool ctrl = modifiers & Qt::ControlModifier;
+	
+	if (key == Qt::Key_Escape) {
+		Close();
+		app_->SetTopLevel(TopLevel::Browser);
+	} else if (ctrl && key == Qt::Key_G) {
+		AskGoTo();
+	} else if (key == Qt::Key_F && modifiers == Qt::NoModifier) {
+		follow_ = !follow_;
+		if (follow_)
+			verticalScrollBar()->setValue(verticalScrollBar()->maximum());
+	} else if (key == Qt::Key_Home) {
+		GoToLine(0);
+	} else if (key == Qt::Key_End) {
+		GoToLine(total_lines());
+	} else {
+		QAbstractScrollArea::keyPressEvent(evt);
+	}
+}
+
+i64 LargeFileView::LineOffset(ci64 line)
+{
+	i64 pos, skip, end;
+	{
+		MutexGuard guard(&index_.mutex);
+		if (line < 0 || line > index_.line_count)
+			return -1;
+		
+		if (line == index_.line_count)
+		{
+			cbool has_tail = !index_.running && index_.indexed_to < index_.size;
+			return has_tail ? index_.indexed_to : -1;
+		}
+		
+		pos = index_.checkpoints[line / LargeFileLinesPerCheckpoint];
+		skip = line % LargeFileLinesPerCheckpoint;
+		end = index_.size;
+	}
+	
+	/// These lines are indexed, so each of them ends with a break:
+	for (i64 i = 0; i < skip; i++)
+	{
+		if (!window_.Cover(fd_, pos, end))
+			return -1;
+		pos = window_.NextLineStart(pos, end);
+	}
+	
+	return pos;
+}
+
+bool LargeFileView::Open()
+{
+	auto ba = full_path_.toLocal8Bit();
+	fd_ = ::open(ba.data(), O_RDONLY | O_CLOEXEC);
+	if (fd_ == -1)
+	{
+		mtl_status(errno);
+		return false;
+	}
+	
+	struct stat st;
+	if (::fstat(fd_, &st) != 0)
+	{
+		mtl_status(errno);
+		Close();
+		return false;
+	}
+	
+	file_size_ = st.st_size;
+	index_.fd = fd_;
+	index_.size = file_size_;
+	index_.checkpoints = {0};
+	index_.line_count = 0;
+	index_.indexed_to = 0;
+	
+	inotify_fd_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd_ != -1 && ::inotify_add_watch(inotify_fd_, ba.data(),
+		IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF) != -1)
+	{
+		notifier_ = new QSocketNotifier(inotify_fd_, QSocketNotifier::Read, this);
+		connect(notifier_, &QSocketNotifier::activated, this, &LargeFileView::FileChanged);
+	} else {
+		mtl_status(errno);
+	}
+	
+	StartIndexing();
+	
+	return true;
+}
+
+void LargeFileView::paintEvent(QPaintEvent *evt)
+{
+	QPainter painter(viewport());
+	painter.setFont(font());
+	const QRect area = viewport()->rect();
+	painter.fillRect(area, palette().base());
+	
+	ci64 total = total_lines();
+	ci64 first = verticalScrollBar()->value();
+	cint rows = visible_rows() + 1;
+	cint gutter_w = char_w_ * (QString::number(total).size() + 2);
+	
+	painter.setPen(palette().text().color());
+	painter.setClipRect(QRect(gutter_w, 0, area.width() - gutter_w, area.height()));
+	cint x = gutter_w + char_w_ / 2 - horizontalScrollBar()->value();
+	int drawn = 0;
+	i64 pos = LineOffset(first);
+	while (pos != -1 && drawn < rows && first + drawn < total)
+	{
+		if (!window_.Cover(fd_, pos, file_size_))
+			break;
+		i64 next = window_.NextLineStart(pos, file_size_);
+		if (next == -1)
+			next = file_size_;
+		
+		const char *s_start = window_.at(pos);
+		i64 len = next - pos;
+		while (len > 0 && (s_start[len - 1] == '\n' || s_start[len - 1] == '\r'))
+			len--;
+		
+		/// Only the visible lines ever get read and decoded:
+		QString s = QString::fromUtf8(s_start, len);
+		s.replace(QChar('\t'), QLatin1String("    "));
+		painter.drawText(QPointF(x, drawn * line_h_ + ascent_), s);
+		
+		pos = next;
+		drawn++;
+	}
+	
+	painter.setClipping(false);
+	painter.fillRect(QRect(0, 0, gutter_w, area.height()), palette().alternateBase());
+	painter.setPen(palette().placeholderText().color());
+	for (int i = 0; i < drawn; i++)
+	{
+		QRect r(0, i * line_h_, gutter_w - char_w_, line_h_);
+		painter.drawText(r, Qt::AlignRight | Qt::AlignVCenter, QString::number(first + i + 1));
+	}
+}
+
+void LargeFileView::Reopen(cint tries_left)
+{
+	auto ba = full_path_.toLocal8Bit();
+	if (::access(ba.data(), R_OK) != 0)
+	{
+		/// Keeps showing the old file until the new one shows up:
+		if (tries_left > 0)
+		{
+			const QString path = full_path_;
+			QTimer::singleShot(ReopenRetryMs, this, [this, path, tries_left] {
+				if (fd_ != -1 && path == full_path_)
+					Reopen(tries_left - 1);
+			});
+		}
+		return;
+	}
+	
+	cbool follow = follow_;
+	Close();
+	if (Open())
+	{
+		follow_ = follow;
+		UpdateScrollBars();
+		viewport()->update();
+	}
+}
+
+void LargeFileView::resizeEvent(QResizeEvent *evt)
+{
+	QAbstractScrollArea::resizeEvent(evt);
+	UpdateScrollBars();
+}
+
+void LargeFileView::StartIndexing()
+{
+	{
+		MutexGuard guard(&index_.mutex);
+		index_.running = true;
+		index_.cancel = false;
+	}
+	
+	if (!io::NewThread(IndexLines, &index_))
+	{
+		MutexGuard guard(&index_.mutex);
+		index_.running = false;
+		return;
+	}
+	
+	progress_timer_->start();
+}
+
+void LargeFileView::StopIndexing()
+{
+	MutexGuard guard(&index_.mutex);
+	if (!index_.running)
+		return;
+	
+	index_.cancel = true;
+	while (index_.running)
+		pthread_cond_wait(&index_.cond, &index_.mutex);
+	index_.cancel = false;
+}
+
+i64 LargeFileView::total_lines()
+{
+	MutexGuard guard(&index_.mutex);
+	cbool has_tail = !index_.running && index_.indexed_to < index_.size;
+	return index_.line_count + (has_tail ? 1 : 0);
+}
+
+void LargeFileView::UpdateScrollBars()
+{
+	cint rows = visible_rows();
+	ci64 total = total_lines();
+	
+	auto *vs = verticalScrollBar();
+	vs->setRange(0, int(std::min(i64(INT_MAX), std::max(i64(0), total - rows))));
+	vs->setPageStep(rows);
+	vs->setSingleStep(1);
+	
+	auto *hs = horizontalScrollBar();
+	cint line_w = int(LargeFileMaxLineBytes) * char_w_;
+	hs->setRange(0, std::max(0, line_w - viewport()->width() / 2));
+	hs->setPageStep(viewport()->width());
+	hs->setSingleStep(char_w_);
+	
+	cbool grew = (total != shown_lines_);
+	shown_lines_ = total;
+	if (follow_ && grew)
+		vs->setValue(vs->maximum());
+}
+
+int LargeFileView::visible_rows() const
+{
+	return std::max(1, viewport()->height() / line_h_);
+}
+
+}
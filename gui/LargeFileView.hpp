@@ -0,0 +1,109 @@
+#pragma once
+
+#include "decl.hxx"
+#include "../decl.hxx"
+#include "../io/decl.hxx"
+#include "../err.hpp"
+
+#include <QAbstractScrollArea>
+#include <QByteArray>
+#include <QVector>
+
+#include <pthread.h>
+
+QT_BEGIN_NAMESPACE
+class QSocketNotifier;
+class QTimer;
+QT_END_NAMESPACE
+
+namespace cornus::gui {
+
+/// Longer lines are shown as several lines so that neither indexing
+/// nor painting ever scans more than this for a line break:
+const i64 LargeFileMaxLineBytes = 4096;
+/// Only the offset of every Nth line is kept (~8 bytes per N lines):
+const i64 LargeFileLinesPerCheckpoint = 512;
+
+/// A part of the file read with pread(). Not a mapping: reading a
+/// mapped page past the end of a file truncated meanwhile is a SIGBUS.
+struct FileWindow {
+	QByteArray buf;
+	i64 from = 0; // file offset of buf[0]
+	i64 read_size = 0;
+	
+	const char* at(ci64 pos) const { return buf.constData() + (pos - from); }
+	void Clear() { buf.clear(); from = 0; }
+	/// Makes sure the line at @pos is in, false if the file got shorter:
+	bool Cover(cint fd, ci64 pos, ci64 end);
+	i64 NextLineStart(ci64 pos, ci64 end) const;
+	i64 to() const { return from + buf.size(); }
+};
+
+/// Shared by the view and its indexing thread, guarded by mutex.
+struct LineIndex {
+	pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+	pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+	int fd = -1;
+	i64 size = 0; // of the file as far as it's being indexed
+	QVector<i64> checkpoints; // offset of line k * LargeFileLinesPerCheckpoint
+	i64 line_count = 0; // lines indexed so far
+	i64 indexed_to = 0; // offset of the first line that isn't indexed yet
+	bool running = false;
+	bool cancel = false;
+};
+
+/** Read-only viewer for files too big for TextEdit. The file is read
+with pread(), its lines are indexed on a background thread (sparsely,
+so memory doesn't grow with the file size) and only the visible lines
+are read, decoded and painted. Ctrl+G jumps to a line (or to a byte
+offset with '@'), F toggles following the end of the file as it grows
+(inotify), a renamed or deleted file is reopened by its path. */
+class LargeFileView: public QAbstractScrollArea {
+	Q_OBJECT
+public:
+	LargeFileView(App *app);
+	virtual ~LargeFileView();
+	
+	bool Display(io::File *cloned_file);
+	void GoToLine(ci64 line);
+	void GoToOffset(ci64 offset);
+
+protected:
+	virtual void keyPressEvent(QKeyEvent *evt) override;
+	virtual void paintEvent(QPaintEvent *evt) override;
+	virtual void resizeEvent(QResizeEvent *evt) override;
+
+private:
+	NO_ASSIGN_COPY_MOVE(LargeFileView);
+	
+	void AskGoTo();
+	void Close();
+	void FileChanged();
+	void IndexProgress();
+	i64 LineOffset(ci64 line);
+	bool Open();
+	void Reopen(cint tries_left);
+	void StartIndexing();
+	void StopIndexing();
+	i64 total_lines();
+	void UpdateScrollBars();
+	int visible_rows() const;
+	
+	App *app_ = nullptr;
+	LineIndex index_ = {};
+	QString full_path_;
+	FileWindow window_ = {};
+	i64 file_size_ = 0;
+	int fd_ = -1;
+	int inotify_fd_ = -1;
+	QSocketNotifier *notifier_ = nullptr;
+	QTimer *progress_timer_ = nullptr;
+	i64 shown_lines_ = 0;
+	int line_h_ = 1;
+	int char_w_ = 1;
+	int ascent_ = 0;
+	bool follow_ = false;
+	bool grown_ = false; // while indexing, picked up when it's done
+};
+
+}
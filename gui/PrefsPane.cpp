@@ -34,6 +34,8 @@ PrefsPane::~PrefsPane()
 	delete remember_window_size_;
 	delete sync_views_scroll_;
 	delete store_thumbnails_in_ext_attrs_;
+	delete thumbnail_cache_mib_;
+	delete thumbnail_cache_stats_;
 }
 
 void PrefsPane::ApplyToWidgets(const Prefs &prefs)
@@ -47,6 +49,7 @@ void PrefsPane::ApplyToWidgets(const Prefs &prefs)
 	remember_window_size_->setCheckState(prefs.remember_window_size() ? Qt::Checked : Qt::Unchecked);
 	sync_views_scroll_->setCheckState(prefs.sync_views_scroll_location() ? Qt::Checked : Qt::Unchecked);
 	store_thumbnails_in_ext_attrs_->setCheckState(prefs.store_thumbnails_in_ext_attrs() ? Qt::Checked : Qt::Unchecked);
+	thumbnail_cache_mib_->setValue(prefs.thumbnail_cache_mib());
 }
 
 void PrefsPane::ButtonClicked(QAbstractButton *btn)
@@ -94,6 +97,23 @@ void PrefsPane::CreateGui()
 	store_thumbnails_in_ext_attrs_ = new QCheckBox(tr("Store thumbnails in extended file attributes"));
 	vert_layout->addWidget(store_thumbnails_in_ext_attrs_);
 	
+	{
+		QFormLayout *form = new QFormLayout();
+		thumbnail_cache_mib_ = new QSpinBox();
+		thumbnail_cache_mib_->setRange(8, 4096);
+		thumbnail_cache_mib_->setSuffix(QLatin1String(" MiB"));
+		form->addRow(tr("Thumbnails kept in memory:"), thumbnail_cache_mib_);
+		
+		const ThumbnailCacheStats stats = app_->thumbnail_cache().stats();
+		const i64 total = stats.hits + stats.misses;
+		const int hit_percent = (total > 0) ? int(stats.hits * 100 / total) : 0;
+		thumbnail_cache_stats_ = new QLabel(tr("%1 thumbnails, %2 of %3 MiB, hits: %4, misses: %5 (%6%)")
+			.arg(stats.count).arg(stats.used_kib / 1024).arg(stats.max_kib / 1024)
+			.arg(stats.hits).arg(stats.misses).arg(hit_percent));
+		form->addRow(QString(), thumbnail_cache_stats_);
+		vert_layout->addLayout(form);
+	}
+	
 	button_box_ = new QDialogButtonBox (QDialogButtonBox::Ok
 		| QDialogButtonBox::RestoreDefaults | QDialogButtonBox::Cancel);
 	connect(button_box_, &QDialogButtonBox::clicked, this, &PrefsPane::ButtonClicked);
@@ -122,6 +142,8 @@ void PrefsPane::SavePrefs()
 	prefs.remember_window_size(remember_window_size_->checkState() == Qt::Checked);
 	prefs.sync_views_scroll_location(sync_views_scroll_->checkState() == Qt::Checked);
 	prefs.store_thumbnails_in_ext_attrs(store_thumbnails_in_ext_attrs_->checkState() == Qt::Checked);
+	prefs.thumbnail_cache_mib(thumbnail_cache_mib_->value());
+	app_->thumbnail_cache().SetBudgetMiB(prefs.thumbnail_cache_mib());
 	
 	prefs.Save();
 	
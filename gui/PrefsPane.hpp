@@ -1,6 +1,8 @@
 #pragma once
 
 #include <QCheckBox>
+#include <QLabel>
+#include <QSpinBox>
 #include <QDialog>
 #include <QDialogButtonBox>
 
@@ -36,5 +38,7 @@ private:
 	QCheckBox *remember_window_size_ = nullptr;
 	QCheckBox *sync_views_scroll_ = nullptr;
 	QCheckBox *store_thumbnails_in_ext_attrs_ = nullptr;
+	QSpinBox *thumbnail_cache_mib_ = nullptr;
+	QLabel *thumbnail_cache_stats_ = nullptr;
 };
 }
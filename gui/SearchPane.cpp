@@ -1,12 +1,18 @@
 #include "SearchPane.hpp"
 
 #include "../App.hpp"
+#include "../ByteArray.hpp"
 #include "../Hid.hpp"
 #include "../io/File.hpp"
 #include "../io/Files.hpp"
+#include "../io/FindFiles.hpp"
+#include "../io/Grep.hpp"
+#include "../io/NameFilter.hpp"
+#include "../io/socket.hh"
 #include "Location.hpp"
 #include "../Media.hpp"
 #include "../MutexGuard.hpp"
+#include "../Prefs.hpp"
 #include "SearchLineEdit.hpp"
 #include "Tab.hpp"
 #include "Table.hpp"
@@ -17,6 +23,7 @@
 #include <QFormLayout>
 #include <QLabel>
 #include <QSet>
+#include <QTimer>
 
 namespace cornus::gui {
 
@@ -28,14 +35,34 @@ bool Same(const MediaSearch &a, const MediaSearch &b)
 	a.year == b.year;
 }
 
+/// How often found matches get moved into the list or the view:
+const int SearchProgressMs = 100;
+/// Filtering as you type has to feel immediate:
+const int FilterResultsMs = 10;
+
 SearchPane::SearchPane(App *app): app_(app)
 {}
 
-SearchPane::~SearchPane() {}
+SearchPane::~SearchPane()
+{
+	delete grep_;
+	delete find_files_;
+	delete name_filter_;
+}
 
 void SearchPane::ActionHide()
 {
 	setVisible(false);
+	if (grep_ != nullptr)
+	{
+		grep_->Stop();
+		ContentSearchProgress();
+	}
+	if (name_filter_ != nullptr)
+	{
+		name_filter_->Cancel();
+		filter_timer_->stop();
+	}
 	BeforeExiting();
 	DeselectAll();
 	select_row_ = -1;
@@ -45,6 +72,71 @@ void SearchPane::ActionHide()
 	app_->tab()->table()->setFocus();
 }
 
+void SearchPane::ApplyNameFilter()
+{
+	io::NameFilterResult result;
+	if (!name_filter_->TakeResult(result))
+	{
+		if (!name_filter_->pending())
+			filter_timer_->stop();
+		return;
+	}
+	
+	gui::Tab *tab = app_->tab();
+	select_row_ = -1;
+	cint found = result.indices.size();
+	QSet<int> indices;
+	{
+		auto &files = *app_->files(tab->files_id());
+		MutexGuard guard = files.guard();
+		if (files.data.dir_id != result.dir_id)
+			return; // the next TextChanged() catches up
+		
+		if (!name_filter_->ResultFits(result, files.data.vec, result.dir_id))
+		{
+			/// Inotify changed the listing meanwhile, so the indices
+			/// would point at other files. The timer is still running:
+			name_filter_->Filter(files.data.vec, files.data.dir_id, result.query, !lower());
+			return;
+		}
+		
+		last_dir_id_ = result.dir_id;
+		auto &vec = files.data.vec;
+		cint count = vec.size();
+		int k = 0;
+		/// Both are ascending, only files whose state changed get updated:
+		for (int i = 0; i < count; i++)
+		{
+			io::File *next = vec[i];
+			cbool matches = k < found && result.indices[k] == i;
+			if (matches)
+				k++;
+			
+			if (matches) {
+				if (!next->selected_by_search()) {
+					next->selected_by_search(true);
+					indices.insert(i);
+				}
+				if (select_row_ == -1) {
+					next->selected_by_search_active(true);
+					select_row_ = i;
+					indices.insert(i);
+				}
+			} else if (next->selected_by_search()) {
+				next->selected_by_search(false);
+				next->selected_by_search_active(false);
+				indices.insert(i);
+			}
+		}
+	}
+	
+	search_le_->SetCount(found);
+	search_le_->SetAt(found > 0 ? 1 : 0, true);
+	tab->table_model()->UpdateIndices(indices);
+	if (select_row_ != -1)
+		tab->table()->ScrollToFile(select_row_);
+}
+
 void SearchPane::BeforeExiting()
 {
 	if (select_row_ < 0 || last_dir_id_ != app_->current_dir_id())
@@ -105,6 +197,90 @@ bool SearchPane::ContainsAll(const media::MediaPreview &data)
 	return true;
 }
 
+void SearchPane::ContentSearchProgress()
+{
+	QVector<io::GrepMatch> matches;
+	grep_->TakeMatches(matches);
+	QString prefix = content_items_.dir_path;
+	if (!prefix.endsWith('/'))
+		prefix.append('/');
+	
+	for (const io::GrepMatch &next: matches)
+	{
+		QString path = next.full_path;
+		if (path.startsWith(prefix))
+			path = path.mid(prefix.size());
+		
+		auto *item = new QListWidgetItem(path + ':' + QString::number(next.line_number)
+			+ QLatin1String(": ") + next.line);
+		item->setData(Qt::UserRole, next.full_path);
+		content_items_.results->addItem(item);
+	}
+	content_items_.found += matches.size();
+	
+	cbool running = grep_->running();
+	QString status = tr("%1 found in %2 files").arg(content_items_.found)
+		.arg(grep_->files_searched());
+	if (grep_->limit_reached())
+		status += tr(" (stopped at %1)").arg(io::GrepMaxMatches);
+	else if (running)
+		status += QLatin1String("...");
+	content_items_.status->setText(status);
+	
+	if (!running)
+	{
+		content_items_.timer->stop();
+		content_items_.start_stop->setText(tr("Search"));
+	}
+}
+
+QWidget* SearchPane::CreateByContentsPane()
+{
+	QWidget *p = new QWidget();
+	p->setContentsMargins(0, 0, 0, 0);
+	QBoxLayout *layout = new QBoxLayout(QBoxLayout::TopToBottom);
+	layout->setContentsMargins(0, 0, 2, 2);
+	p->setLayout(layout);
+	
+	QBoxLayout *row = new QBoxLayout(QBoxLayout::LeftToRight);
+	layout->addLayout(row);
+	
+	content_items_.search_le = new QLineEdit();
+	content_items_.search_le->setPlaceholderText(tr("Search file contents in this folder and below..."));
+	content_items_.search_le->installEventFilter(this);
+	row->addWidget(content_items_.search_le);
+	
+	content_items_.case_sensitive = new QCheckBox();
+	content_items_.case_sensitive->setText(tr("Case Sensitive"));
+	row->addWidget(content_items_.case_sensitive);
+	
+	content_items_.start_stop = new QPushButton(tr("Search"));
+	connect(content_items_.start_stop, &QPushButton::clicked, this, &SearchPane::StartStopContentSearch);
+	row->addWidget(content_items_.start_stop);
+	
+	{
+		auto *btn = new QPushButton();
+		btn->setIcon(QIcon::fromTheme(QLatin1String("window-close")));
+		connect(btn, &QPushButton::clicked, this, &SearchPane::ActionHide);
+		row->addWidget(btn);
+	}
+	
+	content_items_.status = new QLabel();
+	layout->addWidget(content_items_.status);
+	
+	content_items_.results = new QListWidget();
+	connect(content_items_.results, &QListWidget::itemActivated, [=](QListWidgetItem *item) {
+		app_->tab()->GoToAndSelect(item->data(Qt::UserRole).toString());
+	});
+	layout->addWidget(content_items_.results);
+	
+	content_items_.timer = new QTimer(this);
+	content_items_.timer->setInterval(SearchProgressMs);
+	connect(content_items_.timer, &QTimer::timeout, this, &SearchPane::ContentSearchProgress);
+	
+	return p;
+}
+
 QWidget* SearchPane::CreateByFileNamePane()
 {
 	QWidget *p = new QWidget();
@@ -154,6 +330,53 @@ QWidget* SearchPane::CreateByFileNamePane()
 	return p;
 }
 
+QWidget* SearchPane::CreateByFileNameRecursivePane()
+{
+	QWidget *p = new QWidget();
+	p->setContentsMargins(0, 0, 0, 0);
+	QBoxLayout *layout = new QBoxLayout(QBoxLayout::LeftToRight);
+	p->setLayout(layout);
+	layout->setContentsMargins(0, 0, 2, 2);
+	
+	name_items_.search_le = new QLineEdit();
+	name_items_.search_le->setPlaceholderText(tr("Search file names in this folder and below..."));
+	name_items_.search_le->installEventFilter(this);
+	layout->addWidget(name_items_.search_le);
+	
+	name_items_.match_cb = new QComboBox();
+	name_items_.match_cb->addItem(tr("Contains"), int(io::FindMatch::Substring));
+	name_items_.match_cb->addItem(tr("Wildcard"), int(io::FindMatch::Glob));
+	name_items_.match_cb->addItem(tr("Regex"), int(io::FindMatch::Regex));
+	layout->addWidget(name_items_.match_cb);
+	
+	name_items_.case_sensitive = new QCheckBox();
+	name_items_.case_sensitive->setText(tr("Case Sensitive"));
+	layout->addWidget(name_items_.case_sensitive);
+	
+	name_items_.start_stop = new QPushButton(tr("Search"));
+	connect(name_items_.start_stop, &QPushButton::clicked, this, &SearchPane::StartStopNameSearch);
+	layout->addWidget(name_items_.start_stop);
+	
+	name_items_.index_btn = new QPushButton(tr("Index"));
+	name_items_.index_btn->setCheckable(true);
+	name_items_.index_btn->setToolTip(tr("Have cornus_io keep an index of the file names "
+		"in this folder and below, so that searching them is instant"));
+	connect(name_items_.index_btn, &QPushButton::clicked, this, &SearchPane::IndexFolder);
+	layout->addWidget(name_items_.index_btn);
+	
+	name_items_.status = new QLabel();
+	layout->addWidget(name_items_.status);
+	
+	{
+		auto *btn = new QPushButton();
+		btn->setIcon(QIcon::fromTheme(QLatin1String("window-close")));
+		connect(btn, &QPushButton::clicked, this, &SearchPane::ActionHide);
+		layout->addWidget(btn);
+	}
+	
+	return p;
+}
+
 QWidget* CreateRow3(QWidget *a, QWidget *b, QWidget *c)
 {
 	QWidget *pane = new QWidget();
@@ -211,6 +434,17 @@ QWidget* SearchPane::CreateByMediaXattrPane()
 	media_items_.year_tf = new TextField();
 	media_items_.year_tf->setFixedWidth(fixed_w);
 	media_items_.year_tf->setPlaceholderText("Year");
+	media_items_.year_tf->setToolTip(tr("The library search also takes "
+		"\"1990s\" or \"1990-1999\""));
+	
+	media_items_.height_cb = new QComboBox();
+	media_items_.height_cb->addItem(tr("Any resolution"), -1);
+	media_items_.height_cb->addItem(QLatin1String("720p+"), 720);
+	media_items_.height_cb->addItem(QLatin1String("1080p+"), 1080);
+	media_items_.height_cb->addItem(QLatin1String("2160p+"), 2160);
+	media_items_.height_cb->setToolTip(tr("Only used by the library search"));
+	
+	media_items_.status = new QLabel();
 	
 	QWidget *search_pane = new QWidget();
 	{
@@ -218,6 +452,7 @@ QWidget* SearchPane::CreateByMediaXattrPane()
 		QBoxLayout *layout = new QBoxLayout(QBoxLayout::LeftToRight);
 		layout->setContentsMargins(0, 0, 0, 0);
 		search_pane->setLayout(layout);
+		layout->addWidget(media_items_.height_cb);
 		media_items_.search_prev = new QPushButton();
 		media_items_.search_prev->setIcon(QIcon::fromTheme(QLatin1String("go-previous")));
 		media_items_.search_prev->setToolTip(tr("Search backwards"));
@@ -233,12 +468,20 @@ QWidget* SearchPane::CreateByMediaXattrPane()
 		layout->addWidget(media_items_.search_prev);
 		layout->addWidget(media_items_.search_next);
 		
+		media_items_.library = new QPushButton(tr("Library"));
+		media_items_.library->setToolTip(tr("Search all the folders cornus_io "
+			"keeps indexed, the results show up in this tab"));
+		connect(media_items_.library, &QPushButton::clicked, this,
+			&SearchPane::StartStopLibrarySearch);
+		layout->addWidget(media_items_.library);
+		
 		QPushButton *close_btn = new QPushButton();
 		close_btn->setIcon(QIcon::fromTheme(QLatin1String("window-close")));
 		connect(close_btn, &QPushButton::clicked, [=] {
 			ActionHide();
 		});
 		layout->addWidget(close_btn);
+		layout->addWidget(media_items_.status);
 		layout->addStretch(2);
 	}
 	
@@ -333,7 +576,18 @@ bool SearchPane::eventFilter(QObject  *obj, QEvent * event)
 		auto key = kevt->key();
 		const bool ctrl = kevt->modifiers() & Qt::ControlModifier;
 		
-		if ((QLineEdit *)obj == search_le_ || (QWidget*)obj == media_items_.media_xattr)
+		if ((QLineEdit*)obj == content_items_.search_le)
+		{
+			if (key == Qt::Key_Escape)
+				ActionHide();
+			else if (key == Qt::Key_Return)
+				StartStopContentSearch();
+		} else if ((QLineEdit*)obj == name_items_.search_le) {
+			if (key == Qt::Key_Escape)
+				ActionHide();
+			else if (key == Qt::Key_Return)
+				StartStopNameSearch();
+		} else if ((QLineEdit *)obj == search_le_ || (QWidget*)obj == media_items_.media_xattr)
 		{
 			switch (key) {
 			case Qt::Key_Escape: {
@@ -413,6 +667,69 @@ void SearchPane::MediaFileWasUpdated()
 	}
 }
 
+void SearchPane::IndexFolder(cbool yes)
+{
+	const QString dir_path = app_->tab()->current_dir();
+	if (dir_path.isEmpty())
+		return;
+	
+	auto *ba = new ByteArray();
+	ba->set_msg_id(yes ? io::Message::NameIndexAddRoot : io::Message::NameIndexRemoveRoot);
+	ba->add_string(dir_path);
+	io::socket::SendAsync(ba);
+}
+
+void SearchPane::FindProgress()
+{
+	QVector<io::File*> files;
+	find_files_->TakeFiles(files);
+	cint count = files.size();
+	gui::Tab *tab = app_->tab(find_items_.tab_id);
+	bool shown = false;
+	if (tab != nullptr)
+	{
+		shown = tab->table_model()->AppendFiles(find_items_.dir_id, files);
+	} else {
+		for (io::File *next: files)
+			delete next;
+	}
+	
+	if (!shown)
+	{
+		/// The tab was closed or went to another folder:
+		find_files_->Stop();
+		find_items_.timer->stop();
+		find_items_.start_stop->setText(tr("Search"));
+		find_items_.status->clear();
+		return;
+	}
+	
+	find_items_.found += count;
+	cbool running = find_files_->running();
+	cbool from_index = find_files_->from_index();
+	cbool by_media = find_items_.start_stop == media_items_.library;
+	QString status;
+	if (from_index)
+		status = tr("%1 found (indexed)").arg(find_items_.found);
+	else if (by_media)
+		status = running ? QString() : tr("No indexed folders, see the Index button of Ctrl+Alt+F");
+	else
+		status = tr("%1 found in %2 folders").arg(find_items_.found).arg(find_files_->dirs_listed());
+	if (find_files_->limit_reached())
+		status += tr(" (stopped at %1)").arg(io::FindMaxResults);
+	else if (running)
+		status += QLatin1String("...");
+	find_items_.status->setText(status);
+	
+	if (!running)
+	{
+		find_items_.timer->stop();
+		find_items_.start_stop->setText(by_media ? tr("Library") : tr("Search"));
+		if (!by_media)
+			name_items_.index_btn->setChecked(from_index);
+	}
+}
+
 void SearchPane::RequestFocus()
 {
 	if (search_by_ == SearchBy::FileName) {
@@ -425,6 +742,12 @@ void SearchPane::RequestFocus()
 		if (media_items_.media_xattr != nullptr) {
 			media_items_.media_xattr->setFocus();
 		}
+	} else if (search_by_ == SearchBy::Contents) {
+		content_items_.search_le->setFocus();
+		content_items_.search_le->selectAll();
+	} else if (search_by_ == SearchBy::FileNameRecursive) {
+		name_items_.search_le->setFocus();
+		name_items_.search_le->selectAll();
 	} else {
 		mtl_trace();
 	}
@@ -551,21 +874,217 @@ void SearchPane::SetMode(const SearchBy mode)
 		const int h = wh * 3 * 1.2;
 		setMaximumSize(50000, h);
 		setCurrentIndex(media_items_.by_media_xattr);
+	} else if (search_by_ == SearchBy::Contents) {
+		if (content_items_.index == -1)
+			content_items_.index = addWidget(CreateByContentsPane());
+		const int wh = app_->location()->size().height();
+		setMaximumSize(50000, wh * 12);
+		setCurrentIndex(content_items_.index);
+	} else if (search_by_ == SearchBy::FileNameRecursive) {
+		if (name_items_.index == -1)
+			name_items_.index = addWidget(CreateByFileNameRecursivePane());
+		setMaximumSize(50000, name_items_.search_le->size().height() * 1.2);
+		setCurrentIndex(name_items_.index);
 	} else {
 		mtl_trace();
 	}
 }
 
+void SearchPane::StartStopContentSearch()
+{
+	if (grep_ == nullptr)
+		grep_ = new io::Grep();
+	
+	if (grep_->running())
+	{
+		grep_->Stop();
+		ContentSearchProgress();
+		return;
+	}
+	
+	io::GrepParams params;
+	params.dir_path = app_->tab()->current_dir();
+	params.text = content_items_.search_le->text();
+	params.case_sensitive = content_items_.case_sensitive->isChecked();
+	params.show_hidden_files = app_->prefs().show_hidden_files();
+	
+	content_items_.results->clear();
+	content_items_.status->clear();
+	content_items_.found = 0;
+	content_items_.dir_path = params.dir_path;
+	if (!grep_->Start(params))
+		return;
+	
+	content_items_.start_stop->setText(tr("Stop"));
+	content_items_.timer->start();
+}
+
+bool SearchPane::StartFind(const io::FindParams &params, const QString &title,
+	QPushButton *start_stop, QLabel *status)
+{
+	if (!find_files_->Start(params))
+	{
+		status->setText(tr("Invalid pattern"));
+		return false;
+	}
+	
+	if (find_items_.timer == nullptr)
+	{
+		find_items_.timer = new QTimer(this);
+		find_items_.timer->setInterval(SearchProgressMs);
+		connect(find_items_.timer, &QTimer::timeout, this, &SearchPane::FindProgress);
+	}
+	
+	if (find_items_.status != nullptr && find_items_.status != status)
+		find_items_.status->clear();
+	
+	/// Files found meanwhile wait for the first FindProgress():
+	gui::Tab *tab = app_->tab();
+	find_items_.start_stop = start_stop;
+	find_items_.status = status;
+	find_items_.tab_id = tab->id();
+	find_items_.found = 0;
+	find_items_.dir_id = tab->ShowSearchResults(params.dir_path, title);
+	status->clear();
+	start_stop->setText(tr("Stop"));
+	find_items_.timer->start();
+	
+	return true;
+}
+
+void SearchPane::StartStopLibrarySearch()
+{
+	if (find_files_ == nullptr)
+		find_files_ = new io::FindFiles();
+	
+	if (find_files_->running())
+	{
+		find_files_->Stop();
+		FindProgress();
+		if (find_items_.start_stop == media_items_.library)
+			return;
+	}
+	
+	MediaSearch m;
+	FillInSearchItem(m);
+	gui::Tab *tab = app_->tab();
+	io::FindParams params;
+	params.by_media = true;
+	/// The whole library, that is every indexed folder:
+	params.media.dir_path.clear();
+	params.media.actor = m.actor;
+	params.media.director = m.director;
+	params.media.writer = m.writer;
+	params.media.genre = m.genre;
+	params.media.subgenre = m.subgenre;
+	params.media.country = m.country;
+	params.media.video_codec = m.video_codec;
+	params.media.min_height = media_items_.height_cb->currentData().toInt();
+	
+	/// "1995", "1990s" or "1990-1999":
+	const QString year = media_items_.year_tf->text().trimmed();
+	bool ok = true;
+	int year_from = -1, year_to = -1;
+	if (year.endsWith('s')) {
+		year_from = year.chopped(1).toInt(&ok);
+		year_to = year_from + 9;
+	} else if (year.contains('-')) {
+		bool ok2 = false;
+		year_from = year.section('-', 0, 0).toInt(&ok);
+		year_to = year.section('-', 1, 1).toInt(&ok2);
+		ok = ok && ok2;
+	} else if (!year.isEmpty()) {
+		year_from = year.toInt(&ok);
+	}
+	
+	if (!year.isEmpty())
+	{
+		auto in_range = [](cint y) {
+			return y == -1 || (y >= io::MediaQueryMinYear && y <= io::MediaQueryMaxYear);
+		};
+		if (!ok || !in_range(year_from) || !in_range(year_to))
+		{
+			app_->TellUser(tr("The year should be like 1995, 1990s or 1990-1999, "
+				"from %1 to %2").arg(io::MediaQueryMinYear).arg(io::MediaQueryMaxYear));
+			return;
+		}
+		params.media.year_from = year_from;
+		params.media.year_to = year_to;
+	}
+	
+	if (m.isEmpty() && params.media.year_from == -1 && params.media.min_height == -1)
+	{
+		app_->TellUser(tr("No search parameters specified"));
+		return;
+	}
+	
+	params.dir_path = tab->current_dir();
+	params.files = &tab->view_files();
+	params.possible_categories = &app_->possible_categories();
+	params.env = app_->env();
+	StartFind(params, tr("Media Library"), media_items_.library, media_items_.status);
+}
+
+void SearchPane::StartStopNameSearch()
+{
+	if (find_files_ == nullptr)
+		find_files_ = new io::FindFiles();
+	
+	if (find_files_->running())
+	{
+		find_files_->Stop();
+		FindProgress();
+		if (find_items_.start_stop == name_items_.start_stop)
+			return;
+	}
+	
+	gui::Tab *tab = app_->tab();
+	io::FindParams params;
+	params.dir_path = tab->current_dir();
+	params.pattern = name_items_.search_le->text();
+	params.match = io::FindMatch(name_items_.match_cb->currentData().toInt());
+	params.case_sensitive = name_items_.case_sensitive->isChecked();
+	params.show_hidden_files = app_->prefs().show_hidden_files();
+	params.files = &tab->view_files();
+	params.possible_categories = &app_->possible_categories();
+	params.env = app_->env();
+	if (params.pattern.isEmpty() || params.dir_path.isEmpty())
+		return;
+	
+	StartFind(params, tr("Search: %1").arg(params.pattern),
+		name_items_.start_stop, name_items_.status);
+}
+
 void SearchPane::TextChanged(const QString &s)
 {
-	QString search = s.trimmed().toLower();
+	QString search = s.trimmed();
+	if (lower())
+		search = search.toLower();
+	
+	if (name_filter_ == nullptr)
+	{
+		name_filter_ = new io::NameFilter();
+		filter_timer_ = new QTimer(this);
+		filter_timer_->setInterval(FilterResultsMs);
+		connect(filter_timer_, &QTimer::timeout, this, &SearchPane::ApplyNameFilter);
+	}
+	
 	if (search.isEmpty()) {
+		name_filter_->Cancel();
+		filter_timer_->stop();
 		search_le_->SetCount(-1);
 		DeselectAll();
 		return;
 	}
 	
-	DoSearch(&search);
+	/// Matched on the filter thread, ApplyNameFilter() shows the result:
+	gui::Tab *tab = app_->tab();
+	{
+		auto &files = *app_->files(tab->files_id());
+		MutexGuard guard = files.guard();
+		name_filter_->Filter(files.data.vec, files.data.dir_id, search, !lower());
+	}
+	filter_timer_->start();
 }
 
 }
@@ -3,14 +3,21 @@
 #include "../decl.hxx"
 #include "decl.hxx"
 #include "../err.hpp"
+#include "../io/decl.hxx"
 #include "../media.hxx"
 
 #include <QCheckBox>
 #include <QComboBox>
+#include <QLabel>
 #include <QLineEdit>
+#include <QListWidget>
 #include <QPushButton>
 #include <QStackedWidget>
 
+QT_BEGIN_NAMESPACE
+class QTimer;
+QT_END_NAMESPACE
+
 namespace cornus::gui {
 
 struct MediaSearch {
@@ -36,6 +43,8 @@ class SearchPane: public QStackedWidget {
 enum class SearchBy : i8 {
 	FileName,
 	MediaXAttrs,
+	Contents,
+	FileNameRecursive,
 };
 public:
 	SearchPane(App *app);
@@ -45,6 +54,8 @@ public:
 	void SetMode(const SearchBy mode);
 	void SetSearchByFileName() { SetMode(SearchBy::FileName); }
 	void SetSearchByMediaXattr() { SetMode(SearchBy::MediaXAttrs); }
+	void SetSearchByContents() { SetMode(SearchBy::Contents); }
+	void SetSearchByFileNameRecursive() { SetMode(SearchBy::FileNameRecursive); }
 	void TextChanged(const QString &s);
 	void MediaFileWasUpdated();
 	
@@ -54,16 +65,27 @@ private:
 	NO_ASSIGN_COPY_MOVE(SearchPane);
 	
 	void ActionHide();
+	void ApplyNameFilter();
 	void BeforeExiting();
 	bool ContainsAll(const media::MediaPreview &data);
+	void ContentSearchProgress();
 	void DeselectAll();
 	void DoSearch(const QString *search_str);
 	void FillInSearchItem(MediaSearch &d);
 	bool lower() const { return !case_sensitive_->isChecked(); }
 	bool Matches(io::File *file, const QString *search_str);
+	void FindProgress();
 	void ScrollToNext(const Direction dir);
 	QWidget* CreateByFileNamePane();
+	QWidget* CreateByFileNameRecursivePane();
 	QWidget* CreateByMediaXattrPane();
+	QWidget* CreateByContentsPane();
+	void IndexFolder(cbool yes);
+	bool StartFind(const io::FindParams &params, const QString &title,
+		QPushButton *start_stop, QLabel *status);
+	void StartStopContentSearch();
+	void StartStopLibrarySearch();
+	void StartStopNameSearch();
 	
 	App *app_ = nullptr;
 	QCheckBox *case_sensitive_ = nullptr;
@@ -81,9 +103,49 @@ private:
 		*countries_cb = nullptr,
 		*video_codec_cb = nullptr;
 		TextField *year_tf = nullptr;
+		QComboBox *height_cb = nullptr;
 		QPushButton *search_prev = nullptr, *search_next = nullptr;
+		QPushButton *library = nullptr;
+		QLabel *status = nullptr;
 	} media_items_ = {};
 	
+	struct ContentItems {
+		int index = -1;
+		QLineEdit *search_le = nullptr;
+		QCheckBox *case_sensitive = nullptr;
+		QPushButton *start_stop = nullptr;
+		QLabel *status = nullptr;
+		QListWidget *results = nullptr;
+		QTimer *timer = nullptr;
+		QString dir_path; // of the last search
+		int found = 0;
+	} content_items_ = {};
+	io::Grep *grep_ = nullptr;
+	
+	struct NameItems {
+		int index = -1;
+		QLineEdit *search_le = nullptr;
+		QComboBox *match_cb = nullptr;
+		QCheckBox *case_sensitive = nullptr;
+		QPushButton *start_stop = nullptr;
+		QPushButton *index_btn = nullptr;
+		QLabel *status = nullptr;
+	} name_items_ = {};
+	
+	/// The recursive name search or the media library search, the
+	/// results go into a virtual listing of the tab:
+	struct FindItems {
+		QPushButton *start_stop = nullptr; // of the pane that started it
+		QLabel *status = nullptr;
+		QTimer *timer = nullptr;
+		TabId tab_id = -1;
+		DirId dir_id = -1;
+		int found = 0;
+	} find_items_ = {};
+	io::FindFiles *find_files_ = nullptr;
+	io::NameFilter *name_filter_ = nullptr;
+	QTimer *filter_timer_ = nullptr; // picks up the name filter's results
+	
 	MediaSearch media_search_ = {};
 	int select_row_ = -1;
 	DirId last_dir_id_ = -1;
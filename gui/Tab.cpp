@@ -16,10 +16,12 @@
 #include "Location.hpp"
 #include "../misc/Blacklist.hpp"
 #include "OpenOrderPane.hpp"
+#include "../startup.hh"
 #include "../str.hxx"
 #include "Table.hpp"
 #include "TableModel.hpp"
 #include "TabsWidget.hpp"
+#include "../ThumbnailPrefetcher.hpp"
 #include "TreeModel.hpp"
 #include "TreeView.hpp"
 #include "../ui.hh"
@@ -817,6 +819,7 @@ void Tab::GoHomeSlot() {
 
 bool Tab::GoTo(const Action action, DirPath dp, const cornus::Reload r)
 {
+	app_->thumbnail_prefetcher()->GoingTo(dp.path);
 	GoToParams *params = new GoToParams();
 	params->tab = this;
 	params->dir_path = dp;
@@ -838,7 +841,7 @@ void Tab::GoToAndSelect(const QString full_path)
 	MTL_CHECK_VOID(parent.exists());
 	QString parent_dir = parent.absolutePath();
 	const QString name = io::GetFileNameOfFullPath(full_path).toString();
-	const SameDir same_dir = io::SameFiles(parent_dir, current_dir_) ? SameDir::Yes : SameDir::No;
+	const SameDir same_dir = ViewIsAt(parent_dir) ? SameDir::Yes : SameDir::No;
 	auto &files = view_files();
 	files.SelectFilenamesLater({name}, same_dir);
 	
@@ -870,6 +873,15 @@ void Tab::GoToFinish(cornus::io::FilesData *new_data)
 	
 	table_model_->SwitchTo(new_data);
 	history_->Add(new_data->action, current_dir_);
+	if (startup::profiling())
+	{
+		static bool first_time = true;
+		if (first_time)
+		{
+			first_time = false;
+			startup::Mark("Initial directory listed");
+		}
+	}
 	
 	if (new_data->action == Action::Back)
 	{
@@ -2041,6 +2053,32 @@ void Tab::ShowRightClickMenu(const QPoint &global_pos,
 	menu->popup(global_pos);
 }
 
+DirId Tab::ShowSearchResults(const QString &dir_path, const QString &title)
+{
+	io::FilesData *new_data = new io::FilesData();
+	io::Files &files = view_files();
+	{
+		auto g = files.guard();
+		new_data->sorting_order = files.data.sorting_order;
+	}
+	
+	new_data->action = Action::To;
+	/// There's no listing speed to show:
+	new_data->start_time = std::chrono::time_point<std::chrono::steady_clock>::max();
+	new_data->is_virtual(true);
+	new_data->show_hidden_files(app_->prefs().show_hidden_files());
+	new_data->unprocessed_dir_path = dir_path;
+	new_data->processed_dir_path = dir_path;
+	new_data->can_write_to_dir(io::CanWriteToDir(dir_path));
+	/// Starts out empty, the search appends to it with
+	/// TableModel::AppendFiles() as it finds files:
+	GoToFinish(new_data);
+	SetTitle(title);
+	
+	auto g = files.guard();
+	return files.data.dir_id;
+}
+
 void Tab::ShutdownLastInotifyThread()
 {
 #ifdef CORNUS_WAITED_FOR_WIDGETS
@@ -2305,6 +2343,9 @@ bool Tab::ViewIsAt(const QString &dir_path) const
 	auto &files = view_files();
 	{
 		auto g = files.guard();
+		/// Search results aren't the listing of their root folder:
+		if (files.data.is_virtual())
+			return false;
 		old_dir_path = files.data.processed_dir_path;
 	}
 	
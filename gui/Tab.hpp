@@ -121,6 +121,7 @@ public:
 	gui::ShiftSelect* ShiftSelect();
 	void ShowRightClickMenu(const QPoint &global_pos,
 		const QPoint &local_pos);
+	DirId ShowSearchResults(const QString &dir_path, const QString &title);
 	io::Files& view_files() const;
 	
 	const QString& title() const { return title_; }
@@ -6,6 +6,7 @@
 #include "../AutoDelete.hh"
 #include "CountFolder.hpp"
 #include "../DesktopFile.hpp"
+#include "DirSizeQueue.hpp"
 #include "../ExecInfo.hpp"
 #include "../Hid.hpp"
 #include "OpenOrderPane.hpp"
@@ -16,6 +17,7 @@
 #include "../MutexGuard.hpp"
 #include "../Prefs.hpp"
 #include "RestorePainter.hpp"
+#include "../startup.hh"
 #include "../str.hxx"
 #include "Tab.hpp"
 #include "TableDelegate.hpp"
@@ -65,6 +67,7 @@ model_(tm), tab_(tab)
 	{
 		auto *hz = horizontalHeader();
 		hz->setSectionHidden(int(Column::TimeModified), true);
+		hz->setSectionHidden(int(Column::DirSize), true);
 		hz->setSortIndicator(int(Column::FileName), Qt::AscendingOrder);
 		connect(hz, &QHeaderView::sortIndicatorChanged, this, &Table::SortingChanged);
 		
@@ -92,12 +95,15 @@ model_(tm), tab_(tab)
 	SetCustomResizePolicy();
 	auto *vs = verticalScrollBar();
 	connect(vs, &QAbstractSlider::valueChanged, this, &Table::HiliteFileUnderMouse);
+	dir_sizes_ = new DirSizeQueue(app_, this);
+	connect(vs, &QAbstractSlider::valueChanged, dir_sizes_, &DirSizeQueue::Schedule);
 }
 
 Table::~Table()
 {
 	delete model_;
 	delete delegate_;
+	delete dir_sizes_;
 }
 
 void Table::ApplyPrefs()
@@ -470,15 +476,23 @@ void Table::paintEvent(QPaintEvent *evt)
 {
 	QRect r(0, 0, viewport()->width(), viewport()->height());
 	cbool magnify = tab_->magnified();
-	if (magnify) {
-		auto pe = QPaintEvent(r);
-		QTableView::paintEvent(&pe);
-	} else {
-		QTableView::paintEvent(evt);
+	{
+		/// One lock for all visible cells instead of one per cell:
+		auto g = tab_->view_files().guard();
+		cells_locked_ = true;
+		if (magnify) {
+			auto pe = QPaintEvent(r);
+			QTableView::paintEvent(&pe);
+		} else {
+			QTableView::paintEvent(evt);
+		}
+		cells_locked_ = false;
 	}
 	
 	if (magnify)
 		tab_->PaintMagnified(viewport(), view_options());
+	
+	startup::MarkFirstPaint();
 }
 
 bool Table::ScrollToAndSelect(QString full_path)
@@ -604,6 +618,7 @@ void Table::SetCustomResizePolicy()
 	hh->setSectionResizeMode(i8(gui::Column::TimeCreated), QHeaderView::Fixed);
 	hh->setSectionResizeMode(i8(gui::Column::TimeModified), QHeaderView::Fixed);
 	hh->setSectionResizeMode(i8(gui::Column::Permissions), QHeaderView::Fixed);
+	hh->setSectionResizeMode(i8(gui::Column::DirSize), QHeaderView::Fixed);
 	QFontMetrics fm = fontMetrics();
 	QString sample_date = QLatin1String("2020-12-01 18:04");
 	
@@ -615,6 +630,7 @@ void Table::SetCustomResizePolicy()
 	setColumnWidth(i8(gui::Column::TimeCreated), time_col_w);
 	setColumnWidth(i8(gui::Column::TimeModified), time_col_w);
 	setColumnWidth(i8(gui::Column::Permissions), time_col_w);
+	setColumnWidth(i8(gui::Column::DirSize), size_col_w);
 }
 
 void Table::ShowVisibleColumnOptions(QPoint pos)
@@ -632,6 +648,8 @@ void Table::ShowVisibleColumnOptions(QPoint pos)
 		
 		connect(action, &QAction::triggered, [=] {
 			hz->setSectionHidden(i, !action->isChecked());
+			if (i == int(Column::DirSize))
+				dir_sizes_->Schedule();
 			app_->prefs().Save();
 		});
 	}
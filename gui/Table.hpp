@@ -27,6 +27,9 @@ public:
 	void ApplyPrefs();
 	void AutoScroll(const VDirection d);
 	bool CheckIsOnFileName(io::File *file, const int file_row, const QPoint &pos) const;
+	DirSizeQueue* dir_sizes() const { return dir_sizes_; }
+	/// True while paintEvent() holds the files lock for all visible cells.
+	bool cells_locked() const { return cells_locked_; }
 	void ClearMouseOver();
 	void ClipboardChanged(const ClipboardData &cd, QSet<int> &affected_indices);
 	const QPoint& drop_coord() const { return drop_coord_; }
@@ -82,7 +85,9 @@ private:
 	TableModel *model_ = nullptr;
 	gui::Tab *tab_ = nullptr;
 	TableDelegate *delegate_ = nullptr;
+	DirSizeQueue *dir_sizes_ = nullptr;
 	bool mouse_down_ = false;
+	bool cells_locked_ = false;
 	i32 mouse_over_file_name_ = -1;
 	i32 mouse_over_file_icon_ = -1;
 	ShiftSelect shift_select_ = {};
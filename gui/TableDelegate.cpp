@@ -13,6 +13,7 @@
 #include "Table.hpp"
 #include "TableModel.hpp"
 
+#include <cmath>
 #include <mutex>
 #include <QDateTime>
 #include <QHeaderView>
@@ -37,19 +38,70 @@ TableDelegate::TableDelegate(gui::Table *table, App *app, gui::Tab *tab): app_(a
 table_(table), tab_(tab)
 {
 	media_ = app_->media();
-	if (!media_->loaded())
-		media_->Reload();
 }
 
 TableDelegate::~TableDelegate() {
 }
 
+io::DisplayCache&
+TableDelegate::display(io::File *file) const
+{
+	io::FileCache &cache = file->cache();
+	if (cache.display == nullptr)
+		cache.display = new io::DisplayCache();
+	
+	io::DisplayCache &dc = *cache.display;
+	if (dc.name_w < 0 || dc.font_generation != font_generation_)
+	{
+		dc.name.setTextFormat(Qt::PlainText);
+		dc.name.setText(file->name());
+		dc.name.prepare(QTransform(), font_);
+		dc.name_w = dc.name.size().width();
+		dc.font_generation = font_generation_;
+	}
+	
+	return dc;
+}
+
+void
+TableDelegate::DrawDirSize(QPainter *painter, io::File *file,
+	const QStyleOptionViewItem &option, QFontMetricsF &fm,
+	const QRect &text_rect) const
+{
+	if (!file->is_dir())
+		return;
+	
+	ci64 size = file->dir_size();
+	if (size == -2)
+		return;
+	
+	if (size == -1)
+	{
+		/// Still being counted:
+		QBrush brush = option.palette.brush(QPalette::PlaceholderText);
+		painter->setPen(QPen(brush.color()));
+		painter->drawText(text_rect, AlignCenterMiddle, QString(QChar(0x2026)));
+		return;
+	}
+	
+	io::DisplayCache &dc = display(file);
+	if (!dc.has_dir_size || dc.dir_size_of != size)
+	{
+		dc.dir_size = io::SizeToString(size);
+		dc.dir_size_of = size;
+		dc.has_dir_size = true;
+	}
+	
+	painter->drawText(text_rect, text_alignment_, dc.dir_size);
+}
+
 void
 TableDelegate::DrawFileName(QPainter *painter, io::File *file,
 	cint row, const QStyleOptionViewItem &option,
 	QFontMetricsF &fm, const QRect &text_rect) const
 {
-	const auto filename_width = fm.horizontalAdvance(file->name());
+	io::DisplayCache &dc = display(file);
+	const auto filename_width = dc.name_w;
 	
 	if (!file->is_dir_or_so() && file->has_exec_bit()) {
 		QPen pen(app_->green_color());
@@ -90,9 +142,16 @@ TableDelegate::DrawFileName(QPainter *painter, io::File *file,
 		painter->fillPath(path, c);
 	}
 	
+	/// Laid out once, not on every paint like drawText() does:
 	auto bounding_rect = text_rect;
-	bounding_rect.setWidth(bounding_rect.width() + 300);
-	painter->drawText(text_rect, text_alignment_, file->name(), &bounding_rect);
+	bounding_rect.setWidth(std::ceil(filename_width));
+	{
+		cf64 y = text_rect.y() + (text_rect.height() - dc.name.size().height()) / 2;
+		painter->save();
+		painter->setClipRect(text_rect, Qt::IntersectClip);
+		painter->drawStaticText(QPointF(text_rect.x(), y), dc.name);
+		painter->restore();
+	}
 	
 	if (file->is_regular() && file->cache().desktop_file != nullptr)
 	{
@@ -237,7 +296,7 @@ TableDelegate::DrawIcon(QPainter *painter, io::File *file,
 	
 	
 	if (icon) {
-		icon->paint(painter, icon_rect);
+		app_->icons().Paint(painter, *icon, icon_rect);
 	}
 	
 	if (transparent) {
@@ -255,7 +314,7 @@ TableDelegate::DrawIcon(QPainter *painter, io::File *file,
 			action_icon = &clipboard_icons_.link;
 		
 		if (action_icon != nullptr)
-			action_icon->paint(painter, icon_rect);
+			app_->icons().Paint(painter, *action_icon, icon_rect);
 	}
 	
 	if (show_hint) {
@@ -301,6 +360,10 @@ void TableDelegate::DrawMediaAttrs(io::File *file, QPainter *painter,
 {
 	media::MediaPreview *m = file->media_attrs_decoded();
 	mtl_check_void(m != nullptr);
+	/// The DB is normally loaded after startup, but a file with
+	/// media attrs might get painted before that.
+	if (!media_->loaded())
+		media_->Reload();
 	
 	QString shadow_str = QLatin1String(" ");
 	cbool has_year = m->year_started > 0;
@@ -415,10 +478,18 @@ TableDelegate::DrawPermission(QPainter *painter, io::File *file,
 	const QStyleOptionViewItem &option, QFontMetricsF &fm,
 	const QRect &text_rect, const Column col) const
 {
-	char buf[14];
-	strmode(file->mode(), buf);
-	QString s(buf);
-	painter->drawText(text_rect, text_alignment_, s);
+	io::DisplayCache &dc = display(file);
+	cauto mode = file->mode();
+	if (!dc.has_permissions || dc.mode_of != mode)
+	{
+		char buf[14];
+		strmode(mode, buf);
+		dc.permissions = QString::fromLatin1(buf);
+		dc.mode_of = mode;
+		dc.has_permissions = true;
+	}
+	
+	painter->drawText(text_rect, text_alignment_, dc.permissions);
 }
 
 void
@@ -426,7 +497,17 @@ TableDelegate::DrawSize(QPainter *painter, io::File *file,
 	const QStyleOptionViewItem &option, QFontMetricsF &fm,
 	const QRect &text_rect) const
 {
-	QString text = file->SizeToString();
+	io::DisplayCache &dc = display(file);
+	ci64 size = file->size();
+	cint dir_file_count = file->dir_file_count();
+	if (!dc.has_size || dc.size_of != size || dc.dir_file_count_of != dir_file_count)
+	{
+		dc.size = file->SizeToString();
+		dc.size_of = size;
+		dc.dir_file_count_of = dir_file_count;
+		dc.has_size = true;
+	}
+	
 	const auto a = file->is_dir_or_so() ? AlignCenterMiddle : text_alignment_;
 	
 	if (file->is_dir_or_so())
@@ -435,7 +516,7 @@ TableDelegate::DrawSize(QPainter *painter, io::File *file,
 		QPen pen(brush.color());
 		painter->setPen(pen);
 	}
-	painter->drawText(text_rect, a, text);
+	painter->drawText(text_rect, a, dc.size);
 }
 
 void
@@ -445,9 +526,19 @@ TableDelegate::DrawTime(QPainter *painter, io::File *file,
 {
 	const struct statx_timestamp &stx = (col == Column::TimeCreated)
 		? file->time_created() : file->time_modified();
-	QDateTime tm = QDateTime::fromSecsSinceEpoch(stx.tv_sec);
-	static const QString format = QLatin1String("yyyy-MM-dd hh:mm");
-	QString s = tm.toString(format);
+	io::DisplayCache &dc = display(file);
+	cbool created = (col == Column::TimeCreated);
+	QString &s = created ? dc.time_created : dc.time_modified;
+	bool &has = created ? dc.has_time_created : dc.has_time_modified;
+	i64 &made_of = created ? dc.time_created_of : dc.time_modified_of;
+	if (!has || made_of != stx.tv_sec)
+	{
+		static const QString format = QLatin1String("yyyy-MM-dd hh:mm");
+		s = QDateTime::fromSecsSinceEpoch(stx.tv_sec).toString(format);
+		made_of = stx.tv_sec;
+		has = true;
+	}
+	
 	painter->drawText(text_rect, text_alignment_, s);
 }
 
@@ -461,14 +552,17 @@ TableDelegate::paint(QPainter *painter, const QStyleOptionViewItem &option,
 	painter->setRenderHint(QPainter::Antialiasing);
 	QFontMetricsF fm(option.font);
 	
-	if (min_name_w_ == -1) {
+	if (min_name_w_ == -1 || option.font != font_) {
 		min_name_w_ = fm.horizontalAdvance(QLatin1String("w")) * 7;
+		font_ = option.font;
+		font_generation_++;
 	}
 	
 	const Column col = static_cast<Column>(index.column());
 	initStyleOption(const_cast<QStyleOptionViewItem*>(&option), index);
 	io::Files &files = tab_->view_files();
-	auto g = files.guard();
+	/// Table::paintEvent() normally holds it for all visible cells:
+	auto g = files.guard(table_->cells_locked() ? Lock::No : Lock::Yes);
 	cint row = index.row();
 	
 	if (row >= files.data.vec.size())
@@ -503,6 +597,7 @@ TableDelegate::paint(QPainter *painter, const QStyleOptionViewItem &option,
 	case Column::TimeCreated:
 	case Column::TimeModified: DrawTime(painter, file, option, fm, text_rect, col); break;
 	case Column::Permissions: DrawPermission(painter, file, option, fm, text_rect, col); break;
+	case Column::DirSize: DrawDirSize(painter, file, option, fm, text_rect); break;
 	default: QStyledItemDelegate::paint(painter, option, index);
 	}
 }
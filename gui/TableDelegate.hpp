@@ -5,6 +5,7 @@
 #include "../err.hpp"
 #include "../io/decl.hxx"
 
+#include <QFont>
 #include <QFontMetrics>
 #include <QStyledItemDelegate>
 
@@ -28,8 +29,14 @@ public:
 	
 	virtual void paint(QPainter *painter, const QStyleOptionViewItem &option,
 		const QModelIndex &index) const;
-	
+
 private:
+	io::DisplayCache& display(io::File *file) const;
+	
+	void DrawDirSize(QPainter *painter, io::File *file,
+		const QStyleOptionViewItem &option, QFontMetricsF &fm,
+		const QRect &text_rect) const;
+	
 	void DrawFileName(QPainter *painter, io::File *file, const int row,
 		const QStyleOptionViewItem &option, QFontMetricsF &fm,
 		const QRect &text_rect) const;
@@ -61,6 +68,9 @@ private:
 	Qt::Alignment text_alignment_ = Qt::AlignLeft | Qt::AlignVCenter;
 	
 	mutable int min_name_w_ = -1;
+	/// Bumped when the font changes, the cached names get laid out again.
+	mutable QFont font_;
+	mutable u32 font_generation_ = 0;
 	mutable ClipboardIcons clipboard_icons_ = {};
 };
 
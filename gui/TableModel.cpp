@@ -2,6 +2,7 @@
 
 #include "../App.hpp"
 #include "../AutoDelete.hh"
+#include "DirSizeQueue.hpp"
 #include "../io/File.hpp"
 #include "../io/Files.hpp"
 #include "../io/Notify.hpp"
@@ -12,6 +13,7 @@
 #include "Table.hpp"
 #include "TableHeader.hpp"
 
+#include <algorithm>
 #include <sys/epoll.h>
 #include <cstring>
 #include <sys/ioctl.h>
@@ -660,6 +662,7 @@ QVariant TableModel::headerData(int section_i, Qt::Orientation orientation, int
 			case Column::TimeCreated: return tr("Created");
 			case Column::TimeModified: return tr("Modified");
 			case Column::Permissions: return tr("Permissions");
+			case Column::DirSize: return tr("Folder size");
 			default: {
 				mtl_trace();
 				return {};
@@ -760,6 +763,9 @@ void TableModel::InotifyEventInGuiThread(cornus::io::FileEvent evt)
 			mtl_info("Modified %s", qPrintable(file->name()));
 			struct statx stx;
 			if (io::ReloadMeta(*file, stx, app_->env(), PrintErrors::No)) {
+				/// Its content changed, UpdateVisibleArea() counts it again:
+				if (file->is_dir())
+					file->dir_size(-1);
 				cloned_file = file->Clone();
 			} else {
 				mtl_warn("%s", qPrintable(file->name()));
@@ -848,6 +854,45 @@ void TableModel::InotifyEventInGuiThread(cornus::io::FileEvent evt)
 	
 }
 
+bool TableModel::AppendFiles(const DirId dir_id, QVector<io::File*> &vec)
+{
+	io::Files &files = tab_->view_files();
+	int count;
+	{
+		auto g = files.guard();
+		/// The view moved on since the search started:
+		if (dir_id != files.data.dir_id || !files.data.is_virtual())
+		{
+			for (auto *file: vec)
+				delete file;
+			vec.clear();
+			return false;
+		}
+		count = files.data.vec.size();
+	}
+	
+	if (vec.isEmpty())
+		return true;
+	
+	beginInsertRows(QModelIndex(), count, count + vec.size() - 1);
+	{
+		auto g = files.guard();
+		/// Kept in the sorting order of the view like a folder listing:
+		auto &all = files.data.vec;
+		std::sort(vec.begin(), vec.end(), cornus::io::SortFiles);
+		all.append(vec);
+		std::inplace_merge(all.begin(), all.begin() + count, all.end(), cornus::io::SortFiles);
+		files.cached_files_count = all.size();
+	}
+	endInsertRows();
+	vec.clear();
+	UpdateHeaderNameColumn();
+	/// The merge also moved rows that were there already:
+	UpdateVisibleArea();
+	
+	return true;
+}
+
 bool TableModel::InsertRows(ci32 at, const QVector<cornus::io::File*> &files_to_add)
 {
 	io::Files &files = tab_->view_files();
@@ -946,6 +991,7 @@ void TableModel::SwitchTo(io::FilesData *new_data)
 {
 	const Reload reload = new_data->reloaded() ? Reload::Yes : Reload::No;
 	io::Files &files = tab_->view_files();
+	tab_->table()->dir_sizes()->Cancel();
 	int prev_count, new_count;
 	{
 		auto g = files.guard();
@@ -953,7 +999,8 @@ void TableModel::SwitchTo(io::FilesData *new_data)
 		new_count = new_data->vec.size();
 		if (files.first_time) {
 			files.first_time = false;
-		} else {
+		} else if (!files.data.is_virtual()) {
+			/// A virtual listing has no inotify thread to tell to quit:
 			files.WakeUpInotify(Lock::No, Quit::Yes);
 		}
 	}
@@ -983,6 +1030,7 @@ void TableModel::SwitchTo(io::FilesData *new_data)
 		/// the existing one.
 		files.data.show_hidden_files(new_data->show_hidden_files());
 		files.data.count_dir_files_1_level(new_data->count_dir_files_1_level());
+		files.data.is_virtual(new_data->is_virtual());
 		files.data.vec = new_data->vec;
 		new_data->vec.clear();
 		files.cached_files_count = files.data.vec.size();
@@ -991,16 +1039,20 @@ void TableModel::SwitchTo(io::FilesData *new_data)
 	
 	QSet<int> indices;
 	//tab_->table()->SyncWith(app_->clipboard(), indices);
+	UpdateIndices(indices);
+	UpdateHeaderNameColumn();
+	SelectFilesAfterInotifyBatch();
+	tab_->DisplayingNewDirectory(dir_id, reload);
+	tab_->table()->dir_sizes()->Schedule();
+	
+	if (new_data->is_virtual())
+		return;
+	
 	WatchArgs *args = new WatchArgs {
 		.dir_id = dir_id,
 		.dir_path = new_data->processed_dir_path,
 		.table_model = this,
 	};
-	
-	UpdateIndices(indices);
-	UpdateHeaderNameColumn();
-	SelectFilesAfterInotifyBatch();
-	tab_->DisplayingNewDirectory(dir_id, reload);
 	io::NewThread(gui::WatchDir, args);
 }
 
@@ -1103,6 +1155,7 @@ void TableModel::UpdateVisibleArea()
 	cint row_end = row_start + count_per_page;
 //	mtl_info("row_start: %d, row_end: %d", row_start, row_end);
 	UpdateFileIndexRange(row_start, row_end);
+	table->dir_sizes()->Schedule();
 }
 
 void TableModel::UpdateHeaderNameColumn()
@@ -39,6 +39,9 @@ public:
 	QModelIndex
 	index(int row, int column, const QModelIndex &parent) const override;
 	
+	/// Appends to a virtual listing (search results), takes ownership
+	/// of the files and clears vec:
+	bool AppendFiles(const DirId dir_id, QVector<io::File*> &vec);
 	bool InsertRows(const i32 at, const QVector<cornus::io::File *> &files_to_add);
 	
 	virtual bool insertRows(int row, int count, const QModelIndex &parent) override {
@@ -12,6 +12,8 @@
 #include "Tab.hpp"
 
 #include <QKeyEvent>
+#include <QScrollBar>
+#include <QTextBlock>
 #include <QVector>
 
 namespace cornus::gui {
@@ -48,6 +50,8 @@ TextEdit::TextEdit(Tab *tab): tab_(tab)
 		option.setFlags(option.flags() | QTextOption::ShowTabsAndSpaces);
 		document()->setDefaultTextOption(option);
 	}
+	
+	connect(verticalScrollBar(), &QScrollBar::valueChanged, this, &TextEdit::HighlightVisible);
 }
 
 TextEdit::~TextEdit() {
@@ -64,7 +68,7 @@ bool TextEdit::Display(io::File *cloned_file)
 	full_path_ = cloned_file->build_full_path();
 	io::ReadParams read_params = {};
 	read_params.print_errors = PrintErrors::Yes;
-	read_params.read_max = 1024 * 1024 * 5; // 5 MiB
+	read_params.read_max = TextEditMaxFileSize;
 	
 	ByteArray buf;
 	MTL_CHECK(io::ReadFile(full_path_, buf, read_params));
@@ -84,8 +88,11 @@ bool TextEdit::Display(io::File *cloned_file)
 		s = QString::fromLocal8Bit(buf.data(), buf.size());
 	}
 	
+	hiliter_->BeginLoad();
 	setPlainText(s);
+	hiliter_->EndLoad(filename_);
 	moveCursor(QTextCursor::Start);
+	HighlightVisible();
 	
 	return true;
 }
@@ -96,7 +103,7 @@ TextEdit::GetHiliteMode(const ByteArray &buf, io::File *file)
 	auto ext = file->cache().ext;
 	if (ext.isEmpty()) {
 		ExecInfo exec;
-		app_->TestExecBuf(buf.constData(), buf.size(), exec);
+		exec.TestBuf(buf.constData(), buf.size());
 		
 		if (exec.is_shell_script()) {
 			return HiliteMode::ShellScript;
@@ -145,6 +152,22 @@ TextEdit::GetHiliteMode(const ByteArray &buf, io::File *file)
 	return HiliteMode::None;
 }
 
+void TextEdit::HighlightVisible()
+{
+	QTextBlock first = firstVisibleBlock();
+	QTextBlock last = first;
+	const QPointF offset = contentOffset();
+	cint h = viewport()->height();
+	for (QTextBlock next = first; next.isValid(); next = next.next())
+	{
+		if (blockBoundingGeometry(next).translated(offset).top() > h)
+			break;
+		last = next;
+	}
+	
+	hiliter_->HighlightVisible(first, last);
+}
+
 void TextEdit::keyPressEvent(QKeyEvent *evt)
 {
 	QPlainTextEdit::keyPressEvent(evt);
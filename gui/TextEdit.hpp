@@ -9,6 +9,9 @@
 
 namespace cornus::gui {
 
+/// Bigger files are shown read-only by LargeFileView:
+const i64 TextEditMaxFileSize = 1024 * 1024 * 5; // 5 MiB
+
 class TextEdit: public QPlainTextEdit {
 public:
 	TextEdit(Tab *tab);
@@ -21,6 +24,7 @@ protected:
 	
 private:
 	HiliteMode GetHiliteMode(const cornus::ByteArray &buf, io::File *file);
+	void HighlightVisible();
 	bool Save();
 	
 	App *app_ = nullptr;
@@ -4,6 +4,7 @@
 #include "../App.hpp"
 #include "RestorePainter.hpp"
 #include "Tab.hpp"
+#include "../ThumbnailPrefetcher.hpp"
 #include "TreeItem.hpp"
 #include "TreeModel.hpp"
 
@@ -80,8 +81,9 @@ TreeView::TreeView(App *app, TreeModel *model): app_(app), model_(model)
 	setDropIndicatorShown(true);
 	setDefaultDropAction(Qt::MoveAction);
 	setUpdatesEnabled(true);
-	// enables receiving ordinary mouse events (when mouse is not down)
-	// setMouseTracking(true);
+	// enables receiving ordinary mouse events (when mouse is not down),
+	// used to prefetch the thumbnails of hovered bookmarks
+	setMouseTracking(true);
 }
 
 TreeView::~TreeView() {
@@ -240,9 +242,25 @@ void TreeView::mouseDoubleClickEvent(QMouseEvent *evt)
 	QTreeView::mouseDoubleClickEvent(evt);
 }
 
+void TreeView::leaveEvent(QEvent *evt)
+{
+	QTreeView::leaveEvent(evt);
+	app_->thumbnail_prefetcher()->Hovered(QString());
+}
+
 void TreeView::mouseMoveEvent(QMouseEvent *evt)
 {
 	//HiliteFileUnderMouse();
+	if (!mouse_down_)
+	{
+		QString dir_path;
+		QModelIndex index = indexAt(evt->pos());
+		TreeItem *node = index.isValid() ?
+			static_cast<TreeItem*>(index.internalPointer()) : nullptr;
+		if (node != nullptr && (node->mounted() || node->is_bookmark()))
+			dir_path = node->mount_path();
+		app_->thumbnail_prefetcher()->Hovered(dir_path);
+	}
 	
 	if (mouse_down_ && (drag_start_pos_.x() >= 0 || drag_start_pos_.y() >= 0))
 	{
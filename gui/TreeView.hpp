@@ -39,6 +39,7 @@ protected:
 	
 	void keyPressEvent(QKeyEvent *evt) override;
 	
+	virtual void leaveEvent(QEvent *evt) override;
 	virtual void mouseDoubleClickEvent(QMouseEvent *evt) override;
 	virtual void mouseMoveEvent(QMouseEvent *evt) override;
 	virtual void mousePressEvent(QMouseEvent *evt) override;
@@ -18,8 +18,10 @@ class AttrsDialog;
 class CompleterModel;
 class ConfirmDialog;
 class CountFolder;
+class DirSizeQueue;
 class Hiliter;
 class IconView;
+class LargeFileView;
 class Location;
 class MediaDialog;
 class OpenOrderModel;
@@ -95,6 +97,7 @@ enum class Column : i8 {
 	TimeCreated,
 	TimeModified,
 	Permissions,
+	DirSize,
 	Count,
 };
 
@@ -5,6 +5,7 @@
 #include "../ByteArray.hpp"
 #include "../ElapsedTimer.hpp"
 #include "../prefs.hh"
+#include "../startup.hh"
 #include "TableModel.hpp"
 #include "TreeItem.hpp"
 #include "TreeModel.hpp"
@@ -140,6 +141,7 @@ void* LoadItems(void *args)
 #endif
 	
 	LoadBookmarks(method_args.bookmarks);
+	startup::Mark("Partitions & bookmarks loaded");
 	TreeData &tree_data = app->tree_data();
 	{
 		auto guard = tree_data.guard();
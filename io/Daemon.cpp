@@ -171,6 +171,15 @@ void ReadEvent(int inotify_fd, char *buf,
 	}
 }
 
+void* CompactThumbStore(void *args)
+{
+	/// Joined by the Daemon, the store is its member.
+	ThumbStore *store = (ThumbStore*) args;
+	store->Compact();
+	
+	return nullptr;
+}
+
 void* WatchDesktopFileDirs(void *void_args)
 {
 	pthread_detach(pthread_self());
@@ -290,6 +299,8 @@ Daemon::Daemon()
 	InitTrayIcon();
 	
 	LoadDesktopFiles();
+	mime_cache_.Load();
+	name_index_.Start();
 	
 	QTimer::singleShot(OneHourInMs, this, &Daemon::CheckOldThumbnails);
 }
@@ -304,6 +315,12 @@ Daemon::~Daemon() {
 		}
 		::close(signal_quit_fd_);
 	}
+	name_index_.Stop();
+	if (compact_thread_started_)
+	{
+		thumb_store_.CancelCompact();
+		pthread_join(compact_thread_, nullptr);
+	}
 	notify_.Close();
 	delete life_;
 	life_ = nullptr;
@@ -317,6 +334,14 @@ void Daemon::CheckOldThumbnails()
 	const int three_days = OneHourInMs * 24 * 3;
 	QTimer::singleShot(three_days, this, &Daemon::CheckOldThumbnails);
 	
+	/// Copies the live thumbnails around, keep the event loop going.
+	/// The previous run ended long ago, joining it doesn't wait:
+	if (compact_thread_started_)
+		pthread_join(compact_thread_, nullptr);
+	compact_thread_started_ = io::NewThread(CompactThumbStore, &thumb_store_,
+		PrintErrors::Yes, &compact_thread_);
+	
+	/// What's left of the one file per thumbnail days:
 	const QString &dir_path = io::GetLastingTmpDir();
 	MTL_CHECK_VOID(!dir_path.isEmpty());
 	ci64 ten_days = 60 * 60 * 24 * 10;
@@ -325,7 +350,7 @@ void Daemon::CheckOldThumbnails()
 	while (io::DirItem *next = ds.next())
 	{
 		ci64 modif_time_sec = next->stx.stx_mtime.tv_sec;
-		if (modif_time_sec > now_minus_ten_days)
+		if (modif_time_sec > now_minus_ten_days || S_ISDIR(next->stx.stx_mode))
 			continue;
 		auto ba = (dir_path + next->name).toLocal8Bit();
 		mtl_info("Removing %s", next->name);
@@ -590,8 +615,7 @@ void Daemon::SendDesktopFilesById(ByteArray *ba, cint fd)
 void Daemon::SendDefaultDesktopFileForFullPath(ByteArray *ba, cint fd)
 {
 	QString full_path = ba->next_string();
-	QMimeType mt = mime_db_.mimeTypeForFile(full_path);
-	const QString mime = mt.name();
+	const QString mime = mime_cache_.QueryMimeType(full_path);
 	QVector<DesktopFile*> show_vec;
 	QVector<DesktopFile*> hide_vec;
 	GetDesktopFilesForMime(mime, show_vec, hide_vec);
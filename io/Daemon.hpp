@@ -7,10 +7,12 @@
 #include "../decl.hxx"
 #include "../err.hpp"
 #include "io.hh"
+#include "MimeCache.hpp"
+#include "NameIndex.hpp"
+#include "ThumbStore.hpp"
 #include "Notify.hpp"
 
 #include <QMenu>
-#include <QMimeDatabase>
 #include <QProcess>
 #include <QVector>
 #include <QHash>
@@ -36,6 +38,7 @@ public:
 	DesktopFiles& desktop_files() { return desktop_files_; }
 	CondMutex* get_exit_cm() const { return cm_; }
 	io::ServerLife* life() { return life_; }
+	io::NameIndex& name_index() { return name_index_; }
 	io::Notify& notify() { return notify_; }
 	const QHash<QString, Category>& possible_categories() const { return possible_categories_; }
 	int signal_quit_fd() const { return signal_quit_fd_; }
@@ -72,7 +75,11 @@ private:
 	DesktopFiles desktop_files_ = {};
 	io::Notify notify_ = {};
 	QStringList watch_desktop_file_dirs_;
-	QMimeDatabase mime_db_;
+	io::MimeCache mime_cache_;
+	io::NameIndex name_index_;
+	io::ThumbStore thumb_store_;
+	pthread_t compact_thread_ = {};
+	bool compact_thread_started_ = false;
 	QSystemTrayIcon *tray_icon_ = nullptr;
 	QMenu *tray_menu_ = nullptr;
 	io::ServerLife *life_ = nullptr;
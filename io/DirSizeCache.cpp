@@ -0,0 +1,144 @@
+#include "DirSizeCache.hpp"
+
+#include "../ByteArray.hpp"
+#include "../MutexGuard.hpp"
+#include "io.hh"
+#include "SaveFile.hpp"
+
+#include <time.h>
+
+namespace cornus::io {
+
+static QString CacheFilePath()
+{
+	QString dir_path = io::GetLastingTmpDir();
+	if (!dir_path.endsWith('/'))
+		dir_path.append('/');
+	return dir_path + QLatin1String("dir_sizes");
+}
+
+DirSizeCache::DirSizeCache() {}
+
+DirSizeCache::~DirSizeCache() {}
+
+bool DirSizeCache::Get(const DiskFileId &id, ci64 mtime_ns, DirSizeEntry &entry)
+{
+	MutexGuard guard(&mutex_);
+	LoadIfNeeded();
+	auto it = hash_.constFind(id);
+	if (it == hash_.cend() || it->mtime_ns != mtime_ns)
+		return false;
+	
+	if (time(nullptr) - it->checked_at > DirSizeCacheMaxAgeSec)
+		return false;
+	
+	entry = it.value();
+	return true;
+}
+
+void DirSizeCache::LoadIfNeeded()
+{
+	if (loaded_)
+		return;
+	
+	loaded_ = true;
+	ByteArray ba;
+	io::ReadParams rp = {};
+	rp.print_errors = PrintErrors::No;
+	rp.can_rely = CanRelyOnStatxSize::Yes;
+	if (!io::ReadFile(CacheFilePath(), ba, rp))
+		return;
+	
+	if (!ba.has_more(sizeof(u32) + sizeof(i16) + sizeof(i32)) ||
+		ba.next_u32() != DirSizeCacheMagic || ba.next_i16() != DirSizeCacheAbiVersion)
+		return;
+	
+	ci32 count = ba.next_i32();
+	hash_.reserve(count);
+	for (int i = 0; i < count && ba.has_more(); i++)
+	{
+		DiskFileId id;
+		id.inode_number = ba.next_u64();
+		id.dev_major = ba.next_u32();
+		id.dev_minor = ba.next_u32();
+		DirSizeEntry entry;
+		entry.mtime_ns = ba.next_i64();
+		entry.checked_at = ba.next_i64();
+		entry.files_size = ba.next_i64();
+		entry.file_count = ba.next_i32();
+		cu32 subdir_count = ba.next_u32();
+		entry.subdirs.reserve(subdir_count);
+		for (u32 k = 0; k < subdir_count; k++)
+		{
+			cu32 len = ba.next_u32();
+			if (!ba.has_more(len))
+				return;
+			QByteArray name(len, Qt::Uninitialized);
+			ba.next(name.data(), len);
+			entry.subdirs.append(name);
+		}
+		hash_.insert(id, entry);
+	}
+}
+
+void DirSizeCache::Put(const DiskFileId &id, const DirSizeEntry &entry)
+{
+	MutexGuard guard(&mutex_);
+	LoadIfNeeded();
+	if (hash_.size() >= DirSizeCacheMaxEntries && !hash_.contains(id))
+		return;
+	
+	hash_.insert(id, entry);
+	modified_ = true;
+}
+
+bool DirSizeCache::Save()
+{
+	ByteArray ba;
+	{
+		MutexGuard guard(&mutex_);
+		if (!modified_)
+			return true;
+		
+		ci64 now = time(nullptr);
+		/// Stale entries go, their folders are likely gone:
+		for (auto it = hash_.begin(); it != hash_.end();)
+		{
+			if (now - it->checked_at > DirSizeCacheMaxAgeSec * 30)
+				it = hash_.erase(it);
+			else
+				it++;
+		}
+		
+		ba.add_u32(DirSizeCacheMagic);
+		ba.add_i16(DirSizeCacheAbiVersion);
+		ba.add_i32(hash_.size());
+		for (auto it = hash_.cbegin(); it != hash_.cend(); it++)
+		{
+			const DiskFileId &id = it.key();
+			const DirSizeEntry &entry = it.value();
+			ba.add_u64(id.inode_number);
+			ba.add_u32(id.dev_major);
+			ba.add_u32(id.dev_minor);
+			ba.add_i64(entry.mtime_ns);
+			ba.add_i64(entry.checked_at);
+			ba.add_i64(entry.files_size);
+			ba.add_i32(entry.file_count);
+			ba.add_u32(entry.subdirs.size());
+			for (const QByteArray &name: entry.subdirs)
+			{
+				ba.add_u32(name.size());
+				ba.add(name.constData(), name.size());
+			}
+		}
+		modified_ = false;
+	}
+	
+	io::SaveFile save_file(CacheFilePath());
+	if (!io::WriteToFile(save_file.GetPathToWorkWith(), ba.data(), ba.size()))
+		return false;
+	
+	return save_file.Commit();
+}
+
+}
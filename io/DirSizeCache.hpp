@@ -0,0 +1,56 @@
+#pragma once
+
+#include "../decl.hxx"
+#include "../err.hpp"
+#include "decl.hxx"
+
+#include <QByteArray>
+#include <QHash>
+#include <QVector>
+
+#include <pthread.h>
+
+namespace cornus::io {
+
+const i16 DirSizeCacheAbiVersion = 1;
+const u32 DirSizeCacheMagic = 0x53444e43; // "CNDS"
+/// Entries are trusted this long, files growing in place don't change
+/// their folder's mtime:
+const i64 DirSizeCacheMaxAgeSec = 60 * 60 * 24;
+/// New folders aren't cached anymore past this:
+const int DirSizeCacheMaxEntries = 1000 * 1000;
+
+/// A folder's own files (not its subfolders), as of its mtime.
+struct DirSizeEntry {
+	i64 mtime_ns = 0;
+	i64 checked_at = 0; // seconds since Unix Epoch
+	i64 files_size = 0;
+	i32 file_count = 0;
+	QVector<QByteArray> subdirs; // local 8 bit names
+};
+
+/** Lets DiskUsage skip listing and stat'ing the files of folders whose
+mtime didn't change since they were last counted, it then only opens
+their subfolders. Kept in GetLastingTmpDir()/dir_sizes, loaded on first
+use and saved by Save(). Thread safe. */
+class DirSizeCache {
+public:
+	DirSizeCache();
+	~DirSizeCache();
+	
+	bool Get(const DiskFileId &id, ci64 mtime_ns, DirSizeEntry &entry);
+	void Put(const DiskFileId &id, const DirSizeEntry &entry);
+	bool Save();
+
+private:
+	NO_ASSIGN_COPY_MOVE(DirSizeCache);
+	
+	void LoadIfNeeded();
+	
+	pthread_mutex_t mutex_ = PTHREAD_MUTEX_INITIALIZER;
+	QHash<DiskFileId, DirSizeEntry> hash_;
+	bool loaded_ = false;
+	bool modified_ = false;
+};
+
+}
@@ -0,0 +1,292 @@
+#include "DiskUsage.hpp"
+
+#include "../AutoDelete.hh"
+#include "DirSizeCache.hpp"
+#include "../MutexGuard.hpp"
+#include "../trash.hh"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace cornus::io {
+
+DiskUsage::DiskUsage(DirSizeCache *cache): cache_(cache) {}
+
+DiskUsage::~DiskUsage()
+{
+	Stop();
+}
+
+void DiskUsage::GetProgress(CountRecursiveInfo &info, QVector<DiskUsageTop> *tops,
+	cint top_n)
+{
+	MutexGuard guard(&mutex_);
+	info = info_;
+	if (tops == nullptr)
+		return;
+	
+	*tops = tops_;
+	auto by_size = [](const DiskUsageTop &a, const DiskUsageTop &b) {
+		return a.size > b.size;
+	};
+	cint count = std::min(top_n, int(tops->size()));
+	std::partial_sort(tops->begin(), tops->begin() + count, tops->end(), by_size);
+	tops->resize(count);
+}
+
+bool DiskUsage::Init(const QString &dir_path)
+{
+	if (dir_path.isEmpty())
+		return false;
+	
+	QString path = dir_path;
+	if (!path.endsWith('/'))
+		path.append('/');
+	
+	/// The folder itself might be a trash can:
+	const QString name = path.section('/', -2, -2);
+	Job job;
+	job.path = path.toLocal8Bit();
+	job.in_trash = job.trash_can = !name.isEmpty() &&
+		name.startsWith(trash::basename());
+	
+	MutexGuard guard(&mutex_);
+	trash_name_ = trash::basename().toLocal8Bit();
+	jobs_ = {job};
+	tops_.clear();
+	info_ = {};
+	busy_ = 0;
+	dirs_failed_ = 0;
+	first_error_ = 0;
+	dirs_cached_ = 0;
+	
+	return true;
+}
+
+void DiskUsage::ListFolder(char *buf, const Job &job)
+{
+	if (io::IsPseudoFsDir(job.path))
+		return;
+	
+	cint fd = ::open(job.path.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+	struct stat st;
+	if (fd == -1 || ::fstat(fd, &st) != 0)
+	{
+		cint err = errno;
+		if (fd != -1)
+			::close(fd);
+		MutexGuard guard(&mutex_);
+		dirs_failed_++;
+		if (first_error_ == 0)
+			first_error_ = err;
+		return;
+	}
+	
+	AutoCloseFd ac(fd);
+	const auto id = DiskFileId::FromStat(st);
+	ci64 mtime_ns = i64(st.st_mtim.tv_sec) * 1000'000'000L + st.st_mtim.tv_nsec;
+	DirSizeEntry entry;
+	cbool cached = cache_ != nullptr && cache_->Get(id, mtime_ns, entry);
+	
+	if (!cached)
+	{
+		entry.mtime_ns = mtime_ns;
+		entry.checked_at = time(nullptr);
+		while (!cancel_)
+		{
+			cisize n = ::syscall(SYS_getdents64, fd, buf, DiskUsageDentsBufSize);
+			if (n == -1 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				break;
+			
+			for (isize pos = 0; pos < n;)
+			{
+				auto *dirent = (LinuxDirent64*) (buf + pos);
+				pos += dirent->d_reclen;
+				const char *name = dirent->d_name;
+				if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+					continue;
+				
+				if (dirent->d_type == DT_DIR)
+				{
+					entry.subdirs.append(QByteArray(name));
+					continue;
+				}
+				
+				struct stat file_st;
+				if (::fstatat(fd, name, &file_st, AT_SYMLINK_NOFOLLOW) != 0)
+					continue;
+				
+				if (S_ISDIR(file_st.st_mode)) {
+					entry.subdirs.append(QByteArray(name));
+				} else {
+					entry.files_size += file_st.st_size;
+					entry.file_count++;
+				}
+			}
+		}
+		
+		/// A partial listing must not end up in the cache:
+		if (cancel_)
+			return;
+		
+		if (cache_ != nullptr)
+			cache_->Put(id, entry);
+	}
+	
+	CountRecursiveInfo delta = {};
+	delta.dir_count = 1;
+	delta.size = st.st_size + entry.files_size;
+	delta.file_count = entry.file_count;
+	if (job.in_trash)
+	{
+		delta.trash_size = delta.size;
+		delta.trash_file_count = delta.file_count;
+		delta.trash_dir_count = job.trash_can ? 0 : 1;
+	}
+	
+	QVector<Job> subjobs;
+	subjobs.reserve(entry.subdirs.size());
+	for (const QByteArray &name: entry.subdirs)
+	{
+		Job sub;
+		sub.path = job.path + name + '/';
+		sub.top = job.top;
+		sub.trash_can = !job.in_trash && name.startsWith(trash_name_);
+		sub.in_trash = job.in_trash || sub.trash_can;
+		subjobs.append(sub);
+	}
+	
+	MutexGuard guard(&mutex_);
+	info_.size += delta.size;
+	info_.trash_size += delta.trash_size;
+	info_.file_count += delta.file_count;
+	info_.trash_file_count += delta.trash_file_count;
+	info_.dir_count += delta.dir_count;
+	info_.trash_dir_count += delta.trash_dir_count;
+	if (cached)
+		dirs_cached_++;
+	
+	if (job.top == -1)
+	{
+		/// The subfolders of the folder being counted:
+		for (Job &sub: subjobs)
+		{
+			sub.top = tops_.size();
+			DiskUsageTop top;
+			top.name = QString::fromLocal8Bit(sub.path.chopped(1).mid(job.path.size()));
+			tops_.append(top);
+		}
+	} else {
+		DiskUsageTop &top = tops_[job.top];
+		top.size += delta.size;
+		top.file_count += delta.file_count;
+	}
+	
+	/// Other threads can start on the subfolders meanwhile:
+	if (!subjobs.isEmpty())
+	{
+		jobs_.append(subjobs);
+		pthread_cond_broadcast(&cond_);
+	}
+}
+
+bool DiskUsage::Run(const QString &dir_path)
+{
+	/// No Stop(), it would set cancel_ and a Cancel() from another
+	/// thread must not get lost by resetting it either:
+	if (!Init(dir_path))
+		return false;
+	
+	{
+		MutexGuard guard(&mutex_);
+		threads_++;
+	}
+	WorkLoop();
+	
+	return !cancel_;
+}
+
+bool DiskUsage::running()
+{
+	MutexGuard guard(&mutex_);
+	return threads_ > 0;
+}
+
+bool DiskUsage::Start(const QString &dir_path, cint max_threads)
+{
+	Stop();
+	cancel_ = false;
+	if (!Init(dir_path))
+		return false;
+	
+	cint count = std::clamp(int(sysconf(_SC_NPROCESSORS_ONLN)), 1,
+		std::max(1, max_threads));
+	MutexGuard guard(&mutex_);
+	for (int i = 0; i < count; i++)
+	{
+		/// They wait for the mutex, which is held here:
+		if (!io::NewThread(Work, this))
+			break;
+		threads_++;
+	}
+	
+	return threads_ > 0;
+}
+
+void DiskUsage::Stop()
+{
+	cancel_ = true;
+	MutexGuard guard(&mutex_);
+	pthread_cond_broadcast(&cond_);
+	while (threads_ > 0)
+		pthread_cond_wait(&cond_, &mutex_);
+}
+
+void* DiskUsage::Work(void *p)
+{
+	pthread_detach(pthread_self());
+	DiskUsage *du = (DiskUsage*) p;
+	du->WorkLoop();
+	
+	return nullptr;
+}
+
+void DiskUsage::WorkLoop()
+{
+	QByteArray dents(DiskUsageDentsBufSize, Qt::Uninitialized);
+	
+	while (true)
+	{
+		Job job;
+		{
+			MutexGuard guard(&mutex_);
+			while (jobs_.isEmpty() && busy_ > 0 && !cancel_)
+				pthread_cond_wait(&cond_, &mutex_);
+			
+			if (cancel_ || jobs_.isEmpty())
+			{
+				threads_--;
+				pthread_cond_broadcast(&cond_);
+				return;
+			}
+			
+			job = jobs_.takeLast();
+			busy_++;
+		}
+		
+		ListFolder(dents.data(), job);
+		
+		MutexGuard guard(&mutex_);
+		busy_--;
+		if (busy_ == 0 && jobs_.isEmpty())
+			pthread_cond_broadcast(&cond_);
+	}
+}
+
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "../decl.hxx"
+#include "../err.hpp"
+#include "decl.hxx"
+#include "io.hh"
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+#include <atomic>
+#include <pthread.h>
+
+namespace cornus::io {
+
+const int DiskUsageMaxThreads = 8;
+const isize DiskUsageDentsBufSize = 64 * 1024;
+
+/// One of the subfolders of the folder being counted:
+struct DiskUsageTop {
+	QString name;
+	i64 size = 0;
+	i32 file_count = 0;
+};
+
+/** du-like recursive size count: a pool of threads shares a stack of
+folders, each thread opens a folder, lists it with getdents64() and
+stats its files relative to the folder's fd (fstatat()), then pushes its
+subfolders for any thread to pick up. The totals are added once per
+folder rather than once per file. Folders whose mtime matches the
+DirSizeCache aren't listed at all, their cached file totals and
+subfolder names are used instead. Also tallies each first level
+subfolder for a biggest-first breakdown. */
+class DiskUsage {
+public:
+	DiskUsage(DirSizeCache *cache);
+	~DiskUsage();
+	
+	/// Like Stop() but doesn't wait, for stopping Run() from another thread:
+	void Cancel() { cancel_ = true; }
+	i64 dirs_cached() const { return dirs_cached_; }
+	int dirs_failed() const { return dirs_failed_; }
+	int first_error() const { return first_error_; }
+	/// Copies the totals so far and the @top_n biggest subfolders:
+	void GetProgress(CountRecursiveInfo &info, QVector<DiskUsageTop> *tops = nullptr,
+		cint top_n = 0);
+	/// Counts on the calling thread, returns when done or stopped. For a
+	/// DiskUsage of its own (no Start() threads), it's stopped by a
+	/// Cancel() that came before it too:
+	bool Run(const QString &dir_path);
+	bool running();
+	bool Start(const QString &dir_path, cint max_threads = DiskUsageMaxThreads);
+	void Stop();
+
+private:
+	NO_ASSIGN_COPY_MOVE(DiskUsage);
+	
+	struct Job {
+		QByteArray path; // local 8 bit, ends with '/'
+		int top = -1; // index into tops_, -1 for the folder itself
+		bool in_trash = false;
+		bool trash_can = false; // it's not counted as a folder in trash
+	};
+	
+	bool Init(const QString &dir_path);
+	void ListFolder(char *buf, const Job &job);
+	static void* Work(void *p);
+	void WorkLoop();
+	
+	pthread_mutex_t mutex_ = PTHREAD_MUTEX_INITIALIZER;
+	pthread_cond_t cond_ = PTHREAD_COND_INITIALIZER;
+	DirSizeCache *cache_ = nullptr;
+	QVector<Job> jobs_;
+	QVector<DiskUsageTop> tops_;
+	CountRecursiveInfo info_ = {};
+	QByteArray trash_name_;
+	int busy_ = 0; // threads listing a folder
+	int threads_ = 0; // alive
+	std::atomic<bool> cancel_ = false;
+	std::atomic<int> dirs_failed_ = 0;
+	std::atomic<int> first_error_ = 0; // errno
+	std::atomic<i64> dirs_cached_ = 0;
+};
+
+}
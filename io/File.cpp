@@ -32,11 +32,14 @@ File::~File()
 	
 	delete cache_.media_preview;
 	cache_.media_preview = 0;
+	
+	delete cache_.display;
+	cache_.display = nullptr;
 }
 
 QString File::build_full_path() const
 {
-	if (files_ != nullptr)
+	if (files_ != nullptr && dp_.isEmpty())
 		return files_->data.processed_dir_path + name_.orig;
 	QString s = dp_;
 	
@@ -84,10 +87,12 @@ File* File::Clone(const CloneFileOption opt) const
 	}
 	file->cache_.media_preview = cache_.media_preview ? cache_.media_preview->Clone() : 0;
 	file->cache_.desktop_file = cache_.desktop_file ? cache_.desktop_file->Clone() : 0;
+	file->cache_.display = nullptr; // remade when painted
 	file->bits_ = bits_;
 	file->time_created_ = time_created_;
 	file->time_modified_ = time_modified_;
 	file->dir_file_count_ = dir_file_count_;
+	file->dir_size_ = dir_size_;
 	file->link_target_ = link_target_ ? link_target_->Clone() : nullptr;
 	file->load_thumbnail_ = load_thumbnail_;
 	
@@ -191,7 +196,8 @@ void File::DeleteMediaPreview() {
 
 const QString& File::dir_path(const Lock l) const
 {
-	if (files_ == nullptr)
+	/// Files of a search results listing have their own dir path:
+	if (files_ == nullptr || !dp_.isEmpty())
 		return dp_;
 	
 	bool unlock = false;
@@ -208,6 +214,9 @@ bool File::extensionCanHaveThumbnail() const {
 		return true;
 	
 	auto extension = cache_.ext.toLocal8Bit();
+	if (thumbnail::IsRawExtension(extension) || thumbnail::IsMatroskaExtension(extension))
+		return true;
+	
 	static cauto formats = QImageReader::supportedImageFormats();
 	
 	return formats.contains(extension);
@@ -222,14 +231,13 @@ bool File::has_exec_bit() const {
 
 bool File::IsThumbnailMarkedFailed()
 {
-	ByteArray &ba = ext_attrs_[io::Efa_thumbnail];
-	return ba.size() <= (thumbnail::HeaderSize + 4);
+	return thumbnail::IsMarkedFailed(ext_attrs_[io::Efa_thumbnail]);
 }
 
 void File::MarkThumbnailFailed()
 {
 	ByteArray ba;
-	ba.add_i32(-1);
+	thumbnail::MakeFailedMarker(ba);
 	ext_attrs_.insert(io::Efa_thumbnail, ba);
 }
 
@@ -256,6 +264,8 @@ void File::name(QStringView s)
 	name_.orig = s.toString();
 	name_.lower = name_.orig.toLower();
 	ReadExtension();
+	if (cache_.display != nullptr)
+		cache_.display->name_w = -1;
 }
 
 File* File::NewTextFile(const QString &dir_path, const QString &name)
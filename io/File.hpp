@@ -12,6 +12,7 @@
 #include <QIcon>
 #include <QMetaType> /// Q_DECLARE_METATYPE()
 #include <QMimeDatabase>
+#include <QStaticText>
 
 namespace cornus::io {
 
@@ -38,6 +39,31 @@ inline bool operator & (const CloneFileOption a, const CloneFileOption b) {
 	return (static_cast<u32>(a) & static_cast<u32>(b));
 }
 
+/// What the details view draws for a file, made on its first paint and
+/// remade only when the data (or the font) it was made from changes.
+struct DisplayCache {
+	QStaticText name;
+	QString size;
+	QString dir_size;
+	QString time_created;
+	QString time_modified;
+	QString permissions;
+	f64 name_w = -1; // -1 => the name must be laid out again
+	u32 font_generation = 0;
+	/// What the strings were made from:
+	i64 size_of = 0;
+	int dir_file_count_of = 0;
+	i64 dir_size_of = 0;
+	i64 time_created_of = 0;
+	i64 time_modified_of = 0;
+	mode_t mode_of = 0;
+	bool has_size = false;
+	bool has_dir_size = false;
+	bool has_time_created = false;
+	bool has_time_modified = false;
+	bool has_permissions = false;
+};
+
 struct FileCache {
 	QString mime;
 	QString ext;
@@ -46,6 +72,7 @@ struct FileCache {
 	const QHash<QString, Category> *possible_categories = nullptr;
 	media::MediaPreview *media_preview = nullptr;
 	Thumbnail *thumbnail = nullptr;
+	DisplayCache *display = nullptr;
 };
 
 class File {
@@ -237,6 +264,10 @@ public:
 	void CountDirFiles();
 	int dir_file_count() const { return dir_file_count_; }
 	
+	/// Recursive, filled in by gui::DirSizeQueue for the details view:
+	i64 dir_size() const { return dir_size_; }
+	void dir_size(ci64 n) { dir_size_ = n; }
+
 private:
 	NO_ASSIGN_COPY_MOVE(File);
 	
@@ -258,6 +289,7 @@ private:
 	struct statx_timestamp time_modified_ = {};
 	mode_t mode_ = 0;
 	int dir_file_count_ = -1; // -2 => an error occured
+	i64 dir_size_ = -1; // -1 => not counted yet, -2 => an error occured
 	io::FileBits bits_ = FileBits::Empty;
 	FileType type_ = FileType::Unknown;
 	bool load_thumbnail_ = true;
@@ -20,6 +20,7 @@ class FilesData {
 	cu16 CanWriteToDir =       1u << 3;
 	cu16 CountDirFiles1Level = 1u << 4;
 	cu16 Reloaded =            1u << 5;
+	cu16 Virtual =             1u << 6;
 	
 public:
 	FilesData();
@@ -97,6 +98,16 @@ public:
 		else
 			bits_ &= ~ThreadExited;
 	}
+	
+	/// A listing of search results rather than of processed_dir_path,
+	/// each file has its own dir path and the folder isn't watched.
+	bool is_virtual() const { return bits_ & Virtual; }
+	void is_virtual(cbool flag) {
+		if (flag)
+			bits_ |= Virtual;
+		else
+			bits_ &= ~Virtual;
+	}
 };
 
 class Files {
@@ -166,4 +177,5 @@ public:
 };
 
 }
+Q_DECLARE_METATYPE(cornus::io::Files*);
 Q_DECLARE_METATYPE(cornus::io::FilesData*);
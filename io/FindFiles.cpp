@@ -0,0 +1,368 @@
+#include "FindFiles.hpp"
+
+#include "../AutoDelete.hh"
+#include "../ByteArray.hpp"
+#include "File.hpp"
+#include "../MutexGuard.hpp"
+#include "io.hh"
+#include "socket.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace cornus::io {
+
+FindFiles::FindFiles() {}
+
+FindFiles::~FindFiles()
+{
+	Stop();
+	ClearFound();
+}
+
+void FindFiles::AddFile(QString &dir_path, const QString &name)
+{
+	auto *file = new io::File(params_.files);
+	file->dir_path(dir_path);
+	file->name(name);
+	file->cache().possible_categories = params_.possible_categories;
+	struct statx stx;
+	if (!ReloadMeta(*file, stx, params_.env, PrintErrors::No, &dir_path))
+	{
+		delete file;
+		return;
+	}
+	
+	MutexGuard guard(&mutex_);
+	if (found_count_ >= FindMaxResults)
+	{
+		limit_reached_ = true;
+		cancel_ = true;
+		delete file;
+		return;
+	}
+	
+	found_count_++;
+	found_.append(file);
+}
+
+void FindFiles::ClearFound()
+{
+	MutexGuard guard(&mutex_);
+	for (io::File *next: found_)
+		delete next;
+	found_.clear();
+}
+
+void FindFiles::ListFolder(Worker &worker, const QByteArray &dir_path)
+{
+	if (io::IsPseudoFsDir(dir_path))
+		return;
+	
+	cint fd = ::open(dir_path.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1)
+		return;
+	
+	AutoCloseFd ac(fd);
+	dirs_listed_++;
+	worker.dir_path = QString::fromLocal8Bit(dir_path);
+	QVector<QByteArray> subdirs;
+	char *buf = worker.dents.data();
+	
+	while (!cancel_)
+	{
+		cisize n = ::syscall(SYS_getdents64, fd, buf, FindDentsBufSize);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		
+		for (isize pos = 0; pos < n && !cancel_;)
+		{
+			auto *entry = (LinuxDirent64*) (buf + pos);
+			pos += entry->d_reclen;
+			const char *name = entry->d_name;
+			if (name[0] == '.')
+			{
+				if (name[1] == 0 || (name[1] == '.' && name[2] == 0))
+					continue;
+				if (!params_.show_hidden_files)
+					continue;
+			}
+			
+			auto type = entry->d_type;
+			if (type == DT_UNKNOWN)
+			{
+				struct stat st;
+				if (::fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+					continue;
+				if (S_ISDIR(st.st_mode))
+					type = DT_DIR;
+			}
+			
+			if (type == DT_DIR)
+				subdirs.append(dir_path + name + '/');
+			
+			if (Matches(worker, name, strlen(name)))
+				AddFile(worker.dir_path, QString::fromLocal8Bit(name));
+		}
+	}
+	
+	/// Other threads can start on the subfolders meanwhile:
+	if (!subdirs.isEmpty())
+	{
+		MutexGuard guard(&mutex_);
+		dirs_.append(subdirs);
+		pthread_cond_broadcast(&cond_);
+	}
+}
+
+bool FindFiles::Matches(Worker &worker, const char *name, cisize len) const
+{
+	if (params_.match == FindMatch::Substring && ascii_needle_)
+	{
+		if (params_.case_sensitive)
+			return memmem(name, len, needle_.constData(), needle_.size()) != nullptr;
+		
+		/// NAME_MAX is 255:
+		char folded[256];
+		cisize count = std::min(len, isize(sizeof folded));
+		FoldAscii(name, folded, count);
+		return memmem(folded, count, needle_.constData(), needle_.size()) != nullptr;
+	}
+	
+	const QString s = QString::fromLocal8Bit(name, len);
+	if (params_.match == FindMatch::Substring)
+	{
+		return s.contains(params_.pattern, params_.case_sensitive ?
+			Qt::CaseSensitive : Qt::CaseInsensitive);
+	}
+	
+	return worker.regex.match(s).hasMatch();
+}
+
+void* FindFiles::QueryIndex(void *p)
+{
+	pthread_detach(pthread_self());
+	FindFiles *find = (FindFiles*) p;
+	QVector<QString> paths;
+	bool limit_reached = false;
+	cbool covered = find->QueryNameIndex(paths, limit_reached);
+	if (covered)
+	{
+		find->from_index_ = true;
+		find->limit_reached_ = limit_reached;
+		QString dir_path;
+		for (const QString &full_path: paths)
+		{
+			if (find->cancel_)
+				break;
+			cint slash = full_path.lastIndexOf('/');
+			if (QStringView(full_path).left(slash + 1) != dir_path)
+				dir_path = full_path.left(slash + 1);
+			/// Gone since it got indexed unless ReloadMeta() succeeds:
+			find->AddFile(dir_path, full_path.mid(slash + 1));
+		}
+	}
+	
+	MutexGuard guard(&find->mutex_);
+	if (!covered && !find->cancel_ && !find->params_.by_media)
+	{
+		find->dirs_ = {find->params_.dir_path.toLocal8Bit()};
+		find->StartWalkers();
+	}
+	
+	find->threads_--;
+	pthread_cond_broadcast(&find->cond_);
+	
+	return nullptr;
+}
+
+bool FindFiles::QueryNameIndex(QVector<QString> &paths, bool &limit_reached) const
+{
+	cint fd = io::socket::Client(cornus::SocketPath);
+	if (fd == -1)
+		return false;
+	
+	ByteArray ba;
+	if (params_.by_media)
+	{
+		const MediaQuery &m = params_.media;
+		ba.set_msg_id(io::Message::NameIndexMediaQuery);
+		ba.add_string(m.dir_path);
+		ba.add_i32(m.actor);
+		ba.add_i32(m.director);
+		ba.add_i32(m.writer);
+		ba.add_i16(m.genre);
+		ba.add_i16(m.subgenre);
+		ba.add_i16(m.country);
+		ba.add_i16(m.video_codec);
+		ba.add_i16(m.year_from);
+		ba.add_i16(m.year_to);
+		ba.add_i32(m.min_height);
+		ba.add_i32(FindMaxResults);
+	} else {
+		ba.set_msg_id(io::Message::NameIndexQuery);
+		ba.add_string(params_.dir_path);
+		ba.add_string(params_.pattern);
+		ba.add_i8(i8(params_.match));
+		ba.add_i8(params_.case_sensitive ? 1 : 0);
+		ba.add_i8(params_.show_hidden_files ? 1 : 0);
+		ba.add_i32(FindMaxResults);
+	}
+	if (!ba.Send(fd, CloseSocket::No))
+	{
+		::close(fd);
+		return false;
+	}
+	
+	ByteArray reply;
+	if (!reply.Receive(fd) || !reply.has_more(sizeof(i8) * 2 + sizeof(i32)))
+		return false;
+	
+	cbool covered = reply.next_i8() == 1;
+	limit_reached = reply.next_i8() == 1;
+	cint count = reply.next_i32();
+	for (int i = 0; i < count && reply.has_more(); i++)
+		paths.append(reply.next_string());
+	
+	return covered;
+}
+
+bool FindFiles::running()
+{
+	MutexGuard guard(&mutex_);
+	return threads_ > 0;
+}
+
+bool FindFiles::Start(const FindParams &params)
+{
+	Stop();
+	ClearFound();
+	
+	if (params.pattern.isEmpty() && !params.by_media)
+		return false;
+	
+	params_ = params;
+	if (!params_.dir_path.endsWith('/'))
+		params_.dir_path.append('/');
+	
+	regex_pattern_.clear();
+	needle_.clear();
+	ascii_needle_ = false;
+	if (params_.match == FindMatch::Substring)
+	{
+		needle_ = params_.pattern.toUtf8();
+		ascii_needle_ = std::none_of(needle_.cbegin(), needle_.cend(),
+			[](const char c) { return c & 0x80; });
+		if (!params_.case_sensitive)
+			FoldAscii(needle_.constData(), needle_.data(), needle_.size());
+	} else {
+		regex_pattern_ = (params_.match == FindMatch::Glob) ?
+			QRegularExpression::wildcardToRegularExpression(params_.pattern)
+			: params_.pattern;
+		const QRegularExpression regex(regex_pattern_);
+		if (!regex.isValid())
+		{
+			mtl_warn("%s", qPrintable(regex.errorString()));
+			return false;
+		}
+	}
+	
+	MutexGuard guard(&mutex_);
+	found_count_ = 0;
+	busy_ = 0;
+	cancel_ = false;
+	limit_reached_ = false;
+	from_index_ = false;
+	dirs_listed_ = 0;
+	
+	/// It starts the walkers if the folder isn't indexed:
+	if ((params_.use_name_index || params_.by_media) && io::NewThread(QueryIndex, this))
+	{
+		threads_++;
+		return true;
+	}
+	
+	dirs_ = {params_.dir_path.toLocal8Bit()};
+	StartWalkers();
+	
+	return threads_ > 0;
+}
+
+void FindFiles::StartWalkers()
+{
+	cint count = std::clamp(int(sysconf(_SC_NPROCESSORS_ONLN)), 1, FindMaxThreads);
+	for (int i = 0; i < count; i++)
+	{
+		/// They wait for the mutex, which the caller holds:
+		if (!io::NewThread(Work, this))
+			break;
+		threads_++;
+	}
+}
+
+void FindFiles::Stop()
+{
+	cancel_ = true;
+	MutexGuard guard(&mutex_);
+	pthread_cond_broadcast(&cond_);
+	while (threads_ > 0)
+		pthread_cond_wait(&cond_, &mutex_);
+}
+
+void FindFiles::TakeFiles(QVector<io::File*> &files)
+{
+	MutexGuard guard(&mutex_);
+	files.append(found_);
+	found_.clear();
+}
+
+void* FindFiles::Work(void *p)
+{
+	pthread_detach(pthread_self());
+	FindFiles *find = (FindFiles*) p;
+	Worker worker;
+	worker.dents.resize(FindDentsBufSize);
+	if (!find->regex_pattern_.isEmpty())
+	{
+		auto options = QRegularExpression::DontCaptureOption;
+		if (!find->params_.case_sensitive)
+			options |= QRegularExpression::CaseInsensitiveOption;
+		worker.regex = QRegularExpression(find->regex_pattern_, options);
+		worker.regex.optimize();
+	}
+	
+	while (true)
+	{
+		QByteArray dir_path;
+		{
+			MutexGuard guard(&find->mutex_);
+			while (find->dirs_.isEmpty() && find->busy_ > 0 && !find->cancel_)
+				pthread_cond_wait(&find->cond_, &find->mutex_);
+			
+			if (find->cancel_ || find->dirs_.isEmpty())
+			{
+				find->threads_--;
+				pthread_cond_broadcast(&find->cond_);
+				return nullptr;
+			}
+			
+			dir_path = find->dirs_.takeLast();
+			find->busy_++;
+		}
+		
+		find->ListFolder(worker, dir_path);
+		
+		MutexGuard guard(&find->mutex_);
+		find->busy_--;
+		if (find->busy_ == 0 && find->dirs_.isEmpty())
+			pthread_cond_broadcast(&find->cond_);
+	}
+}
+
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "../category.hh"
+#include "../decl.hxx"
+#include "decl.hxx"
+#include "../err.hpp"
+#include "NameIndex.hpp"
+
+#include <QByteArray>
+#include <QHash>
+#include <QProcessEnvironment>
+#include <QRegularExpression>
+#include <QString>
+#include <QVector>
+
+#include <atomic>
+#include <pthread.h>
+
+namespace cornus::io {
+
+/// The search stops once it found this many files:
+const int FindMaxResults = 10000;
+const int FindMaxThreads = 8;
+/// Buffer for getdents64(), big folders are listed in few syscalls:
+const isize FindDentsBufSize = 64 * 1024;
+
+struct FindParams {
+	QString dir_path;
+	QString pattern;
+	/// Set as File::files() of the found files, which then can go
+	/// straight into the view's (virtual) listing.
+	io::Files *files = nullptr;
+	const QHash<QString, Category> *possible_categories = nullptr;
+	QProcessEnvironment env;
+	FindMatch match = FindMatch::Substring;
+	bool case_sensitive = false;
+	bool show_hidden_files = false;
+	/// Ask cornus_io first, its NameIndex answers for indexed folders:
+	bool use_name_index = true;
+	/// Instead of the pattern, only answered by the NameIndex:
+	MediaQuery media = {};
+	bool by_media = false;
+};
+
+/** Recursive file name search: a pool of threads shares a stack of
+folders, each thread lists a folder with getdents64() (d_type spares a
+stat of every entry), pushes its subfolders and matches the names of all
+its entries (symlinks aren't followed). Only matching files are stat'd
+and made into io::File objects, TakeFiles() moves them to the caller as
+they're found. If cornus_io keeps an index of the folder the results come
+from it instead, the walk is only the fallback. */
+class FindFiles {
+public:
+	FindFiles();
+	~FindFiles();
+	
+	i64 dirs_listed() const { return dirs_listed_; }
+	bool from_index() const { return from_index_; }
+	bool limit_reached() const { return limit_reached_; }
+	bool running();
+	bool Start(const FindParams &params);
+	void Stop();
+	/// The caller owns the files:
+	void TakeFiles(QVector<io::File*> &files);
+
+private:
+	NO_ASSIGN_COPY_MOVE(FindFiles);
+	
+	struct Worker {
+		QByteArray dents;
+		/// Own copy, QRegularExpression isn't meant to be shared
+		/// between threads.
+		QRegularExpression regex;
+		QString dir_path; // of the folder being listed, ends with '/'
+	};
+	
+	void AddFile(QString &dir_path, const QString &name);
+	void ClearFound();
+	void ListFolder(Worker &worker, const QByteArray &dir_path);
+	bool Matches(Worker &worker, const char *name, cisize len) const;
+	static void* QueryIndex(void *p);
+	bool QueryNameIndex(QVector<QString> &paths, bool &limit_reached) const;
+	void StartWalkers();
+	static void* Work(void *p);
+	
+	pthread_mutex_t mutex_ = PTHREAD_MUTEX_INITIALIZER;
+	pthread_cond_t cond_ = PTHREAD_COND_INITIALIZER;
+	QVector<QByteArray> dirs_; // local 8 bit, end with '/'
+	QVector<io::File*> found_;
+	int found_count_ = 0;
+	int busy_ = 0; // threads listing a folder
+	int threads_ = 0; // alive
+	FindParams params_ = {};
+	QString regex_pattern_; // for Glob and Regex
+	QByteArray needle_; // utf-8, lowered unless case sensitive
+	bool ascii_needle_ = false; // then substrings are matched with memmem()
+	std::atomic<bool> cancel_ = false;
+	std::atomic<bool> limit_reached_ = false;
+	std::atomic<bool> from_index_ = false;
+	std::atomic<i64> dirs_listed_ = 0;
+};
+
+}
@@ -0,0 +1,272 @@
+#include "Grep.hpp"
+
+#include "../AutoDelete.hh"
+#include "../MutexGuard.hpp"
+#include "io.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace cornus::io {
+
+Grep::Grep() {}
+
+Grep::~Grep()
+{
+	Stop();
+}
+
+void Grep::AddMatch(const QByteArray &path, const char *line, const isize len,
+	ci64 line_number)
+{
+	GrepMatch match;
+	match.full_path = QString::fromLocal8Bit(path);
+	match.line = QString::fromUtf8(line, std::min(len, isize(GrepMaxLineChars * 4)))
+		.trimmed().left(GrepMaxLineChars);
+	match.line_number = line_number;
+	
+	MutexGuard guard(&mutex_);
+	if (match_count_ >= GrepMaxMatches)
+	{
+		limit_reached_ = true;
+		cancel_ = true;
+		return;
+	}
+	
+	match_count_++;
+	matches_.append(match);
+}
+
+bool Grep::running()
+{
+	MutexGuard guard(&mutex_);
+	return threads_ > 0;
+}
+
+void Grep::SearchFile(Worker &worker, const int dir_fd, const char *name,
+	const QByteArray &dir_path)
+{
+	cint fd = ::openat(dir_fd, name, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+	if (fd == -1)
+		return;
+	
+	AutoCloseFd ac(fd);
+	struct stat st;
+	if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+		st.st_size == 0 || st.st_size > GrepMaxFileSize)
+		return;
+	
+	files_searched_++;
+	cisize needle_len = needle_.size();
+	/// A match can span two reads, so the tail of one is kept for the next:
+	cisize keep = needle_len - 1;
+	char *buf = worker.buf.data();
+	char *hay = case_sensitive_ ? buf : worker.folded.data();
+	isize have = 0;
+	i64 line_number = 1;
+	bool first_read = true;
+	
+	while (!cancel_)
+	{
+		cisize n = ::read(fd, buf + have, GrepBufSize - have);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return;
+		
+		if (first_read)
+		{
+			first_read = false;
+			if (memchr(buf, 0, std::min(n, GrepBinaryProbeSize)) != nullptr)
+				return;
+		}
+		
+		cisize len = have + n;
+		if (!case_sensitive_)
+			FoldAscii(buf + have, hay + have, n);
+		
+		const char *found = (const char*) memmem(hay, len, needle_.constData(), needle_len);
+		if (found != nullptr)
+		{
+			cisize at = found - hay;
+			line_number += std::count(buf, buf + at, '\n');
+			const char *line_start = (const char*) memrchr(buf, '\n', at);
+			line_start = (line_start == nullptr) ? buf : line_start + 1;
+			const char *line_end = (const char*) memchr(buf + at, '\n', len - at);
+			if (line_end == nullptr)
+				line_end = buf + len;
+			AddMatch(dir_path + name, line_start, line_end - line_start, line_number);
+			return;
+		}
+		
+		if (len <= keep)
+		{
+			have = len;
+			continue;
+		}
+		
+		line_number += std::count(buf, buf + len - keep, '\n');
+		memmove(buf, buf + len - keep, keep);
+		if (!case_sensitive_)
+			memmove(hay, hay + len - keep, keep);
+		have = keep;
+	}
+}
+
+void Grep::SearchFolder(Worker &worker, const QByteArray &dir_path)
+{
+	if (io::IsPseudoFsDir(dir_path))
+		return;
+	
+	DIR *dir = ::opendir(dir_path.constData());
+	if (dir == nullptr)
+		return;
+	
+	cint dir_fd = ::dirfd(dir);
+	QVector<QByteArray> subdirs;
+	QVector<QByteArray> files;
+	struct dirent *entry;
+	while (!cancel_ && (entry = ::readdir(dir)) != nullptr)
+	{
+		const char *name = entry->d_name;
+		if (name[0] == '.')
+		{
+			if (name[1] == 0 || (name[1] == '.' && name[2] == 0))
+				continue;
+			if (!show_hidden_files_)
+				continue;
+		}
+		
+		auto type = entry->d_type;
+		if (type == DT_UNKNOWN)
+		{
+			struct stat st;
+			if (::fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+				continue;
+			if (S_ISDIR(st.st_mode))
+				type = DT_DIR;
+			else if (S_ISREG(st.st_mode))
+				type = DT_REG;
+		}
+		
+		if (type == DT_DIR)
+			subdirs.append(dir_path + name + '/');
+		else if (type == DT_REG)
+			files.append(QByteArray(name));
+	}
+	
+	/// Other threads can start on the subfolders meanwhile:
+	if (!subdirs.isEmpty())
+	{
+		MutexGuard guard(&mutex_);
+		dirs_.append(subdirs);
+		pthread_cond_broadcast(&cond_);
+	}
+	
+	for (const QByteArray &name: files)
+	{
+		if (cancel_)
+			break;
+		SearchFile(worker, dir_fd, name.constData(), dir_path);
+	}
+	
+	::closedir(dir);
+}
+
+bool Grep::Start(const GrepParams &params)
+{
+	Stop();
+	
+	const QByteArray text = params.text.toUtf8();
+	if (text.isEmpty() || text.size() >= GrepBufSize / 2)
+		return false;
+	
+	case_sensitive_ = params.case_sensitive;
+	show_hidden_files_ = params.show_hidden_files;
+	needle_ = text;
+	if (!case_sensitive_)
+		FoldAscii(text.constData(), needle_.data(), text.size());
+	
+	QString dir_path = params.dir_path;
+	if (!dir_path.endsWith('/'))
+		dir_path.append('/');
+	
+	MutexGuard guard(&mutex_);
+	dirs_ = {dir_path.toLocal8Bit()};
+	matches_.clear();
+	match_count_ = 0;
+	busy_ = 0;
+	cancel_ = false;
+	limit_reached_ = false;
+	files_searched_ = 0;
+	
+	cint count = std::clamp(int(sysconf(_SC_NPROCESSORS_ONLN)), 1, GrepMaxThreads);
+	for (int i = 0; i < count; i++)
+	{
+		/// They wait for the mutex, which is held till this returns:
+		if (!io::NewThread(Work, this))
+			break;
+		threads_++;
+	}
+	
+	return threads_ > 0;
+}
+
+void Grep::Stop()
+{
+	cancel_ = true;
+	MutexGuard guard(&mutex_);
+	pthread_cond_broadcast(&cond_);
+	while (threads_ > 0)
+		pthread_cond_wait(&cond_, &mutex_);
+}
+
+void Grep::TakeMatches(QVector<GrepMatch> &matches)
+{
+	MutexGuard guard(&mutex_);
+	matches.append(matches_);
+	matches_.clear();
+}
+
+void* Grep::Work(void *p)
+{
+	pthread_detach(pthread_self());
+	Grep *grep = (Grep*) p;
+	Worker worker;
+	worker.buf.resize(GrepBufSize);
+	if (!grep->case_sensitive_)
+		worker.folded.resize(GrepBufSize);
+	
+	while (true)
+	{
+		QByteArray dir_path;
+		{
+			MutexGuard guard(&grep->mutex_);
+			while (grep->dirs_.isEmpty() && grep->busy_ > 0 && !grep->cancel_)
+				pthread_cond_wait(&grep->cond_, &grep->mutex_);
+			
+			if (grep->cancel_ || grep->dirs_.isEmpty())
+			{
+				grep->threads_--;
+				pthread_cond_broadcast(&grep->cond_);
+				return nullptr;
+			}
+			
+			dir_path = grep->dirs_.takeLast();
+			grep->busy_++;
+		}
+		
+		grep->SearchFolder(worker, dir_path);
+		
+		MutexGuard guard(&grep->mutex_);
+		grep->busy_--;
+		if (grep->busy_ == 0 && grep->dirs_.isEmpty())
+			pthread_cond_broadcast(&grep->cond_);
+	}
+}
+
+}
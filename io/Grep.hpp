@@ -0,0 +1,82 @@
+#pragma once
+
+#include "../err.hpp"
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+#include <atomic>
+#include <pthread.h>
+
+namespace cornus::io {
+
+/// Bigger files aren't searched:
+const i64 GrepMaxFileSize = 64 * 1024 * 1024;
+/// The search stops once it found this many files:
+const int GrepMaxMatches = 10000;
+const int GrepMaxThreads = 8;
+const isize GrepBufSize = 1024 * 1024;
+/// Files with a zero byte in this many first bytes are binary:
+const isize GrepBinaryProbeSize = 8 * 1024;
+const int GrepMaxLineChars = 200;
+
+struct GrepMatch {
+	QString full_path;
+	QString line; // the first matching line
+	i64 line_number = 0; // starts at 1
+};
+
+struct GrepParams {
+	QString dir_path;
+	QString text;
+	bool case_sensitive = false;
+	bool show_hidden_files = false;
+};
+
+/** Recursive content search: a pool of threads shares a stack of
+folders, each thread lists a folder, pushes its subfolders and searches
+its regular files (symlinks aren't followed) with large reads and
+memmem(), case insensitive matching only folds ASCII. Matches are
+collected as they're found, TakeMatches() moves them to the caller. */
+class Grep {
+public:
+	Grep();
+	~Grep();
+	
+	i64 files_searched() const { return files_searched_; }
+	bool limit_reached() const { return limit_reached_; }
+	bool running();
+	bool Start(const GrepParams &params);
+	void Stop();
+	void TakeMatches(QVector<GrepMatch> &matches);
+
+private:
+	NO_ASSIGN_COPY_MOVE(Grep);
+	
+	struct Worker {
+		QByteArray buf;
+		QByteArray folded; // buf with ASCII lowered
+	};
+	
+	void AddMatch(const QByteArray &path, const char *line, const isize len, ci64 line_number);
+	void SearchFile(Worker &worker, const int dir_fd, const char *name, const QByteArray &dir_path);
+	void SearchFolder(Worker &worker, const QByteArray &dir_path);
+	static void* Work(void *p);
+	
+	pthread_mutex_t mutex_ = PTHREAD_MUTEX_INITIALIZER;
+	pthread_cond_t cond_ = PTHREAD_COND_INITIALIZER;
+	QVector<QByteArray> dirs_; // local 8 bit, end with '/'
+	QVector<GrepMatch> matches_;
+	int match_count_ = 0;
+	int busy_ = 0; // threads searching a folder
+	int threads_ = 0; // alive
+	QByteArray needle_; // utf-8, lowered unless case sensitive
+	bool case_sensitive_ = false;
+	bool show_hidden_files_ = false;
+	std::atomic<bool> cancel_ = false;
+	std::atomic<bool> limit_reached_ = false;
+	std::atomic<i64> files_searched_ = 0;
+};
+
+}
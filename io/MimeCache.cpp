@@ -0,0 +1,366 @@
+#include "MimeCache.hpp"
+
+#include "../AutoDelete.hh"
+#include "../ByteArray.hpp"
+#include "../prefs.hh"
+#include "io.hh"
+#include "SaveFile.hpp"
+
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace cornus::io {
+
+/// Don't rewrite the cache file after every new entry:
+static const int SaveAfterChanges = 64;
+/// How often (seconds) a miss may check whether the other process updated the file:
+static const i64 DiskCheckInterval = 2;
+
+static bool SameTime(const MimeCacheEntry &e, const struct statx &stx)
+{
+	return e.mtime_sec == stx.stx_mtime.tv_sec && e.mtime_nsec == stx.stx_mtime.tv_nsec;
+}
+
+static bool IsNewer(const MimeCacheEntry &a, const MimeCacheEntry &b)
+{
+	if (a.mtime_sec != b.mtime_sec)
+		return a.mtime_sec > b.mtime_sec;
+	return a.mtime_nsec > b.mtime_nsec;
+}
+
+MimeCache::MimeCache() {}
+
+MimeCache::~MimeCache()
+{
+	if (unsaved_count_ > 0)
+		Save();
+}
+
+QString MimeCache::filePath()
+{
+	QString full_path = prefs::QueryAppConfigPath();
+	if (!full_path.endsWith('/'))
+		full_path.append('/');
+	full_path.append("mime_cache.bin");
+	return full_path;
+}
+
+MimeCacheEntry* MimeCache::Find(const DiskFileId &id, const struct statx &stx)
+{
+	auto it = hash_.find(id);
+	if (it == hash_.end())
+		return nullptr;
+	
+	if (!SameTime(it.value(), stx))
+	{
+		hash_.erase(it);
+		return nullptr;
+	}
+	
+	return &it.value();
+}
+
+MimeCacheEntry& MimeCache::Insert(const DiskFileId &id, const struct statx &stx)
+{
+	MimeCacheEntry &e = hash_[id];
+	if (!SameTime(e, stx))
+	{
+		e = {};
+		e.mtime_sec = stx.stx_mtime.tv_sec;
+		e.mtime_nsec = stx.stx_mtime.tv_nsec;
+	}
+	e.time_added = u32(time(NULL) / 60);
+	
+	return e;
+}
+
+void MimeCache::Load()
+{
+	/// Keeps what was queried before loading, cornus loads it lazily.
+	MergeFromDisk();
+}
+
+void MimeCache::MergeFromDisk()
+{
+	QString path = filePath();
+	auto path_ba = path.toLocal8Bit();
+	struct statx stx;
+	if (statx(0, path_ba.data(), 0, STATX_MTIME, &stx) != 0)
+		return;
+	
+	disk_mtime_ = stx.stx_mtime;
+	ByteArray buf;
+	io::ReadParams params = {};
+	params.can_rely = CanRelyOnStatxSize::Yes;
+	params.print_errors = PrintErrors::No;
+	mtl_check_void(io::ReadFile(path, buf, params));
+	
+	if (!buf.has_more(sizeof(i16)) || buf.next_i16() != MimeCacheAbiVersion)
+		return;
+	
+	/// The fixed size part of a record, two strings follow:
+	static const isize RecordSize = sizeof(u64) + sizeof(u32) * 2 + sizeof(i64) +
+		sizeof(u32) * 2 + sizeof(u16) + sizeof(u8);
+	auto next_string = [&buf](QString &s) -> bool {
+		if (!buf.has_more(sizeof(i32)))
+			return false;
+		ci32 len = buf.next_i32();
+		if (len < 0 || !buf.has_more(len))
+			return false;
+		s = QString::fromLocal8Bit(buf.constData() + buf.at(), len);
+		buf.to(buf.at() + len);
+		return true;
+	};
+	
+	/// All or nothing, a truncated or corrupt file isn't merged at all
+	/// and the next Save() replaces it:
+	QVector<QPair<DiskFileId, MimeCacheEntry>> records;
+	while (buf.has_more())
+	{
+		if (!buf.has_more(RecordSize))
+		{
+			mtl_warn("Corrupt %s", path_ba.data());
+			return;
+		}
+		
+		DiskFileId id;
+		id.inode_number = buf.next_u64();
+		id.dev_major = buf.next_u32();
+		id.dev_minor = buf.next_u32();
+		MimeCacheEntry e;
+		e.mtime_sec = buf.next_i64();
+		e.mtime_nsec = buf.next_u32();
+		e.time_added = buf.next_u32();
+		e.exec_type = buf.next_u16();
+		e.bits = buf.next_u8();
+		if (!next_string(e.mime) || !next_string(e.starter))
+		{
+			mtl_warn("Corrupt %s", path_ba.data());
+			return;
+		}
+		records.append({id, e});
+	}
+	
+	for (const auto &record: records)
+	{
+		const DiskFileId &id = record.first;
+		const MimeCacheEntry &e = record.second;
+		auto it = hash_.find(id);
+		if (it == hash_.end()) {
+			hash_.insert(id, e);
+			continue;
+		}
+		
+		MimeCacheEntry &mine = it.value();
+		if (IsNewer(e, mine)) {
+			mine = e;
+		} else if (!IsNewer(mine, e)) {
+			/// Same file version, take what the other process learned:
+			if (!mine.has(MimeCacheBits::HasMime) && e.has(MimeCacheBits::HasMime))
+			{
+				mine.mime = e.mime;
+				mine.bits |= MimeCacheBits::HasMime;
+			}
+			if (!mine.has(MimeCacheBits::HasExec) && e.has(MimeCacheBits::HasExec))
+			{
+				mine.exec_type = e.exec_type;
+				mine.starter = e.starter;
+				mine.bits |= MimeCacheBits::HasExec;
+			}
+		}
+	}
+}
+
+void MimeCache::MergeIfChangedOnDisk()
+{
+	ci64 now = time(NULL);
+	if (now - last_disk_check_ < DiskCheckInterval)
+		return;
+	last_disk_check_ = now;
+	
+	auto path_ba = filePath().toLocal8Bit();
+	struct statx stx;
+	if (statx(0, path_ba.data(), 0, STATX_MTIME, &stx) != 0)
+		return;
+	
+	if (stx.stx_mtime.tv_sec != disk_mtime_.tv_sec ||
+		stx.stx_mtime.tv_nsec != disk_mtime_.tv_nsec)
+	{
+		MergeFromDisk();
+	}
+}
+
+ExecInfo MimeCache::QueryExecInfo(const QString &full_path, const QString &ext)
+{
+/// ls -ls ./2to3-2.7
+/// 4 -rwxr-xr-x 1 root root 96 Aug 24 22:12 ./2to3-2.7
+
+///#! /bin/sh
+	ExecInfo ret = {};
+	if (!ext.isEmpty()) {
+		if (ext == QLatin1String("sh") || ext == QLatin1String("py")) {
+			ret.type |= ExecType::ShellScript;
+		} else if (ext == QLatin1String("bat")) {
+			ret.type |= ExecType::BatScript;
+		}
+	}
+	
+	auto ba = full_path.toLocal8Bit();
+	struct statx stx;
+	const auto fields = STATX_MODE | STATX_INO | STATX_MTIME;
+	if (statx(0, ba.data(), AT_SYMLINK_NOFOLLOW, fields, &stx) != 0)
+		return ret;
+	
+	ret.mode = stx.stx_mode;
+	
+	/// The file contents are read through the link, so key by the target:
+	if (S_ISLNK(stx.stx_mode) && statx(0, ba.data(), 0, fields, &stx) != 0)
+		return ret;
+	
+	const DiskFileId id = DiskFileId::FromStx(stx);
+	MimeCacheEntry *found = Find(id, stx);
+	if (found == nullptr || !found->has(MimeCacheBits::HasExec))
+	{
+		MergeIfChangedOnDisk();
+		found = Find(id, stx);
+	}
+	
+	if (found != nullptr && found->has(MimeCacheBits::HasExec))
+	{
+		ret.type |= found->exec_type;
+		ret.starter = found->starter;
+		return ret;
+	}
+	
+	const isize size = 64;
+	char buf[size];
+	cint fd = ::open(ba.data(), O_RDONLY);
+	if (fd == -1)
+		return ret;
+	
+	cisize real_size = ::read(fd, buf, size);
+	::close(fd);
+	if (real_size < 0)
+		return ret;
+	
+	ExecInfo sniffed = {};
+	sniffed.TestBuf(buf, real_size);
+	ret.type |= sniffed.type;
+	ret.starter = sniffed.starter;
+	
+	MimeCacheEntry &e = Insert(id, stx);
+	e.exec_type = sniffed.type;
+	e.starter = sniffed.starter;
+	e.bits |= MimeCacheBits::HasExec;
+	SaveIfManyChanges();
+	
+	return ret;
+}
+
+QString MimeCache::QueryMimeType(const QString &full_path)
+{
+	auto ba = full_path.toLocal8Bit();
+	struct statx stx;
+	const auto fields = STATX_MODE | STATX_INO | STATX_MTIME;
+	/// Only regular files get sniffed, let Qt handle the rest by itself.
+	if (statx(0, ba.data(), 0, fields, &stx) != 0 || !S_ISREG(stx.stx_mode))
+		return mime_db_.mimeTypeForFile(full_path).name();
+	
+	/// Fast path: the file name alone maps to exactly one mime type,
+	/// so there's no need to read the contents nor to cache anything.
+	QStringView name = full_path;
+	{
+		cint slash = full_path.lastIndexOf('/');
+		if (slash != -1)
+			name = name.mid(slash + 1);
+	}
+	const QList<QMimeType> by_name = mime_db_.mimeTypesForFileName(name.toString());
+	if (by_name.size() == 1)
+		return by_name[0].name();
+	
+	const DiskFileId id = DiskFileId::FromStx(stx);
+	MimeCacheEntry *found = Find(id, stx);
+	if (found == nullptr || !found->has(MimeCacheBits::HasMime))
+	{
+		MergeIfChangedOnDisk();
+		found = Find(id, stx);
+	}
+	
+	if (found != nullptr && found->has(MimeCacheBits::HasMime))
+		return found->mime;
+	
+	const QString mime = mime_db_.mimeTypeForFile(full_path).name();
+	MimeCacheEntry &e = Insert(id, stx);
+	e.mime = mime;
+	e.bits |= MimeCacheBits::HasMime;
+	SaveIfManyChanges();
+	
+	return mime;
+}
+
+bool MimeCache::Save()
+{
+	// returns true on success
+	/// Don't clobber what the other process added since we last looked:
+	MergeFromDisk();
+	
+	cu32 now = u32(time(NULL) / 60);
+	for (auto it = hash_.begin(); it != hash_.end();)
+	{
+		if (now - it.value().time_added > MimeCacheMaxAgeMinutes)
+			it = hash_.erase(it);
+		else
+			++it;
+	}
+	
+	ByteArray buf;
+	ToBlob(buf);
+	unsaved_count_ = 0;
+	
+	const QString path = filePath();
+	io::SaveFile save_file(path);
+	if (!io::WriteToFile(save_file.GetPathToWorkWith(), buf.data(), buf.size()))
+	{
+		save_file.CommitCancelled();
+		return false;
+	}
+	
+	if (!save_file.Commit(PrintErrors::Yes))
+		return false;
+	
+	auto path_ba = path.toLocal8Bit();
+	struct statx stx;
+	if (statx(0, path_ba.data(), 0, STATX_MTIME, &stx) == 0)
+		disk_mtime_ = stx.stx_mtime;
+	
+	return true;
+}
+
+void MimeCache::SaveIfManyChanges()
+{
+	if (++unsaved_count_ >= SaveAfterChanges)
+		Save();
+}
+
+void MimeCache::ToBlob(ByteArray &buf)
+{
+	buf.add_i16(MimeCacheAbiVersion);
+	for (auto it = hash_.cbegin(); it != hash_.cend(); ++it)
+	{
+		const DiskFileId &id = it.key();
+		const MimeCacheEntry &e = it.value();
+		buf.add_u64(id.inode_number);
+		buf.add_u32(id.dev_major);
+		buf.add_u32(id.dev_minor);
+		buf.add_i64(e.mtime_sec);
+		buf.add_u32(e.mtime_nsec);
+		buf.add_u32(e.time_added);
+		buf.add_u16(e.exec_type);
+		buf.add_u8(e.bits);
+		buf.add_string(e.mime);
+		buf.add_string(e.starter);
+	}
+}
+
+}
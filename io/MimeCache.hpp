@@ -0,0 +1,70 @@
+#pragma once
+
+#include "../decl.hxx"
+#include "../err.hpp"
+#include "../ExecInfo.hpp"
+#include "decl.hxx"
+
+#include <QHash>
+#include <QMimeDatabase>
+#include <QString>
+
+namespace cornus::io {
+
+const i16 MimeCacheAbiVersion = 1;
+/// Entries not touched for this long are dropped when saving:
+const u32 MimeCacheMaxAgeMinutes = 60 * 24 * 30;
+
+namespace MimeCacheBits {
+	const u8 HasMime = 1u << 0;
+	const u8 HasExec = 1u << 1;
+}
+
+struct MimeCacheEntry {
+	i64 mtime_sec = 0;
+	u32 mtime_nsec = 0;
+	u32 time_added = 0; // minutes, not seconds since Unix Epoch
+	u16 exec_type = ExecType::None;
+	u8 bits = 0;
+	QString mime;
+	QString starter;
+	
+	bool has(cu8 b) const { return (bits & b) != 0; }
+};
+
+/** Caches the results of content sniffing (mime type and exec type)
+keyed by DiskFileId + mtime. The cache file lives in the app config dir
+and is shared by cornus and cornus_io: each process merges the other's
+entries in when the file changed on disk. Not thread safe, must be used
+from the thread that owns it. */
+class MimeCache {
+public:
+	MimeCache();
+	~MimeCache();
+	
+	QMimeDatabase& mime_db() { return mime_db_; }
+	ExecInfo QueryExecInfo(const QString &full_path, const QString &ext);
+	QString QueryMimeType(const QString &full_path);
+	
+	void Load();
+	bool Save();
+
+private:
+	NO_ASSIGN_COPY_MOVE(MimeCache);
+	
+	QString filePath();
+	MimeCacheEntry* Find(const DiskFileId &id, const struct statx &stx);
+	MimeCacheEntry& Insert(const DiskFileId &id, const struct statx &stx);
+	void MergeFromDisk();
+	void MergeIfChangedOnDisk();
+	void SaveIfManyChanges();
+	void ToBlob(ByteArray &buf);
+	
+	QHash<DiskFileId, MimeCacheEntry> hash_;
+	QMimeDatabase mime_db_;
+	struct statx_timestamp disk_mtime_ = {};
+	i64 last_disk_check_ = 0;
+	int unsaved_count_ = 0;
+};
+
+}
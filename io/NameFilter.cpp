@@ -0,0 +1,245 @@
+#include "NameFilter.hpp"
+
+#include "File.hpp"
+#include "../MutexGuard.hpp"
+#include "io.hh"
+
+#include <algorithm>
+#include <cstring>
+
+namespace cornus::io {
+
+NameFilter::NameFilter() {}
+
+NameFilter::~NameFilter()
+{
+	quit_ = true;
+	superseded_ = true;
+	MutexGuard guard(&mutex_);
+	pthread_cond_broadcast(&cond_);
+	while (thread_running_)
+		pthread_cond_wait(&cond_, &mutex_);
+}
+
+void NameFilter::Cancel()
+{
+	MutexGuard guard(&mutex_);
+	superseded_ = running_job_;
+	has_job_ = false;
+	has_result_ = false;
+	result_ = {};
+	/// The dropped job might have carried the names:
+	listed_.clear();
+	listed_names_.clear();
+	listed_dir_id_ = -1;
+}
+
+void NameFilter::Fill(Arena &arena, const QVector<QString> &names)
+{
+	arena.names.clear();
+	arena.offsets.clear();
+	arena.offsets.reserve(names.size() + 1);
+	for (const QString &next: names)
+	{
+		arena.offsets.append(arena.names.size());
+		arena.names.append(next.toUtf8());
+		arena.names.append('\0');
+	}
+	arena.offsets.append(arena.names.size());
+}
+
+void NameFilter::Filter(const QVector<io::File*> &vec, const DirId dir_id,
+	const QString &query, cbool case_sensitive)
+{
+	Job job;
+	job.query = query;
+	job.dir_id = dir_id;
+	job.case_sensitive = case_sensitive;
+	
+	if (!SameListing(vec, dir_id))
+	{
+		listing_++;
+		/// Shallow copies, the filter thread converts them:
+		cint count = vec.size();
+		job.new_names = true;
+		job.names.reserve(count);
+		job.names_lower.reserve(count);
+		listed_ = vec;
+		listed_names_.resize(count);
+		for (int i = 0; i < count; i++)
+		{
+			job.names.append(vec[i]->name());
+			job.names_lower.append(vec[i]->name_lower());
+			listed_names_[i] = vec[i]->name().constData();
+		}
+		listed_dir_id_ = dir_id;
+	}
+	job.listing = listing_;
+	
+	MutexGuard guard(&mutex_);
+	if (has_job_ && job_.new_names && !job.new_names)
+	{
+		/// The pending job was never run, its names are still needed:
+		job.new_names = true;
+		job.names = std::move(job_.names);
+		job.names_lower = std::move(job_.names_lower);
+	}
+	
+	job_ = std::move(job);
+	has_job_ = true;
+	has_result_ = false;
+	superseded_ = running_job_;
+	
+	if (!thread_running_)
+		thread_running_ = io::NewThread(Work, this);
+	pthread_cond_broadcast(&cond_);
+}
+
+bool NameFilter::pending()
+{
+	MutexGuard guard(&mutex_);
+	return has_job_ || has_result_ || running_job_;
+}
+
+bool NameFilter::Run(const Job &job, QVector<int> &indices)
+{
+	if (job.new_names)
+	{
+		Fill(exact_, job.names);
+		Fill(lower_, job.names_lower);
+		prev_valid_ = false;
+	}
+	
+	const Arena &arena = job.case_sensitive ? exact_ : lower_;
+	const QByteArray needle = job.query.toUtf8();
+	const char *start = arena.names.constData();
+	const char *p = needle.constData();
+	cisize p_len = needle.size();
+	cint count = arena.offsets.size() - 1;
+	
+	if (prev_valid_ && prev_case_sensitive_ == job.case_sensitive &&
+		job.query.contains(prev_query_))
+	{
+		/// Typing on narrows the previous matches down:
+		for (cint i: prev_indices_)
+		{
+			if (superseded_)
+				return false;
+			cu32 at = arena.offsets[i];
+			if (memmem(start + at, arena.offsets[i + 1] - at - 1, p, p_len) != nullptr)
+				indices.append(i);
+		}
+	} else {
+		/// One pass over the whole arena, names are '\0' separated
+		/// so a match never spans two of them:
+		cisize size = arena.names.size();
+		isize pos = 0;
+		while (pos < size && !superseded_)
+		{
+			auto *found = (const char*) memmem(start + pos, size - pos, p, p_len);
+			if (found == nullptr)
+				break;
+			
+			cu32 at = found - start;
+			auto it = std::upper_bound(arena.offsets.cbegin(), arena.offsets.cend(), at);
+			cint i = int(it - arena.offsets.cbegin()) - 1;
+			if (i >= count)
+				break;
+			indices.append(i);
+			pos = arena.offsets[i + 1];
+		}
+		
+		if (superseded_)
+			return false;
+	}
+	
+	prev_query_ = job.query;
+	prev_indices_ = indices;
+	prev_case_sensitive_ = job.case_sensitive;
+	prev_valid_ = true;
+	
+	return true;
+}
+
+bool NameFilter::ResultFits(const NameFilterResult &result,
+	const QVector<io::File*> &vec, const DirId dir_id) const
+{
+	return result.listing == listing_ && SameListing(vec, dir_id);
+}
+
+bool NameFilter::SameListing(const QVector<io::File*> &vec, const DirId dir_id) const
+{
+	/// Renames replace the name's buffer, so comparing the pointers
+	/// tells whether the arenas are still current:
+	cint count = vec.size();
+	if (dir_id != listed_dir_id_ || count != listed_.size())
+		return false;
+	
+	for (int i = 0; i < count; i++)
+	{
+		if (vec[i] != listed_[i] || vec[i]->name().constData() != listed_names_[i])
+			return false;
+	}
+	
+	return true;
+}
+
+bool NameFilter::TakeResult(NameFilterResult &result)
+{
+	MutexGuard guard(&mutex_);
+	if (!has_result_)
+		return false;
+	
+	result = std::move(result_);
+	result_ = {};
+	has_result_ = false;
+	
+	return true;
+}
+
+void* NameFilter::Work(void *p)
+{
+	pthread_detach(pthread_self());
+	NameFilter *filter = (NameFilter*) p;
+	
+	while (true)
+	{
+		Job job;
+		{
+			MutexGuard guard(&filter->mutex_);
+			while (!filter->has_job_ && !filter->quit_)
+				pthread_cond_wait(&filter->cond_, &filter->mutex_);
+			
+			if (filter->quit_)
+				break;
+			
+			job = std::move(filter->job_);
+			filter->job_ = {};
+			filter->has_job_ = false;
+			filter->running_job_ = true;
+			filter->superseded_ = false;
+		}
+		
+		NameFilterResult result;
+		cbool done = filter->Run(job, result.indices);
+		
+		MutexGuard guard(&filter->mutex_);
+		filter->running_job_ = false;
+		if (done && !filter->has_job_ && !filter->superseded_)
+		{
+			result.query = job.query;
+			result.dir_id = job.dir_id;
+			result.listing = job.listing;
+			filter->result_ = std::move(result);
+			filter->has_result_ = true;
+		}
+	}
+	
+	MutexGuard guard(&filter->mutex_);
+	filter->thread_running_ = false;
+	pthread_cond_broadcast(&filter->cond_);
+	
+	return nullptr;
+}
+
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "../decl.hxx"
+#include "decl.hxx"
+#include "../err.hpp"
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+#include <atomic>
+#include <pthread.h>
+
+namespace cornus::io {
+
+struct NameFilterResult {
+	QVector<int> indices; // of the matching files, ascending
+	QString query;
+	DirId dir_id = -1;
+	u64 listing = 0; // NameFilter::listing_ of the names it ran on
+};
+
+/** Filter-as-you-type for the current folder. The names are copied once
+per listing into a contiguous '\0' separated UTF-8 arena (as is and
+lowered) which a background thread scans with memmem() per keystroke,
+the GUI thread then only flips the bits of the files whose state changed.
+When the query contains the previous one only the previous matches are
+tested again. A newer query supersedes the one being run. */
+class NameFilter {
+public:
+	NameFilter();
+	~NameFilter();
+	
+	/// GUI thread, with the files locked. @query must already be lowered
+	/// unless @case_sensitive.
+	void Filter(const QVector<io::File*> &vec, const DirId dir_id,
+		const QString &query, cbool case_sensitive);
+	/// Drops the pending query and result:
+	void Cancel();
+	bool pending();
+	/// GUI thread, with the files locked. False once inotify added,
+	/// removed or renamed files since, the indices would be off then:
+	bool ResultFits(const NameFilterResult &result, const QVector<io::File*> &vec,
+		const DirId dir_id) const;
+	bool TakeResult(NameFilterResult &result);
+
+private:
+	NO_ASSIGN_COPY_MOVE(NameFilter);
+	
+	struct Job {
+		QString query;
+		DirId dir_id = -1;
+		u64 listing = 0;
+		bool case_sensitive = false;
+		/// Set when the folder's listing changed since the last job:
+		bool new_names = false;
+		QVector<QString> names;
+		QVector<QString> names_lower;
+	};
+	
+	struct Arena {
+		QByteArray names;
+		QVector<u32> offsets; // of each name, plus one past the last
+	};
+	
+	static void Fill(Arena &arena, const QVector<QString> &names);
+	bool Run(const Job &job, QVector<int> &indices);
+	bool SameListing(const QVector<io::File*> &vec, const DirId dir_id) const;
+	static void* Work(void *p);
+	
+	pthread_mutex_t mutex_ = PTHREAD_MUTEX_INITIALIZER;
+	pthread_cond_t cond_ = PTHREAD_COND_INITIALIZER;
+	Job job_ = {};
+	NameFilterResult result_ = {};
+	bool has_job_ = false;
+	bool has_result_ = false;
+	bool running_job_ = false;
+	bool thread_running_ = false;
+	std::atomic<bool> superseded_ = false;
+	std::atomic<bool> quit_ = false;
+	
+	// ==> only used in the filter thread
+	Arena exact_ = {};
+	Arena lower_ = {};
+	QString prev_query_;
+	QVector<int> prev_indices_;
+	bool prev_case_sensitive_ = false;
+	bool prev_valid_ = false;
+	// <== only used in the filter thread
+	
+	// ==> only used in the gui thread, what the arenas were built from
+	QVector<io::File*> listed_;
+	QVector<const QChar*> listed_names_;
+	DirId listed_dir_id_ = -1;
+	u64 listing_ = 0; // bumped whenever the names are copied anew
+	// <== only used in the gui thread
+};
+
+}
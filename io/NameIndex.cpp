@@ -0,0 +1,1188 @@
+#include "NameIndex.hpp"
+
+#include "../AutoDelete.hh"
+#include "../ByteArray.hpp"
+#include "../ElapsedTimer.hpp"
+#include "../media.hxx"
+#include "../MutexGuard.hpp"
+#include "../prefs.hh"
+#include "io.hh"
+#include "SaveFile.hpp"
+
+#include <QCryptographicHash>
+#include <QRegularExpression>
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/xattr.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace cornus::io {
+
+static const auto WatchEvents = IN_CREATE | IN_DELETE | IN_MOVED_FROM
+	| IN_MOVED_TO | IN_DELETE_SELF | IN_ATTRIB | IN_ONLYDIR | IN_DONT_FOLLOW;
+static const isize InotifyBufSize = 64 * 1024;
+static const QString RootsFileName = QLatin1String("name_index_roots");
+
+static QString IndexFilePath(const QString &root_path, cu64 dev)
+{
+	QString dir_path;
+	if (!io::EnsureDir(io::GetLastingTmpDir(), QLatin1String("name_index"), &dir_path))
+		return QString();
+	
+	if (!dir_path.endsWith('/'))
+		dir_path.append('/');
+	
+	/// Per mount, then per root:
+	auto hash = QCryptographicHash::hash(root_path.toLocal8Bit(), QCryptographicHash::Md5);
+	return dir_path + QString::number(dev, 16) + '-'
+		+ QString::fromLatin1(hash.toHex().left(16));
+}
+
+static QString RootsFilePath()
+{
+	return prefs::QueryAppConfigPath() + '/' + RootsFileName;
+}
+
+static u64 MediaKey(const media::Field f, ci32 value)
+{
+	return (u64(f) << 32) | u32(value);
+}
+
+static void MediaKeys(const QByteArray &xattr, QVector<u64> &keys)
+{
+	ByteArray ba;
+	ba.add(xattr.constData(), xattr.size());
+	ba.to(0);
+	media::MediaPreview *p = io::CreateMediaPreview(ba);
+	if (p == nullptr)
+		return;
+	
+	AutoDelete ad(p);
+	using media::Field;
+	for (ci32 n: p->actors)
+		keys.append(MediaKey(Field::Actors, n));
+	for (ci32 n: p->directors)
+		keys.append(MediaKey(Field::Directors, n));
+	for (ci32 n: p->writers)
+		keys.append(MediaKey(Field::Writers, n));
+	for (ci16 n: p->genres)
+		keys.append(MediaKey(Field::Genres, n));
+	for (ci16 n: p->subgenres)
+		keys.append(MediaKey(Field::Subgenres, n));
+	for (ci16 n: p->countries)
+		keys.append(MediaKey(Field::Countries, n));
+	for (ci16 n: p->video_codecs)
+		keys.append(MediaKey(Field::VideoCodec, n));
+	
+	/// Series running for years are found by each of them, queries
+	/// don't look outside of MediaQueryMinYear..MediaQueryMaxYear:
+	if (p->year_started > 0)
+	{
+		cint first = std::max(int(p->year_started), int(MediaQueryMinYear));
+		cint last = std::min(std::max(int(p->year_end), int(p->year_started)),
+			int(MediaQueryMaxYear));
+		for (int y = first; y <= last; y++)
+			keys.append(MediaKey(Field::YearStarted, y));
+	}
+	
+	if (p->video_h > 0)
+		keys.append(MediaKey(Field::VideoResolution, p->video_h));
+	
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+}
+
+NameIndex::NameIndex() {}
+
+NameIndex::~NameIndex()
+{
+	Stop();
+	for (NameIndexRoot *next: roots_)
+	{
+		if (next->inotify_fd != -1)
+			::close(next->inotify_fd);
+		delete next;
+	}
+	
+	if (wake_fd_ != -1)
+		::close(wake_fd_);
+}
+
+u32 NameIndex::AddEntry(NameIndexRoot &root, cu32 dir, const char *name,
+	cisize len, cbool is_dir)
+{
+	NameIndexEntry entry = {};
+	entry.dir = dir;
+	entry.name_at = root.names.size();
+	entry.name_len = len;
+	root.names.append(name, len);
+	root.names.append('\0');
+	root.lower.append(name, len);
+	root.lower.append('\0');
+	FoldAscii(root.lower.constData() + entry.name_at, root.lower.data() + entry.name_at, len);
+	
+	cu32 index = root.entries.size();
+	if (is_dir)
+	{
+		entry.sub = root.dirs.size();
+		NameIndexDir sub = {};
+		sub.entry = index;
+		root.dirs.append(sub);
+	}
+	
+	root.entries.append(entry);
+	return index;
+}
+
+void NameIndex::AddMedia(NameIndexRoot &root, cu32 entry, const QByteArray &xattr)
+{
+	QVector<u64> keys;
+	MediaKeys(xattr, keys);
+	if (keys.isEmpty())
+		return;
+	
+	root.media.insert(entry, xattr);
+	for (cu64 key: keys)
+	{
+		QVector<u32> &v = root.postings[key];
+		if (v.isEmpty() || v.last() < entry)
+		{
+			v.append(entry); // the usual case, entries only get appended
+			continue;
+		}
+		
+		auto it = std::lower_bound(v.begin(), v.end(), entry);
+		if (*it != entry)
+			v.insert(it, entry);
+	}
+}
+
+bool NameIndex::AddRoot(QString dir_path)
+{
+	if (!dir_path.endsWith('/'))
+		dir_path.append('/');
+	
+	if (!io::DirExists(dir_path))
+		return false;
+	
+	{
+		MutexGuard guard(&mutex_);
+		for (NameIndexRoot *next: roots_)
+		{
+			if (dir_path.startsWith(next->path))
+				return true; // already indexed
+		}
+		
+		/// The new root covers these:
+		for (int i = roots_.size() - 1; i >= 0; i--)
+		{
+			if (roots_[i]->path.startsWith(dir_path))
+			{
+				DropRoot(roots_[i]);
+				roots_.remove(i);
+			}
+		}
+		
+		auto *root = new NameIndexRoot();
+		root->path = dir_path;
+		root->must_rescan = true;
+		roots_.append(root);
+		SaveRoots();
+	}
+	
+	WakeUp();
+	return true;
+}
+
+QString NameIndex::DirPath(const NameIndexRoot &root, u32 dir) const
+{
+	QVector<const NameIndexEntry*> chain;
+	while (root.dirs[dir].entry != NameIndexNone)
+	{
+		const NameIndexEntry *entry = &root.entries[root.dirs[dir].entry];
+		chain.append(entry);
+		dir = entry->dir;
+	}
+	
+	QByteArray path = root.path.toLocal8Bit();
+	for (int i = chain.size() - 1; i >= 0; i--)
+	{
+		path.append(root.names.constData() + chain[i]->name_at, chain[i]->name_len);
+		path.append('/');
+	}
+	
+	return QString::fromLocal8Bit(path);
+}
+
+void NameIndex::DropRoot(NameIndexRoot *root)
+{
+	if (root->inotify_fd != -1)
+		::close(root->inotify_fd);
+	
+	if (root->dev != 0)
+	{
+		auto ba = IndexFilePath(root->path, root->dev).toLocal8Bit();
+		::remove(ba.constData());
+	}
+	
+	delete root;
+}
+
+u32 NameIndex::EntryAt(const NameIndexRoot &root, ci64 name_at) const
+{
+	auto it = std::upper_bound(root.entries.cbegin(), root.entries.cend(), name_at,
+		[](ci64 at, const NameIndexEntry &entry) { return at < i64(entry.name_at); });
+	return u32(it - root.entries.cbegin()) - 1;
+}
+
+bool NameIndex::FindDir(const NameIndexRoot &root, QString dir_path, u32 &dir) const
+{
+	if (!dir_path.endsWith('/'))
+		dir_path.append('/');
+	
+	if (!dir_path.startsWith(root.path))
+		return false;
+	
+	dir = 0;
+	const QByteArray rel = dir_path.mid(root.path.size()).toLocal8Bit();
+	for (const QByteArray &name: rel.split('/'))
+	{
+		if (name.isEmpty())
+			continue;
+		cu32 index = FindChild(root, dir, name.constData(), name.size());
+		if (index == NameIndexNone || root.entries[index].sub == NameIndexNone)
+			return false;
+		dir = root.entries[index].sub;
+	}
+	
+	return true;
+}
+
+NameIndexRoot* NameIndex::FindRoot(const QString &dir_path) const
+{
+	for (NameIndexRoot *next: roots_)
+	{
+		if (!next->dirs.isEmpty() && dir_path.startsWith(next->path))
+			return next;
+	}
+	
+	return nullptr;
+}
+
+u32 NameIndex::FindChild(const NameIndexRoot &root, cu32 dir, const char *name,
+	cisize len) const
+{
+	auto same = [&](cu32 index) {
+		const NameIndexEntry &entry = root.entries[index];
+		return !entry.dead && entry.dir == dir && entry.name_len == len &&
+			memcmp(root.names.constData() + entry.name_at, name, len) == 0;
+	};
+	
+	const NameIndexDir &d = root.dirs[dir];
+	for (u32 i = d.first; i < d.first + d.count; i++)
+	{
+		if (same(i))
+			return i;
+	}
+	
+	auto it = root.added.constFind(dir);
+	if (it != root.added.cend())
+	{
+		for (cu32 index: it.value())
+		{
+			if (same(index))
+				return index;
+		}
+	}
+	
+	return NameIndexNone;
+}
+
+bool NameIndex::IsVisible(const NameIndexRoot &root, cu32 index, cu32 under,
+	cbool hidden_ok) const
+{
+	const NameIndexEntry *entry = &root.entries[index];
+	u32 dir = entry->dir;
+	while (true)
+	{
+		if (entry->dead)
+			return false;
+		if (!hidden_ok && root.names[entry->name_at] == '.')
+			return false;
+		if (dir == under)
+			return !root.dirs[dir].dead;
+		
+		const NameIndexDir &d = root.dirs[dir];
+		if (d.dead || d.entry == NameIndexNone)
+			return false; // not below @under
+		entry = &root.entries[d.entry];
+		dir = entry->dir;
+	}
+}
+
+void NameIndex::KillEntry(NameIndexRoot &root, cu32 index)
+{
+	NameIndexEntry &entry = root.entries[index];
+	entry.dead = 1;
+	/// Whatever is below a dead folder is skipped by IsVisible():
+	if (entry.sub != NameIndexNone)
+		root.dirs[entry.sub].dead = 1;
+	
+	RemoveMedia(root, index);
+	/// Compacted by the rescan:
+	if (++root.dead_count > u32(root.entries.size() / 2))
+		root.must_rescan = true;
+}
+
+void NameIndex::ListDir(NameIndexRoot &root, cu32 dir, const QByteArray &dir_path,
+	QVector<QPair<u32, QByteArray>> &pending, char *buf)
+{
+	cint fd = ::open(dir_path.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1)
+		return;
+	
+	AutoCloseFd ac(fd);
+	/// Watched before it's listed so that nothing created meanwhile is
+	/// missed, what's listed and reported twice is deduplicated.
+	cint wd = inotify_add_watch(root.inotify_fd, dir_path.constData(), WatchEvents);
+	if (wd != -1)
+	{
+		root.wd_dirs.insert(wd, dir);
+	} else if (errno == ENOSPC) {
+		static bool warned = false;
+		if (!warned)
+		{
+			warned = true;
+			mtl_warn("Out of inotify watches (fs.inotify.max_user_watches), "
+				"relying on rescans");
+		}
+	}
+	
+	root.dirs[dir].first = root.entries.size();
+	while (!quit_)
+	{
+		cisize n = ::syscall(SYS_getdents64, fd, buf, NameIndexDentsBufSize);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		
+		for (isize pos = 0; pos < n;)
+		{
+			auto *dirent = (LinuxDirent64*) (buf + pos);
+			pos += dirent->d_reclen;
+			const char *name = dirent->d_name;
+			if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+				continue;
+			
+			bool is_dir = dirent->d_type == DT_DIR;
+			struct stat st;
+			if (dirent->d_type == DT_UNKNOWN || is_dir)
+			{
+				if (::fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+					continue;
+				is_dir = S_ISDIR(st.st_mode);
+			}
+			
+			cu32 index = AddEntry(root, dir, name, strlen(name), is_dir);
+			ReadMedia(root, index, dir_path + name);
+			if (!is_dir || u64(st.st_dev) != root.dev)
+				continue; // other mounts stay unlisted
+			
+			QByteArray sub_path = dir_path + name + '/';
+			if (!io::IsPseudoFsDir(sub_path))
+				pending.append({root.entries[index].sub, sub_path});
+		}
+	}
+	
+	root.dirs[dir].count = root.entries.size() - root.dirs[dir].first;
+}
+
+/// What DirPath(), FindChild() and IsVisible() rely on, checked on
+/// a loaded index before using it.
+static bool IsConsistent(const NameIndexRoot &root)
+{
+	const u64 dir_count = root.dirs.size();
+	const u64 entry_count = root.entries.size();
+	const u64 names_size = root.names.size();
+	if (root.dirs[0].entry != NameIndexNone)
+		return false;
+	
+	for (u64 i = 0; i < dir_count; i++)
+	{
+		const NameIndexDir &dir = root.dirs[i];
+		if (u64(dir.first) + dir.count > entry_count)
+			return false;
+		if (i == 0)
+			continue;
+		/// A folder's parent is always added before it, which also
+		/// rules out loops when walking up to the root:
+		if (dir.entry >= entry_count || root.entries[dir.entry].sub != i ||
+			root.entries[dir.entry].dir >= i)
+			return false;
+	}
+	
+	for (u64 i = 0; i < entry_count; i++)
+	{
+		const NameIndexEntry &entry = root.entries[i];
+		/// Each name is followed by a '\0':
+		if (entry.dir >= dir_count || u64(entry.name_at) + entry.name_len >= names_size)
+			return false;
+		if (entry.sub != NameIndexNone && (entry.sub >= dir_count ||
+			root.dirs[entry.sub].entry != i))
+			return false;
+	}
+	
+	return true;
+}
+
+NameIndexRoot* NameIndex::Load(const QString &root_path)
+{
+	struct stat st;
+	auto path_ba = root_path.toLocal8Bit();
+	if (::stat(path_ba.constData(), &st) != 0)
+		return nullptr;
+	
+	const QString file_path = IndexFilePath(root_path, st.st_dev);
+	ByteArray ba;
+	io::ReadParams rp = {};
+	rp.print_errors = PrintErrors::No;
+	rp.can_rely = CanRelyOnStatxSize::Yes;
+	if (file_path.isEmpty() || !io::ReadFile(file_path, ba, rp))
+		return nullptr;
+	
+	const isize header_size = sizeof(u32) + sizeof(i16) + sizeof(i32);
+	if (!ba.has_more(header_size) || ba.next_u32() != NameIndexMagic ||
+		ba.next_i16() != NameIndexAbiVersion)
+		return nullptr;
+	
+	ci32 path_len = ba.next_i32();
+	if (path_len < 0 || !ba.has_more(path_len) || QString::fromLocal8Bit(
+		ba.constData() + ba.at(), path_len) != root_path)
+		return nullptr;
+	ba.to(ba.at() + path_len);
+	
+	const isize counts_size = sizeof(u64) + sizeof(i64) + sizeof(u32) * 3;
+	if (!ba.has_more(counts_size))
+		return nullptr;
+	
+	auto *root = new NameIndexRoot();
+	root->path = root_path;
+	root->dev = ba.next_u64();
+	root->scanned_at = ba.next_i64();
+	cu32 dir_count = ba.next_u32();
+	cu32 entry_count = ba.next_u32();
+	cu32 names_size = ba.next_u32();
+	const isize size = isize(dir_count) * sizeof(NameIndexDir)
+		+ isize(entry_count) * sizeof(NameIndexEntry) + names_size;
+	if (root->dev != u64(st.st_dev) || dir_count == 0 || !ba.has_more(size))
+	{
+		delete root;
+		return nullptr;
+	}
+	
+	root->dirs.resize(dir_count);
+	ba.next((char*) root->dirs.data(), dir_count * sizeof(NameIndexDir));
+	root->entries.resize(entry_count);
+	ba.next((char*) root->entries.data(), entry_count * sizeof(NameIndexEntry));
+	root->names.resize(names_size);
+	ba.next(root->names.data(), names_size);
+	if (!IsConsistent(*root))
+	{
+		mtl_warn("Corrupt %s", qPrintable(file_path));
+		delete root;
+		return nullptr;
+	}
+	
+	root->lower = root->names;
+	FoldAscii(root->lower.constData(), root->lower.data(), names_size);
+	
+	cu32 media_count = ba.has_more(sizeof(u32)) ? ba.next_u32() : 0;
+	for (u32 i = 0; i < media_count; i++)
+	{
+		if (!ba.has_more(sizeof(u32) * 2))
+		{
+			delete root;
+			return nullptr;
+		}
+		cu32 entry = ba.next_u32();
+		cu32 size = ba.next_u32();
+		if (entry >= entry_count || !ba.has_more(size))
+		{
+			delete root;
+			return nullptr;
+		}
+		QByteArray xattr(size, Qt::Uninitialized);
+		ba.next(xattr.data(), size);
+		AddMedia(*root, entry, xattr);
+	}
+	/// Answers queries right away, but the folders have no watches
+	/// yet and might have changed while cornus_io wasn't running:
+	root->must_rescan = true;
+	
+	return root;
+}
+
+void NameIndex::LoadRoots()
+{
+	ByteArray ba;
+	io::ReadParams rp = {};
+	rp.print_errors = PrintErrors::No;
+	if (!io::ReadFile(RootsFilePath(), ba, rp))
+		return;
+	
+	/// One path per line so that it's easy to edit by hand:
+	const QStringList list = ba.toString().split('\n', Qt::SkipEmptyParts);
+	for (QString path: list)
+	{
+		if (!path.endsWith('/'))
+			path.append('/');
+		
+		NameIndexRoot *root = Load(path);
+		if (root == nullptr)
+		{
+			root = new NameIndexRoot();
+			root->path = path;
+			root->must_rescan = true;
+		}
+		
+		MutexGuard guard(&mutex_);
+		roots_.append(root);
+	}
+}
+
+void NameIndex::MatchMedia(const NameIndexRoot &root, const MediaQuery &query,
+	QVector<u32> &found) const
+{
+	using media::Field;
+	QVector<QVector<u32>> sets;
+	/// Returns false when no file has the value:
+	auto add = [&](const Field f, ci32 value) -> bool {
+		if (value == -1)
+			return true;
+		auto it = root.postings.constFind(MediaKey(f, value));
+		if (it == root.postings.cend())
+			return false;
+		sets.append(it.value());
+		return true;
+	};
+	
+	if (!add(Field::Actors, query.actor) || !add(Field::Directors, query.director) ||
+		!add(Field::Writers, query.writer) || !add(Field::Genres, query.genre) ||
+		!add(Field::Subgenres, query.subgenre) || !add(Field::Countries, query.country) ||
+		!add(Field::VideoCodec, query.video_codec))
+		return;
+	
+	/// Ranges are the union of the postings of their values:
+	QVector<u32> range;
+	if (query.year_from != -1)
+	{
+		cint first = std::max(int(query.year_from), int(MediaQueryMinYear));
+		cint last = std::min(std::max(int(query.year_to), int(query.year_from)),
+			int(MediaQueryMaxYear));
+		for (int y = first; y <= last; y++)
+		{
+			auto it = root.postings.constFind(MediaKey(Field::YearStarted, y));
+			if (it != root.postings.cend())
+				range.append(it.value());
+		}
+		if (range.isEmpty())
+			return;
+		std::sort(range.begin(), range.end());
+		range.erase(std::unique(range.begin(), range.end()), range.end());
+		sets.append(range);
+		range.clear();
+	}
+	
+	if (query.min_height != -1)
+	{
+		for (auto it = root.postings.cbegin(); it != root.postings.cend(); it++)
+		{
+			cu64 key = it.key();
+			if (Field(key >> 32) == Field::VideoResolution && i32(u32(key)) >= query.min_height)
+				range.append(it.value());
+		}
+		if (range.isEmpty())
+			return;
+		std::sort(range.begin(), range.end());
+		range.erase(std::unique(range.begin(), range.end()), range.end());
+		sets.append(range);
+	}
+	
+	if (sets.isEmpty())
+		return;
+	
+	/// Smallest first so that the intersection shrinks fast:
+	std::sort(sets.begin(), sets.end(), [](const QVector<u32> &a, const QVector<u32> &b) {
+		return a.size() < b.size();
+	});
+	found = sets[0];
+	QVector<u32> out;
+	for (int i = 1; i < sets.size() && !found.isEmpty(); i++)
+	{
+		out.clear();
+		std::set_intersection(found.cbegin(), found.cend(), sets[i].cbegin(),
+			sets[i].cend(), std::back_inserter(out));
+		found.swap(out);
+	}
+}
+
+/// The longest run of literal characters of a glob, every match
+/// contains it. A bracket expression ("[ch]", "[!c]") is one character
+/// out of several, so it splits the runs like '*' and '?' do.
+static QString GlobNeedle(const QString &glob)
+{
+	QString longest, run;
+	cint len = glob.size();
+	for (int i = 0; i < len; i++)
+	{
+		const QChar c = glob[i];
+		if (c != '*' && c != '?' && c != '[')
+		{
+			run.append(c);
+			continue;
+		}
+		
+		if (run.size() > longest.size())
+			longest = run;
+		run.clear();
+		if (c != '[')
+			continue;
+		
+		/// A ']' right after the '[' or "[!" is one of the characters:
+		int k = i + 1;
+		if (k < len && (glob[k] == '!' || glob[k] == '^'))
+			k++;
+		if (k < len && glob[k] == ']')
+			k++;
+		while (k < len && glob[k] != ']')
+			k++;
+		/// Without the closing ']' the rest is skipped, which only
+		/// makes the needle shorter than it could be:
+		i = k;
+	}
+	
+	return (run.size() > longest.size()) ? run : longest;
+}
+
+bool NameIndex::Query(const NameIndexQuery &query, QVector<QString> &paths,
+	bool &limit_reached)
+{
+	limit_reached = false;
+	QString dir_path = query.dir_path;
+	if (!dir_path.endsWith('/'))
+		dir_path.append('/');
+	
+	const auto cs = query.case_sensitive ? Qt::CaseSensitive : Qt::CaseInsensitive;
+	cbool use_regex = query.match != FindMatch::Substring;
+	QRegularExpression regex;
+	/// Entries containing it are the candidates:
+	QByteArray needle;
+	if (use_regex)
+	{
+		QString pattern = query.pattern;
+		if (query.match == FindMatch::Glob)
+		{
+			pattern = QRegularExpression::wildcardToRegularExpression(pattern);
+			/// The longest run without wildcards narrows the search:
+			needle = GlobNeedle(query.pattern).toUtf8();
+			if (needle.size() < 2)
+				needle.clear();
+		}
+		auto options = QRegularExpression::DontCaptureOption;
+		if (!query.case_sensitive)
+			options |= QRegularExpression::CaseInsensitiveOption;
+		regex = QRegularExpression(pattern, options);
+		if (!regex.isValid())
+			return false;
+		regex.optimize();
+	} else {
+		needle = query.pattern.toUtf8();
+	}
+	
+	if (std::any_of(needle.cbegin(), needle.cend(), [](const char c) { return c & 0x80; }))
+		needle.clear(); // folding it takes more than ASCII
+	if (!query.case_sensitive)
+		FoldAscii(needle.constData(), needle.data(), needle.size());
+	
+	MutexGuard guard(&mutex_);
+	NameIndexRoot *root = FindRoot(dir_path);
+	u32 under = 0;
+	if (root == nullptr || !FindDir(*root, dir_path, under))
+		return false;
+	
+	QHash<u32, QString> dir_paths;
+	/// Returns false once the limit is reached:
+	auto add = [&](cu32 index) -> bool {
+		const NameIndexEntry &entry = root->entries[index];
+		const char *name = root->names.constData() + entry.name_at;
+		if (needle.isEmpty() || use_regex)
+		{
+			const QString s = QString::fromLocal8Bit(name, entry.name_len);
+			cbool matches = use_regex ? regex.match(s).hasMatch() : s.contains(query.pattern, cs);
+			if (!matches)
+				return true;
+		}
+		
+		if (!IsVisible(*root, index, under, query.show_hidden_files))
+			return true;
+		
+		if (paths.size() >= query.max_results)
+		{
+			limit_reached = true;
+			return false;
+		}
+		
+		auto it = dir_paths.find(entry.dir);
+		if (it == dir_paths.end())
+			it = dir_paths.insert(entry.dir, DirPath(*root, entry.dir));
+		paths.append(it.value() + QString::fromLocal8Bit(name, entry.name_len));
+		return true;
+	};
+	
+	if (needle.isEmpty())
+	{
+		cu32 count = root->entries.size();
+		for (u32 i = 0; i < count; i++)
+		{
+			if (!root->entries[i].dead && !add(i))
+				break;
+		}
+		return true;
+	}
+	
+	const QByteArray &hay = query.case_sensitive ? root->names : root->lower;
+	const char *start = hay.constData();
+	cisize size = hay.size();
+	isize pos = 0;
+	while (pos < size)
+	{
+		/// Names are '\0' separated so a match never spans two of them:
+		const char *found = (const char*) memmem(start + pos, size - pos,
+			needle.constData(), needle.size());
+		if (found == nullptr)
+			break;
+		
+		cu32 index = EntryAt(*root, found - start);
+		if (!add(index))
+			break;
+		const NameIndexEntry &entry = root->entries[index];
+		pos = isize(entry.name_at) + entry.name_len + 1;
+	}
+	
+	return true;
+}
+
+bool NameIndex::QueryMedia(const MediaQuery &query, QVector<QString> &paths,
+	bool &limit_reached)
+{
+	limit_reached = false;
+	bool covered = false;
+	MutexGuard guard(&mutex_);
+	for (NameIndexRoot *root: roots_)
+	{
+		u32 under = 0;
+		if (root->dirs.isEmpty())
+			continue;
+		if (!query.dir_path.isEmpty() && !FindDir(*root, query.dir_path, under))
+			continue;
+		
+		covered = true;
+		QVector<u32> found;
+		MatchMedia(*root, query, found);
+		QHash<u32, QString> dir_paths;
+		for (cu32 index: found)
+		{
+			if (!IsVisible(*root, index, under, true))
+				continue;
+			
+			if (paths.size() >= query.max_results)
+			{
+				limit_reached = true;
+				return true;
+			}
+			
+			const NameIndexEntry &entry = root->entries[index];
+			auto it = dir_paths.find(entry.dir);
+			if (it == dir_paths.end())
+				it = dir_paths.insert(entry.dir, DirPath(*root, entry.dir));
+			paths.append(it.value() + QString::fromLocal8Bit(
+				root->names.constData() + entry.name_at, entry.name_len));
+		}
+	}
+	
+	return covered;
+}
+
+void NameIndex::ReadEvents(NameIndexRoot &root, char *buf)
+{
+	while (true)
+	{
+		cisize n = ::read(root.inotify_fd, buf, InotifyBufSize);
+		if (n <= 0)
+			break; // EAGAIN, the fd is non-blocking
+		
+		for (char *p = buf; p < buf + n;)
+		{
+			auto *ev = (struct inotify_event*) p;
+			p += sizeof(struct inotify_event) + ev->len;
+			const auto mask = ev->mask;
+			if (mask & (IN_Q_OVERFLOW | IN_UNMOUNT))
+			{
+				root.must_rescan = true;
+				continue;
+			}
+			
+			auto it = root.wd_dirs.find(ev->wd);
+			if (it == root.wd_dirs.end())
+				continue;
+			
+			if (mask & IN_IGNORED)
+			{
+				root.wd_dirs.erase(it);
+				continue;
+			}
+			
+			cu32 dir = it.value();
+			if (ev->len == 0 || root.dirs[dir].dead)
+				continue;
+			
+			const char *name = ev->name;
+			cisize len = strlen(name);
+			cu32 old = FindChild(root, dir, name, len);
+			if (mask & IN_ATTRIB)
+			{
+				/// Might be its media attributes that changed:
+				if (old != NameIndexNone)
+					ReadMedia(root, old, DirPath(root, dir).toLocal8Bit() + name);
+				continue;
+			}
+			
+			if (old != NameIndexNone)
+				KillEntry(root, old);
+			
+			if (!(mask & (IN_CREATE | IN_MOVED_TO)))
+				continue;
+			
+			cbool is_dir = mask & IN_ISDIR;
+			cu32 index = AddEntry(root, dir, name, len, is_dir);
+			root.added[dir].append(index);
+			ReadMedia(root, index, DirPath(root, dir).toLocal8Bit() + name);
+			if (is_dir)
+			{
+				/// A folder moved in brings its contents along:
+				ScanFrom(root, root.entries[index].sub,
+					DirPath(root, dir).toLocal8Bit() + name + '/');
+			}
+		}
+	}
+}
+
+void NameIndex::ReadMedia(NameIndexRoot &root, cu32 entry, const QByteArray &full_path)
+{
+	static const QByteArray attr_name = io::Efa_media.toLatin1();
+	char buf[4096];
+	QByteArray xattr;
+	isize n = ::lgetxattr(full_path.constData(), attr_name.constData(), buf, sizeof buf);
+	if (n > 0)
+	{
+		xattr = QByteArray(buf, n);
+	} else if (n == -1 && errno == ERANGE) {
+		n = ::lgetxattr(full_path.constData(), attr_name.constData(), nullptr, 0);
+		if (n > 0)
+		{
+			xattr.resize(n);
+			n = ::lgetxattr(full_path.constData(), attr_name.constData(), xattr.data(), n);
+			xattr.resize(std::max(isize(0), n));
+		}
+	}
+	
+	/// Mostly ENODATA, most files have none:
+	if (root.media.contains(entry))
+		RemoveMedia(root, entry);
+	if (!xattr.isEmpty())
+		AddMedia(root, entry, xattr);
+}
+
+void NameIndex::RemoveMedia(NameIndexRoot &root, cu32 entry)
+{
+	auto found = root.media.find(entry);
+	if (found == root.media.end())
+		return;
+	
+	QVector<u64> keys;
+	MediaKeys(found.value(), keys);
+	root.media.erase(found);
+	for (cu64 key: keys)
+	{
+		auto it = root.postings.find(key);
+		if (it == root.postings.end())
+			continue;
+		QVector<u32> &v = it.value();
+		auto at = std::lower_bound(v.begin(), v.end(), entry);
+		if (at != v.end() && *at == entry)
+			v.erase(at);
+		if (v.isEmpty())
+			root.postings.erase(it);
+	}
+}
+
+bool NameIndex::RemoveRoot(QString dir_path)
+{
+	if (!dir_path.endsWith('/'))
+		dir_path.append('/');
+	
+	{
+		MutexGuard guard(&mutex_);
+		cint count = roots_.size();
+		for (int i = 0; i < count; i++)
+		{
+			if (roots_[i]->path == dir_path)
+			{
+				DropRoot(roots_[i]);
+				roots_.remove(i);
+				SaveRoots();
+				break;
+			}
+		}
+		
+		if (roots_.size() == count)
+			return false;
+	}
+	
+	/// To stop polling the closed inotify fd:
+	WakeUp();
+	return true;
+}
+
+void NameIndex::Rescan(const QString &root_path)
+{
+	NameIndexRoot *fresh = Scan(root_path);
+	MutexGuard guard(&mutex_);
+	for (NameIndexRoot *&next: roots_)
+	{
+		if (next->path != root_path)
+			continue;
+		
+		if (fresh == nullptr)
+		{
+			/// Gone or unmounted, try again later:
+			next->must_rescan = false;
+			next->scanned_at = time(nullptr);
+			return;
+		}
+		
+		Save(*fresh);
+		if (next->inotify_fd != -1)
+			::close(next->inotify_fd);
+		delete next;
+		next = fresh;
+		return;
+	}
+	
+	/// Removed meanwhile:
+	if (fresh != nullptr)
+	{
+		::close(fresh->inotify_fd);
+		delete fresh;
+	}
+}
+
+bool NameIndex::Save(const NameIndexRoot &root) const
+{
+	const QString file_path = IndexFilePath(root.path, root.dev);
+	if (file_path.isEmpty())
+		return false;
+	
+	ByteArray ba;
+	ba.add_u32(NameIndexMagic);
+	ba.add_i16(NameIndexAbiVersion);
+	ba.add_string(root.path);
+	ba.add_u64(root.dev);
+	ba.add_i64(root.scanned_at);
+	ba.add_u32(root.dirs.size());
+	ba.add_u32(root.entries.size());
+	ba.add_u32(root.names.size());
+	ba.add((const char*) root.dirs.constData(), root.dirs.size() * sizeof(NameIndexDir));
+	ba.add((const char*) root.entries.constData(), root.entries.size() * sizeof(NameIndexEntry));
+	ba.add(root.names.constData(), root.names.size());
+	ba.add_u32(root.media.size());
+	for (auto it = root.media.cbegin(); it != root.media.cend(); it++)
+	{
+		ba.add_u32(it.key());
+		ba.add_u32(it.value().size());
+		ba.add(it.value().constData(), it.value().size());
+	}
+	
+	io::SaveFile save_file(file_path);
+	if (!io::WriteToFile(save_file.GetPathToWorkWith(), ba.data(), ba.size()))
+		return false;
+	
+	return save_file.Commit();
+}
+
+void NameIndex::SaveRoots() const
+{
+	QByteArray ba;
+	for (NameIndexRoot *next: roots_)
+		ba.append(next->path.toLocal8Bit() + '\n');
+	
+	io::SaveFile save_file(RootsFilePath());
+	if (io::WriteToFile(save_file.GetPathToWorkWith(), ba.constData(), ba.size()))
+		save_file.Commit();
+}
+
+NameIndexRoot* NameIndex::Scan(const QString &root_path)
+{
+	auto path_ba = root_path.toLocal8Bit();
+	struct stat st;
+	if (::stat(path_ba.constData(), &st) != 0 || !S_ISDIR(st.st_mode))
+		return nullptr;
+	
+	auto *root = new NameIndexRoot();
+	root->path = root_path;
+	root->dev = st.st_dev;
+	root->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (root->inotify_fd == -1)
+	{
+		mtl_status(errno);
+		delete root;
+		return nullptr;
+	}
+	
+	ElapsedTimer timer;
+	timer.Continue();
+	root->dirs.append(NameIndexDir());
+	ScanFrom(*root, 0, path_ba);
+	if (quit_)
+	{
+		::close(root->inotify_fd);
+		delete root;
+		return nullptr;
+	}
+	
+	root->scanned_at = time(nullptr);
+	mtl_info("Indexed %s: %d files in %d folders, %ld ms", path_ba.constData(),
+		int(root->entries.size()), int(root->dirs.size()), long(timer.elapsed_ms()));
+	
+	return root;
+}
+
+void NameIndex::ScanFrom(NameIndexRoot &root, cu32 dir, const QByteArray &dir_path)
+{
+	QByteArray buf(NameIndexDentsBufSize, Qt::Uninitialized);
+	QVector<QPair<u32, QByteArray>> pending = {{dir, dir_path}};
+	while (!pending.isEmpty() && !quit_)
+	{
+		auto next = pending.takeLast();
+		ListDir(root, next.first, next.second, pending, buf.data());
+	}
+}
+
+void NameIndex::Start()
+{
+	wake_fd_ = ::eventfd(0, EFD_CLOEXEC);
+	if (wake_fd_ == -1)
+	{
+		mtl_status(errno);
+		return;
+	}
+	
+	MutexGuard guard(&mutex_);
+	thread_running_ = io::NewThread(Work, this);
+}
+
+void NameIndex::Stop()
+{
+	quit_ = true;
+	WakeUp();
+	MutexGuard guard(&mutex_);
+	while (thread_running_)
+		pthread_cond_wait(&cond_, &mutex_);
+}
+
+void NameIndex::WakeUp()
+{
+	if (wake_fd_ == -1)
+		return;
+	
+	ci64 n = 1;
+	if (::write(wake_fd_, &n, sizeof n) == -1)
+		mtl_status(errno);
+}
+
+void* NameIndex::Work(void *p)
+{
+	pthread_detach(pthread_self());
+	NameIndex *index = (NameIndex*) p;
+	index->LoadRoots();
+	QByteArray buf(InotifyBufSize, Qt::Uninitialized);
+	
+	while (!index->quit_)
+	{
+		QString scan_path;
+		QVector<struct pollfd> fds;
+		i64 timeout_sec = NameIndexRescanSec;
+		{
+			MutexGuard guard(&index->mutex_);
+			ci64 now = time(nullptr);
+			for (NameIndexRoot *next: index->roots_)
+			{
+				ci64 due_in = std::max(i64(0), next->scanned_at + NameIndexRescanSec - now);
+				if (scan_path.isEmpty() && (next->must_rescan || due_in == 0))
+					scan_path = next->path;
+				timeout_sec = std::min(timeout_sec, due_in);
+				if (next->inotify_fd != -1)
+					fds.append({next->inotify_fd, POLLIN, 0});
+			}
+		}
+		
+		if (!scan_path.isEmpty())
+		{
+			index->Rescan(scan_path);
+			continue;
+		}
+		
+		fds.append({index->wake_fd_, POLLIN, 0});
+		if (::poll(fds.data(), fds.size(), int(timeout_sec * 1000)) <= 0)
+			continue;
+		
+		for (const struct pollfd &next: fds)
+		{
+			if (!(next.revents & POLLIN))
+				continue;
+			
+			if (next.fd == index->wake_fd_)
+			{
+				io::ReadEventFd(next.fd);
+				continue;
+			}
+			
+			MutexGuard guard(&index->mutex_);
+			for (NameIndexRoot *root: index->roots_)
+			{
+				if (root->inotify_fd == next.fd)
+				{
+					index->ReadEvents(*root, buf.data());
+					break;
+				}
+			}
+		}
+	}
+	
+	MutexGuard guard(&index->mutex_);
+	index->thread_running_ = false;
+	pthread_cond_broadcast(&index->cond_);
+	
+	return nullptr;
+}
+
+}
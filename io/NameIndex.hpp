@@ -0,0 +1,163 @@
+#pragma once
+
+#include "../decl.hxx"
+#include "decl.hxx"
+#include "../err.hpp"
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+#include <atomic>
+#include <pthread.h>
+
+namespace cornus::tests {
+class NameIndexGlobs;
+}
+
+namespace cornus::io {
+
+const i16 NameIndexAbiVersion = 2;
+const u32 NameIndexMagic = 0x58494e43; // "CNIX"
+const u32 NameIndexNone = u32(-1);
+/// Roots get rescanned this often besides inotify keeping them current:
+const i64 NameIndexRescanSec = 60 * 60 * 6;
+const isize NameIndexDentsBufSize = 64 * 1024;
+
+/// A file or folder, the same layout in memory and on disk.
+struct NameIndexEntry {
+	u32 dir = 0; // the NameIndexDir it's in
+	u32 name_at = 0; // offset into NameIndexRoot::names
+	u32 sub = NameIndexNone; // its NameIndexDir if it's a folder
+	u16 name_len = 0;
+	u8 dead = 0; // deleted or moved away since the scan
+	u8 reserved = 0;
+};
+static_assert(sizeof(NameIndexEntry) == 16, "NameIndexEntry layout changed");
+
+struct NameIndexDir {
+	u32 entry = NameIndexNone; // its entry, none for the root
+	u32 first = 0; // its entries as of listing it
+	u32 count = 0;
+	u32 dead = 0;
+};
+static_assert(sizeof(NameIndexDir) == 16, "NameIndexDir layout changed");
+
+struct NameIndexQuery {
+	QString dir_path;
+	QString pattern;
+	FindMatch match = FindMatch::Substring;
+	bool case_sensitive = false;
+	bool show_hidden_files = false;
+	int max_results = 0;
+};
+
+/// Year ranges of media queries are clamped to these:
+const i16 MediaQueryMinYear = 1800;
+const i16 MediaQueryMaxYear = 2200;
+
+/// Matches the files whose media attributes (Efa_media) have all the
+/// fields that are set, -1 means any.
+struct MediaQuery {
+	QString dir_path; // empty for all indexed folders
+	i32 actor = -1;
+	i32 director = -1;
+	i32 writer = -1;
+	i16 genre = -1;
+	i16 subgenre = -1;
+	i16 country = -1;
+	i16 video_codec = -1;
+	i16 year_from = -1; // till year_to, both included
+	i16 year_to = -1;
+	i32 min_height = -1; // of the video, like 1080
+	int max_results = 0;
+};
+
+/// One indexed folder tree, it doesn't cross into other mounts.
+struct NameIndexRoot {
+	QString path; // ends with '/'
+	QVector<NameIndexDir> dirs; // [0] is the root itself
+	QVector<NameIndexEntry> entries; // by name_at, so binary searchable
+	QByteArray names; // '\0' separated
+	QByteArray lower; // names with ASCII lowered
+	/// Entries that inotify added after their folder got listed:
+	QHash<u32, QVector<u32>> added; // dir -> entries
+	QHash<int, u32> wd_dirs; // inotify watch -> dir
+	/// Of the entries that have media attributes, saved along:
+	QHash<u32, QByteArray> media; // entry -> Efa_media xattr
+	/// The inverted index built from them:
+	QHash<u64, QVector<u32>> postings; // MediaKey() -> entries, ascending
+	u64 dev = 0;
+	i64 scanned_at = 0; // seconds since Unix Epoch
+	u32 dead_count = 0;
+	int inotify_fd = -1;
+	bool must_rescan = false;
+};
+
+/** cornus_io's index of the file names below the folders the user chose
+to keep indexed, so that recursive name searches don't have to walk them.
+Each root is scanned (getdents64()) on a background thread, saved to
+GetLastingTmpDir()/name_index/ and loaded at startup. Each root has its
+own inotify instance (one watch per folder) to stay current in between
+the periodic rescans, an inotify queue overflow makes it rescan early.
+Queries run memmem() over the '\0' separated names, a few milliseconds
+for a million names, regexes are matched name by name.
+The media attributes of the files are read along (one lgetxattr() per
+entry, IN_ATTRIB keeps them current) into postings per actor, genre,
+year etc, a media query intersects those of the fields it sets.
+Thread safe. */
+class NameIndex {
+public:
+	NameIndex();
+	~NameIndex();
+	
+	bool AddRoot(QString dir_path);
+	/// Returns false when no indexed root covers query.dir_path.
+	bool Query(const NameIndexQuery &query, QVector<QString> &paths, bool &limit_reached);
+	/// Returns false when no indexed root covers query.dir_path.
+	bool QueryMedia(const MediaQuery &query, QVector<QString> &paths, bool &limit_reached);
+	bool RemoveRoot(QString dir_path);
+	void Start();
+	void Stop();
+
+private:
+	NO_ASSIGN_COPY_MOVE(NameIndex);
+	
+	u32 AddEntry(NameIndexRoot &root, cu32 dir, const char *name, cisize len, cbool is_dir);
+	void AddMedia(NameIndexRoot &root, cu32 entry, const QByteArray &xattr);
+	QString DirPath(const NameIndexRoot &root, u32 dir) const;
+	void DropRoot(NameIndexRoot *root);
+	u32 EntryAt(const NameIndexRoot &root, ci64 name_at) const;
+	u32 FindChild(const NameIndexRoot &root, cu32 dir, const char *name, cisize len) const;
+	bool FindDir(const NameIndexRoot &root, QString dir_path, u32 &dir) const;
+	NameIndexRoot* FindRoot(const QString &dir_path) const;
+	bool IsVisible(const NameIndexRoot &root, cu32 entry, cu32 under, cbool hidden_ok) const;
+	void KillEntry(NameIndexRoot &root, cu32 entry);
+	void ListDir(NameIndexRoot &root, cu32 dir, const QByteArray &dir_path,
+		QVector<QPair<u32, QByteArray>> &pending, char *buf);
+	NameIndexRoot* Load(const QString &root_path);
+	void LoadRoots();
+	void MatchMedia(const NameIndexRoot &root, const MediaQuery &query, QVector<u32> &found) const;
+	void ReadEvents(NameIndexRoot &root, char *buf);
+	void ReadMedia(NameIndexRoot &root, cu32 entry, const QByteArray &full_path);
+	void RemoveMedia(NameIndexRoot &root, cu32 entry);
+	void Rescan(const QString &root_path);
+	bool Save(const NameIndexRoot &root) const;
+	void SaveRoots() const;
+	NameIndexRoot* Scan(const QString &root_path);
+	void ScanFrom(NameIndexRoot &root, cu32 dir, const QByteArray &dir_path);
+	void WakeUp();
+	static void* Work(void *p);
+	
+	pthread_mutex_t mutex_ = PTHREAD_MUTEX_INITIALIZER;
+	pthread_cond_t cond_ = PTHREAD_COND_INITIALIZER;
+	QVector<NameIndexRoot*> roots_;
+	int wake_fd_ = -1;
+	bool thread_running_ = false;
+	std::atomic<bool> quit_ = false;
+	
+	friend class cornus::tests::NameIndexGlobs;
+};
+
+}
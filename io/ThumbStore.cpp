@@ -0,0 +1,597 @@
+#include "ThumbStore.hpp"
+
+#include "../AutoDelete.hh"
+#include "../ByteArray.hpp"
+#include "../MutexGuard.hpp"
+#include "io.hh"
+
+#include <QVector>
+
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace cornus::io {
+
+/// abi(i16) + reserved(i16) + generation(u32)
+static const i64 IndexHeaderSize = 8;
+/// inode(u64) + dev_major(u32) + dev_minor(u32) + mtime(i64) + offset(i64)
+/// + segment(u32) + size(u32) + time_added(u32)
+static const i64 IndexRecordSize = 44;
+/// How often (seconds) a miss may check if compaction replaced the index:
+static const i64 ReplaceCheckInterval = 2;
+
+static void AddRecord(ByteArray &ba, const ThumbStoreKey &key,
+	const ThumbStoreEntry &e)
+{
+	ba.add_u64(key.id.inode_number);
+	ba.add_u32(key.id.dev_major);
+	ba.add_u32(key.id.dev_minor);
+	ba.add_i64(key.time_modified);
+	ba.add_i64(e.offset);
+	ba.add_u32(e.segment);
+	ba.add_u32(e.size);
+	ba.add_u32(e.time_added);
+}
+
+static bool WriteAll(cint fd, const char *data, i64 size, i64 offset)
+{
+	while (size > 0)
+	{
+		cisize written = ::pwrite(fd, data, size, offset);
+		if (written == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			mtl_status(errno);
+			return false;
+		}
+		data += written;
+		size -= written;
+		offset += written;
+	}
+	
+	return true;
+}
+
+ThumbStore::ThumbStore() {}
+
+ThumbStore::~ThumbStore()
+{
+	/// Waits for a Compact() or Put() that might be running on another thread.
+	MutexGuard write_guard(&write_mutex_);
+	MutexGuard guard(&mutex_);
+	CloseAll();
+}
+
+void ThumbStore::CloseAll()
+{
+	for (auto it = maps_.begin(); it != maps_.end(); ++it)
+		::munmap(it.value().addr, it.value().len);
+	maps_.clear();
+	hash_.clear();
+	
+	if (index_fd_ != -1)
+	{
+		::close(index_fd_);
+		index_fd_ = -1;
+	}
+	
+	index_read_pos_ = 0;
+	generation_ = 0;
+	last_segment_ = 0;
+}
+
+void ThumbStore::Compact()
+{
+	MutexGuard write_guard(&write_mutex_);
+	cint lock_fd = LockIndex();
+	if (lock_fd == -1)
+		return;
+	
+	MutexGuard guard(&mutex_);
+	if (!ReadLockedIndex())
+	{
+		UnlockIndex(lock_fd);
+		return;
+	}
+	
+	i64 total_bytes = 0;
+	for (u32 i = 0; i <= last_segment_; i++)
+	{
+		auto ba = SegmentPath(generation_, i).toLocal8Bit();
+		struct stat st;
+		if (::stat(ba.data(), &st) == 0)
+			total_bytes += st.st_size;
+	}
+	
+	/// Only the newest thumbnail of each file is worth keeping:
+	QHash<DiskFileId, ThumbStoreKey> newest;
+	cu32 now = u32(time(NULL) / 60);
+	for (auto it = hash_.cbegin(); it != hash_.cend(); ++it)
+	{
+		const ThumbStoreKey &key = it.key();
+		if (now - it.value().time_added > ThumbStoreMaxAgeMinutes)
+			continue;
+		auto found = newest.find(key.id);
+		if (found == newest.end())
+			newest.insert(key.id, key);
+		else if (found.value().time_modified < key.time_modified)
+			found.value() = key;
+	}
+	
+	QVector<ThumbStoreKey> keep;
+	keep.reserve(newest.size());
+	for (const ThumbStoreKey &key: newest)
+		keep.append(key);
+	
+	/// Evict the least recently added ones that don't fit the budget:
+	std::sort(keep.begin(), keep.end(), [this] (const ThumbStoreKey &a, const ThumbStoreKey &b) {
+		return hash_.value(a).time_added > hash_.value(b).time_added;
+	});
+	i64 live_bytes = 0;
+	for (int i = 0; i < keep.size(); i++)
+	{
+		cu32 size = hash_.value(keep[i]).size;
+		if (live_bytes + size > ThumbStoreMaxBytes)
+		{
+			keep.resize(i);
+			break;
+		}
+		live_bytes += size;
+	}
+	
+	cbool nothing_dropped = (keep.size() == hash_.size());
+	if (nothing_dropped && (total_bytes - live_bytes) <= total_bytes / 4)
+	{
+		UnlockIndex(lock_fd);
+		return;
+	}
+	
+	/// Files of the same dir tend to have close inode numbers, keeping
+	/// them next to each other makes loading a dir mostly sequential.
+	std::sort(keep.begin(), keep.end(), [] (const ThumbStoreKey &a, const ThumbStoreKey &b) {
+		if (a.id.dev_major != b.id.dev_major)
+			return a.id.dev_major < b.id.dev_major;
+		if (a.id.dev_minor != b.id.dev_minor)
+			return a.id.dev_minor < b.id.dev_minor;
+		return a.id.inode_number < b.id.inode_number;
+	});
+	
+	cu32 new_gen = generation_ + 1;
+	ByteArray index;
+	index.add_i16(ThumbStoreAbiVersion);
+	index.add_i16(0);
+	index.add_u32(new_gen);
+	
+	u32 segment = 0;
+	i64 offset = 0;
+	int seg_fd = -1;
+	bool ok = true;
+	for (const ThumbStoreKey &key: keep)
+	{
+		if (compact_cancel_)
+		{
+			ok = false;
+			break;
+		}
+		
+		const ThumbStoreEntry old = hash_.value(key);
+		const char *data = MapEntry(old);
+		if (data == nullptr)
+			continue;
+		
+		if (seg_fd != -1 && offset + old.size > ThumbStoreSegmentMax)
+		{
+			::close(seg_fd);
+			seg_fd = -1;
+			segment++;
+			offset = 0;
+		}
+		
+		if (seg_fd == -1)
+		{
+			auto ba = SegmentPath(new_gen, segment).toLocal8Bit();
+			seg_fd = ::open(ba.data(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, FilePermissions);
+			if (seg_fd == -1)
+			{
+				mtl_status(errno);
+				ok = false;
+				break;
+			}
+		}
+		
+		if (!WriteAll(seg_fd, data, old.size, offset))
+		{
+			ok = false;
+			break;
+		}
+		
+		ThumbStoreEntry e = old;
+		e.segment = segment;
+		e.offset = offset;
+		AddRecord(index, key, e);
+		offset += old.size;
+	}
+	
+	if (seg_fd != -1)
+		::close(seg_fd);
+	
+	const QString new_index_path = IndexPath() + QLatin1String(".new");
+	auto new_index_ba = new_index_path.toLocal8Bit();
+	auto index_ba = IndexPath().toLocal8Bit();
+	if (ok)
+		ok = io::WriteToFile(new_index_path, index.data(), index.size());
+	
+	if (ok && ::rename(new_index_ba.data(), index_ba.data()) != 0)
+	{
+		mtl_status(errno);
+		ok = false;
+	}
+	
+	/// Whichever generation lost, remove its segments. Readers that
+	/// still have them mapped keep working off the mappings.
+	cu32 drop_gen = ok ? generation_ : new_gen;
+	cu32 drop_last = ok ? last_segment_ : segment;
+	for (u32 i = 0; i <= drop_last; i++)
+	{
+		auto ba = SegmentPath(drop_gen, i).toLocal8Bit();
+		::unlink(ba.data());
+	}
+	
+	if (ok)
+	{
+		mtl_info("Thumbnail store: kept %d of %d, %ld -> %ld bytes",
+			int(keep.size()), int(hash_.size()), total_bytes, live_bytes);
+	} else {
+		::unlink(new_index_ba.data());
+	}
+	
+	UnlockIndex(lock_fd);
+	CloseAll(); // reopens the new index on next use
+}
+
+bool ThumbStore::Get(const DiskFileId &id, ci64 time_modified, ByteArray &out)
+{
+	MutexGuard guard(&mutex_);
+	if (!OpenIfNeeded())
+		return false;
+	
+	const ThumbStoreKey key = {id, time_modified};
+	auto it = hash_.find(key);
+	if (it == hash_.end())
+	{
+		/// Maybe another process added it (or compacted) meanwhile:
+		ci64 now = time(NULL);
+		if (now - last_replace_check_ >= ReplaceCheckInterval)
+		{
+			last_replace_check_ = now;
+			if (!ReopenIfReplaced())
+				return false;
+		}
+		
+		if (!ReadNewEntries())
+			return false;
+		it = hash_.find(key);
+		if (it == hash_.end())
+			return false;
+	}
+	
+	ThumbStoreEntry e = it.value();
+	const char *data = MapEntry(e);
+	if (data == nullptr)
+	{
+		/// Its segment is gone, the index likely got compacted:
+		if (!ReopenIfReplaced())
+			return false;
+		it = hash_.find(key);
+		if (it == hash_.end())
+			return false;
+		e = it.value();
+		data = MapEntry(e);
+		if (data == nullptr)
+			return false;
+	}
+	
+	out.to(0);
+	out.size(0);
+	out.add(data, e.size, ExactSize::Yes);
+	out.to(0);
+	
+	return true;
+}
+
+bool ThumbStore::IndexReplaced(cint fd)
+{
+	auto ba = IndexPath().toLocal8Bit();
+	struct stat path_st, fd_st;
+	if (::stat(ba.data(), &path_st) != 0 || ::fstat(fd, &fd_st) != 0)
+		return true;
+	
+	return path_st.st_ino != fd_st.st_ino || path_st.st_dev != fd_st.st_dev;
+}
+
+int ThumbStore::LockIndex()
+{
+	while (true)
+	{
+		/// Its own fd, Get() may close and reopen index_fd_ meanwhile:
+		int fd;
+		{
+			MutexGuard guard(&mutex_);
+			if (!OpenIfNeeded())
+				return -1;
+			fd = ::fcntl(index_fd_, F_DUPFD_CLOEXEC, 0);
+		}
+		
+		if (fd == -1)
+		{
+			mtl_status(errno);
+			return -1;
+		}
+		
+		if (::flock(fd, LOCK_EX) != 0)
+		{
+			mtl_status(errno);
+			::close(fd);
+			return -1;
+		}
+		
+		/// Compaction might have replaced it while waiting for the lock:
+		if (!IndexReplaced(fd))
+			return fd;
+		
+		UnlockIndex(fd);
+		MutexGuard guard(&mutex_);
+		if (index_fd_ != -1 && IndexReplaced(index_fd_))
+			CloseAll();
+	}
+}
+
+const char* ThumbStore::MapEntry(const ThumbStoreEntry &e)
+{
+	ci64 end = e.offset + e.size;
+	auto it = maps_.find(e.segment);
+	if (it != maps_.end())
+	{
+		if (it.value().len >= end)
+			return it.value().addr + e.offset;
+		/// The segment grew since it was mapped:
+		::munmap(it.value().addr, it.value().len);
+		maps_.erase(it);
+	}
+	
+	auto ba = SegmentPath(generation_, e.segment).toLocal8Bit();
+	cint fd = ::open(ba.data(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return nullptr;
+	
+	AutoCloseFd acf(fd);
+	struct stat st;
+	if (::fstat(fd, &st) != 0 || st.st_size < end)
+		return nullptr;
+	
+	void *addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED)
+	{
+		mtl_status(errno);
+		return nullptr;
+	}
+	
+	maps_.insert(e.segment, ThumbSegmentMap {(char*)addr, st.st_size});
+	
+	return (const char*)addr + e.offset;
+}
+
+bool ThumbStore::OpenIfNeeded()
+{
+	if (index_fd_ != -1)
+		return true;
+	
+	if (dir_path_.isEmpty())
+	{
+		const QString &tmp_dir = io::GetLastingTmpDir();
+		if (tmp_dir.isEmpty())
+			return false;
+		dir_path_ = tmp_dir + QLatin1String("thumbs/");
+	}
+	
+	auto dir_ba = dir_path_.toLocal8Bit();
+	if (::mkdir(dir_ba.data(), DirPermissions) != 0 && errno != EEXIST)
+	{
+		mtl_status(errno);
+		return false;
+	}
+	
+	auto ba = IndexPath().toLocal8Bit();
+	index_fd_ = ::open(ba.data(), O_RDWR | O_CREAT | O_CLOEXEC, FilePermissions);
+	if (index_fd_ == -1)
+	{
+		mtl_status(errno);
+		return false;
+	}
+	
+	struct stat st;
+	if (::fstat(index_fd_, &st) == 0 && st.st_size == 0)
+	{
+		::flock(index_fd_, LOCK_EX);
+		if (::fstat(index_fd_, &st) == 0 && st.st_size == 0)
+		{
+			ByteArray header;
+			header.add_i16(ThumbStoreAbiVersion);
+			header.add_i16(0);
+			header.add_u32(0);
+			WriteAll(index_fd_, header.data(), header.size(), 0);
+		}
+		::flock(index_fd_, LOCK_UN);
+	}
+	
+	return ReadNewEntries();
+}
+
+bool ThumbStore::Put(const DiskFileId &id, ci64 time_modified,
+	const char *data, ci64 size)
+{
+	/// Readers only wait for mutex_ while the new index records are read,
+	/// not for the flock() or the writes:
+	MutexGuard write_guard(&write_mutex_);
+	cint lock_fd = LockIndex();
+	if (lock_fd == -1)
+		return false;
+	
+	u32 generation, segment;
+	i64 record_pos;
+	{
+		MutexGuard guard(&mutex_);
+		if (!ReadLockedIndex())
+		{
+			UnlockIndex(lock_fd);
+			return false;
+		}
+		generation = generation_;
+		segment = last_segment_;
+		record_pos = index_read_pos_;
+	}
+	
+	int seg_fd = -1;
+	struct stat st;
+	for (int i = 0; i < 2; i++)
+	{
+		auto ba = SegmentPath(generation, segment).toLocal8Bit();
+		seg_fd = ::open(ba.data(), O_WRONLY | O_CREAT | O_CLOEXEC, FilePermissions);
+		if (seg_fd == -1 || ::fstat(seg_fd, &st) != 0)
+			break;
+		if (st.st_size == 0 || st.st_size + size <= ThumbStoreSegmentMax)
+			break;
+		::close(seg_fd);
+		seg_fd = -1;
+		segment++;
+	}
+	
+	if (seg_fd == -1)
+	{
+		mtl_status(errno);
+		UnlockIndex(lock_fd);
+		return false;
+	}
+	
+	AutoCloseFd acf(seg_fd);
+	ThumbStoreEntry e;
+	e.offset = st.st_size;
+	e.segment = segment;
+	e.size = size;
+	e.time_added = u32(time(NULL) / 60);
+	const ThumbStoreKey key = {id, time_modified};
+	if (!WriteAll(seg_fd, data, size, e.offset))
+	{
+		UnlockIndex(lock_fd);
+		return false;
+	}
+	
+	/// Appended only after the data is in place. A torn record (crash
+	/// while writing it) isn't counted by index_read_pos_ and gets
+	/// overwritten here.
+	ByteArray record;
+	AddRecord(record, key, e);
+	cbool ok = WriteAll(lock_fd, record.data(), record.size(), record_pos);
+	if (ok)
+	{
+		/// Picks up the record (unless a Get() already did):
+		MutexGuard guard(&mutex_);
+		ReadNewEntries();
+	}
+	UnlockIndex(lock_fd);
+	
+	return ok;
+}
+
+bool ThumbStore::ReadLockedIndex()
+{
+	/// The path can't be replaced while the lock is held, but index_fd_
+	/// might still be the one from before the last compaction:
+	if (index_fd_ != -1 && IndexReplaced(index_fd_))
+		CloseAll();
+	
+	return OpenIfNeeded() && ReadNewEntries();
+}
+
+bool ThumbStore::ReadNewEntries()
+{
+	struct stat st;
+	if (::fstat(index_fd_, &st) != 0)
+	{
+		mtl_status(errno);
+		return false;
+	}
+	
+	ci64 from = index_read_pos_;
+	ci64 avail = st.st_size - from;
+	if (avail < ((from == 0) ? IndexHeaderSize : IndexRecordSize))
+		return true;
+	
+	ByteArray buf;
+	buf.MakeSure(avail, ExactSize::Yes);
+	if (::pread(index_fd_, buf.data(), avail, from) != avail)
+	{
+		mtl_status(errno);
+		return false;
+	}
+	buf.size(avail);
+	buf.to(0);
+	
+	if (from == 0)
+	{
+		if (buf.next_i16() != ThumbStoreAbiVersion)
+		{
+			mtl_warn("Thumbnail store ABI mismatch");
+			return false;
+		}
+		buf.next_i16();
+		generation_ = buf.next_u32();
+		index_read_pos_ = IndexHeaderSize;
+	}
+	
+	while (buf.has_more(IndexRecordSize))
+	{
+		ThumbStoreKey key;
+		key.id.inode_number = buf.next_u64();
+		key.id.dev_major = buf.next_u32();
+		key.id.dev_minor = buf.next_u32();
+		key.time_modified = buf.next_i64();
+		ThumbStoreEntry e;
+		e.offset = buf.next_i64();
+		e.segment = buf.next_u32();
+		e.size = buf.next_u32();
+		e.time_added = buf.next_u32();
+		hash_.insert(key, e);
+		last_segment_ = std::max(last_segment_, e.segment);
+		index_read_pos_ += IndexRecordSize;
+	}
+	
+	return true;
+}
+
+bool ThumbStore::ReopenIfReplaced()
+{
+	if (!IndexReplaced(index_fd_))
+		return true;
+	
+	CloseAll();
+	return OpenIfNeeded();
+}
+
+QString ThumbStore::SegmentPath(cu32 generation, cu32 segment) const
+{
+	return dir_path_ + QString::number(generation) + '_' + QString::number(segment);
+}
+
+void ThumbStore::UnlockIndex(cint fd)
+{
+	::flock(fd, LOCK_UN);
+	::close(fd);
+}
+
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "../decl.hxx"
+#include "../err.hpp"
+#include "decl.hxx"
+
+#include <QHash>
+#include <QString>
+
+#include <atomic>
+#include <pthread.h>
+
+namespace cornus::io {
+
+const i16 ThumbStoreAbiVersion = 1;
+/// A segment isn't appended to anymore once it's this big:
+const i64 ThumbStoreSegmentMax = 64 * 1024 * 1024;
+/// Compaction evicts the oldest thumbnails to stay under this size:
+const i64 ThumbStoreMaxBytes = i64(1024) * 1024 * 1024;
+const u32 ThumbStoreMaxAgeMinutes = 60 * 24 * 10;
+
+struct ThumbStoreKey {
+	DiskFileId id = {};
+	i64 time_modified = 0;
+	
+	bool operator == (const ThumbStoreKey &rhs) const {
+		return id == rhs.id && time_modified == rhs.time_modified;
+	}
+};
+
+inline size_t qHash(const ThumbStoreKey &key, size_t seed)
+{
+	return qHashMulti(seed, key.id, key.time_modified);
+}
+
+struct ThumbStoreEntry {
+	i64 offset = 0;
+	u32 segment = 0;
+	u32 size = 0;
+	u32 time_added = 0; // minutes, not seconds since Unix Epoch
+};
+
+struct ThumbSegmentMap {
+	char *addr = nullptr;
+	i64 len = 0;
+};
+
+/** Keeps the thumbnails that can't be stored in ext attrs packed into
+a few big append-only segment files in GetLastingTmpDir()/thumbs/
+instead of one file per thumbnail. The "index" file maps DiskFileId +
+mtime to (segment, offset, size) with fixed size records, it's appended
+to after the data got written and each process only reads the records
+it hasn't seen yet. Segments are mmap'd for reading, writers (of all
+processes) serialize with flock() on the index, readers of the same
+process don't wait for it. Compact() (run by cornus_io) writes the live
+entries into a new generation of segments, dropping stale, old and over
+budget ones, then renames the new index over the old one. Thread safe. */
+class ThumbStore {
+public:
+	ThumbStore();
+	~ThumbStore();
+	
+	/// Makes a running (or the next) Compact() give up, for shutting down:
+	void CancelCompact() { compact_cancel_ = true; }
+	void Compact();
+	/// Fills @out with what Put() stored, leaves it at position 0.
+	bool Get(const DiskFileId &id, ci64 time_modified, ByteArray &out);
+	bool Put(const DiskFileId &id, ci64 time_modified, const char *data, ci64 size);
+	
+private:
+	NO_ASSIGN_COPY_MOVE(ThumbStore);
+	
+	void CloseAll();
+	bool IndexReplaced(cint fd);
+	QString IndexPath() const { return dir_path_ + QLatin1String("index"); }
+	/// Returns a dup of the index fd holding LOCK_EX or -1, call it
+	/// with write_mutex_ held but not mutex_.
+	int LockIndex();
+	const char* MapEntry(const ThumbStoreEntry &e);
+	bool OpenIfNeeded();
+	/// With the index locked: reopens it if compacted, reads new records.
+	bool ReadLockedIndex();
+	bool ReadNewEntries();
+	bool ReopenIfReplaced();
+	QString SegmentPath(cu32 generation, cu32 segment) const;
+	void UnlockIndex(cint fd);
+	
+	/// Serializes this process' writers (Put(), Compact()), which flock()
+	/// one shared index description and so don't exclude each other:
+	pthread_mutex_t write_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+	/// Guards the members below, Put() doesn't hold it across flock()
+	/// or its writes:
+	mutable pthread_mutex_t mutex_ = PTHREAD_MUTEX_INITIALIZER;
+	QHash<ThumbStoreKey, ThumbStoreEntry> hash_;
+	QHash<u32, ThumbSegmentMap> maps_;
+	QString dir_path_;
+	int index_fd_ = -1;
+	i64 index_read_pos_ = 0;
+	i64 last_replace_check_ = 0;
+	u32 generation_ = 0;
+	u32 last_segment_ = 0;
+	std::atomic<bool> compact_cancel_ = false;
+};
+
+}
@@ -12,13 +12,21 @@
 namespace cornus::io {
 class AutoRemoveWatch;
 class Daemon;
+class DirSizeCache;
 class DirStream;
+class DiskUsage;
 class File;
 class Files;
 class FilesData;
+class FindFiles;
+class Grep;
+class NameFilter;
+class NameIndex;
 class Notify;
 class SaveFile;
 class Task;
+class ThumbStore;
+struct FindParams;
 
 static const QString Efa_cornus = QLatin1String("user.CornusMas");
 static const QString Efa_media = QStringLiteral("user.CornusMas.m");
@@ -52,6 +60,13 @@ enum class CountDirFiles: i8 {
 	No
 };
 
+/// How recursive name searches match file names:
+enum class FindMatch: i8 {
+	Substring,
+	Glob, // the whole name, like "*.cpp"
+	Regex,
+};
+
 struct DevNum {
 	i32 major = -1;
 	i32 minor = -1;
@@ -9,7 +9,7 @@
 #include "../err.hpp"
 #include "../ByteArray.hpp"
 #include "SaveFile.hpp"
-#include "../trash.hh"
+#include "ThumbStore.hpp"
 
 #include <QDir>
 #include <QFileInfo>
@@ -79,18 +79,6 @@ int allocate_shm_file(size_t size)
 	return fd;
 }
 
-QString BuildTempPathFromID(const DiskFileId &id, ci64 time_modified)
-{
-	QString s = io::GetLastingTmpDir();
-	s.append(QString::number(id.dev_major)).append('_');
-	s.append(QString::number(id.dev_minor)).append('_');
-	s.append(QString::number(id.inode_number)).append('_');
-	s.append(QString::number(time_modified));
-	// mtl_info("%s", qPrintable(s));
-	
-	return s;
-}
-
 bool CanWriteToDir(QStringView dir_path)
 {
 	auto ba = dir_path.toLocal8Bit();
@@ -477,82 +465,6 @@ int DeleteFolder(QString dp, const DeleteSubFolders dsf, const DeleteTopFolder d
 	return 0;
 }
 
-int DoStat(const QString &full_path, const QString &name, bool &is_trash_dir,
-	cbool do_check, CountFolderData &data)
-{
-	const auto flags = AT_SYMLINK_NOFOLLOW;
-	const auto fields = STATX_SIZE | STATX_MODE;
-	auto path_ba = full_path.toLocal8Bit();
-	
-	if (statx(0, path_ba.data(), flags, fields, &data.stx) == 0)
-	{
-		if (do_check && S_ISDIR(data.stx.stx_mode)) {
-			is_trash_dir = name.startsWith(trash::basename());
-			if (is_trash_dir) {
-				auto guard = data.guard();
-				data.info.trash_dir_count--; // don't count the trash can itself
-			}
-		}
-		return 0;
-	}
-
-	mtl_warn("statx(): %s", strerror(errno));
-	return errno;
-}
-
-int CountSizeRecursiveTh(const QString &path,
-	CountFolderData &data, cbool inside_trash)
-{
-	cbool is_dir = S_ISDIR(data.stx.stx_mode);
-	{
-		auto guard = data.guard();
-		if (data.app_has_quit)
-			return 0;
-		
-		if (inside_trash)
-			data.info.trash_size += data.stx.stx_size;
-		data.info.size += data.stx.stx_size;
-		
-		if (!is_dir) {
-			data.info.file_count++;
-			if (inside_trash)
-				data.info.trash_file_count++;
-			return 0;
-		}
-		
-		data.info.dir_count++;
-		if (inside_trash)
-			data.info.trash_dir_count++;
-	}
-	
-	QVector<QString> names;
-	
-	if (!ListFileNames(path, names)) {
-		mtl_printq(path);
-		return errno;
-	}
-	
-	for (const auto &name: names)
-	{
-		QString full_path = path;
-		if (!full_path.endsWith('/'))
-			full_path.append('/');
-		full_path.append(name);
-		
-		bool is_trash_dir = false;
-		int err = io::DoStat(full_path, name, is_trash_dir, !inside_trash, data);
-		if (err != 0)
-			return err;
-		
-		cbool inside_trash2 = inside_trash ? inside_trash : is_trash_dir;
-		err = CountSizeRecursiveTh(full_path, data, inside_trash2);
-		if (err != 0)
-			return err;
-	}
-	
-	return 0;
-}
-
 void Delete(io::File *file, const QProcessEnvironment &env)
 {
 	if (file->is_dir())
@@ -811,6 +723,16 @@ FloatToString(const float number, cint precision)
 	return QString::number(number, 'f', precision);
 }
 
+void FoldAscii(const char *src, char *dst, const isize len)
+{
+	/// Plain enough for the compiler to vectorize:
+	for (isize i = 0; i < len; i++)
+	{
+		const char c = src[i];
+		dst[i] = (c >= 'A' && c <= 'Z') ? char(c + ('a' - 'A')) : c;
+	}
+}
+
 QStringView
 GetFileNameExtension(QStringView name, QStringView *base_name)
 {
@@ -972,6 +894,18 @@ bool IsNearlyEqual(double x, double y)
 	// see Knuth section 4.2.2 pages 217-218
 }
 
+bool IsPseudoFsDir(const QByteArray &dir_path)
+{
+	static const char *Dirs[] = {"/proc/", "/sys/", "/dev/", "/run/"};
+	for (const char *next: Dirs)
+	{
+		if (dir_path == next)
+			return true;
+	}
+	
+	return false;
+}
+
 int ListDirNames(QString dir_path, QVector<QString> &vec, const ListDirOption option)
 {
 	struct dirent *entry;
@@ -1691,27 +1625,15 @@ bool SameFiles(const QString &path1, const QString &path2, int *ret_error)
 }
 
 bool SaveThumbnailToDisk(const SaveThumbnail &item, ZSTD_CCtx *compress_ctx,
-	cbool ok_to_store_thumbnails_in_ext_attrs)
+	cbool ok_to_store_thumbnails_in_ext_attrs, ThumbStore *store)
 {
 	ByteArray ba;
-	ba.MakeSure(thumbnail::HeaderSize, ExactSize::Yes);
-	ba.add_i16(thumbnail::AbiVersion);
-	ba.add_i16(item.thmb.width());
-	ba.add_i16(item.thmb.height());
-	cu16 bpl = item.thmb.bytesPerLine();
-	ba.add_u16(bpl);
-	ba.add_i32(item.orig_img_w);
-	ba.add_i32(item.orig_img_h);
-	ba.add_i32(static_cast<i32>(item.thmb.format()));
-	
-	const char *src_buf = (const char*)item.thmb.constBits();
-	ci64 src_size = item.thmb.sizeInBytes();
-	ci64 dst_size = ZSTD_compressBound(src_size);
-	char *dst_buf = (char*)malloc(dst_size);
-	ci64 compressed_size = ZSTD_compressCCtx(compress_ctx,
-		dst_buf, dst_size, src_buf, src_size, 1);
-	ba.add(dst_buf, compressed_size, ExactSize::Yes);
-	free(dst_buf);
+	thumbnail::Encode(item.thmb, item.orig_img_w, item.orig_img_h, compress_ctx, ba);
+	if (ba.is_empty())
+	{
+		mtl_info("Failed compressing thumbnail of: %s", qPrintable(item.full_path));
+		return false;
+	}
 	
 	cbool temp_dir_not_mandatory = (item.dir == TempDir::No);
 	if (ok_to_store_thumbnails_in_ext_attrs && temp_dir_not_mandatory)
@@ -1722,18 +1644,13 @@ bool SaveThumbnailToDisk(const SaveThumbnail &item, ZSTD_CCtx *compress_ctx,
 		}
 	}
 	
-	QString file_path = io::BuildTempPathFromID(item.id, item.time_modified);
-	io::SaveFile save_file(file_path);
-	if (!io::WriteToFile(save_file.GetPathToWorkWith(), ba.data(), ba.size()))
+	if (store == nullptr || !store->Put(item.id, item.time_modified, ba.data(), ba.size()))
 	{
-		save_file.CommitCancelled();
-		mtl_info("Failed saving to: ", qPrintable(save_file.GetPathToWorkWith()));
+		mtl_info("Failed saving thumbnail of: %s", qPrintable(item.full_path));
 		return false;
-	} else {
-		// mtl_info("Saved to: %s", qPrintable(save_file.GetPathToWorkWith()));
 	}
 	
-	return save_file.Commit();
+	return true;
 }
 
 bool sd_nvme(const QString &name)
@@ -1843,6 +1760,17 @@ bool SortFiles(io::File *a, io::File *b)
 		return order.ascending ? flag : !flag;
 	}
 	
+	if (order.column == gui::Column::DirSize) {
+		/// Folders not counted yet (-1) go first:
+		if (a->dir_size() == b->dir_size()) {
+			int n = CompareStrings(a->name_lower(), b->name_lower());
+			bool result = n >= 0 ? false : true;
+			return order.ascending ? result : !result;
+		}
+		cbool flag = a->dir_size() < b->dir_size();
+		return order.ascending ? flag : !flag;
+	}
+	
 	if (order.column == gui::Column::Icon) {
 		// order by file type..
 		if (a->type() != b->type()) {
@@ -31,6 +31,16 @@
 
 namespace cornus::io {
 
+/// What getdents64() fills the buffer with, glibc only declares it
+/// along with its own getdents64() wrapper since 2.30:
+struct LinuxDirent64 {
+	ino64_t d_ino;
+	off64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
 struct ReadParams {
 	i64 read_max = -1;
 	mode_t *ret_mode = nullptr;
@@ -91,6 +101,10 @@ enum class Message: MessageType {
 	PasteLinks,
 	PasteRelativeLinks,
 	RenameFile,
+	NameIndexAddRoot,
+	NameIndexRemoveRoot,
+	NameIndexQuery,
+	NameIndexMediaQuery,
 	
 	Pasted_Hint = 1u << 28,
 	Copy = 1u << 29, // copies files
@@ -173,8 +187,6 @@ void randname(char *buf);
 int create_shm_file(void);
 int allocate_shm_file(size_t size);
 
-QString BuildTempPathFromID(const DiskFileId &id, ci64 time_modified);
-
 bool CanWriteToDir(QStringView dir_path);
 
 bool CheckDesktopFileABI(ByteArray &ba);
@@ -186,36 +198,9 @@ int CountDirFilesSkippingSubdirs(QStringView dir_path);
 
 bool CopyFileFromTo(QStringView from_full_path, QString to_dir);
 
-struct CountFolderData {
-	io::CountRecursiveInfo info = {};
-	QString full_path;
-	pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-	bool thread_has_quit = false;
-	bool app_has_quit = false;
-	struct statx stx;
-	QString err_str;
-	
-	inline void Lock() {
-		int status = pthread_mutex_lock(&mutex);
-		if (status != 0)
-			mtl_status(status);
-	}
-	
-	inline void Unlock() {
-		int status = pthread_mutex_unlock(&mutex);
-		if (status != 0)
-			mtl_status(status);
-	}
-	
-	MutexGuard guard() { return MutexGuard(&mutex); }
-};
-
 bool CountSizeRecursive(const QString &path, struct statx &stx,
 	CountRecursiveInfo &info, const FirstTime ft = FirstTime::Yes);
 
-// returns errno, or zero for success
-int CountSizeRecursiveTh(const QString &path, CountFolderData &data, const bool inside_trash);
-
 bool CreateRegularFile(QStringView full_path);
 
 // returns -1 on error, fd otherwise
@@ -231,9 +216,6 @@ int DeleteFolder(QString dir_path, const DeleteSubFolders dsf = DeleteSubFolders
 
 bool DirExists(const QString &full_path);
 
-int DoStat(const QString &full_path, const QString &name,
-	bool &is_trash_dir, const bool do_check, CountFolderData &data);
-
 bool EnsureDir(QString dir_path, const QString &subdir, QString *result = nullptr);
 
 bool EnsureRegularFile(const QString &full_path, const mode_t *mode = nullptr);
@@ -263,6 +245,9 @@ void FillInStx(io::File &file, const struct statx &st, const QString *name);
 
 QString FloatToString(const float number, cint precision);
 
+/// Lowers ASCII letters only, dst may be src:
+void FoldAscii(const char *src, char *dst, const isize len);
+
 DirType GetDirType(const QString &full_path);
 
 QStringView GetFileNameExtension(QStringView name, QStringView *base_name = 0);
@@ -281,6 +266,10 @@ void InitEnvInfo(Category &desktop, QVector<QString> &search_icons_dirs,
 
 inline bool IsNearlyEqual(double x, double y);
 
+/// Pseudo file systems that recursive searches skip since they'd only
+/// waste time or block on reads, dir_path is local 8 bit ending with '/':
+bool IsPseudoFsDir(const QByteArray &dir_path);
+
 /// lists only dir names, returns 0 on success, errno otherwise
 int ListDirNames(QString dir_path, QVector<QString> &vec,
 	const ListDirOption option = ListDirOption::IncludeLinksToDirs);
@@ -362,7 +351,7 @@ bool SameFiles(const QString &path1, const QString &path2,
 	int *ret_error = nullptr);
 
 bool SaveThumbnailToDisk(const SaveThumbnail &item, ZSTD_CCtx *compress_ctx,
-	const bool ok_to_store_thumbnails_in_ext_attrs);
+	const bool ok_to_store_thumbnails_in_ext_attrs, ThumbStore *store);
 
 bool sd_nvme(const QString &name);
 
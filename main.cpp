@@ -1,16 +1,26 @@
 #include "App.hpp"
 #include "gui/Tab.hpp"
+#include "startup.hh"
 
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <QApplication>
+#include <QDir>
 #include <QWidget>
 
 #include "tests.hh"
 
 int main(int argc, char *argv[])
 {
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], cornus::startup::ProfileArg) == 0)
+			cornus::startup::EnableProfile();
+	}
+	
 	QApplication qapp(argc, argv);
+	cornus::startup::Mark("QApplication");
 	
 	// QString s = "Jos\u{65}\u{301}";
 	// mtl_info("String count: %lld (%s)", s.size(), qPrintable(s));
@@ -18,6 +28,7 @@ int main(int argc, char *argv[])
 	// mtl_info("Size: %lld, \"%s\"", s.size(), qPrintable(s));
 	
 	cornus::App app;
+	cornus::startup::Mark("App constructed");
 	QStringList args = qapp.arguments();
 	QList<cornus::tests::Test*> tests;
 	
@@ -29,6 +40,30 @@ int main(int argc, char *argv[])
 		
 		if (args[2] == QLatin1String("newFiles")) {
 			tests.append(new cornus::tests::CreateNewFiles(&app));
+		} else if (args[2] == QLatin1String("downscale")) {
+			tests.append(new cornus::tests::DownscaleSpeed(&app));
+		} else if (args[2] == QLatin1String("nameglobs")) {
+			tests.append(new cornus::tests::NameIndexGlobs(&app));
+		} else if (args[2] == QLatin1String("thumbcodec")) {
+			QString dir = QDir::currentPath();
+			bool train = false;
+			for (int i = 3; i < args.size(); i++) {
+				if (args[i] == QLatin1String("--train"))
+					train = true;
+				else
+					dir = args[i];
+			}
+			tests.append(new cornus::tests::ThumbCodecSpeed(&app, dir, train));
+		} else if (args[2] == QLatin1String("thumbnails")) {
+			QString dir = QDir::currentPath();
+			bool use_previews = true;
+			for (int i = 3; i < args.size(); i++) {
+				if (args[i] == QLatin1String("--no-previews"))
+					use_previews = false;
+				else
+					dir = args[i];
+			}
+			tests.append(new cornus::tests::ThumbnailSpeed(&app, dir, use_previews));
 		} else {
 			auto ba = args[2].toLocal8Bit();
 			mtl_warn("No such test: \"%s\"", ba.data());
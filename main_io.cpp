@@ -150,6 +150,63 @@ void* ProcessRequestTh(void *ptr)
 		ConnectionType, Q_ARG(cint, fd));
 		return nullptr;
 	}
+	case io::Message::NameIndexAddRoot: {
+		close(fd);
+		daemon->name_index().AddRoot(ba.next_string());
+		return nullptr;
+	}
+	case io::Message::NameIndexRemoveRoot: {
+		close(fd);
+		daemon->name_index().RemoveRoot(ba.next_string());
+		return nullptr;
+	}
+	case io::Message::NameIndexQuery: {
+		/// Thread safe, no need to go through the GUI thread:
+		io::NameIndexQuery query;
+		query.dir_path = ba.next_string();
+		query.pattern = ba.next_string();
+		query.match = io::FindMatch(ba.next_i8());
+		query.case_sensitive = ba.next_i8() == 1;
+		query.show_hidden_files = ba.next_i8() == 1;
+		query.max_results = ba.next_i32();
+		QVector<QString> paths;
+		bool limit_reached = false;
+		cbool covered = daemon->name_index().Query(query, paths, limit_reached);
+		ByteArray reply;
+		reply.add_i8(covered ? 1 : 0);
+		reply.add_i8(limit_reached ? 1 : 0);
+		reply.add_i32(paths.size());
+		for (const QString &next: paths)
+			reply.add_string(next);
+		reply.Send(fd);
+		return nullptr;
+	}
+	case io::Message::NameIndexMediaQuery: {
+		io::MediaQuery query;
+		query.dir_path = ba.next_string();
+		query.actor = ba.next_i32();
+		query.director = ba.next_i32();
+		query.writer = ba.next_i32();
+		query.genre = ba.next_i16();
+		query.subgenre = ba.next_i16();
+		query.country = ba.next_i16();
+		query.video_codec = ba.next_i16();
+		query.year_from = ba.next_i16();
+		query.year_to = ba.next_i16();
+		query.min_height = ba.next_i32();
+		query.max_results = ba.next_i32();
+		QVector<QString> paths;
+		bool limit_reached = false;
+		cbool covered = daemon->name_index().QueryMedia(query, paths, limit_reached);
+		ByteArray reply;
+		reply.add_i8(covered ? 1 : 0);
+		reply.add_i8(limit_reached ? 1 : 0);
+		reply.add_i32(paths.size());
+		for (const QString &next: paths)
+			reply.add_string(next);
+		reply.Send(fd);
+		return nullptr;
+	}
 	case io::Message::QuitServer: {
 #ifdef CORNUS_DEBUG_SERVER_SHUTDOWN
 		mtl_info("Received QuitServer signal over socket");
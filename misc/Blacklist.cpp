@@ -3,96 +3,347 @@
 #include "../prefs.hh"
 #include "../io/File.hpp"
 
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
 #include <time.h>
+#include <unistd.h>
 
 namespace cornus::misc {
 
+/// abi(i16) + reserved(i16) + reserved(12 bytes)
+static const i64 HeaderSize = 16;
+static const i64 RecordSize = sizeof(Thumbnail);
+static const int MinSlotCount = 256;
+
 Blacklist::Blacklist() {}
 
 Blacklist::~Blacklist() {
-	if (modified_) {
-		Save();
-	}
+	Save();
+	Close();
 }
 
-Efa Blacklist::Add(const io::DiskFileId &id, const struct statx_timestamp &date, Efa value, cu32 *added)
+Efa Blacklist::Add(const io::DiskFileId &id, const struct statx_timestamp &date, Efa value)
 {
-	Thumbnail t = hash_.value(id);
-	const Efa what_changed = value & ~t.value;
-	// mtl_info("value: %d, t.value: %d, what_changed: %d", (int)value, (int)t.value, (int)what_changed);
-	if (!t.id.empty()) {
+	LoadIfNeeded();
+	AppendPending();
+	const Thumbnail *found = Find(id);
+	cbool same_file = found != nullptr && found->value != Efa::None &&
+		found->date_sec == date.tv_sec && found->date_nsec == date.tv_nsec;
+	const Efa what_changed = value & ~(same_file ? found->value : Efa::None);
+	// mtl_info("value: %d, what_changed: %d", (int)value, (int)what_changed);
+	if (same_file) {
+		if (what_changed == Efa::None)
+			return what_changed;
+		/// Copied, appending can move the mapping:
+		Thumbnail t = *found;
 		t.value |= value;
-		hash_.insert(id, t);
+		Append(&t, 1);
 		return what_changed;
 	}
 	
+	Thumbnail t;
 	t.id = id;
-	t.date = date;
+	t.date_sec = date.tv_sec;
+	t.date_nsec = date.tv_nsec;
+	t.time_added = u32(time(NULL) / 60);
 	t.value = value;
-	if (added) {
-		t.time_added = *added;
-	} else {
-		t.time_added = u32(time(NULL) / 60);
-		modified_ = true;
-		// mtl_info("Added disk id %lu, %u, %u", id.inode_number, id.dev_major, id.dev_minor);
-	}
-
-	hash_.insert(id, t);
+	Append(&t, 1);
+	// mtl_info("Added disk id %lu, %u, %u", id.inode_number, id.dev_major, id.dev_minor);
 	
 	return what_changed;
 }
 
 Efa Blacklist::Allow(io::File *file, Efa allowed) {
 	// returns what changed for the file
-	Thumbnail found = hash_.value(file->id());
-	if (found.id.empty()) {
+	LoadIfNeeded();
+	AppendPending();
+	const Thumbnail *found = Find(file->id());
+	if (found == nullptr || found->value == Efa::None) {
 		return Efa::None;
 	}
 	
-	modified_ = true;
-	Efa what_changed = allowed & ~found.value;
-	found.value &= ~allowed;
-	if (found.value == Efa::None) {
-		hash_.remove(file->id());
-	} else {
-		hash_.insert(file->id(), found);
-	}
+	Thumbnail t = *found;
+	Efa what_changed = allowed & ~t.value;
+	t.value &= ~allowed;
+	if (t.value != found->value)
+		Append(&t, 1);
 	
 	return what_changed;
 }
 
+bool Blacklist::Append(const Thumbnail *records, cint count)
+{
+	if (fd_ == -1 || count <= 0)
+		return false;
+	
+	/// Shared with other appenders, Compact() holds LOCK_EX while it
+	/// copies the live records and renames the new file over this one:
+	while (true)
+	{
+		if (::flock(fd_, LOCK_SH) != 0)
+		{
+			mtl_status(errno);
+			return false;
+		}
+		
+		/// Another process compacted it, the old file is unlinked:
+		if (!FileReplaced())
+			break;
+		
+		::flock(fd_, LOCK_UN);
+		if (!Open())
+			return false;
+	}
+	
+	const char *data = (const char*)records;
+	i64 size = i64(count) * RecordSize;
+	while (size > 0)
+	{
+		/// O_APPEND: records of other processes don't get overwritten.
+		cisize written = ::write(fd_, data, size);
+		if (written == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			mtl_status(errno);
+			::flock(fd_, LOCK_UN);
+			return false;
+		}
+		data += written;
+		size -= written;
+	}
+	
+	::flock(fd_, LOCK_UN);
+	
+	return MapNewRecords();
+}
+
+void Blacklist::AppendPending()
+{
+	if (pending_.isEmpty())
+		return;
+	
+	Append(pending_.constData(), pending_.size());
+	pending_.clear();
+}
+
 Efa Blacklist::Block(io::File *file, Efa efa) {
 	// returns what changed for the file
 	return Add(file->id(), file->time_created(), efa);
 }
 
-Efa Blacklist::GetStatus(io::File *file) {
-	if (!hash_.contains(file->id())) {
-		return Efa::None;
+void Blacklist::Close()
+{
+	if (map_ != nullptr)
+	{
+		::munmap(map_, map_len_);
+		map_ = nullptr;
+		map_len_ = 0;
 	}
 	
-	const misc::Thumbnail th = hash_.value(file->id());
+	if (fd_ != -1)
+	{
+		::close(fd_);
+		fd_ = -1;
+	}
 	
-	cauto b = file->time_created();
-	cbool ret = th.date.tv_sec == b.tv_sec && th.date.tv_nsec == b.tv_nsec;
+	slots_.clear();
+	record_count_ = 0;
+	live_count_ = 0;
+	key_count_ = 0;
+}
+
+bool Blacklist::Compact()
+{
+	if (::flock(fd_, LOCK_EX) != 0)
+	{
+		mtl_status(errno);
+		return false;
+	}
 	
-	if (!ret) {
-		modified_ = true;
-		hash_.remove(file->id());
-		return Efa::None;
+	/// Records appended by other processes meanwhile are kept too:
+	if (FileReplaced() || !MapNewRecords())
+	{
+		::flock(fd_, LOCK_UN);
+		return Open();
 	}
 	
-	return th.value;
+	ByteArray buf;
+	buf.add_i16(BlacklistAbiVersion);
+	buf.add_i16(0);
+	buf.add_u32(0);
+	buf.add_u64(0);
+	const Thumbnail *recs = records();
+	for (ci32 index: slots_)
+	{
+		if (index != -1 && recs[index].value != Efa::None)
+			buf.add((const char*)&recs[index], RecordSize);
+	}
+	
+	const QString path = filePath(BlacklistAbiVersion);
+	const QString new_path = path + QLatin1String(".new");
+	auto path_ba = path.toLocal8Bit();
+	auto new_path_ba = new_path.toLocal8Bit();
+	bool ok = io::WriteToFile(new_path, buf.data(), buf.size());
+	if (ok && ::rename(new_path_ba.data(), path_ba.data()) != 0)
+	{
+		mtl_status(errno);
+		::unlink(new_path_ba.data());
+		ok = false;
+	}
+	
+	if (ok)
+		mtl_info("Blacklist: %d of %d records kept", live_count_, record_count_);
+	
+	::flock(fd_, LOCK_UN);
+	
+	return Open() && ok;
+}
+
+bool Blacklist::Contains(const io::File *file, const Efa efa) const
+{
+	const Thumbnail *found = Find(file->id());
+	if (found == nullptr || found->value == Efa::None)
+		return false;
+	
+	/// An inode reused by another file, GetStatus() drops the record:
+	cauto b = file->time_created();
+	if (found->date_sec != b.tv_sec || found->date_nsec != b.tv_nsec)
+		return false;
+	
+	return EfaContains(found->value, efa);
+}
+
+bool Blacklist::FileReplaced() const
+{
+	auto ba = filePath(BlacklistAbiVersion).toLocal8Bit();
+	struct stat path_st, fd_st;
+	if (::stat(ba.data(), &path_st) != 0 || ::fstat(fd_, &fd_st) != 0)
+		return true;
+	
+	return path_st.st_ino != fd_st.st_ino || path_st.st_dev != fd_st.st_dev;
 }
 
-QString Blacklist::filePath() {
+QString Blacklist::filePath(cint abi_version) {
 	QString full_path = prefs::QueryAppConfigPath();
 	if (!full_path.endsWith('/'))
 		full_path.append('/');
-	full_path.append("blacklist.bin");
+	if (abi_version == 1)
+		full_path.append("blacklist.bin");
+	else
+		full_path.append(QString("blacklist%1.bin").arg(abi_version));
 	return full_path;
 }
 
+const Thumbnail* Blacklist::Find(const io::DiskFileId &id) const
+{
+	if (slots_.isEmpty())
+		return nullptr;
+	
+	const Thumbnail *recs = records();
+	cint mask = slots_.size() - 1;
+	int slot = int(qHash(id, 0) & mask);
+	while (true)
+	{
+		ci32 index = slots_[slot];
+		if (index == -1)
+			return nullptr;
+		if (recs[index].id == id)
+			return &recs[index];
+		slot = (slot + 1) & mask;
+	}
+}
+
+Efa Blacklist::GetStatus(io::File *file) {
+	LoadIfNeeded();
+	const Thumbnail *found = Find(file->id());
+	if (found == nullptr || found->value == Efa::None) {
+		return Efa::None;
+	}
+	
+	cauto b = file->time_created();
+	if (found->date_sec != b.tv_sec || found->date_nsec != b.tv_nsec) {
+		/// The inode got reused by another file. It's called while
+		/// painting, so the record is dropped with the next write:
+		auto same = [found](const Thumbnail &t) { return t.id == found->id; };
+		if (std::none_of(pending_.cbegin(), pending_.cend(), same))
+		{
+			Thumbnail t = *found;
+			t.value = Efa::None;
+			pending_.append(t);
+		}
+		return Efa::None;
+	}
+	
+	return found->value;
+}
+
+void Blacklist::ImportV1()
+{
+	const QString path = filePath(1);
+	ByteArray buf;
+	io::ReadParams params = {};
+	params.can_rely = CanRelyOnStatxSize::Yes;
+	params.print_errors = PrintErrors::No;
+	if (!io::ReadFile(path, buf, params))
+		return;
+	
+	QVector<Thumbnail> vec;
+	while (buf.has_more()) {
+		Thumbnail t;
+		t.id.inode_number = buf.next_u64();
+		t.id.dev_major = buf.next_u32();
+		t.id.dev_minor = buf.next_u32();
+		t.date_sec = buf.next_i64();
+		t.date_nsec = buf.next_u32();
+		t.time_added = buf.next_u32();
+		t.value = (Efa)buf.next_u8();
+		vec.append(t);
+	}
+	
+	if (vec.isEmpty() || Append(vec.constData(), vec.size()))
+	{
+		auto ba = path.toLocal8Bit();
+		::unlink(ba.data());
+		mtl_info("Blacklist: imported %d records", int(vec.size()));
+	}
+}
+
+void Blacklist::IndexRecord(ci32 index)
+{
+	const Thumbnail *recs = records();
+	const Thumbnail &rec = recs[index];
+	if ((key_count_ + 1) * 2 > slots_.size())
+		Rehash(std::max(MinSlotCount, int(slots_.size()) * 2));
+	
+	cint mask = slots_.size() - 1;
+	int slot = int(qHash(rec.id, 0) & mask);
+	while (true)
+	{
+		ci32 existing = slots_[slot];
+		if (existing == -1)
+		{
+			slots_[slot] = index;
+			key_count_++;
+			if (rec.value != Efa::None)
+				live_count_++;
+			return;
+		}
+		
+		if (recs[existing].id == rec.id)
+		{
+			/// The newest record wins:
+			live_count_ += int(rec.value != Efa::None) - int(recs[existing].value != Efa::None);
+			slots_[slot] = index;
+			return;
+		}
+		
+		slot = (slot + 1) & mask;
+	}
+}
+
 bool Blacklist::IsAllowed(io::File *file, Efa efa)
 {
 	Efa has = GetStatus(file);
@@ -102,53 +353,121 @@ bool Blacklist::IsAllowed(io::File *file, Efa efa)
 }
 
 void Blacklist::Load() {
-	hash_.clear();
-	QString path = filePath();
-	ByteArray buf;
-	io::ReadParams params = {};
-	params.can_rely = CanRelyOnStatxSize::Yes;
-	params.print_errors = PrintErrors::No;
-	mtl_check_void(io::ReadFile(path, buf, params));
-	io::DiskFileId id;
-	struct statx_timestamp date;
-	while (buf.has_more()) {
-		id.inode_number = buf.next_u64();
-		id.dev_major = buf.next_u32();
-		id.dev_minor = buf.next_u32();
-		date.tv_sec = buf.next_i64();
-		date.tv_nsec = buf.next_u32();
-		cu32 added = buf.next_u32();
-		Efa value = (Efa)buf.next_u8();
-		Add(id, date, value, &added);
+	/// Called lazily on first use to keep it off the startup path.
+	loaded_ = true;
+	if (Open() && record_count_ == 0)
+		ImportV1();
+}
+
+bool Blacklist::MapNewRecords()
+{
+	struct stat st;
+	if (::fstat(fd_, &st) != 0)
+	{
+		mtl_status(errno);
+		return false;
 	}
+	
+	/// A torn record at the end (crash while appending) is ignored:
+	ci32 count = i32((st.st_size - HeaderSize) / RecordSize);
+	if (count < 0 || (map_ != nullptr && count == record_count_))
+		return count >= 0;
+	
+	ci64 len = HeaderSize + i64(count) * RecordSize;
+	void *addr = (map_ == nullptr) ?
+		::mmap(nullptr, len, PROT_READ, MAP_SHARED, fd_, 0) :
+		::mremap(map_, map_len_, len, MREMAP_MAYMOVE);
+	if (addr == MAP_FAILED)
+	{
+		mtl_status(errno);
+		Close();
+		return false;
+	}
+	
+	map_ = (char*)addr;
+	map_len_ = len;
+	for (i32 i = record_count_; i < count; i++)
+		IndexRecord(i);
+	record_count_ = count;
+	
+	return true;
 }
 
-bool Blacklist::Save() {
-	// returns true on success
-	if (!modified_) {
-		return true;
+bool Blacklist::Open()
+{
+	Close();
+	auto ba = filePath(BlacklistAbiVersion).toLocal8Bit();
+	fd_ = ::open(ba.data(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, io::FilePermissions);
+	if (fd_ == -1)
+	{
+		mtl_status(errno);
+		return false;
+	}
+	
+	struct stat st;
+	if (::fstat(fd_, &st) == 0 && st.st_size == 0)
+	{
+		::flock(fd_, LOCK_EX);
+		if (::fstat(fd_, &st) == 0 && st.st_size == 0)
+		{
+			ByteArray header;
+			header.add_i16(BlacklistAbiVersion);
+			header.add_i16(0);
+			header.add_u32(0);
+			header.add_u64(0);
+			if (::write(fd_, header.data(), header.size()) != header.size())
+				mtl_status(errno);
+		}
+		::flock(fd_, LOCK_UN);
 	}
-	QString path = filePath();
-	ByteArray buf;
-	ToBlob(buf);
 	
-	modified_ = false;
+	i16 abi = 0;
+	if (::pread(fd_, &abi, sizeof abi, 0) != sizeof abi || abi != BlacklistAbiVersion)
+	{
+		mtl_warn("Blacklist ABI mismatch: %s", ba.data());
+		Close();
+		return false;
+	}
 	
-	return io::WriteToFile(path, buf.data(), buf.size());
+	return MapNewRecords();
+}
+
+const Thumbnail* Blacklist::records() const
+{
+	return (const Thumbnail*)(map_ + HeaderSize);
 }
 
-void Blacklist::ToBlob(ByteArray &buf)
+void Blacklist::Rehash(cint slot_count)
 {
-	for (auto it = hash_.cbegin(); it != hash_.cend(); ++it) {
-		const Thumbnail th = it.value();
-		buf.add_u64(th.id.inode_number);
-		buf.add_u32(th.id.dev_major);
-		buf.add_u32(th.id.dev_minor);
-		buf.add_i64(th.date.tv_sec);
-		buf.add_u32(th.date.tv_nsec);
-		buf.add_u32(th.time_added);
-		buf.add_u8((EfaType)th.value);
+	const Thumbnail *recs = records();
+	QVector<i32> old = slots_;
+	slots_.fill(-1, slot_count);
+	cint mask = slot_count - 1;
+	for (ci32 index: old)
+	{
+		if (index == -1)
+			continue;
+		int slot = int(qHash(recs[index].id, 0) & mask);
+		while (slots_[slot] != -1)
+			slot = (slot + 1) & mask;
+		slots_[slot] = index;
+	}
+}
+
+bool Blacklist::Save() {
+	// returns true on success
+	if (!loaded_ || fd_ == -1) {
+		return true;
 	}
+	
+	AppendPending();
+	
+	/// Changes are on disk already, only get rid of the dead records:
+	cint dead = record_count_ - live_count_;
+	if (dead < BlacklistCompactMinDead || dead <= live_count_)
+		return true;
+	
+	return Compact();
 }
 
 }
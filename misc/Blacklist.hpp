@@ -1,54 +1,87 @@
 #pragma once
 
 #include <QString>
-#include <QHash>
+#include <QVector>
 
 #include "../decl.hxx"
+#include "../err.hpp"
 #include "../io/decl.hxx"
 
 namespace cornus::misc {
 
+const i16 BlacklistAbiVersion = 2;
+/// Save() compacts the file when it has at least this many dead
+/// records and more dead than live ones:
+const int BlacklistCompactMinDead = 256;
+
+/// A record of the blacklist file, it's used straight from the mapping.
+/// A file is un-blacklisted by appending its record with Efa::None.
 struct Thumbnail {
-	struct io::DiskFileId id = {};
-	struct statx_timestamp date = {};
+	io::DiskFileId id = {};
+	i64 date_sec = 0;
+	u32 date_nsec = 0;
 	u32 time_added = 0; // minutes, not seconds since Unix Epoch
 	Efa value = Efa::None;
+	u8 reserved[7] = {};
 };
+static_assert(sizeof(Thumbnail) == 40, "Blacklist record layout changed");
 
-inline bool operator==(const Thumbnail &a, const Thumbnail &b)
-{
-	return a.id == b.id && a.date.tv_sec == b.date.tv_sec && a.date.tv_nsec == b.date.tv_nsec;
-}
-
-inline size_t qHash(const Thumbnail &key, size_t seed)
-{
-	return qHashMulti(seed, key.id.inode_number, key.id.dev_major, key.id.dev_minor);
-}
-
+/** Files (by DiskFileId + creation date) that must not get thumbnails
+or text previews. The file is a header plus an append-only log of fixed
+size records, mmap'd for reading. An open addressing table of record
+indices makes lookups allocation free, the newest record of a file wins.
+Changes are appended right away (O_APPEND under LOCK_SH, so other
+processes' records are picked up too) except for the ones GetStatus()
+makes, which wait for the next write. Save() only compacts the log once
+it's mostly dead records. The v1 file (blacklist.bin, rewritten on every save) is
+imported once. Not thread safe, used from the GUI thread. */
 class Blacklist {
 public:
 	Blacklist();
 	~Blacklist();
 	
-	Efa Add(const io::DiskFileId &id, const statx_timestamp &date, Efa value, cu32 *added = 0);
-	
+	Efa Add(const io::DiskFileId &id, const statx_timestamp &date, Efa value);
 	
 	void Load();
+	void LoadIfNeeded() { if (!loaded_) Load(); }
 	bool Save();
 	
 	bool IsAllowed(io::File *file, Efa efa);
+	/// Lookup only, for painting. False before the first Load().
+	bool Contains(const io::File *file, const Efa efa) const;
 	Efa GetStatus(io::File *file);
 	Efa Block(io::File *file, Efa efa);
 	Efa Allow(io::File *file, Efa allowed);
 
 private:
-	QString filePath();
+	NO_ASSIGN_COPY_MOVE(Blacklist);
 	
-	void ToBlob(ByteArray &buf);
+	bool Append(const Thumbnail *records, cint count);
+	void AppendPending();
+	void Close();
+	bool Compact();
+	const Thumbnail* Find(const io::DiskFileId &id) const;
+	bool FileReplaced() const;
+	void ImportV1();
+	void IndexRecord(ci32 index);
+	bool MapNewRecords();
+	bool Open();
+	void Rehash(cint slot_count);
+	QString filePath(cint abi_version);
 	
-	QHash<io::DiskFileId, misc::Thumbnail> hash_;
+	const Thumbnail* records() const;
 	
-	bool modified_ = false;
+	/// Records dropping files whose inode got reused, see GetStatus():
+	QVector<Thumbnail> pending_;
+	/// Record indices, -1 is an empty slot. The size is a power of 2.
+	QVector<i32> slots_;
+	char *map_ = nullptr;
+	i64 map_len_ = 0;
+	i32 record_count_ = 0;
+	i32 key_count_ = 0; // distinct files
+	i32 live_count_ = 0; // files whose newest record isn't Efa::None
+	int fd_ = -1;
+	bool loaded_ = false;
 };
 
 }
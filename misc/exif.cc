@@ -0,0 +1,318 @@
+#include "exif.hh"
+
+namespace cornus::exif {
+
+namespace tag {
+const u16 Compression = 0x0103;
+const u16 StripOffsets = 0x0111;
+const u16 Orientation = 0x0112;
+const u16 StripByteCounts = 0x0117;
+const u16 SubIFDs = 0x014A;
+const u16 JpegOffset = 0x0201; // JPEGInterchangeFormat
+const u16 JpegLength = 0x0202; // JPEGInterchangeFormatLength
+}
+
+namespace type {
+const u16 Short = 3;
+const u16 Long = 4;
+}
+
+/// Broken or hostile files can point IFDs at each other:
+const int MaxIfds = 32;
+const int MaxSubIfdDepth = 3;
+
+class Tiff {
+public:
+	Tiff(const u8 *file, ci64 file_size, ci64 base):
+	file_(file), file_size_(file_size), base_(base) {}
+	
+	u32 ifd0() const { return u32_at(4); }
+	bool Init();
+	int orientation() const;
+	void WalkChain(u32 ifd_offset, cint depth, QVector<Preview> &ret);
+
+private:
+	void AddIfJpeg(ci64 rel_offset, ci64 size, QVector<Preview> &ret);
+	bool has(ci64 rel_offset, ci64 n) const {
+		return rel_offset >= 0 && n >= 0 && base_ + rel_offset + n <= file_size_;
+	}
+	u16 u16_at(ci64 rel_offset) const;
+	u32 u32_at(ci64 rel_offset) const;
+	/// SHORT or LONG value stored in the 4 byte value field of an entry:
+	u32 value_at(ci64 entry_offset, cu16 value_type) const;
+	
+	const u8 *file_ = nullptr;
+	i64 file_size_ = 0;
+	i64 base_ = 0; // offsets in TIFF are relative to its header
+	bool little_endian_ = true;
+	int ifd_count_ = 0;
+};
+
+bool Tiff::Init()
+{
+	if (!has(0, 8))
+		return false;
+	
+	const u8 *p = file_ + base_;
+	if (p[0] == 'I' && p[1] == 'I')
+		little_endian_ = true;
+	else if (p[0] == 'M' && p[1] == 'M')
+		little_endian_ = false;
+	else
+		return false;
+	
+	return u16_at(2) == 42;
+}
+
+int Tiff::orientation() const
+{
+	cu32 ifd_offset = ifd0();
+	if (!has(ifd_offset, 2))
+		return 1;
+	
+	cu16 count = u16_at(ifd_offset);
+	if (!has(ifd_offset + 2, i64(count) * 12))
+		return 1;
+	
+	for (int i = 0; i < count; i++)
+	{
+		ci64 entry = ifd_offset + 2 + i * 12;
+		if (u16_at(entry) != tag::Orientation || u16_at(entry + 2) != type::Short)
+			continue;
+		
+		cint value = u16_at(entry + 8);
+		return (value >= 1 && value <= 8) ? value : 1;
+	}
+	
+	return 1;
+}
+
+u16 Tiff::u16_at(ci64 rel_offset) const
+{
+	const u8 *p = file_ + base_ + rel_offset;
+	return little_endian_ ? u16(p[0] | (p[1] << 8)) : u16((p[0] << 8) | p[1]);
+}
+
+u32 Tiff::u32_at(ci64 rel_offset) const
+{
+	const u8 *p = file_ + base_ + rel_offset;
+	if (little_endian_)
+		return u32(p[0]) | (u32(p[1]) << 8) | (u32(p[2]) << 16) | (u32(p[3]) << 24);
+	return (u32(p[0]) << 24) | (u32(p[1]) << 16) | (u32(p[2]) << 8) | u32(p[3]);
+}
+
+u32 Tiff::value_at(ci64 entry_offset, cu16 value_type) const
+{
+	return (value_type == type::Short) ? u16_at(entry_offset + 8) : u32_at(entry_offset + 8);
+}
+
+void Tiff::AddIfJpeg(ci64 rel_offset, ci64 size, QVector<Preview> &ret)
+{
+	if (size <= 0 || !has(rel_offset, size))
+		return;
+	
+	Preview preview;
+	preview.offset = base_ + rel_offset;
+	preview.size = size;
+	if (!JpegSize(file_ + preview.offset, size, preview.w, preview.h))
+		return;
+	
+	for (const Preview &next: ret)
+	{
+		if (next.offset == preview.offset)
+			return;
+	}
+	
+	ret.append(preview);
+}
+
+void Tiff::WalkChain(u32 ifd_offset, cint depth, QVector<Preview> &ret)
+{
+	while (ifd_offset != 0 && ifd_count_++ < MaxIfds)
+	{
+		if (!has(ifd_offset, 2))
+			return;
+		
+		cu16 count = u16_at(ifd_offset);
+		if (!has(ifd_offset + 2, i64(count) * 12 + 4))
+			return;
+		
+		i64 jpeg_offset = -1, jpeg_length = 0;
+		i64 strip_offset = -1, strip_length = 0;
+		u32 compression = 0;
+		for (int i = 0; i < count; i++)
+		{
+			ci64 entry = ifd_offset + 2 + i * 12;
+			cu16 entry_tag = u16_at(entry);
+			cu16 value_type = u16_at(entry + 2);
+			cu32 value_count = u32_at(entry + 4);
+			if (value_type != type::Short && value_type != type::Long)
+				continue;
+			
+			switch (entry_tag) {
+			case tag::Compression: compression = value_at(entry, value_type); break;
+			case tag::JpegOffset: jpeg_offset = value_at(entry, value_type); break;
+			case tag::JpegLength: jpeg_length = value_at(entry, value_type); break;
+			case tag::StripOffsets: {
+				if (value_count == 1)
+					strip_offset = value_at(entry, value_type);
+				break;
+			}
+			case tag::StripByteCounts: {
+				if (value_count == 1)
+					strip_length = value_at(entry, value_type);
+				break;
+			}
+			case tag::SubIFDs: {
+				if (depth >= MaxSubIfdDepth || value_type != type::Long)
+					break;
+				if (value_count == 1) {
+					WalkChain(u32_at(entry + 8), depth + 1, ret);
+					break;
+				}
+				ci64 at = u32_at(entry + 8);
+				if (!has(at, i64(value_count) * 4))
+					break;
+				for (u32 k = 0; k < value_count; k++)
+					WalkChain(u32_at(at + k * 4), depth + 1, ret);
+				break;
+			}
+			default: break;
+			}
+		}
+		
+		if (jpeg_offset >= 0)
+			AddIfJpeg(jpeg_offset, jpeg_length, ret);
+		/// 6 is old-style JPEG, 7 is JPEG. The latter can also be the
+		/// lossless RAW data itself, which JpegSize() rejects.
+		if (strip_offset >= 0 && (compression == 6 || compression == 7))
+			AddIfJpeg(strip_offset, strip_length, ret);
+		
+		ifd_offset = u32_at(ifd_offset + 2 + i64(count) * 12);
+	}
+}
+
+/// Where the TIFF header is: at the start of a TIFF based file, in the
+/// EXIF APP1 segment of a JPEG. TIFF offsets are relative to @base, but
+/// the file from its start up to @end is kept so that nothing can point
+/// past the APP1.
+static bool LocateTiff(const u8 *buf, ci64 size, i64 &base, i64 &end)
+{
+	if (size < 8)
+		return false;
+	
+	if (buf[0] != 0xFF || buf[1] != 0xD8)
+	{
+		base = 0;
+		end = size;
+		return true;
+	}
+	
+	/// JPEG: the EXIF block is an APP1 segment near the start.
+	i64 at = 2;
+	while (at + 4 <= size)
+	{
+		if (buf[at] != 0xFF)
+			return false;
+		cu8 marker = buf[at + 1];
+		if (marker == 0xD8 || marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+		{
+			at += 2;
+			continue;
+		}
+		
+		if (marker == 0xDA || marker == 0xD9) // image data starts, or EOI
+			return false;
+		
+		ci64 seg_len = (i64(buf[at + 2]) << 8) | buf[at + 3];
+		if (seg_len < 2 || at + 2 + seg_len > size)
+			return false;
+		
+		const u8 *seg = buf + at + 4;
+		if (marker == 0xE1 && seg_len >= 2 + 6 + 8 && seg[0] == 'E' && seg[1] == 'x' &&
+			seg[2] == 'i' && seg[3] == 'f' && seg[4] == 0 && seg[5] == 0)
+		{
+			base = at + 4 + 6;
+			end = at + 2 + seg_len;
+			return true;
+		}
+		
+		at += 2 + seg_len;
+	}
+	
+	return false;
+}
+
+void FindPreviews(const u8 *buf, ci64 size, QVector<Preview> &ret)
+{
+	i64 base, end;
+	if (!LocateTiff(buf, size, base, end))
+		return;
+	
+	Tiff tiff(buf, end, base);
+	if (tiff.Init())
+		tiff.WalkChain(tiff.ifd0(), 0, ret);
+}
+
+int Orientation(const u8 *buf, ci64 size)
+{
+	i64 base, end;
+	if (!LocateTiff(buf, size, base, end))
+		return 1;
+	
+	Tiff tiff(buf, end, base);
+	return tiff.Init() ? tiff.orientation() : 1;
+}
+
+bool JpegSize(const u8 *buf, ci64 size, i32 &w, i32 &h)
+{
+	if (size < 4 || buf[0] != 0xFF || buf[1] != 0xD8)
+		return false;
+	
+	i64 at = 2;
+	while (at + 4 <= size)
+	{
+		if (buf[at] != 0xFF)
+			return false;
+		cu8 marker = buf[at + 1];
+		if (marker == 0xFF) // fill byte
+		{
+			at++;
+			continue;
+		}
+		
+		if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+		{
+			at += 2;
+			continue;
+		}
+		
+		if (marker == 0xDA || marker == 0xD9)
+			return false;
+		
+		ci64 seg_len = (i64(buf[at + 2]) << 8) | buf[at + 3];
+		if (seg_len < 2 || at + 2 + seg_len > size)
+			return false;
+		
+		/// SOF0 baseline, SOF1 extended, SOF2 progressive. The lossless
+		/// ones (SOF3 etc) hold RAW sensor data, not a picture.
+		if (marker >= 0xC0 && marker <= 0xC2)
+		{
+			if (seg_len < 7)
+				return false;
+			const u8 *p = buf + at + 4;
+			h = (i32(p[1]) << 8) | p[2];
+			w = (i32(p[3]) << 8) | p[4];
+			return w > 0 && h > 0;
+		}
+		
+		if (marker >= 0xC3 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+			return false;
+		
+		at += 2 + seg_len;
+	}
+	
+	return false;
+}
+
+}
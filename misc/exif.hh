@@ -0,0 +1,31 @@
+#pragma once
+
+#include "../types.hxx"
+
+#include <QVector>
+
+namespace cornus::exif {
+
+/// A JPEG embedded in an image file, its size is read from the
+/// embedded JPEG's own header.
+struct Preview {
+	i64 offset = -1; // from the start of the file
+	i64 size = 0;
+	i32 w = -1;
+	i32 h = -1;
+};
+
+/** Lists the (baseline or progressive) JPEG previews embedded in a JPEG
+file (the EXIF IFD1 thumbnail) or in a TIFF based RAW file (DNG, NEF,
+CR2, ARW, PEF, SRW: the JPEGInterchangeFormat and single strip JPEG
+images of the IFD chain and of the SubIFDs). @buf is the whole file. */
+void FindPreviews(const u8 *buf, ci64 size, QVector<Preview> &ret);
+
+/// The IFD0 Orientation tag (1 to 8 as in the EXIF spec, 1 means as
+/// stored) of a JPEG or TIFF based RAW file, 1 if it has none.
+int Orientation(const u8 *buf, ci64 size);
+
+/// Reads the frame size of a baseline/progressive JPEG.
+bool JpegSize(const u8 *buf, ci64 size, i32 &w, i32 &h);
+
+}
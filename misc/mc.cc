@@ -17,8 +17,208 @@
 #include "../err.hpp"
 #include "../types.hxx"
 
+#include <algorithm>
+
 namespace cornus::mc {
 
+/// Level 1 and 2 element IDs, as returned by ReadUInt() (without the
+/// length marker bit):
+namespace mkv_id {
+const i64 Attachments = 0x0941A469;
+const i64 AttachedFile = 0x21A7;
+const i64 FileName = 0x066E;
+const i64 FileMimeType = 0x0660;
+const i64 FileData = 0x065C;
+const i64 Cluster = 0x0F43B675;
+}
+
+/// Cover file names (without extension) in the Matroska spec's order of
+/// preference, anything else must at least be a jpeg or png.
+static const char *const CoverNames[] = {
+	"cover", "cover_land", "small_cover", "small_cover_land"
+};
+static const int MaxAttachmentNameLen = 256;
+static const i64 MaxCoverSize = 32 * 1024 * 1024;
+
+struct MkvAttachment {
+	QByteArray name;
+	QByteArray mime;
+	i64 data_pos = -1;
+	i64 data_size = 0;
+};
+
+/// Reads the ID and size of the element at @pos, leaves @pos at its payload.
+static bool ReadElementHeader(mkvparser::IMkvReader *reader, i64 &pos,
+	ci64 stop, i64 &id, i64 &size)
+{
+	long len;
+	if (pos >= stop || mkvparser::GetUIntLength(reader, pos, len) != 0 || pos + len > stop)
+		return false;
+	id = mkvparser::ReadUInt(reader, pos, len);
+	if (id < 0)
+		return false;
+	pos += len;
+	
+	if (pos >= stop || mkvparser::GetUIntLength(reader, pos, len) != 0 || pos + len > stop)
+		return false;
+	size = mkvparser::ReadUInt(reader, pos, len);
+	if (size < 0)
+		return false;
+	pos += len;
+	
+	return pos + size <= stop;
+}
+
+static QByteArray ReadString(mkvparser::IMkvReader *reader, ci64 pos, ci64 size)
+{
+	if (size <= 0 || size > MaxAttachmentNameLen)
+		return QByteArray();
+	
+	QByteArray ba(size, Qt::Uninitialized);
+	if (reader->Read(pos, size, (unsigned char*)ba.data()) != 0)
+		return QByteArray();
+	
+	cint nul = ba.indexOf('\0'); // strings may be zero padded
+	if (nul != -1)
+		ba.truncate(nul);
+	
+	return ba;
+}
+
+static int CoverRank(const MkvAttachment &a)
+{
+	if (a.mime != "image/jpeg" && a.mime != "image/png")
+		return -1;
+	
+	const QByteArray name = a.name.toLower();
+	cint dot = name.lastIndexOf('.');
+	const QByteArray base = (dot == -1) ? name : name.left(dot);
+	cint count = int(sizeof CoverNames / sizeof CoverNames[0]);
+	for (int i = 0; i < count; i++)
+	{
+		if (base == CoverNames[i])
+			return count - i + 1;
+	}
+	
+	return 1; // some other picture, better than nothing
+}
+
+/// Finds the Attachments element: through the SeekHead when it's listed
+/// there, otherwise among the elements in front of the first cluster.
+static bool FindAttachments(mkvparser::Segment *segment, i64 &pos, i64 &size)
+{
+	mkvparser::IMkvReader *reader = segment->m_pReader;
+	long long total, available;
+	if (reader->Length(&total, &available) != 0)
+		return false;
+	
+	ci64 stop = (segment->m_size < 0) ? total : std::min<i64>(total,
+		segment->m_start + segment->m_size);
+	
+	const mkvparser::SeekHead *seek_head = segment->GetSeekHead();
+	if (seek_head != nullptr)
+	{
+		cint count = seek_head->GetCount();
+		for (int i = 0; i < count; i++)
+		{
+			const mkvparser::SeekHead::Entry *entry = seek_head->GetEntry(i);
+			if (entry->id != mkv_id::Attachments)
+				continue;
+			pos = segment->m_start + entry->pos;
+			i64 id;
+			return ReadElementHeader(reader, pos, stop, id, size) &&
+				id == mkv_id::Attachments;
+		}
+	}
+	
+	pos = segment->m_start;
+	i64 id;
+	while (ReadElementHeader(reader, pos, stop, id, size))
+	{
+		if (id == mkv_id::Attachments)
+			return true;
+		if (id == mkv_id::Cluster)
+			return false;
+		pos += size;
+	}
+	
+	return false;
+}
+
+QByteArray ReadMkvCover(QStringView full_path)
+{
+	MkvReader reader;
+	auto path_ba = full_path.toLocal8Bit();
+	if (reader.Open(path_ba.data()) != 0)
+		return QByteArray();
+	
+	long long pos = 0;
+	mkvparser::EBMLHeader ebml_header;
+	if (ebml_header.Parse(&reader, pos) < 0)
+		return QByteArray();
+	
+	mkvparser::Segment *segment = nullptr;
+	if (mkvparser::Segment::CreateInstance(&reader, pos, segment) != 0 || segment == nullptr)
+		return QByteArray();
+	
+	/// Unlike Load() this stops at the first cluster:
+	i64 attachments_pos, attachments_size;
+	if (segment->ParseHeaders() != 0 ||
+		!FindAttachments(segment, attachments_pos, attachments_size))
+	{
+		delete segment;
+		return QByteArray();
+	}
+	delete segment;
+	
+	MkvAttachment best;
+	int best_rank = -1;
+	i64 at = attachments_pos;
+	ci64 attachments_stop = attachments_pos + attachments_size;
+	i64 id, size;
+	while (ReadElementHeader(&reader, at, attachments_stop, id, size))
+	{
+		ci64 file_stop = at + size;
+		if (id != mkv_id::AttachedFile) {
+			at = file_stop;
+			continue;
+		}
+		
+		MkvAttachment next;
+		while (ReadElementHeader(&reader, at, file_stop, id, size))
+		{
+			if (id == mkv_id::FileName) {
+				next.name = ReadString(&reader, at, size);
+			} else if (id == mkv_id::FileMimeType) {
+				next.mime = ReadString(&reader, at, size);
+			} else if (id == mkv_id::FileData) {
+				next.data_pos = at;
+				next.data_size = size;
+			}
+			at += size;
+		}
+		at = file_stop;
+		
+		cbool has_data = next.data_size > 0 && next.data_size <= MaxCoverSize;
+		cint rank = has_data ? CoverRank(next) : -1;
+		if (rank > best_rank)
+		{
+			best_rank = rank;
+			best = next;
+		}
+	}
+	
+	if (best_rank < 0)
+		return QByteArray();
+	
+	QByteArray ret(best.data_size, Qt::Uninitialized);
+	if (reader.Read(best.data_pos, best.data_size, (unsigned char*)ret.data()) != 0)
+		return QByteArray();
+	
+	return ret;
+}
+
+
 static const wchar_t* utf8towcs(const char* str)
 {
 	if (str == NULL)
@@ -1,9 +1,15 @@
 #pragma once
 
+#include <QByteArray>
 #include <QString>
 
 namespace cornus::mc {
 
 QString ReadMkvTitle(QStringView full_path, bool *ok = 0);
 
+/** Returns the bytes of the cover art attachment (cover.jpg/png and
+friends) of a Matroska file or an empty array. Only the headers, the
+attachment list and the chosen attachment's data are read. */
+QByteArray ReadMkvCover(QStringView full_path);
+
 }
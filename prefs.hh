@@ -10,6 +10,7 @@ const QString MimeConfigDir = QLatin1String("mimetypes-open-order");
 const QString PrefsFileName = QLatin1String("prefs_");
 const u16 BookmarksFormatVersion = 1;
 const u16 PrefsFormatVersion = 3;
+const i32 DefaultThumbnailCacheMiB = 128;
 
 QString GetBookmarksFileName();
 QString GetBookmarksFilePath();
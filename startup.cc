@@ -0,0 +1,57 @@
+#include "startup.hh"
+
+#include "err.hpp"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+namespace cornus::startup {
+
+static bool enabled = false;
+static bool painted = false;
+static i64 start_nano = 0;
+static i64 last_nano = 0;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static i64 now_nano()
+{
+	struct timespec t = {};
+	clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+	return i64(t.tv_sec) * 1000000000L + t.tv_nsec;
+}
+
+void EnableProfile()
+{
+	start_nano = last_nano = now_nano();
+	enabled = true;
+	printf("Startup timeline (ms since main, +ms since previous stage):\n");
+}
+
+bool profiling() { return enabled; }
+
+void Mark(const char *stage)
+{
+	if (!enabled)
+		return;
+	
+	ci64 now = now_nano();
+	pthread_mutex_lock(&mutex);
+	const double total = double(now - start_nano) / 1000000.0;
+	const double delta = double(now - last_nano) / 1000000.0;
+	last_nano = now;
+	printf("%9.2f  +%8.2f  %s\n", total, delta, stage);
+	fflush(stdout);
+	pthread_mutex_unlock(&mutex);
+}
+
+void MarkFirstPaint()
+{
+	if (!enabled || painted)
+		return;
+	
+	painted = true;
+	Mark("First paint");
+}
+
+}
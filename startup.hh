@@ -0,0 +1,20 @@
+#pragma once
+
+#include "types.hxx"
+
+namespace cornus::startup {
+
+const char *const ProfileArg = "--startup-profile";
+
+/// Must be called as early as possible in main(), the timeline starts here.
+void EnableProfile();
+bool profiling();
+
+/// Prints the time since EnableProfile() and since the previous mark,
+/// can be called from any thread, does nothing unless profiling.
+void Mark(const char *stage);
+
+/// Marks "First paint" only the first time it's called.
+void MarkFirstPaint();
+
+}
@@ -1,14 +1,36 @@
 #include "tests.hh"
 
+#include <QApplication>
+#include <QBuffer>
+#include <QDir>
+#include <QFile>
+#include <QImageReader>
+#include <QTemporaryDir>
 #include <QTimer>
 
+#include "io/File.hpp"
+#include "io/FindFiles.hpp"
 #include "io/io.hh"
+#include "io/NameIndex.hpp"
 #include "App.hpp"
+#include "downscale.hh"
 #include "gui/Tab.hpp"
+#include "thumbnail.hh"
+
+#include <algorithm>
+#include <linux/limits.h> /// XATTR_SIZE_MAX
+#include <zdict.h>
 
 namespace cornus::tests {
 
 cint InotifyFinishMs = 500; // 0.5 seconds
+cint SpeedTestIconSize = 256; // roughly a zoomed in icon view cell
+cint DownscaleRuns = 10;
+cint PngDecodeRuns = 3;
+cint CodecMaxImages = 1000;
+cint CodecDecodeRounds = 5;
+/// Dictionary training works best with many smallish samples:
+cint DictSampleSize = 32 * 1024;
 
 void Print(const char *msg, QList<PathAndMode> test_files)
 {
@@ -101,4 +123,450 @@ void CreateNewFiles::SwitchedToNewDir(QString unprocessed_dir_path,
 	QTimer::singleShot(InotifyFinishMs, this, &Test::PerformCheckSameFiles);
 }
 
+/// Files ThumbnailSpeed and ThumbCodecSpeed make thumbnails of:
+static QFileInfoList ListImages(const QString &dir_path)
+{
+	static cauto formats = QImageReader::supportedImageFormats();
+	QDir dir(dir_path);
+	QFileInfoList ret;
+	for (const QFileInfo &info: dir.entryInfoList(QDir::Files, QDir::Name))
+	{
+		const QByteArray ext = info.suffix().toLower().toLocal8Bit();
+		if (ext == "webp" || formats.contains(ext) || thumbnail::IsRawExtension(ext) ||
+			thumbnail::IsMatroskaExtension(ext))
+		{
+			ret.append(info);
+		}
+	}
+	
+	return ret;
+}
+
+ThumbCodecSpeed::ThumbCodecSpeed(App *app, const QString &dir_path,
+	cbool train): Test(app)
+{
+	QVector<QImage> images;
+	i64 raw_size = 0;
+	for (const QFileInfo &info: ListImages(dir_path))
+	{
+		Thumbnail *thumbnail = thumbnail::Load(info.absoluteFilePath(), 0,
+			info.suffix().toLower().toLocal8Bit(), SpeedTestIconSize,
+			SpeedTestIconSize, -1, -1);
+		if (thumbnail == nullptr)
+			continue;
+		images.append(thumbnail->img);
+		raw_size += thumbnail->img.sizeInBytes();
+		delete thumbnail;
+		if (images.size() >= CodecMaxImages)
+			break;
+	}
+	
+	QTimer::singleShot(0, qApp, &QApplication::quit);
+	if (images.isEmpty())
+	{
+		auto ba = dir_path.toLocal8Bit();
+		mtl_warn("No images found in \"%s\"", ba.data());
+		status_ = ENOENT;
+		return;
+	}
+	
+	if (train && !TrainDictionary(images))
+	{
+		status_ = EINVAL;
+		return;
+	}
+	
+	mtl_info("%d thumbnails, %ld KiB raw, dictionary id: %u", int(images.size()),
+		raw_size / 1024, thumbnail::GetDictionary().id);
+	ZSTD_CCtx *compress_ctx = ZSTD_createCCtx();
+	ZSTD_DCtx *decompress_ctx = ZSTD_createDCtx();
+	
+	for (const thumbnail::AbiType abi: {thumbnail::AbiVersion1, thumbnail::AbiVersion})
+	{
+		QVector<ByteArray*> blobs;
+		QElapsedTimer timer;
+		timer.start();
+		for (const QImage &img: images)
+		{
+			auto *ba = new ByteArray();
+			thumbnail::Encode(img, img.width(), img.height(), compress_ctx, *ba, abi);
+			ba->to(0);
+			blobs.append(ba);
+		}
+		cf64 encode_ms = f64(timer.nsecsElapsed()) / 1e6;
+		
+		i64 packed_size = 0;
+		int fit_in_xattr = 0;
+		for (const ByteArray *ba: blobs)
+		{
+			packed_size += ba->size();
+			if (ba->size() <= XATTR_SIZE_MAX)
+				fit_in_xattr++;
+		}
+		
+		int failed = 0;
+		timer.restart();
+		for (int round = 0; round < CodecDecodeRounds; round++)
+		{
+			for (ByteArray *ba: blobs)
+			{
+				i32 w, h;
+				thumbnail::AbiType abi_version;
+				if (thumbnail::ImageFromByteArray(*ba, w, h, abi_version, decompress_ctx).isNull())
+					failed++;
+			}
+		}
+		qDeleteAll(blobs);
+		cf64 decode_sec = std::max(1e-9, f64(timer.nsecsElapsed()) / 1e9);
+		cf64 decode_mbs = f64(raw_size) * CodecDecodeRounds / decode_sec / (1024 * 1024);
+		
+		mtl_info("v%d: ratio %.2f, %ld KiB, %d/%d fit in an xattr, encode %.1fms,"
+			" decode %.0f MB/s", int(abi), f64(raw_size) / std::max<i64>(1, packed_size),
+			packed_size / 1024, fit_in_xattr, int(blobs.size()), encode_ms, decode_mbs);
+		if (failed > 0)
+		{
+			mtl_warn("v%d: %d decodes failed", int(abi), failed);
+			status_ = EINVAL;
+		}
+	}
+	
+	mtl_info("Decode buffers reused: %ld", thumbnail::BufferPool::reused());
+	ZSTD_freeCCtx(compress_ctx);
+	ZSTD_freeDCtx(decompress_ctx);
+}
+
+bool ThumbCodecSpeed::TrainDictionary(const QVector<QImage> &images)
+{
+	/// Both plain and filtered pixels since the encoder uses either.
+	QByteArray samples;
+	QVector<size_t> sample_sizes;
+	QByteArray filtered;
+	auto add_samples = [&](const char *data, ci64 size) {
+		for (i64 at = 0; at < size; at += DictSampleSize)
+		{
+			ci64 n = std::min<i64>(DictSampleSize, size - at);
+			samples.append(data + at, n);
+			sample_sizes.append(n);
+		}
+	};
+	
+	for (const QImage &img: images)
+	{
+		add_samples((const char*)img.constBits(), img.sizeInBytes());
+		if (img.depth() != 32)
+			continue;
+		filtered.resize(img.sizeInBytes());
+		thumbnail::ApplyLeftDelta(img, (uchar*)filtered.data());
+		add_samples(filtered.constData(), filtered.size());
+	}
+	
+	QByteArray dict(thumbnail::MaxDictSize, Qt::Uninitialized);
+	QElapsedTimer timer;
+	timer.start();
+	cusize dict_size = ZDICT_trainFromBuffer(dict.data(), dict.size(),
+		samples.constData(), sample_sizes.constData(), sample_sizes.size());
+	if (ZDICT_isError(dict_size))
+	{
+		mtl_warn("Training failed: %s", ZDICT_getErrorName(dict_size));
+		return false;
+	}
+	dict.resize(dict_size);
+	
+	const QString path = thumbnail::DictionaryPath();
+	QFile file(path);
+	if (!file.open(QIODevice::WriteOnly) || file.write(dict) != dict.size())
+	{
+		mtl_warn("Can't save %s", qPrintable(path));
+		return false;
+	}
+	file.close();
+	
+	mtl_info("Trained a %ld byte dictionary in %ldms, saved to %s", i64(dict_size),
+		i64(timer.elapsed()), qPrintable(path));
+	
+	return thumbnail::SetDictionary(dict);
+}
+
+/// Noise, so that nothing can be skipped or predicted:
+static QImage CreateNoiseImage(cint w, cint h, const QImage::Format format)
+{
+	QImage img(w, h, format);
+	u32 state = 0x9E3779B9u;
+	for (int y = 0; y < h; y++)
+	{
+		u32 *line = (u32*)img.scanLine(y);
+		for (int x = 0; x < w; x++)
+		{
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			line[x] = (format == QImage::Format_RGB32) ? (state | 0xFF000000u) : qPremultiply(state);
+		}
+	}
+	
+	return img;
+}
+
+DownscaleSpeed::DownscaleSpeed(App *app): Test(app)
+{
+	const QSize sizes[] = { QSize(4000, 3000), QSize(3000, 4000) };
+	const QImage::Format formats[] = { QImage::Format_RGB32, QImage::Format_ARGB32_Premultiplied };
+	
+	for (const QSize &src_size: sizes)
+	{
+		for (const QImage::Format format: formats)
+		{
+			const QImage src = CreateNoiseImage(src_size.width(), src_size.height(), format);
+			const QSize dst_size = thumbnail::GetScaledSize(src_size,
+				SpeedTestIconSize, SpeedTestIconSize);
+			const char *format_name = (format == QImage::Format_RGB32) ? "RGB32" : "ARGB32_Pre";
+			
+			QElapsedTimer timer;
+			timer.start();
+			for (int i = 0; i < DownscaleRuns; i++)
+				src.scaled(dst_size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+			cf64 qt_ms = f64(timer.nsecsElapsed()) / 1e6 / DownscaleRuns;
+			mtl_info("%dx%d %s -> %dx%d: Qt smooth %.2fms", src_size.width(),
+				src_size.height(), format_name, dst_size.width(), dst_size.height(), qt_ms);
+			
+			const QImage reference = downscale::Scale(src, dst_size, downscale::Simd::None);
+			for (int level = 0; level <= int(downscale::BestSimd()); level++)
+			{
+				const auto simd = downscale::Simd(level);
+				QImage result;
+				timer.restart();
+				for (int i = 0; i < DownscaleRuns; i++)
+					result = downscale::Scale(src, dst_size, simd);
+				cf64 ms = f64(timer.nsecsElapsed()) / 1e6 / DownscaleRuns;
+				mtl_info("    box %s %.2fms (%.1fx)", downscale::SimdName(simd), ms, qt_ms / ms);
+				
+				if (result != reference)
+				{
+					mtl_warn("%s result differs from the scalar one", downscale::SimdName(simd));
+					status_ = EINVAL;
+				}
+			}
+		}
+	}
+	
+	TimePngThumbnails();
+	QTimer::singleShot(0, qApp, &QApplication::quit);
+}
+
+void DownscaleSpeed::TimePngThumbnails()
+{
+	const QImage::Format formats[] = { QImage::Format_RGB32, QImage::Format_ARGB32 };
+	for (const QImage::Format format: formats)
+	{
+		const QImage src = CreateNoiseImage(4000, 3000, format);
+		QByteArray png;
+		{
+			QBuffer buffer(&png);
+			buffer.open(QIODevice::WriteOnly);
+			src.save(&buffer, "png", 100); // fastest compression, decoding is timed
+		}
+		const QSize dst_size = thumbnail::GetScaledSize(src.size(),
+			SpeedTestIconSize, SpeedTestIconSize);
+		
+		/// How ReadScaled() did it before, the PNG handler reports ScaledSize:
+		QElapsedTimer timer;
+		timer.start();
+		for (int i = 0; i < PngDecodeRuns; i++)
+		{
+			QBuffer buffer(&png);
+			QImageReader reader(&buffer, "png");
+			reader.setScaledSize(dst_size);
+			reader.read();
+		}
+		cf64 before_ms = f64(timer.nsecsElapsed()) / 1e6 / PngDecodeRuns;
+		
+		timer.restart();
+		QImage result;
+		for (int i = 0; i < PngDecodeRuns; i++)
+		{
+			QBuffer buffer(&png);
+			QImageReader reader(&buffer, "png");
+			result = thumbnail::ReadScaled(reader, dst_size);
+		}
+		cf64 after_ms = f64(timer.nsecsElapsed()) / 1e6 / PngDecodeRuns;
+		
+		mtl_info("PNG %s 4000x3000 -> %dx%d: ScaledSize %.2fms, ReadScaled %.2fms (%.1fx)",
+			(format == QImage::Format_RGB32) ? "RGB32" : "ARGB32",
+			dst_size.width(), dst_size.height(), before_ms, after_ms, before_ms / after_ms);
+		
+		if (result.size() != dst_size)
+		{
+			mtl_warn("ReadScaled() gave %dx%d", result.width(), result.height());
+			status_ = EINVAL;
+		}
+	}
+}
+
+NameIndexGlobs::NameIndexGlobs(App *app): Test(app)
+{
+	QTemporaryDir tmp_dir;
+	if (!tmp_dir.isValid())
+	{
+		mtl_warn("%s", qPrintable(tmp_dir.errorString()));
+		status_ = EIO;
+		QTimer::singleShot(0, qApp, &QApplication::quit);
+		return;
+	}
+	
+	const QString dir_path = tmp_dir.path() + '/';
+	const char *names[] = { "foo.cpp", "foo.hpp", "foo.c", "foo.h", "foo.cc",
+		"main.cxx", "chpp", "a]b.txt", "[x].txt", "sub/bar.cpp", "sub/bar.hh",
+		"sub/ch.txt" };
+	QDir().mkpath(dir_path + QLatin1String("sub"));
+	for (const char *name: names)
+	{
+		QFile file(dir_path + QLatin1String(name));
+		if (!file.open(QIODevice::WriteOnly))
+			status_ = EIO;
+	}
+	
+	io::NameIndex index;
+	io::NameIndexRoot *root = index.Scan(dir_path);
+	if (status_ != 0 || root == nullptr)
+	{
+		mtl_warn("Couldn't set up %s", qPrintable(dir_path));
+		status_ = EIO;
+		QTimer::singleShot(0, qApp, &QApplication::quit);
+		return;
+	}
+	index.roots_.append(root);
+	
+	const char *globs[] = { "*.[ch]pp", "*.[ch]", "*.[!c]pp", "[fm]*.c*",
+		"*[]]*", "*.c[cx]*", "ch*", "*[ch].txt" };
+	for (const char *glob: globs)
+	{
+		io::NameIndexQuery query;
+		query.dir_path = dir_path;
+		query.pattern = QLatin1String(glob);
+		query.match = io::FindMatch::Glob;
+		query.max_results = io::FindMaxResults;
+		QVector<QString> indexed;
+		bool limit_reached;
+		if (!index.Query(query, indexed, limit_reached))
+		{
+			mtl_warn("\"%s\": the index didn't answer", glob);
+			status_ = EINVAL;
+			continue;
+		}
+		
+		QVector<QString> walked = Walk(dir_path, query.pattern);
+		std::sort(indexed.begin(), indexed.end());
+		std::sort(walked.begin(), walked.end());
+		mtl_info("\"%s\": %d indexed, %d walked", glob, int(indexed.size()), int(walked.size()));
+		if (indexed != walked)
+		{
+			mtl_warn("\"%s\": the index and the walk found different files", glob);
+			status_ = EINVAL;
+		}
+	}
+	
+	QTimer::singleShot(0, qApp, &QApplication::quit);
+}
+
+QVector<QString> NameIndexGlobs::Walk(const QString &dir_path, const QString &glob)
+{
+	io::FindParams params;
+	params.dir_path = dir_path;
+	params.pattern = glob;
+	params.match = io::FindMatch::Glob;
+	params.use_name_index = false;
+	params.env = QProcessEnvironment::systemEnvironment();
+	
+	QVector<QString> ret;
+	io::FindFiles find;
+	if (!find.Start(params))
+		return ret;
+	
+	while (find.running())
+		QTest::qSleep(5);
+	
+	QVector<io::File*> files;
+	find.TakeFiles(files);
+	for (io::File *next: files)
+	{
+		ret.append(next->build_full_path());
+		delete next;
+	}
+	
+	return ret;
+}
+
+ThumbnailSpeed::ThumbnailSpeed(App *app, const QString &dir_path,
+	cbool use_previews): Test(app)
+{
+	auto *work_vec = new QVector<ThumbLoaderArgs*>();
+	
+	for (const QFileInfo &info: ListImages(dir_path))
+	{
+		const QByteArray ext = info.suffix().toLower().toLocal8Bit();
+		const QString full_path = info.absoluteFilePath();
+		auto path_ba = full_path.toLocal8Bit();
+		struct statx stx;
+		if (statx(0, path_ba.data(), 0, STATX_INO | STATX_MTIME, &stx) != 0)
+			continue;
+		
+		ThumbLoaderArgs *p = new ThumbLoaderArgs();
+		p->app = nullptr; // results get dropped by the workers
+		p->full_path = full_path;
+		p->ext = ext;
+		p->file_id = io::DiskFileId::FromStx(stx);
+		p->time_modified = stx.stx_mtime.tv_sec;
+		p->icon_w = SpeedTestIconSize;
+		p->icon_h = SpeedTestIconSize;
+		p->file_index = work_vec->size();
+		work_vec->append(p);
+	}
+	
+	total_ = work_vec->size();
+	if (total_ == 0)
+	{
+		auto ba = dir_path.toLocal8Bit();
+		mtl_warn("No images found in \"%s\"", ba.data());
+		delete work_vec;
+		status_ = ENOENT;
+		return;
+	}
+	
+	{
+		GlobalThumbLoaderData &global_data = app_->global_thumb_loader_data();
+		auto g = global_data.guard();
+		done_at_start_ = global_data.done_count;
+	}
+	
+	thumbnail::UseEmbeddedPreviews(use_previews);
+	previews_at_start_ = thumbnail::EmbeddedPreviewsUsed();
+	
+	timer_.start();
+	app_->SubmitThumbLoaderBatchFromTab(work_vec, -1, -1);
+	progress_timer_ = new QTimer(this);
+	QObject::connect(progress_timer_, &QTimer::timeout, this, &ThumbnailSpeed::CheckProgress);
+	progress_timer_->start(20);
+}
+
+void ThumbnailSpeed::CheckProgress()
+{
+	i64 done;
+	{
+		GlobalThumbLoaderData &global_data = app_->global_thumb_loader_data();
+		auto g = global_data.guard();
+		done = global_data.done_count - done_at_start_;
+	}
+	
+	if (done < total_)
+		return;
+	
+	progress_timer_->stop();
+	ci64 ms = std::max<i64>(1, timer_.elapsed());
+	const double per_sec = double(total_) * 1000.0 / ms;
+	ci64 previews = thumbnail::EmbeddedPreviewsUsed() - previews_at_start_;
+	mtl_info("%d thumbnails in %ldms (%.1f/s, %d threads, %ld from embedded previews)",
+		total_, ms, per_sec, int(app_->global_thumb_loader_data().threads.size()), previews);
+	QApplication::quit();
+}
+
 }
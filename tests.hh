@@ -1,6 +1,8 @@
 #pragma once
 
+#include <QElapsedTimer>
 #include <QTest>
+#include <QTimer>
 
 #include "decl.hxx"
 
@@ -29,4 +31,64 @@ public Q_SLOTS:
 	void SwitchedToNewDir(QString unprocessed_dir_path, QString processed_dir_path);
 };
 
+/** Micro-benchmark of the thumbnail downscaler against Qt's smooth
+scaling, for 4000x3000 and 3000x4000 images shrunk to fit 256x256.
+Also checks that the SIMD paths give the same pixels as the scalar one,
+and times making a PNG thumbnail the way QImageReader's ScaledSize
+option does it against thumbnail::ReadScaled().
+Usage: cornus test downscale */
+class DownscaleSpeed: public Test {
+public:
+	DownscaleSpeed(App *app);
+
+private:
+	void TimePngThumbnails();
+};
+
+/** Checks that a glob search answered by io::NameIndex finds the same
+files as walking the folder with io::FindFiles, for bracket expressions
+like "*.[ch]pp" that the index must not take for literal text when it
+picks the part every name has to contain.
+Usage: cornus test nameglobs */
+class NameIndexGlobs: public Test {
+public:
+	NameIndexGlobs(App *app);
+
+private:
+	QVector<QString> Walk(const QString &dir_path, const QString &glob);
+};
+
+/** Compares the v1 and v2 thumbnail blob formats on the images of a
+folder: compression ratio, how many blobs fit in an extended attribute,
+encode time and decode MB/s. With --train it first trains a zstd
+dictionary on them and saves it as thumbnail::DictionaryPath().
+Usage: cornus test thumbcodec /path/to/folder [--train] */
+class ThumbCodecSpeed: public Test {
+public:
+	ThumbCodecSpeed(App *app, const QString &dir_path, cbool train);
+
+private:
+	bool TrainDictionary(const QVector<QImage> &images);
+};
+
+/** Stress test of the thumbnail worker pool: loads the thumbnails of all
+images in a folder (without showing them) and prints thumbnails/second.
+Usage: cornus test thumbnails /path/to/folder [--no-previews]
+--no-previews decodes whole JPEGs instead of their embedded previews. */
+class ThumbnailSpeed: public Test {
+	Q_OBJECT
+public:
+	ThumbnailSpeed(App *app, const QString &dir_path, cbool use_previews);
+
+public Q_SLOTS:
+	void CheckProgress();
+
+private:
+	QElapsedTimer timer_;
+	QTimer *progress_timer_ = nullptr;
+	i64 done_at_start_ = 0;
+	i64 previews_at_start_ = 0;
+	int total_ = 0;
+};
+
 } // namespace
@@ -1,11 +1,31 @@
 #include "thumbnail.hh"
 
 #include "ByteArray.hpp"
+#include "downscale.hh"
+#include "MutexGuard.hpp"
+#include "prefs.hh"
 
 #include "io/File.hpp"
 #include "io/io.hh"
+#include "misc/exif.hh"
+#include "misc/mc.hh"
 
+#include <QBuffer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
 #include <QImageReader>
+#include <QStandardPaths>
+#include <QTransform>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zdict.h>
 
 void CornusFreeQImageMemory(void *data)
 {
@@ -15,12 +35,18 @@ void CornusFreeQImageMemory(void *data)
 	//free(m);
 }
 
+void CornusReleasePooledImageMemory(void *data)
+{
+	cornus::thumbnail::BufferPool::Give((uchar*)data);
+}
+
 namespace cornus {
 
 Thumbnail* Thumbnail::Clone() {
 	Thumbnail *t = new Thumbnail();
 	t->debug_path = debug_path;
 	t->img = img;
+	t->display_img = display_img;
 	t->file_id = file_id;
 	t->time_generated = time_generated;
 	t->tab_id = tab_id;
@@ -36,15 +62,215 @@ Thumbnail* Thumbnail::Clone() {
 }
 
 namespace thumbnail {
+
+static std::atomic<bool> use_embedded_previews = true;
+static std::atomic<i64> embedded_previews_used = 0;
+
+/// How much the aspect ratio of a preview may differ from the image's,
+/// EXIF thumbnails of 3:2 photos are often letterboxed to 4:3.
+static const f64 PreviewAspectTolerance = 0.02;
+
+bool IsRawExtension(const QByteArray &ext)
+{
+	static const QVector<QByteArray> raw_exts = {
+		"arw", "cr2", "dng", "nef", "nrw", "pef", "srw"
+	};
+	return raw_exts.contains(ext);
+}
+
+bool IsMatroskaExtension(const QByteArray &ext)
+{
+	return ext == "mkv" || ext == "mka" || ext == "mk3d";
+}
+
+void MakeFailedMarker(ByteArray &ba)
+{
+	ba.add_i32(-1);
+}
+
+void UseEmbeddedPreviews(cbool flag) { use_embedded_previews = flag; }
+i64 EmbeddedPreviewsUsed() { return embedded_previews_used; }
+
+static bool SameAspect(const QSize &a, const QSize &b)
+{
+	cf64 ra = f64(a.width()) / a.height();
+	cf64 rb = f64(b.width()) / b.height();
+	return std::abs(ra - rb) <= ra * PreviewAspectTolerance;
+}
+
+/// Turns @img upright as told by its EXIF @orientation (1 to 8), the
+/// mirrored ones (2, 4, 5, 7) get mirrored first and then rotated.
+static QImage ApplyOrientation(const QImage &img, cint orientation)
+{
+	if (orientation <= 1 || orientation > 8)
+		return img;
+	
+	const int angles[] = {0, 0, 180, 180, 270, 90, 90, 270};
+	cbool mirror = (orientation == 2 || orientation == 4 ||
+		orientation == 5 || orientation == 7);
+	QTransform transform;
+	transform.rotate(angles[orientation - 1]);
+	if (mirror)
+		transform.scale(-1, 1); // applied before the rotation
+	
+	return img.transformed(transform);
+}
+
+/// Decodes the smallest embedded JPEG preview (if any) that is at least as
+/// big as the thumbnail, which for a 24MP photo is 10-50x less work than
+/// decoding the whole image. Sets @orig_img_sz and @scaled on success.
+static QImage LoadEmbeddedPreview(const QString &full_path, cbool is_raw,
+	cint max_img_w, cint max_img_h, QSize &orig_img_sz, QSize &scaled)
+{
+	auto path_ba = full_path.toLocal8Bit();
+	cint fd = ::open(path_ba.data(), O_RDONLY);
+	if (fd == -1)
+		return QImage();
+	
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < 8)
+	{
+		::close(fd);
+		return QImage();
+	}
+	
+	ci64 file_size = st.st_size;
+	void *mem = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (mem == MAP_FAILED)
+		return QImage();
+	
+	const u8 *buf = (const u8*)mem;
+	QVector<exif::Preview> previews;
+	exif::FindPreviews(buf, file_size, previews);
+	QImage img;
+	
+	if (!previews.isEmpty())
+	{
+		i32 w = -1, h = -1;
+		if (is_raw)
+		{
+			/// The sensor data isn't readable without a RAW decoder, the
+			/// biggest preview is the full size (or close to it) image.
+			for (const exif::Preview &next: previews)
+			{
+				if (i64(next.w) * next.h > i64(w) * h) {
+					w = next.w;
+					h = next.h;
+				}
+			}
+		} else if (!exif::JpegSize(buf, file_size, w, h)) {
+			w = h = -1;
+		}
+		
+		const exif::Preview *best = nullptr;
+		if (w > 0 && h > 0)
+		{
+			orig_img_sz = QSize(w, h);
+			const QSize target = GetScaledSize(orig_img_sz, max_img_w, max_img_h);
+			for (const exif::Preview &next: previews)
+			{
+				const QSize sz(next.w, next.h);
+				if (sz.width() < target.width() || sz.height() < target.height() ||
+					!SameAspect(sz, orig_img_sz))
+				{
+					continue;
+				}
+				
+				if (best == nullptr || i64(next.w) * next.h < i64(best->w) * best->h)
+					best = &next;
+			}
+		}
+		
+		if (best != nullptr)
+		{
+			/// No copy, the data stays in the mapping until it's decoded:
+			QByteArray bytes = QByteArray::fromRawData((const char*)buf + best->offset, best->size);
+			QBuffer buffer(&bytes);
+			buffer.open(QIODevice::ReadOnly);
+			QImageReader reader(&buffer, "jpeg");
+			scaled = GetScaledSize(QSize(best->w, best->h), max_img_w, max_img_h);
+			reader.setScaledSize(scaled);
+			img = reader.read();
+		}
+	}
+	
+	/// The previews are stored the same way as the image, unrotated:
+	cint orientation = img.isNull() ? 1 : exif::Orientation(buf, file_size);
+	munmap(mem, file_size);
+	if (orientation != 1)
+	{
+		img = ApplyOrientation(img, orientation);
+		if (orientation >= 5)
+		{
+			orig_img_sz.transpose();
+			scaled.transpose();
+		}
+	}
+	
+	if (!img.isNull())
+		embedded_previews_used++;
+	
+	return img;
+}
+
+QImage ReadScaled(QImageReader &reader, const QSize &scaled)
+{
+	const QByteArray format = reader.format();
+	if ((format == "jpeg" || format == "jpg") &&
+		reader.supportsOption(QImageIOHandler::ScaledSize))
+	{
+		reader.setScaledSize(scaled);
+		return reader.read();
+	}
+	
+	const QImage img = reader.read();
+	if (img.isNull() || img.size() == scaled)
+		return img;
+	
+	return downscale::Scale(img, scaled);
+}
+
+/// The thumbnail of a Matroska file is its cover art attachment.
+static QImage LoadMatroskaCover(const QString &full_path, cint max_img_w,
+	cint max_img_h, QSize &orig_img_sz, QSize &scaled)
+{
+	QByteArray bytes = mc::ReadMkvCover(full_path);
+	if (bytes.isEmpty())
+		return QImage();
+	
+	QBuffer buffer(&bytes);
+	buffer.open(QIODevice::ReadOnly);
+	QImageReader reader(&buffer);
+	orig_img_sz = reader.size();
+	if (orig_img_sz.isEmpty())
+		return QImage();
+	
+	scaled = GetScaledSize(orig_img_sz, max_img_w, max_img_h);
+	
+	return ReadScaled(reader, scaled);
+}
+
+static i64 HeaderSizeOf(const AbiType abi_version)
+{
+	if (abi_version == AbiVersion)
+		return HeaderSize;
+	if (abi_version == AbiVersion1)
+		return HeaderSizeV1;
+	return -1;
+}
+
 bool GetOriginalImageSize(ByteArray &ba, i32 &w, i32 &h)
 {
 	const auto at = ba.at();
-	if (ba.size() <= thumbnail::HeaderSize ||
-		(ba.next_i16() != thumbnail::AbiVersion))
+	if (ba.size() <= thumbnail::HeaderSizeV1 ||
+		HeaderSizeOf(ba.next_i16()) == -1)
 	{
+		ba.to(at);
 		return false;
 	}
 	
+	/// Same place in v1 and v2:
 	ba.to(at + 8);
 	w = ba.next_i32();
 	h = ba.next_i32();
@@ -53,12 +279,249 @@ bool GetOriginalImageSize(ByteArray &ba, i32 &w, i32 &h)
 	return true;
 }
 
+/// Buffers are prefixed with their size, this keeps the pixels aligned:
+static const i64 PoolPrefix = 16;
+static const i64 MaxPooledBytes = 16 * 1024 * 1024;
+
+struct Pool {
+	pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+	QHash<i64, QVector<uchar*>> free_lists; // by buffer size
+	i64 free_bytes = 0;
+	i64 reused = 0;
+};
+
+/// Never deleted: images may release their buffers during exit.
+static Pool& pool()
+{
+	static Pool *p = new Pool();
+	return *p;
+}
+
+uchar* BufferPool::Take(ci64 size)
+{
+	{
+		Pool &p = pool();
+		MutexGuard guard(&p.mutex);
+		auto it = p.free_lists.find(size);
+		if (it != p.free_lists.end() && !it.value().isEmpty())
+		{
+			p.free_bytes -= size;
+			p.reused++;
+			return it.value().takeLast();
+		}
+	}
+	
+	uchar *mem = new uchar[PoolPrefix + size];
+	memcpy(mem, &size, sizeof size);
+	return mem + PoolPrefix;
+}
+
+void BufferPool::Give(uchar *buf)
+{
+	uchar *mem = buf - PoolPrefix;
+	i64 size;
+	memcpy(&size, mem, sizeof size);
+	{
+		Pool &p = pool();
+		MutexGuard guard(&p.mutex);
+		if (p.free_bytes + size <= MaxPooledBytes)
+		{
+			p.free_lists[size].append(buf);
+			p.free_bytes += size;
+			return;
+		}
+	}
+	
+	delete[] mem;
+}
+
+i64 BufferPool::reused()
+{
+	Pool &p = pool();
+	MutexGuard guard(&p.mutex);
+	return p.reused;
+}
+
+static bool FillDictionary(Dictionary &dict, const QByteArray &data)
+{
+	if (data.isEmpty())
+		return false;
+	
+	/// Raw content (not trained) dictionaries have no ID, it's needed
+	/// to tell which dictionary a blob was made with.
+	cu32 id = ZDICT_getDictID(data.constData(), data.size());
+	if (id == 0)
+		return false;
+	
+	dict.cdict = ZSTD_createCDict(data.constData(), data.size(), CompressionLevel);
+	dict.ddict = ZSTD_createDDict(data.constData(), data.size());
+	if (dict.cdict == nullptr || dict.ddict == nullptr)
+	{
+		ZSTD_freeCDict(dict.cdict);
+		ZSTD_freeDDict(dict.ddict);
+		dict = {};
+		return false;
+	}
+	dict.id = id;
+	
+	return true;
+}
+
+static Dictionary* LoadDictionary()
+{
+	auto *dict = new Dictionary();
+	QString path = DictionaryPath();
+	if (!QFileInfo::exists(path))
+	{
+		path = QStandardPaths::locate(QStandardPaths::GenericDataLocation,
+			QLatin1String("cornus/") + QLatin1String(DictFileName));
+	}
+	
+	if (path.isEmpty())
+		return dict;
+	
+	QFile file(path);
+	if (!file.open(QIODevice::ReadOnly) || !FillDictionary(*dict, file.read(MaxDictSize * 4)))
+	{
+		mtl_warn("Can't use thumbnail dictionary %s", qPrintable(path));
+		return dict;
+	}
+	
+	return dict;
+}
+
+static std::atomic<Dictionary*> dictionary = nullptr;
+
+const Dictionary& GetDictionary()
+{
+	static Dictionary *loaded = [] {
+		Dictionary *d = LoadDictionary();
+		Dictionary *expected = nullptr;
+		dictionary.compare_exchange_strong(expected, d);
+		return d;
+	}();
+	Q_UNUSED(loaded);
+	
+	return *dictionary.load();
+}
+
+bool SetDictionary(const QByteArray &data)
+{
+	GetDictionary();
+	auto *dict = new Dictionary();
+	if (!FillDictionary(*dict, data))
+	{
+		delete dict;
+		return false;
+	}
+	
+	dictionary = dict;
+	return true;
+}
+
+QString DictionaryPath()
+{
+	return prefs::QueryAppConfigPath() + '/' + QLatin1String(DictFileName);
+}
+
+static void LeftDelta(const uchar *src, uchar *dst, cint w, cint h, cint bpl)
+{
+	cint row_bytes = w * 4;
+	for (int y = 0; y < h; y++)
+	{
+		const uchar *s = src + i64(y) * bpl;
+		uchar *d = dst + i64(y) * bpl;
+		memcpy(d, s, bpl);
+		for (int i = 4; i < row_bytes; i++)
+			d[i] = uchar(s[i] - s[i - 4]);
+	}
+}
+
+void ApplyLeftDelta(const QImage &img, uchar *dst)
+{
+	LeftDelta(img.constBits(), dst, img.width(), img.height(), img.bytesPerLine());
+}
+
+static void UndoLeftDelta(uchar *buf, cint w, cint h, cint bpl)
+{
+	cint row_bytes = w * 4;
+	for (int y = 0; y < h; y++)
+	{
+		uchar *p = buf + i64(y) * bpl;
+		for (int i = 4; i < row_bytes; i++)
+			p[i] = uchar(p[i] + p[i - 4]);
+	}
+}
+
+void Encode(const QImage &img, ci32 orig_img_w, ci32 orig_img_h,
+	ZSTD_CCtx *compress_ctx, ByteArray &ba, const AbiType abi_version)
+{
+	const char *src_buf = (const char*)img.constBits();
+	ci64 src_size = img.sizeInBytes();
+	ci64 bound = ZSTD_compressBound(src_size);
+	cbool v2 = (abi_version == AbiVersion);
+	static const Dictionary no_dict;
+	const Dictionary &dict = v2 ? GetDictionary() : no_dict;
+	
+	auto compress = [&](const char *src, QByteArray &dst) -> i64 {
+		dst.resize(bound);
+		cusize n = (dict.cdict != nullptr) ?
+			ZSTD_compress_usingCDict(compress_ctx, dst.data(), bound, src, src_size, dict.cdict) :
+			ZSTD_compressCCtx(compress_ctx, dst.data(), bound, src, src_size, CompressionLevel);
+		return ZSTD_isError(n) ? -1 : i64(n);
+	};
+	
+	QByteArray best(bound, Qt::Uninitialized);
+	i64 best_size = compress(src_buf, best);
+	Filter filter = Filter::None;
+	
+	/// Neighbouring pixels are alike, their differences compress better
+	/// for photos but sometimes worse for flat graphics, keep the smaller.
+	if (v2 && img.depth() == 32)
+	{
+		QByteArray filtered(src_size, Qt::Uninitialized);
+		ApplyLeftDelta(img, (uchar*)filtered.data());
+		QByteArray packed;
+		ci64 packed_size = compress(filtered.constData(), packed);
+		if (packed_size != -1 && (best_size == -1 || packed_size < best_size))
+		{
+			best.swap(packed);
+			best_size = packed_size;
+			filter = Filter::LeftDelta;
+		}
+	}
+	
+	if (best_size == -1)
+		return;
+	
+	ba.MakeSure(HeaderSizeOf(abi_version) + best_size, ExactSize::Yes);
+	ba.add_i16(abi_version);
+	ba.add_i16(img.width());
+	ba.add_i16(img.height());
+	ba.add_u16(img.bytesPerLine());
+	ba.add_i32(orig_img_w);
+	ba.add_i32(orig_img_h);
+	ba.add_i32(static_cast<i32>(img.format()));
+	if (v2)
+	{
+		ba.add_u8(u8(filter));
+		ba.add_u8(0);
+		ba.add_u32(dict.id);
+	}
+	ba.add(best.constData(), best_size, ExactSize::Yes);
+}
+
 QImage ImageFromByteArray(ByteArray &ba, i32 &img_w, i32 &img_h,
 	AbiType &abi_version, ZSTD_DCtx *decompress_ctx)
 {
-	if (ba.size() <= thumbnail::HeaderSize ||
-		((abi_version = ba.next_i16()) != thumbnail::AbiVersion))
+	if (ba.size() <= thumbnail::HeaderSizeV1)
+		return QImage();
+	
+	abi_version = ba.next_i16();
+	ci64 header_size = HeaderSizeOf(abi_version);
+	if (header_size == -1 || ba.size() <= header_size)
 	{
+		ba.to(0);
 		return QImage();
 	}
 	
@@ -68,17 +531,46 @@ QImage ImageFromByteArray(ByteArray &ba, i32 &img_w, i32 &img_h,
 	img_w = ba.next_i32();
 	img_h = ba.next_i32();
 	const auto format = static_cast<QImage::Format>(ba.next_i32());
+	Filter filter = Filter::None;
+	u32 dict_id = 0;
+	if (abi_version == AbiVersion)
+	{
+		filter = static_cast<Filter>(ba.next_u8());
+		ba.next_u8(); // reserved
+		dict_id = ba.next_u32();
+	}
 	ba.to(0); // leave ByteArray in same state it was passed in
-	char *src_buf = ba.data() + thumbnail::HeaderSize;
-	ci64 src_size = ba.size() - thumbnail::HeaderSize;
+	const char *src_buf = ba.data() + header_size;
+	ci64 src_size = ba.size() - header_size;
 	
-	ci64 dst_size = ZSTD_getFrameContentSize(src_buf, src_size);
-	uchar *dst_buf = new uchar[dst_size];
-	ci64 decompressed_size = ZSTD_decompressDCtx(decompress_ctx,
-		dst_buf, dst_size, src_buf, src_size);
-	Q_UNUSED(decompressed_size);
+	ci64 dst_size = i64(bpl) * thmb_h;
+	if (dst_size <= 0 || ZSTD_getFrameContentSize(src_buf, src_size) != u64(dst_size))
+		return QImage();
 	
-	return QImage(dst_buf, thmb_w, thmb_h, bpl, format, CornusFreeQImageMemory, dst_buf);
+	const ZSTD_DDict *ddict = nullptr;
+	if (dict_id != 0)
+	{
+		const Dictionary &dict = GetDictionary();
+		if (dict.id != dict_id)
+			return QImage(); // made with another dictionary, regenerate
+		ddict = dict.ddict;
+	}
+	
+	uchar *dst_buf = BufferPool::Take(dst_size);
+	cusize decompressed_size = (ddict != nullptr) ?
+		ZSTD_decompress_usingDDict(decompress_ctx, dst_buf, dst_size, src_buf, src_size, ddict) :
+		ZSTD_decompressDCtx(decompress_ctx, dst_buf, dst_size, src_buf, src_size);
+	if (ZSTD_isError(decompressed_size) || i64(decompressed_size) != dst_size)
+	{
+		BufferPool::Give(dst_buf);
+		return QImage();
+	}
+	
+	if (filter == Filter::LeftDelta)
+		UndoLeftDelta(dst_buf, thmb_w, thmb_h, bpl);
+	
+	return QImage(dst_buf, thmb_w, thmb_h, bpl, format,
+		CornusReleasePooledImageMemory, dst_buf);
 }
 
 QSize GetScaledSize(const QSize &input, cint max_img_w,
@@ -100,28 +592,66 @@ QSize GetScaledSize(const QSize &input, cint max_img_w,
 	return QSize((int)used_w, (int)used_h);
 }
 
+QSize DisplaySize(cf64 pic_w, cf64 pic_h, cf64 max_img_w, cf64 max_img_h)
+{
+	cf64 ratio = std::max(pic_w / max_img_w, pic_h / max_img_h);
+	return QSize(pic_w / ratio - DisplayMargin * 2, pic_h / ratio - DisplayMargin * 2);
+}
+
+void ScaleForDisplay(Thumbnail *thumbnail, cf64 max_img_w, cf64 max_img_h, cf64 dpr)
+{
+	const QImage &img = thumbnail->img;
+	if (img.isNull())
+		return;
+	
+	const QSize sz = DisplaySize(img.width(), img.height(), max_img_w, max_img_h);
+	if (sz.isEmpty())
+		return;
+	
+	thumbnail->display_img = img.scaled(sz * dpr, Qt::IgnoreAspectRatio,
+		Qt::SmoothTransformation);
+}
+
 Thumbnail* Load(const QString &full_path, const u64 &file_id,
 	const QByteArray &ext, cint max_img_w, cint max_img_h,
 	const TabId tab_id, const DirId dir_id)
 {
 	QSize scaled, orig_img_sz;
 	QImage img;
+	if (IsMatroskaExtension(ext))
+	{
+		img = LoadMatroskaCover(full_path, max_img_w, max_img_h, orig_img_sz, scaled);
+		if (img.isNull())
+			return nullptr;
+	}
+	
+	cbool is_raw = IsRawExtension(ext);
+	if (use_embedded_previews && (is_raw || ext == "jpg" || ext == "jpeg")) {
+		img = LoadEmbeddedPreview(full_path, is_raw, max_img_w, max_img_h,
+			orig_img_sz, scaled);
+	}
+	
+	if (img.isNull() && is_raw)
+		return nullptr; // no usable preview and Qt can't decode RAW
+	
 	// if (ext == QByteArray("webp")) {
 	// 	img = LoadWebpImage(full_path, max_img_w, max_img_h, scaled, orig_img_sz);
 	// } else {
-	QImageReader reader = QImageReader(full_path, ext);
-	orig_img_sz = reader.size();
-	if (orig_img_sz.isEmpty()) {
-		mtl_warn("%s", qPrintable(full_path));
-		return nullptr;
-	}
-	
-	scaled = GetScaledSize(orig_img_sz, max_img_w, max_img_h);
-	reader.setScaledSize(scaled);
-	img = reader.read();
-	if (img.isNull()) {
-		mtl_warn("%s (\"%s\") is Null(): ", qPrintable(full_path), ext.data());
-		return nullptr;
+	if (img.isNull())
+	{
+		QImageReader reader = QImageReader(full_path, ext);
+		orig_img_sz = reader.size();
+		if (orig_img_sz.isEmpty()) {
+			mtl_warn("%s", qPrintable(full_path));
+			return nullptr;
+		}
+		
+		scaled = GetScaledSize(orig_img_sz, max_img_w, max_img_h);
+		img = ReadScaled(reader, scaled);
+		if (img.isNull()) {
+			mtl_warn("%s (\"%s\") is Null(): ", qPrintable(full_path), ext.data());
+			return nullptr;
+		}
 	}
 	
 	auto *thumbnail = new Thumbnail();
@@ -140,36 +670,78 @@ Thumbnail* Load(const QString &full_path, const u64 &file_id,
 	return thumbnail;
 }
 
-void* LoadMonitor(void *args)
+int CancelWork(GlobalThumbLoaderData &global_data, const TabId tab_id, const DirId dir_id)
 {
-	pthread_detach(pthread_self());
-	GlobalThumbLoaderData *global_data = (GlobalThumbLoaderData*)args;
-	auto global_guard = global_data->guard();
+	auto guard = global_data.guard();
+	return CancelWork_NoLock(global_data.work_queue, tab_id, dir_id);
+}
+
+int CancelWork_NoLock(QVector<ThumbLoaderArgs*> &work_queue, const TabId tab_id,
+	const DirId dir_id)
+{
+	/// One pass, the queue can be long and the workers wait for the lock:
+	auto it = std::remove_if(work_queue.begin(), work_queue.end(),
+	[tab_id, dir_id](ThumbLoaderArgs *arg) {
+		if (arg->tab_id != tab_id || (dir_id != -1 && arg->dir_id != dir_id))
+			return false;
+		delete arg;
+		return true;
+	});
+	cint removed_count = work_queue.end() - it;
+	work_queue.erase(it, work_queue.end());
 	
-	while (!global_data->threads.isEmpty())
+	return removed_count;
+}
+
+void Prioritize(QVector<ThumbLoaderArgs*> &work_queue, const ThumbViewport &vp)
+{
+	if (work_queue.size() < 2 || vp.visible_first < 0)
+		return;
+	
+	QVector<ThumbLoaderArgs*> background, prefetch, visible;
+	background.reserve(work_queue.size());
+	for (ThumbLoaderArgs *next: work_queue)
 	{
-		auto &work_queue = global_data->work_queue;
-		for (ThumbLoaderData *th_data: global_data->threads)
-		{
-			if (work_queue.isEmpty())
-				break;
-			auto guard = th_data->guard();
-			if (th_data->new_work != nullptr)
-				continue;
-			
-			th_data->new_work = work_queue.takeLast();
-			th_data->SignalNewWorkAvailable();
-		}
-		
-		cint status = global_data->CondWaitForWorkQueueChange();
-		if (status != 0)
-		{
-			mtl_status(status);
-			break;
+		ci32 i = next->file_index;
+		cbool ours = next->tab_id == vp.tab_id && next->dir_id == vp.dir_id;
+		if (!ours || i < 0) {
+			/// Single file requests (file changed etc) of this folder go to
+			/// the prefetch lane at distance 0, the rest go to the background:
+			(ours ? prefetch : background).append(next);
+		} else if (i >= vp.visible_first && i <= vp.visible_last) {
+			visible.append(next);
+		} else if (i >= vp.prefetch_first && i <= vp.prefetch_last) {
+			prefetch.append(next);
+		} else {
+			background.append(next);
 		}
 	}
 	
-	return nullptr;
+	if (visible.isEmpty() && prefetch.isEmpty())
+		return;
+	
+	auto distance = [&vp](const ThumbLoaderArgs *a) -> i32 {
+		if (a->file_index < 0)
+			return 0;
+		if (a->file_index > vp.visible_last)
+			return a->file_index - vp.visible_last;
+		/// a screen above counts as farther than a screen below:
+		return (vp.visible_first - a->file_index) * 2;
+	};
+	
+	/// Sorted from farthest to closest since work is taken from the end.
+	std::stable_sort(prefetch.begin(), prefetch.end(),
+	[&distance](const ThumbLoaderArgs *a, const ThumbLoaderArgs *b) {
+		return distance(a) > distance(b);
+	});
+	std::sort(visible.begin(), visible.end(),
+	[](const ThumbLoaderArgs *a, const ThumbLoaderArgs *b) {
+		return a->file_index > b->file_index;
+	});
+	
+	work_queue = background;
+	work_queue.append(prefetch);
+	work_queue.append(visible);
 }
 
 /*
@@ -13,21 +13,55 @@
 #include <zstd.h>
 // #include <webp/decode.h>
 
+QT_BEGIN_NAMESPACE
+class QImageReader;
+QT_END_NAMESPACE
+
 void CornusFreeQImageMemory(void *data);
+/// Gives the buffer back to thumbnail::BufferPool
+void CornusReleasePooledImageMemory(void *data);
 
 namespace cornus {
 
 namespace thumbnail {
 using AbiType = i16;
-const AbiType AbiVersion = 1;
-// header size: abi=2 + width=2 + height=2 + bpl=2 + img_w=4 + img_h=4 + img_format=4
-const i64 HeaderSize = 20;
+/// v1 blobs are still read, new ones are written as v2.
+const AbiType AbiVersion1 = 1;
+const AbiType AbiVersion = 2;
+// v1 header size: abi=2 + width=2 + height=2 + bpl=2 + img_w=4 + img_h=4 + img_format=4
+const i64 HeaderSizeV1 = 20;
+// v2 header size: v1 header + filter=1 + reserved=1 + dict_id=4
+const i64 HeaderSize = 26;
+const int CompressionLevel = 1;
+
+/// Applied to the pixels of 32 bit images before compression:
+enum class Filter: u8 {
+	None = 0,
+	LeftDelta = 1 // each channel minus the same channel of the pixel on the left
+};
+
+/// Where "cornus test thumbcodec --train" saves a dictionary and from
+/// where it's installed (as share/cornus/thumbnails.zdict).
+const char *const DictFileName = "thumbnails.zdict";
+const isize MaxDictSize = 112640; // zstd's recommended ~110 KiB
+
+/// Thumbnails are generated to fit into this box:
+const int MaxImgW = 512;
+const int MaxImgH = 512;
+
+/// Space left around a thumbnail inside its icon view cell:
+const int DisplayMargin = 10;
+
+/// The tab id of the work queued by ThumbnailPrefetcher, the results of
+/// which only go to the ThumbnailCache (and to disk).
+const TabId PrefetchTabId = -2;
 } // thumbnail::
 
 enum class Origin: i8 {
-	TempDir,
+	TempDir, // the packed thumbnail store (io::ThumbStore) in the temp dir
 	ExtAttr,
 	DiskFile,
+	MemoryCache, // ThumbnailCache
 	Undefined
 };
 
@@ -36,6 +70,9 @@ const bool DebugThumbnailExit = false;
 struct Thumbnail {
 	Thumbnail* Clone();
 	QImage img;
+	/// img smoothly scaled by the worker to the device pixels the icon
+	/// view draws it at, null if not requested, see ScaleForDisplay().
+	QImage display_img;
 	QString debug_path; // used for debugging
 	u64 file_id = 0;
 	i64 time_generated = -1;
@@ -61,63 +98,49 @@ public:
 	i64 time_modified = 0;
 	int icon_w = -1;
 	int icon_h = -1;
+	/// The icon view's image box and its device pixel ratio,
+	/// Thumbnail::display_img isn't made when display_w is -1:
+	f64 display_w = -1;
+	f64 display_h = -1;
+	f64 dpr = 1.0;
+	i32 file_index = -1; // position in the dir listing, for prioritizing
 	
 //	static ThumbLoaderArgs* FromFile(gui::Tab *tab,
 //		io::File *file, const DirId dir_id, cint max_img_w, cint max_img_h);
 };
 
+/// Which files the icon view currently shows (visible) and which ones
+/// it's likely to show next (prefetch), the rest of the queue is demoted.
+struct ThumbViewport {
+	TabId tab_id = -1;
+	DirId dir_id = -1;
+	i32 visible_first = -1;
+	i32 visible_last = -1;
+	i32 prefetch_first = -1;
+	i32 prefetch_last = -1;
+};
+
+/// How many screens below the visible area get their thumbnails prefetched
+/// (one screen above is prefetched too):
+const int ThumbPrefetchScreens = 2;
+
 struct GlobalThumbLoaderData;
+class ThumbnailCache;
 
+/// Per worker state, guarded by GlobalThumbLoaderData::mutex.
 struct ThumbLoaderData {
 	GlobalThumbLoaderData *global_data = nullptr;
-	ThumbLoaderArgs *new_work = nullptr;
-	mutable pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-	mutable pthread_cond_t new_work_cond = PTHREAD_COND_INITIALIZER;
 	bool wait_for_work = true;
 	bool thread_exited = false;
-	
-	bool Lock() const {
-		cint status = pthread_mutex_lock(&mutex);
-		if (status != 0) {
-			printf("ThumbLoaderData::Lock() failed!\n");
-			mtl_status(status);
-		}
-		return status == 0;
-	}
-	
-	bool TryLock() const {
-		return (pthread_mutex_trylock(&mutex) == 0);
-	}
-	
-	void Unlock() const {
-		cint status = pthread_mutex_unlock(&mutex);
-		if (status != 0)
-			mtl_status(status);
-	}
-	
-	MutexGuard guard() const {
-		return MutexGuard(&mutex);
-	}
-	
-	bool Broadcast() {
-		return (pthread_cond_broadcast(&new_work_cond) == 0);
-	}
-	
-	int CondWaitForNewWork() const {
-		cint status = pthread_cond_wait(&new_work_cond, &mutex);
-		if (status != 0)
-			mtl_status(status);
-		return status;
-	}
-	
-	bool SignalNewWorkAvailable() {
-		return (pthread_cond_signal(&new_work_cond) == 0);
-	}
 };
 
 struct GlobalThumbLoaderData {
 	QVector<ThumbLoaderData*> threads;
+	/// Shared by all workers, each one pulls the next item with takeLast():
 	QVector<ThumbLoaderArgs*> work_queue;
+	i64 done_count = 0;
+	io::ThumbStore *store = nullptr;
+	ThumbnailCache *cache = nullptr;
 	mutable pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 	mutable pthread_cond_t new_work_cond = PTHREAD_COND_INITIALIZER;
 	
@@ -167,9 +190,81 @@ namespace thumbnail {
 // returns true on success
 bool GetOriginalImageSize(ByteArray &ba, i32 &w, i32 &h);
 
+/** The zstd dictionary thumbnail blobs are compressed with: it's loaded
+once from the app config dir or from the installed data dir, without
+one dict_id is 0 and blobs are compressed without a dictionary. Blobs
+made with another dictionary fail to decode and get regenerated. */
+struct Dictionary {
+	ZSTD_CDict *cdict = nullptr;
+	ZSTD_DDict *ddict = nullptr;
+	u32 id = 0;
+};
+const Dictionary& GetDictionary();
+/// Replaces the dictionary for the rest of the process (the old one is
+/// leaked on purpose since other threads may be using it).
+bool SetDictionary(const QByteArray &data);
+QString DictionaryPath();
+
+/// Writes the header and compressed pixels of @img. @abi_version can be
+/// AbiVersion1 for comparisons. Filter::None is used for non 32 bit
+/// images and when filtering doesn't make the blob smaller.
+void Encode(const QImage &img, ci32 orig_img_w, ci32 orig_img_h,
+	ZSTD_CCtx *compress_ctx, ByteArray &ba, const AbiType abi_version = AbiVersion);
+
+/// Filter::LeftDelta of a 32 bit image into @dst (sizeInBytes() long).
+void ApplyLeftDelta(const QImage &img, uchar *dst);
+
+/// Size classed free lists of the pixel buffers of decoded thumbnails,
+/// so that scrolling through a folder doesn't malloc/free 200 KiB a file.
+class BufferPool {
+public:
+	static uchar* Take(ci64 size);
+	static void Give(uchar *buf);
+	static i64 reused();
+};
+
+/// RAW formats whose thumbnails come from their embedded JPEG previews.
+bool IsRawExtension(const QByteArray &ext);
+
+/// Matroska files, their thumbnail is the cover art attachment.
+bool IsMatroskaExtension(const QByteArray &ext);
+
+/// What's stored instead of a thumbnail for a file known to have none,
+/// the same as io::File::MarkThumbnailFailed() sets.
+void MakeFailedMarker(ByteArray &ba);
+inline bool IsMarkedFailed(const ByteArray &ba) { return ba.size() <= HeaderSizeV1 + 4; }
+
+/// On by default: JPEG and RAW thumbnails are made from the embedded
+/// preview when it's big enough, instead of decoding the whole image.
+void UseEmbeddedPreviews(cbool flag);
+i64 EmbeddedPreviewsUsed();
+
 QSize GetScaledSize(const QSize &input, cint max_img_w, cint max_img_h);
 
-void* LoadMonitor(void *args);
+/// JPEG decodes straight to the smaller size (scaled IDCT), the rest get
+/// decoded whole and then box filtered (downscale::Scale()). The other
+/// handlers that report QImageIOHandler::ScaledSize (PNG etc) decode
+/// whole too and then smooth scale, which is several times slower.
+QImage ReadScaled(QImageReader &reader, const QSize &scaled);
+
+/// The size (in device independent pixels) at which the icon view draws
+/// a picture of @pic_w x @pic_h into an image box of @max_img_w x @max_img_h.
+QSize DisplaySize(cf64 pic_w, cf64 pic_h, cf64 max_img_w, cf64 max_img_h);
+
+/// Sets thumbnail->display_img, done on the worker threads so that
+/// painting is a plain blit instead of a smooth downscale.
+void ScaleForDisplay(Thumbnail *thumbnail, cf64 max_img_w, cf64 max_img_h, cf64 dpr);
+
+/// Drops the queued (not yet started) work of the given tab,
+/// dir_id == -1 means any dir. Returns how many items were dropped.
+int CancelWork(GlobalThumbLoaderData &global_data, const TabId tab_id, const DirId dir_id);
+/// Same, with global_data already locked.
+int CancelWork_NoLock(QVector<ThumbLoaderArgs*> &work_queue, const TabId tab_id,
+	const DirId dir_id);
+
+/// Reorders the queue (which is consumed with takeLast()) so that visible
+/// files come first, then prefetch ones (closest first), then the rest.
+void Prioritize(QVector<ThumbLoaderArgs*> &work_queue, const ThumbViewport &vp);
 
 QImage ImageFromByteArray(ByteArray &ba, i32 &img_w, i32 &img_h,
 	AbiType &abi_version, ZSTD_DCtx *decompress_context);